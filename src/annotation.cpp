@@ -16,8 +16,9 @@ Annotation::Annotation(const Coords &c, MapTile t, bool v, bool coverUp) :
     coords(c),
     tile(t),
     visual(v),
-    ttl(-1),
-    coverUp(coverUp)
+    coverUp(coverUp),
+    mgr(NULL),
+    expiry(0)
 {}
 
 /**
@@ -31,6 +32,24 @@ void Annotation::debug_output() const {
     printf("visual: %s\n", visual ? "Yes" : "No");
 }
 
+/**
+ * Returns the number of turns the annotation has left to live,
+ * or -1 if it is permanent
+ */
+const int Annotation::getTTL() const {
+    if (!mgr || !expiry)
+        return -1;
+    return expiry - mgr->turn - 1;
+}
+
+/**
+ * Sets the number of turns the annotation will live
+ */
+void Annotation::setTTL(int turns) {
+    if (mgr)
+        mgr->schedule(this, turns);
+}
+
 /**
  * Operators
  */
@@ -41,10 +60,16 @@ bool Annotation::operator==(const Annotation &a) const {
 /**
  * AnnotationMgr implementation
  */
+static uint64_t cellKey(const Coords &coords) {
+    return (static_cast<uint64_t>(static_cast<uint16_t>(coords.x)) << 32) |
+           (static_cast<uint64_t>(static_cast<uint16_t>(coords.y)) << 16) |
+           static_cast<uint64_t>(static_cast<uint16_t>(coords.z));
+}
+
 /**
  * Constructors
  */
-AnnotationMgr::AnnotationMgr() {}
+AnnotationMgr::AnnotationMgr() : turn(0), count(0) {}
 
 /**
  * Members
@@ -54,44 +79,42 @@ AnnotationMgr::AnnotationMgr() {}
  * Adds an annotation to the current map
  */
 Annotation *AnnotationMgr::add(Coords coords, MapTile tile, bool visual, bool isCoverUp) {
+    Annotation::List &cell = cells[cellKey(coords)];
+
     /* new annotations go to the front so they're handled "on top" */
-    annotations.push_front(Annotation(coords, tile, visual, isCoverUp));
-    return &annotations.front();
+    cell.push_front(Annotation(coords, tile, visual, isCoverUp));
+    cell.front().mgr = this;
+    count++;
+    return &cell.front();
 }
 
 /**
- * Returns all annotations found at the given map coordinates
+ * Returns copies of all annotations found at the given map coordinates
  */
 Annotation::List AnnotationMgr::allAt(Coords coords) {
-    Annotation::List list;
-
-    for (i = annotations.begin(); i != annotations.end(); i++) {
-        if (zu4_coords_equal(i->getCoords(), coords))
-            list.push_back(*i);
-    }
-
-    return list;
+    return at(coords);
 }
 
 /**
- * Returns pointers to all annotations found at the given map coordinates
- */
-std::list<Annotation *> AnnotationMgr::ptrsToAllAt(Coords coords) {
-    std::list<Annotation *> list;
-
-    for (i = annotations.begin(); i != annotations.end(); i++) {
-        if (zu4_coords_equal(i->getCoords(), coords))
-            list.push_back(&(*i));
-    }
-
-    return list;
+ * Returns the annotations found at the given map coordinates, newest
+ * first, without copying them.  The list must not be held on to past
+ * the next change to the annotations.
+ */
+Annotation::List &AnnotationMgr::at(Coords coords) {
+    std::unordered_map<uint64_t, Annotation::List>::iterator cell = cells.find(cellKey(coords));
+    if (cell == cells.end())
+        return none;
+    return cell->second;
 }
 
 /**
  * Removes all annotations on the map
  */
 void AnnotationMgr::clear() {
-    annotations.clear();
+    cells.clear();
+    for (int slot = 0; slot < ANNOTATION_WHEEL_SLOTS; slot++)
+        wheel[slot].clear();
+    count = 0;
 }
 
 /**
@@ -99,14 +122,28 @@ void AnnotationMgr::clear() {
  * annotations whose TTL has expired
  */
 void AnnotationMgr::passTurn() {
-    for (i = annotations.begin(); i != annotations.end(); i++) {
-        if (i->getTTL() == 0) {
-            i = annotations.erase(i);
-            if (i == annotations.end())
+    std::vector<Annotation *> &slot = wheel[++turn % ANNOTATION_WHEEL_SLOTS];
+
+    for (unsigned int n = 0; n < slot.size();) {
+        Annotation *a = slot[n];
+
+        /* annotations due on a later lap of the wheel stay put */
+        if (a->expiry != turn) {
+            n++;
+            continue;
+        }
+
+        slot[n] = slot.back();
+        slot.pop_back();
+
+        Annotation::List &cell = at(a->coords);
+        for (Annotation::List::iterator i = cell.begin(); i != cell.end(); i++) {
+            if (&(*i) == a) {
+                a->expiry = 0;
+                erase(cell, i);
                 break;
+            }
         }
-        else if (i->getTTL() > 0)
-            i->passTurn();
     }
 }
 
@@ -119,9 +156,13 @@ void AnnotationMgr::remove(Coords coords, MapTile tile) {
 }
 
 void AnnotationMgr::remove(Annotation &a) {
-    for (i = annotations.begin(); i != annotations.end(); i++) {
+    std::unordered_map<uint64_t, Annotation::List>::iterator cell = cells.find(cellKey(a.getCoords()));
+    if (cell == cells.end())
+        return;
+
+    for (Annotation::List::iterator i = cell->second.begin(); i != cell->second.end(); i++) {
         if (*i == a) {
-            i = annotations.erase(i);
+            erase(cell->second, i);
             break;
         }
     }
@@ -137,9 +178,71 @@ void AnnotationMgr::remove(Annotation::List l) {
     }
 }
 
+/**
+ * Adds the coordinates of every map position holding annotations to
+ * the given list.
+ */
+void AnnotationMgr::positions(std::vector<Coords> &out) const {
+    std::unordered_map<uint64_t, Annotation::List>::const_iterator cell;
+    for (cell = cells.begin(); cell != cells.end(); cell++) {
+        if (!cell->second.empty())
+            out.push_back(cell->second.front().getCoords());
+    }
+}
+
 /**
  * Returns the number of annotations on the map
  */
 int AnnotationMgr::size() {
-    return annotations.size();
+    return count;
+}
+
+/**
+ * Hangs an annotation on the expiry wheel so that it is removed after
+ * the given number of turns; a negative number makes it permanent.
+ * Only annotations that actually live in this manager can be scheduled.
+ */
+void AnnotationMgr::schedule(Annotation *a, int turns) {
+    Annotation::List &cell = at(a->coords);
+    Annotation::List::iterator i;
+
+    for (i = cell.begin(); i != cell.end() && &(*i) != a; i++);
+    if (i == cell.end())
+        return;
+
+    unschedule(a);
+    if (turns < 0)
+        return;
+
+    a->expiry = turn + turns + 1;
+    wheel[a->expiry % ANNOTATION_WHEEL_SLOTS].push_back(a);
+}
+
+void AnnotationMgr::unschedule(Annotation *a) {
+    if (!a->expiry)
+        return;
+
+    std::vector<Annotation *> &slot = wheel[a->expiry % ANNOTATION_WHEEL_SLOTS];
+    for (unsigned int n = 0; n < slot.size(); n++) {
+        if (slot[n] == a) {
+            slot[n] = slot.back();
+            slot.pop_back();
+            break;
+        }
+    }
+    a->expiry = 0;
+}
+
+/**
+ * Removes an annotation from its bucket, dropping the bucket once it is
+ * empty.
+ */
+void AnnotationMgr::erase(Annotation::List &cell, Annotation::List::iterator a) {
+    uint64_t key = cellKey(a->coords);
+
+    unschedule(&(*a));
+    cell.erase(a);
+    count--;
+    if (cell.empty())
+        cells.erase(key);
 }
@@ -5,12 +5,19 @@
 #ifndef ANNOTATION_H
 #define ANNOTATION_H
 
+#include <cstdint>
 #include <list>
+#include <unordered_map>
+#include <vector>
 
 #include "coords.h"
 #include "types.h"
 
 struct Annotation;
+struct AnnotationMgr;
+
+/* number of slots in the expiry wheel; longer TTLs just go around again */
+#define ANNOTATION_WHEEL_SLOTS 32
 
 /**
  * Annotation are updates to a map.
@@ -31,25 +38,27 @@ public:
     const Coords& getCoords() const {return coords; } /**< Returns the coordinates of the annotation */
     MapTile& getTile()              {return tile;   } /**< Returns the annotation's tile */
     const bool isVisualOnly() const {return visual; } /**< Returns true for visual-only annotations */
-    const int getTTL() const        {return ttl;    } /**< Returns the number of turns the annotation has left to live */
+    const int getTTL() const;
     bool isCoverUp()                {return coverUp;}
 
     // Setters
     void setCoords(const Coords &c) {coords = c;    } /**< Sets the coordinates for the annotation */
     void setTile(const MapTile &t)  {tile = t;      } /**< Sets the tile for the annotation */
     void setVisualOnly(bool v)      {visual = v;    } /**< Sets whether or not the annotation is visual-only */
-    void setTTL(int turns)          {ttl = turns;   } /**< Sets the number of turns the annotation will live */
-    void passTurn()                 {if (ttl > 0) ttl--; } /**< Passes a turn for the annotation */
+    void setTTL(int turns);
 
     bool operator==(const Annotation&) const;
 
     // Properties
 private:
+    friend struct AnnotationMgr;
+
     Coords coords;
     MapTile tile;
     bool visual;
-    int ttl;
     bool coverUp;
+    AnnotationMgr *mgr;     /**< The manager that owns this annotation, if any */
+    unsigned int expiry;    /**< The turn on which the annotation expires, or 0 if it is permanent */
 
 };
 
@@ -57,6 +66,12 @@ private:
  * Manages annotations for the current map.  This includes
  * adding and removing annotations, as well as finding annotations
  * and managing their existence.
+ *
+ * Annotations are kept in per-coordinate buckets, newest first, so
+ * finding the annotations at a map position doesn't have to look at any
+ * others.  Annotations with a TTL are also hung on a timing wheel slotted
+ * by the turn they expire on, so passing a turn only touches those that
+ * are due.
  */
 struct AnnotationMgr {
 public:
@@ -64,17 +79,27 @@ public:
 
     Annotation       *add(Coords coords, MapTile tile, bool visual = false, bool isCoverUp = false);
     Annotation::List allAt(Coords pos);
-    std::list<Annotation *> ptrsToAllAt(Coords pos);
+    Annotation::List &at(Coords pos);
     void             clear();
     void             passTurn();
+    void             positions(std::vector<Coords> &out) const;
     void             remove(Coords pos, MapTile tile);
     void             remove(Annotation&);
     void             remove(Annotation::List);
     int              size();
 
 private:
-    Annotation::List  annotations;
-    Annotation::List::iterator i;
+    friend struct Annotation;
+
+    void             schedule(Annotation *a, int turns);
+    void             unschedule(Annotation *a);
+    void             erase(Annotation::List &cell, Annotation::List::iterator a);
+
+    std::unordered_map<uint64_t, Annotation::List> cells;
+    std::vector<Annotation *> wheel[ANNOTATION_WHEEL_SLOTS];
+    Annotation::List  none;
+    unsigned int      turn;
+    int               count;
 };
 
 #endif
@@ -0,0 +1,128 @@
+/*
+ * assetcache.c
+ *
+ * A disk cache of fully decoded images, so that later runs can skip
+ * decompression, palette conversion and fixups.  Each entry is a small
+ * header followed by the RGBA pixels, laid out so that it could be
+ * mapped and used in place.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "assetcache.h"
+#include "error.h"
+
+/* bump whenever the layout or the decoders' output changes */
+#define CACHE_VERSION 1
+
+typedef struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t width, height;
+} CacheHeader;
+
+static char cacheDir[128];
+static bool cacheEnabled = false;
+
+void zu4_cache_init(const char *dir) {
+	// Use a cache directory, creating it if needed
+	snprintf(cacheDir, sizeof(cacheDir), "%scache/", dir);
+	mkdir(cacheDir, S_IRWXU|S_IRWXG|S_IRWXO);
+
+	struct stat st;
+	cacheEnabled = stat(cacheDir, &st) == 0 && S_ISDIR(st.st_mode);
+	if (!cacheEnabled)
+		zu4_error(ZU4_LOG_WRN, "Unable to use image cache %s\n", cacheDir);
+}
+
+const char *zu4_cache_dir(void) {
+	// Return the cache directory, for other kinds of cached data, or NULL
+	// if it couldn't be used
+	return cacheEnabled ? cacheDir : NULL;
+}
+
+uint64_t zu4_cache_hash(uint64_t hash, const void *data, size_t len) {
+	// FNV-1a, continuing from a previous hash (or 0 to start)
+	const uint8_t *p = (const uint8_t*)data;
+	if (!hash)
+		hash = 14695981039346656037ULL ^ CACHE_VERSION;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void zu4_cache_path(char *path, size_t psize, uint64_t key, const char *ext) {
+	snprintf(path, psize, "%s%016llx%s", cacheDir, (unsigned long long)key, ext);
+}
+
+Image *zu4_cache_load(uint64_t key) {
+	// Read a decoded image from the cache, or return NULL if there is no
+	// valid entry for the key
+	if (!cacheEnabled)
+		return NULL;
+
+	char path[160];
+	zu4_cache_path(path, sizeof(path), key, ".img");
+
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	CacheHeader hdr;
+	Image *image = NULL;
+	long len = 0;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+		!memcmp(hdr.magic, "ZU4C", 4) && hdr.version == CACHE_VERSION && hdr.key == key &&
+		hdr.width > 0 && hdr.height > 0 && hdr.width <= 4096 && hdr.height <= 65536 &&
+		fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) == (long)(sizeof(hdr) + hdr.width * hdr.height * 4) &&
+		fseek(f, sizeof(hdr), SEEK_SET) == 0) {
+		image = zu4_img_create(hdr.width, hdr.height);
+		if (image && fread(image->pixels, 4, hdr.width * hdr.height, f) != hdr.width * hdr.height) {
+			zu4_img_free(image);
+			image = NULL;
+		}
+	}
+	fclose(f);
+
+	if (!image)
+		remove(path);
+	return image;
+}
+
+void zu4_cache_store(uint64_t key, Image *image) {
+	// Write a decoded image to the cache; this only touches files for
+	// its own key, so the preload workers can store images as they go
+	if (!cacheEnabled || !image)
+		return;
+
+	char path[160], tmp[160];
+	zu4_cache_path(path, sizeof(path), key, ".img");
+	zu4_cache_path(tmp, sizeof(tmp), key, ".tmp");
+
+	CacheHeader hdr;
+	memcpy(hdr.magic, "ZU4C", 4);
+	hdr.version = CACHE_VERSION;
+	hdr.key = key;
+	hdr.width = image->w;
+	hdr.height = image->h;
+
+	FILE *f = fopen(tmp, "wb");
+	if (!f)
+		return;
+
+	size_t pixels = (size_t)image->w * image->h;
+	bool written = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+		fwrite(image->pixels, 4, pixels, f) == pixels;
+	if (fclose(f) != 0)
+		written = false;
+
+	if (!written || rename(tmp, path) != 0)
+		remove(tmp);
+}
@@ -0,0 +1,33 @@
+#ifndef ASSETCACHE_H
+#define ASSETCACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+/*
+ * A disk cache of decoded images, one file per image, named for a key
+ * hashed from the image's source file and everything that affects how
+ * it is decoded.  Entries are checked against their key and size when
+ * read, and written whole then renamed into place, so a bad or partial
+ * entry is never used.
+ */
+void zu4_cache_init(const char *dir);
+const char *zu4_cache_dir(void);
+
+uint64_t zu4_cache_hash(uint64_t hash, const void *data, size_t len);
+
+Image *zu4_cache_load(uint64_t key);
+void zu4_cache_store(uint64_t key, Image *image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
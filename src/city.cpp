@@ -44,7 +44,7 @@ Person *City::addPerson(Person *person) {
     p->setMap(this);
     p->goToStartLocation();
 
-    objects.push_back(p);
+    addObject(p, p->getCoords(), false);
     return p;
 }
 
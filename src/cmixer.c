@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #include "cmixer.h"
 
@@ -40,6 +41,9 @@
 #define BUFFER_SIZE       (512)
 #define BUFFER_MASK       (BUFFER_SIZE - 1)
 
+#define COMMAND_SIZE      (1024)
+#define COMMAND_MASK      (COMMAND_SIZE - 1)
+
 struct cm_Source {
   cm_Source *next;              /* Next source in list */
   cm_Int16 buffer[BUFFER_SIZE]; /* Internal buffer with raw stereo PCM */
@@ -48,7 +52,7 @@ struct cm_Source {
   int samplerate;       /* Stream's native samplerate */
   int length;           /* Stream's length in frames */
   int end;              /* End index for the current play-through */
-  int state;            /* Current state (playing|paused|stopped) */
+  atomic_int state;     /* Current state (playing|paused|stopped) */
   cm_Int64 position;    /* Current playhead position (fixed point) */
   int lgain, rgain;     /* Left and right gain (fixed point) */
   int rate;             /* Playback rate (fixed point) */
@@ -60,31 +64,38 @@ struct cm_Source {
   double pan;           /* Pan set by `cm_set_pan()` */
 };
 
+/* Changes to sources are not made directly by the game thread, but queued
+** here and carried out by the thread calling `cm_process()`, which is the
+** only one to touch the `sources` list. There is one writer and one reader,
+** so the queue needs no lock */
+enum {
+  COMMAND_PLAY,
+  COMMAND_PAUSE,
+  COMMAND_STOP,
+  COMMAND_GAIN,
+  COMMAND_PAN,
+  COMMAND_PITCH,
+  COMMAND_LOOP,
+  COMMAND_DESTROY
+};
+
+typedef struct {
+  int type;             /* Command type */
+  cm_Source *src;       /* Source the command applies to */
+  double value;         /* Gain, pan, pitch or loop flag */
+} Command;
+
 static struct {
   const char *lasterror;        /* Last error message */
-  cm_EventHandler lock;         /* Event handler for lock/unlock events */
   cm_Source *sources;           /* Linked list of active (playing) sources */
   cm_Int32 buffer[BUFFER_SIZE]; /* Internal master buffer */
   int samplerate;               /* Master samplerate */
   int gain;                     /* Master gain (fixed point) */
+  Command commands[COMMAND_SIZE]; /* Queue of commands for the mixer */
+  atomic_uint head;             /* Next command to write (game thread) */
+  atomic_uint tail;             /* Next command to read (mixer thread) */
 } cmixer;
 
-static void dummy_handler(cm_Event *e) {
-  UNUSED(e);
-}
-
-static void lock(void) {
-  cm_Event e;
-  e.type = CM_EVENT_LOCK;
-  cmixer.lock(&e);
-}
-
-static void unlock(void) {
-  cm_Event e;
-  e.type = CM_EVENT_UNLOCK;
-  cmixer.lock(&e);
-}
-
 const char* cm_get_error(void) {
   const char *res = cmixer.lasterror;
   cmixer.lasterror = NULL;
@@ -98,13 +109,10 @@ static const char* error(const char *msg) {
 
 void cm_init(int samplerate) {
   cmixer.samplerate = samplerate;
-  cmixer.lock = dummy_handler;
   cmixer.sources = NULL;
   cmixer.gain = FX_UNIT;
-}
-
-void cm_set_lock(cm_EventHandler lock) {
-  cmixer.lock = lock;
+  atomic_init(&cmixer.head, 0);
+  atomic_init(&cmixer.tail, 0);
 }
 
 void cm_set_master_gain(double gain) {
@@ -142,7 +150,7 @@ static void process_source(cm_Source *src, int len) {
   }
 
   /* Don't process if not playing */
-  if (src->state != CM_STATE_PLAYING) {
+  if (atomic_load_explicit(&src->state, memory_order_relaxed) != CM_STATE_PLAYING) {
     return;
   }
 
@@ -165,7 +173,7 @@ static void process_source(cm_Source *src, int len) {
       src->end = frame + src->length;
       /* Set state and stop processing if we're not set to loop */
       if (!src->loop) {
-        src->state = CM_STATE_STOPPED;
+        atomic_store_explicit(&src->state, CM_STATE_STOPPED, memory_order_relaxed);
         break;
       }
     }
@@ -209,10 +217,111 @@ static void process_source(cm_Source *src, int len) {
   }
 }
 
+static void push_command(int type, cm_Source *src, double value) {
+  unsigned head = atomic_load_explicit(&cmixer.head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&cmixer.tail, memory_order_acquire);
+  Command *cmd;
+
+  /* Drop the command if the mixer has fallen this far behind */
+  if (head - tail >= COMMAND_SIZE) {
+    error("command queue full");
+    return;
+  }
+
+  cmd = &cmixer.commands[head & COMMAND_MASK];
+  cmd->type = type;
+  cmd->src = src;
+  cmd->value = value;
+  atomic_store_explicit(&cmixer.head, head + 1, memory_order_release);
+}
+
+static void recalc_source_gains(cm_Source *src);
+static void apply_pitch(cm_Source *src, double pitch);
+
+static void unlink_source(cm_Source *src) {
+  cm_Source **s = &cmixer.sources;
+  while (*s) {
+    if (*s == src) {
+      *s = src->next;
+      break;
+    }
+    s = &(*s)->next;
+  }
+  src->active = 0;
+}
+
+static void run_command(Command *cmd) {
+  cm_Event e;
+  cm_Source *src = cmd->src;
+
+  switch (cmd->type) {
+
+    case COMMAND_PLAY:
+      atomic_store_explicit(&src->state, CM_STATE_PLAYING, memory_order_relaxed);
+      if (!src->active) {
+        src->active = 1;
+        src->next = cmixer.sources;
+        cmixer.sources = src;
+      }
+      break;
+
+    case COMMAND_PAUSE:
+      atomic_store_explicit(&src->state, CM_STATE_PAUSED, memory_order_relaxed);
+      break;
+
+    case COMMAND_STOP:
+      atomic_store_explicit(&src->state, CM_STATE_STOPPED, memory_order_relaxed);
+      src->rewind = 1;
+      break;
+
+    case COMMAND_GAIN:
+      src->gain = cmd->value;
+      recalc_source_gains(src);
+      break;
+
+    case COMMAND_PAN:
+      src->pan = cmd->value;
+      recalc_source_gains(src);
+      break;
+
+    case COMMAND_PITCH:
+      apply_pitch(src, cmd->value);
+      break;
+
+    case COMMAND_LOOP:
+      src->loop = cmd->value != 0.;
+      break;
+
+    case COMMAND_DESTROY:
+      if (src->active) {
+        unlink_source(src);
+      }
+      e.type = CM_EVENT_DESTROY;
+      e.udata = src->udata;
+      src->handler(&e);
+      free(src);
+      break;
+  }
+}
+
+void cm_flush(void) {
+  unsigned tail = atomic_load_explicit(&cmixer.tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&cmixer.head, memory_order_acquire);
+
+  while (tail != head) {
+    run_command(&cmixer.commands[tail & COMMAND_MASK]);
+    tail++;
+  }
+  atomic_store_explicit(&cmixer.tail, tail, memory_order_release);
+}
+
 void cm_process(cm_Int16 *dst, int len) {
   int i;
   cm_Source **s;
 
+  /* Apply any changes the game has queued since the last call */
+  cm_flush();
+
   /* Process in chunks of BUFFER_SIZE if `len` is larger than BUFFER_SIZE */
   while (len > BUFFER_SIZE) {
     cm_process(dst, BUFFER_SIZE);
@@ -224,19 +333,17 @@ void cm_process(cm_Int16 *dst, int len) {
   memset(cmixer.buffer, 0, len * sizeof(cmixer.buffer[0]));
 
   /* Process active sources */
-  lock();
   s = &cmixer.sources;
   while (*s) {
     process_source(*s, len);
     /* Remove source from list if it is no longer playing */
-    if ((*s)->state != CM_STATE_PLAYING) {
+    if (atomic_load_explicit(&(*s)->state, memory_order_relaxed) != CM_STATE_PLAYING) {
       (*s)->active = 0;
       *s = (*s)->next;
     } else {
       s = &(*s)->next;
     }
   }
-  unlock();
 
   /* Copy internal buffer to destination and clip */
   for (i = 0; i < len; i++) {
@@ -255,11 +362,14 @@ cm_Source* cm_new_source(const cm_SourceInfo *info) {
   src->length = info->length;
   src->samplerate = info->samplerate;
   src->udata = info->udata;
-  cm_set_gain(src, 1);
-  cm_set_pan(src, 0);
-  cm_set_pitch(src, 1);
-  cm_set_loop(src, 0);
-  cm_stop(src);
+  /* The mixer doesn't know about the source yet, so it is set up directly */
+  src->gain = 1;
+  src->pan = 0;
+  recalc_source_gains(src);
+  apply_pitch(src, 1);
+  src->loop = 0;
+  atomic_init(&src->state, CM_STATE_STOPPED);
+  src->rewind = 1;
   return src;
 }
 
@@ -354,22 +464,7 @@ cm_Source* cm_new_source_from_mem(void *data, int size) {
 }
 
 void cm_destroy_source(cm_Source *src) {
-  cm_Event e;
-  lock();
-  if (src->active) {
-    cm_Source **s = &cmixer.sources;
-    while (*s) {
-      if (*s == src) {
-        *s = src->next;
-        break;
-      }
-    }
-  }
-  unlock();
-  e.type = CM_EVENT_DESTROY;
-  e.udata = src->udata;
-  src->handler(&e);
-  free(src);
+  push_command(COMMAND_DESTROY, src, 0);
 }
 
 double cm_get_length(cm_Source *src) {
@@ -381,7 +476,7 @@ double cm_get_position(cm_Source *src) {
 }
 
 int cm_get_state(cm_Source *src) {
-  return src->state;
+  return atomic_load_explicit(&src->state, memory_order_relaxed);
 }
 
 static void recalc_source_gains(cm_Source *src) {
@@ -393,17 +488,7 @@ static void recalc_source_gains(cm_Source *src) {
   src->rgain = FX_FROM_FLOAT(r);
 }
 
-void cm_set_gain(cm_Source *src, double gain) {
-  src->gain = gain;
-  recalc_source_gains(src);
-}
-
-void cm_set_pan(cm_Source *src, double pan) {
-  src->pan = CLAMP(pan, -1.0, 1.0);
-  recalc_source_gains(src);
-}
-
-void cm_set_pitch(cm_Source *src, double pitch) {
+static void apply_pitch(cm_Source *src, double pitch) {
   double rate;
   if (pitch > 0.) {
     rate = src->samplerate / (double) cmixer.samplerate * pitch;
@@ -413,28 +498,32 @@ void cm_set_pitch(cm_Source *src, double pitch) {
   src->rate = FX_FROM_FLOAT(rate);
 }
 
+void cm_set_gain(cm_Source *src, double gain) {
+  push_command(COMMAND_GAIN, src, gain);
+}
+
+void cm_set_pan(cm_Source *src, double pan) {
+  push_command(COMMAND_PAN, src, CLAMP(pan, -1.0, 1.0));
+}
+
+void cm_set_pitch(cm_Source *src, double pitch) {
+  push_command(COMMAND_PITCH, src, pitch);
+}
+
 void cm_set_loop(cm_Source *src, int loop) {
-  src->loop = loop;
+  push_command(COMMAND_LOOP, src, loop);
 }
 
 void cm_play(cm_Source *src) {
-  lock();
-  src->state = CM_STATE_PLAYING;
-  if (!src->active) {
-    src->active = 1;
-    src->next = cmixer.sources;
-    cmixer.sources = src;
-  }
-  unlock();
+  push_command(COMMAND_PLAY, src, 0);
 }
 
 void cm_pause(cm_Source *src) {
-  src->state = CM_STATE_PAUSED;
+  push_command(COMMAND_PAUSE, src, 0);
 }
 
 void cm_stop(cm_Source *src) {
-  src->state = CM_STATE_STOPPED;
-  src->rewind = 1;
+  push_command(COMMAND_STOP, src, 0);
 }
 
 /*============================================================================
@@ -613,11 +702,54 @@ static const char* wav_init(cm_SourceInfo *info, void *data, int len, int ownsda
 #define STB_VORBIS_HEADER_ONLY
 #include "stb_vorbis.c"
 
+/* A stream with read-ahead is decoded by whichever thread calls
+** `cm_fill_ahead()` into the `ahead` ring, and the mixer only copies out of
+** it. Rewinds are passed to the decoding thread by bumping `rewind`; until
+** it answers by setting `rewound` to match, the mixer reads silence */
 typedef struct {
   stb_vorbis *ogg;
   void *data;
+  cm_Int16 *ahead;      /* Ring of decoded samples, or NULL to decode inline */
+  unsigned aheadmask;   /* Size of `ahead` in samples, less one */
+  unsigned start;       /* `read` position of the start of the stream */
+  atomic_uint write;    /* Samples decoded into `ahead` (decoding thread) */
+  atomic_uint read;     /* Samples taken from `ahead` (mixer thread) */
+  atomic_uint rewind;   /* Rewinds asked for (mixer thread) */
+  atomic_uint rewound;  /* Rewinds done (decoding thread) */
 } OggStream;
 
+static void ogg_read_ahead(OggStream *s, cm_Int16 *buf, int len) {
+  unsigned read, n, i;
+
+  /* Wait for a pending rewind, playing silence */
+  n = 0;
+  if (atomic_load_explicit(&s->rewound, memory_order_acquire) ==
+      atomic_load_explicit(&s->rewind, memory_order_relaxed)) {
+    read = atomic_load_explicit(&s->read, memory_order_relaxed);
+    n = atomic_load_explicit(&s->write, memory_order_acquire) - read;
+    n = MIN(n, (unsigned) len);
+    for (i = 0; i < n; i++) {
+      buf[i] = s->ahead[(read + i) & s->aheadmask];
+    }
+    atomic_store_explicit(&s->read, read + n, memory_order_release);
+  }
+
+  /* Fill whatever the decoder hasn't caught up with yet with silence */
+  memset(buf + n, 0, (len - n) * sizeof(*buf));
+}
+
+static void ogg_rewind_ahead(OggStream *s) {
+  unsigned rewind = atomic_load_explicit(&s->rewind, memory_order_relaxed);
+
+  /* Nothing to do if no rewind is pending and nothing has been played since
+  ** the last one, as the ring already holds the start of the stream */
+  if (atomic_load_explicit(&s->rewound, memory_order_acquire) == rewind &&
+      atomic_load_explicit(&s->read, memory_order_relaxed) == s->start) {
+    return;
+  }
+  atomic_store_explicit(&s->rewind, rewind + 1, memory_order_release);
+}
+
 static void ogg_handler(cm_Event *e) {
   int n, len;
   OggStream *s = e->udata;
@@ -627,6 +759,7 @@ static void ogg_handler(cm_Event *e) {
 
     case CM_EVENT_DESTROY:
       stb_vorbis_close(s->ogg);
+      free(s->ahead);
       free(s->data);
       free(s);
       break;
@@ -634,6 +767,10 @@ static void ogg_handler(cm_Event *e) {
     case CM_EVENT_SAMPLES:
       len = e->length;
       buf = e->buffer;
+      if (s->ahead) {
+        ogg_read_ahead(s, buf, len);
+        break;
+      }
 fill:
       n = stb_vorbis_get_samples_short_interleaved(s->ogg, 2, buf, len);
       n *= 2;
@@ -648,11 +785,92 @@ fill:
       break;
 
     case CM_EVENT_REWIND:
+      if (s->ahead) {
+        ogg_rewind_ahead(s);
+        break;
+      }
       stb_vorbis_seek_start(s->ogg);
       break;
   }
 }
 
+void cm_set_ahead(cm_Source *src, double seconds) {
+  OggStream *s;
+  unsigned size = 2;
+
+  if (src->handler != ogg_handler) {
+    error("read-ahead is only supported for ogg streams");
+    return;
+  }
+  s = src->udata;
+
+  /* Round the ring up to a power of two samples */
+  while (size < seconds * src->samplerate * 2) {
+    size <<= 1;
+  }
+  s->ahead = malloc(size * sizeof(*s->ahead));
+  if (!s->ahead) {
+    error("allocation failed");
+    return;
+  }
+  s->aheadmask = size - 1;
+  s->start = 0;
+  atomic_init(&s->write, 0);
+  atomic_init(&s->read, 0);
+  atomic_init(&s->rewind, 0);
+  atomic_init(&s->rewound, 0);
+}
+
+void cm_fill_ahead(cm_Source *src) {
+  OggStream *s;
+  unsigned write, read, rewind, n;
+  int got, looped = 0;
+
+  if (src->handler != ogg_handler) {
+    return;
+  }
+  s = src->udata;
+  if (!s->ahead) {
+    return;
+  }
+
+  write = atomic_load_explicit(&s->write, memory_order_relaxed);
+  read = atomic_load_explicit(&s->read, memory_order_acquire);
+  rewind = atomic_load_explicit(&s->rewind, memory_order_acquire);
+
+  /* Carry out a rewind; if nothing has been played since the stream was last
+  ** at its start, what is in the ring is still good */
+  if (rewind != atomic_load_explicit(&s->rewound, memory_order_relaxed)) {
+    if (read != s->start) {
+      stb_vorbis_seek_start(s->ogg);
+      write = read;
+      s->start = read;
+      atomic_store_explicit(&s->write, write, memory_order_relaxed);
+    }
+    atomic_store_explicit(&s->rewound, rewind, memory_order_release);
+  }
+
+  /* Decode into the free part of the ring, a contiguous run at a time */
+  while ((n = s->aheadmask + 1 - (write - read)) > 0) {
+    n = MIN(n, s->aheadmask + 1 - (write & s->aheadmask));
+    got = stb_vorbis_get_samples_short_interleaved(s->ogg, 2,
+      s->ahead + (write & s->aheadmask), n);
+    /* Loop back to the start at the end of the stream, as the mixer expects
+    ** streams to continue into their next play-through */
+    if (got == 0) {
+      if (looped) {
+        break;
+      }
+      stb_vorbis_seek_start(s->ogg);
+      looped = 1;
+      continue;
+    }
+    looped = 0;
+    write += got * 2;
+    atomic_store_explicit(&s->write, write, memory_order_release);
+  }
+}
+
 static const char* ogg_init(cm_SourceInfo *info, void *data, int len, int ownsdata) {
   OggStream *stream;
   stb_vorbis *ogg;
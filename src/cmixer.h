@@ -47,8 +47,6 @@ enum {
 };
 
 enum {
-  CM_EVENT_LOCK,
-  CM_EVENT_UNLOCK,
   CM_EVENT_DESTROY,
   CM_EVENT_SAMPLES,
   CM_EVENT_REWIND
@@ -56,9 +54,9 @@ enum {
 
 const char* cm_get_error(void);
 void cm_init(int samplerate);
-void cm_set_lock(cm_EventHandler lock);
 void cm_set_master_gain(double gain);
 void cm_process(cm_Int16 *dst, int len);
+void cm_flush(void);
 
 cm_Source* cm_new_source(const cm_SourceInfo *info);
 cm_Source* cm_new_source_from_file(const char *filename);
@@ -74,6 +72,8 @@ void cm_set_loop(cm_Source *src, int loop);
 void cm_play(cm_Source *src);
 void cm_pause(cm_Source *src);
 void cm_stop(cm_Source *src);
+void cm_set_ahead(cm_Source *src, double seconds);
+void cm_fill_ahead(cm_Source *src);
 
 #ifdef __cplusplus
 }
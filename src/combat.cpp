@@ -9,6 +9,8 @@
 #include "death.h"
 #include "dungeon.h"
 #include "error.h"
+#include "harness.h"
+#include "inputlog.h"
 #include "item.h"
 #include "mapmgr.h"
 #include "music.h"
@@ -458,7 +460,7 @@ void CombatController::placePartyMembers() {
             map->player_start[i].z = 0;
             p->setCoords(map->player_start[i]);
             p->setMap(map);
-            map->objects.push_back(p);
+            map->addObject(p, p->getCoords(), false);
             party[i] = p;
         }
     }
@@ -670,6 +672,8 @@ void CombatController::finishTurn() {
     PartyMember *player = getCurrentPlayer();
     int quick;
 
+    harnessTurn();
+
     /* return to party overview */
     c->stats->setView(STATS_PARTY_OVERVIEW);
 
@@ -1025,7 +1029,7 @@ bool CombatController::keyPressed(int key) {
     }
 
     if (valid) {
-        c->lastCommandTime = time(NULL);
+        c->lastCommandTime = inputLogTime();
         if (endTurn && (eventHandler->getController() == this))
             c->location->turnCompleter->finishTurn();
     }
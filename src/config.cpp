@@ -5,7 +5,10 @@
 #include <cstdio>
 #include <cstdarg>
 #include <cstdlib>
+#include <cstring>
 #include <cctype>
+#include <map>
+#include <set>
 
 #include <libxml/xinclude.h>
 #include <libxml/xpath.h>
@@ -16,22 +19,307 @@
 #endif
 
 #include "config.h"
+#include "assetcache.h"
 #include "error.h"
 #include "settings.h"
 #include "u4file.h"
 
+/* bump whenever the snapshot layout changes */
+#define CONFIG_SNAPSHOT_VERSION 1
+#define CONFIG_SNAPSHOT_FILE "config.bin"
+
+/**
+ * The layout of a config snapshot: the header, then the elements in
+ * breadth-first order so that each element's children are stored
+ * together, then their attributes, then the interned strings that both
+ * refer to by offset.  Attribute values are also stored pre-parsed as
+ * they would be read by getInt and getBool.
+ */
+struct ConfigSnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t nelements, nattrs, strsize, reserved;
+};
+
+struct ConfigSnapshotElement {
+    uint32_t name;
+    uint32_t attrs, nattrs;
+    uint32_t children, nchildren;
+};
+
+struct ConfigSnapshotAttr {
+    uint32_t name, value;
+    int32_t intValue;
+    uint32_t boolValue;
+};
+
+struct ConfigSnapshot {
+    U4FILE *file;
+    const ConfigSnapshotHeader *header;
+    const ConfigSnapshotElement *elements;
+    const ConfigSnapshotAttr *attrs;
+    const char *strings;
+};
+
 extern bool verbose;
 Config *Config::instance = NULL;
 
+/**
+ * Hashes a config file into key, followed by each file it includes and
+ * theirs in turn.  A file included twice is only hashed the first time.
+ */
+static uint64_t configHashFile(uint64_t key, const std::string &name, std::set<std::string> &seen) {
+    char path[64];
+
+    key = zu4_cache_hash(key, name.c_str(), name.size() + 1);
+    if (!seen.insert(name).second)
+        return key;
+
+    u4find_conf(path, sizeof(path), name.c_str());
+    U4FILE *f = path[0] ? u4fopen_stdio(path) : NULL;
+    if (!f)
+        return key;
+
+    long len = u4flength(f);
+    const char *xml = reinterpret_cast<const char *>(u4fspan(f, len));
+    if (xml) {
+        key = zu4_cache_hash(key, xml, len);
+
+        // the includes are the only other files the tree comes from
+        static const char href[] = "href=\"";
+        for (long i = 0; i + (long)sizeof(href) < len; i++) {
+            if (memcmp(xml + i, href, sizeof(href) - 1) != 0)
+                continue;
+            const char *start = xml + i + sizeof(href) - 1;
+            const char *end = static_cast<const char *>(memchr(start, '"', len - (start - xml)));
+            if (!end)
+                break;
+
+            key = configHashFile(key, std::string(start, end - start), seen);
+            i = end - xml;
+        }
+    }
+
+    u4fclose(f);
+    return key;
+}
+
+/**
+ * Returns the key for the config files as they are now, hashed from
+ * config.xml and every file it includes, however deeply.
+ */
+static uint64_t configSourceKey() {
+    char path[64];
+    u4find_conf(path, sizeof(path), Config::CONFIG_XML_LOCATION_POINTER);
+    if (!path[0])
+        return 0;
+
+    std::set<std::string> seen;
+    return configHashFile(0, Config::CONFIG_XML_LOCATION_POINTER, seen);
+}
+
+static std::string configSnapshotPath() {
+    const char *dir = zu4_cache_dir();
+    return dir ? std::string(dir) + CONFIG_SNAPSHOT_FILE : std::string();
+}
+
+/**
+ * Maps the snapshot for the given key, checking that every index and
+ * offset in it stays in bounds.  Returns NULL if there is no usable
+ * snapshot.
+ */
+static ConfigSnapshot *configSnapshotLoad(uint64_t key) {
+    std::string path = configSnapshotPath();
+    U4FILE *f = path.empty() || !key ? NULL : u4fopen_stdio(path.c_str());
+    if (!f)
+        return NULL;
+
+    long len = u4flength(f);
+    const uint8_t *data = len >= (long)sizeof(ConfigSnapshotHeader) ? u4fspan(f, len) : NULL;
+    const ConfigSnapshotHeader *header = reinterpret_cast<const ConfigSnapshotHeader *>(data);
+
+    bool valid = header && !memcmp(header->magic, "ZU4X", 4) &&
+        header->version == CONFIG_SNAPSHOT_VERSION && header->key == key &&
+        header->nelements > 0 && header->strsize > 0 &&
+        (uint64_t)len == sizeof(*header) + (uint64_t)header->nelements * sizeof(ConfigSnapshotElement) +
+            (uint64_t)header->nattrs * sizeof(ConfigSnapshotAttr) + header->strsize;
+
+    ConfigSnapshot *snapshot = NULL;
+    if (valid) {
+        snapshot = new ConfigSnapshot;
+        snapshot->file = f;
+        snapshot->header = header;
+        snapshot->elements = reinterpret_cast<const ConfigSnapshotElement *>(header + 1);
+        snapshot->attrs = reinterpret_cast<const ConfigSnapshotAttr *>(snapshot->elements + header->nelements);
+        snapshot->strings = reinterpret_cast<const char *>(snapshot->attrs + header->nattrs);
+
+        valid = snapshot->strings[header->strsize - 1] == '\0';
+        for (uint32_t i = 0; valid && i < header->nelements; i++) {
+            const ConfigSnapshotElement &e = snapshot->elements[i];
+            valid = e.name < header->strsize &&
+                e.attrs <= header->nattrs && e.nattrs <= header->nattrs - e.attrs &&
+                e.children <= header->nelements && e.nchildren <= header->nelements - e.children;
+        }
+        for (uint32_t i = 0; valid && i < header->nattrs; i++) {
+            const ConfigSnapshotAttr &a = snapshot->attrs[i];
+            valid = a.name < header->strsize && a.value < header->strsize;
+        }
+    }
+
+    if (!valid) {
+        delete snapshot;
+        u4fclose(f);
+        remove(path.c_str());
+        return NULL;
+    }
+
+    return snapshot;
+}
+
+/**
+ * Compiles a parsed config tree into a snapshot, written whole and then
+ * renamed into place so a partial one is never read.
+ */
+static bool configSnapshotWrite(xmlDocPtr doc, uint64_t key) {
+    std::string path = configSnapshotPath();
+    if (path.empty() || !key)
+        return false;
+
+    std::vector<xmlNodePtr> nodes;
+    std::vector<ConfigSnapshotElement> elements;
+    std::vector<ConfigSnapshotAttr> attrs;
+    std::string strings;
+    std::map<std::string, uint32_t> interned;
+
+    struct Interner {
+        std::string &strings;
+        std::map<std::string, uint32_t> &interned;
+        uint32_t operator()(const char *s) {
+            std::map<std::string, uint32_t>::iterator i = interned.find(s);
+            if (i != interned.end())
+                return i->second;
+            uint32_t offset = strings.size();
+            strings.append(s);
+            strings.push_back('\0');
+            interned[s] = offset;
+            return offset;
+        }
+    } intern = { strings, interned };
+
+    nodes.push_back(xmlDocGetRootElement(doc));
+    if (!nodes[0])
+        return false;
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        xmlNodePtr node = nodes[i];
+        ConfigSnapshotElement e;
+
+        e.name = intern(reinterpret_cast<const char *>(node->name));
+        e.attrs = attrs.size();
+        for (xmlAttrPtr a = node->properties; a; a = a->next) {
+            xmlChar *prop = xmlGetProp(node, a->name);
+            if (!prop)
+                continue;
+            const char *value = reinterpret_cast<const char *>(prop);
+            ConfigSnapshotAttr attr;
+            attr.name = intern(reinterpret_cast<const char *>(a->name));
+            attr.value = intern(value);
+            attr.intValue = static_cast<int32_t>(strtol(value, NULL, 0));
+            attr.boolValue = strcmp(value, "true") == 0;
+            attrs.push_back(attr);
+            xmlFree(prop);
+        }
+        e.nattrs = attrs.size() - e.attrs;
+
+        e.children = nodes.size();
+        for (xmlNodePtr child = node->children; child; child = child->next) {
+            if (child->type == XML_ELEMENT_NODE)
+                nodes.push_back(child);
+        }
+        e.nchildren = nodes.size() - e.children;
+        elements.push_back(e);
+    }
+
+    ConfigSnapshotHeader header;
+    memcpy(header.magic, "ZU4X", 4);
+    header.version = CONFIG_SNAPSHOT_VERSION;
+    header.key = key;
+    header.nelements = elements.size();
+    header.nattrs = attrs.size();
+    header.strsize = strings.size();
+    header.reserved = 0;
+
+    std::string tmp = path + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if (!out)
+        return false;
+
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+        fwrite(&elements[0], sizeof(elements[0]), elements.size(), out) == elements.size() &&
+        (attrs.empty() || fwrite(&attrs[0], sizeof(attrs[0]), attrs.size(), out) == attrs.size()) &&
+        fwrite(strings.data(), 1, strings.size(), out) == strings.size();
+    if (fclose(out) != 0)
+        written = false;
+
+    if (!written || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        zu4_error(ZU4_LOG_WRN, "Unable to write config snapshot %s\n", path.c_str());
+        return false;
+    }
+
+    if (verbose)
+        printf("wrote config snapshot %s: %u elements, %u attributes, %u bytes of strings\n",
+            path.c_str(), header.nelements, header.nattrs, header.strsize);
+    return true;
+}
+
+void Config::registerInput() {
+    static bool registered = false;
+    if (!registered) {
+        xmlRegisterInputCallbacks(&xmlFileMatch, &fileOpen, xmlFileRead, xmlFileClose);
+        registered = true;
+    }
+}
+
 const Config *Config::getInstance() {
     if (!instance) {
-        xmlRegisterInputCallbacks(&xmlFileMatch, &fileOpen, xmlFileRead, xmlFileClose);
+        registerInput();
         instance = new Config;
     }
     return instance;
 }
 
 ConfigElement Config::getElement(const std::string &name) const {
+    if (snapshot) {
+        // walk down from the root, one path component at a time
+        uint32_t index = 0;
+        size_t start = 0;
+        while (start <= name.size()) {
+            size_t end = name.find('/', start);
+            if (end == std::string::npos)
+                end = name.size();
+            std::string component = name.substr(start, end - start);
+
+            const ConfigSnapshotElement &e = snapshot->elements[index];
+            uint32_t found = 0, matches = 0;
+            for (uint32_t i = e.children; i < e.children + e.nchildren; i++) {
+                if (component == snapshot->strings + snapshot->elements[i].name) {
+                    if (!matches++)
+                        found = i;
+                }
+            }
+            if (!matches)
+                zu4_error(ZU4_LOG_ERR, "no match for xpath /config/%s\n", name.c_str());
+            if (matches > 1)
+                zu4_error(ZU4_LOG_WRN, "more than one match for xpath /config/%s\n", name.c_str());
+
+            index = found;
+            start = end + 1;
+        }
+        return ConfigElement(snapshot, index);
+    }
+
     xmlXPathContextPtr context;
     xmlXPathObjectPtr result;
 
@@ -55,8 +343,12 @@ ConfigElement Config::getElement(const std::string &name) const {
 char DEFAULT_CONFIG_XML_LOCATION[] = "config.xml";
 char * Config::CONFIG_XML_LOCATION_POINTER = &DEFAULT_CONFIG_XML_LOCATION[0];
 
-Config::Config() {
-    doc = xmlParseFile(Config::CONFIG_XML_LOCATION_POINTER);
+/**
+ * Parses config.xml and the files it includes, validating them if the
+ * settings ask for it.
+ */
+xmlDocPtr Config::parse() {
+    xmlDocPtr doc = xmlParseFile(Config::CONFIG_XML_LOCATION_POINTER);
     if (!doc) {
     	printf("Failed to read core config.xml. Assuming it is located at '%s'", Config::CONFIG_XML_LOCATION_POINTER);
         zu4_error(ZU4_LOG_ERR, "error parsing config.xml");
@@ -78,6 +370,36 @@ Config::Config() {
         if (!xmlValidateDocument(&cvp, doc))
             zu4_error(ZU4_LOG_WRN, "xml validation error:\n%s", errorMessage.c_str());
     }
+
+    return doc;
+}
+
+Config::Config() : doc(NULL), snapshot(NULL) {
+    uint64_t key = configSourceKey();
+
+    if (!settings.validateXml)
+        snapshot = configSnapshotLoad(key);
+    if (snapshot) {
+        if (verbose)
+            printf("using config snapshot %s\n", configSnapshotPath().c_str());
+        return;
+    }
+
+    // the XML is used for this run, and compiled for the next one
+    doc = parse();
+    configSnapshotWrite(doc, key);
+}
+
+/**
+ * Compiles the config snapshot from the XML, whether or not there is an
+ * up to date one already.  Returns false if it couldn't be written.
+ */
+bool Config::compile() {
+    registerInput();
+    xmlDocPtr doc = parse();
+    bool written = configSnapshotWrite(doc, configSourceKey());
+    xmlFreeDoc(doc);
+    return written;
 }
 
 std::vector<std::string> Config::getGames() {
@@ -117,10 +439,13 @@ void Config::accumError(void *l, const char *fmt, ...) {
     errorMessage->append(buffer);
 }
 
-ConfigElement::ConfigElement(xmlNodePtr xmlNode) : node(xmlNode), name(reinterpret_cast<const char *>(xmlNode->name)) {
+ConfigElement::ConfigElement(xmlNodePtr xmlNode) : node(xmlNode), snapshot(NULL), index(0), name(reinterpret_cast<const char *>(xmlNode->name)) {
 }
 
-ConfigElement::ConfigElement(const ConfigElement &e) : node(e.node), name(e.name) {
+ConfigElement::ConfigElement(const ConfigSnapshot *s, uint32_t i) : node(NULL), snapshot(s), index(i), name(s->strings + s->elements[i].name) {
+}
+
+ConfigElement::ConfigElement(const ConfigElement &e) : node(e.node), snapshot(e.snapshot), index(e.index), name(e.name) {
 }
 
 ConfigElement::~ConfigElement() {
@@ -129,15 +454,34 @@ ConfigElement::~ConfigElement() {
 ConfigElement &ConfigElement::operator=(const ConfigElement &e) {
     if (&e != this) {
         node = e.node;
+        snapshot = e.snapshot;
+        index = e.index;
         name = e.name;
     }
     return *this;
 }
 
+/**
+ * Returns the named attribute of a snapshot element, or NULL if it
+ * doesn't have one.
+ */
+const ConfigSnapshotAttr *ConfigElement::findAttr(const std::string &name) const {
+    const ConfigSnapshotElement &e = snapshot->elements[index];
+    for (uint32_t i = e.attrs; i < e.attrs + e.nattrs; i++) {
+        const ConfigSnapshotAttr *attr = &snapshot->attrs[i];
+        if (strcmp(snapshot->strings + attr->name, name.c_str()) == 0)
+            return attr;
+    }
+    return NULL;
+}
+
 /**
  * Returns true if the property exists in the current config element
  */
 bool ConfigElement::exists(const std::string &name) const {
+    if (snapshot)
+        return findAttr(name) != NULL;
+
     xmlChar *prop = xmlGetProp(node, reinterpret_cast<const xmlChar *>(name.c_str()));
     bool exists = prop != NULL;
     xmlFree(prop);
@@ -146,6 +490,11 @@ bool ConfigElement::exists(const std::string &name) const {
 }
 
 std::string ConfigElement::getString(const std::string &name) const {
+    if (snapshot) {
+        const ConfigSnapshotAttr *attr = findAttr(name);
+        return attr ? std::string(snapshot->strings + attr->value) : std::string();
+    }
+
     xmlChar *prop = xmlGetProp(node, reinterpret_cast<const xmlChar *>(name.c_str()));
     if (!prop)
         return "";
@@ -160,6 +509,11 @@ int ConfigElement::getInt(const std::string &name, int defaultValue) const {
     long result;
     xmlChar *prop;
 
+    if (snapshot) {
+        const ConfigSnapshotAttr *attr = findAttr(name);
+        return attr ? attr->intValue : defaultValue;
+    }
+
     prop = xmlGetProp(node, reinterpret_cast<const xmlChar *>(name.c_str()));
     if (!prop)
         return defaultValue;
@@ -173,6 +527,11 @@ int ConfigElement::getInt(const std::string &name, int defaultValue) const {
 bool ConfigElement::getBool(const std::string &name) const {
     int result;
 
+    if (snapshot) {
+        const ConfigSnapshotAttr *attr = findAttr(name);
+        return attr && attr->boolValue;
+    }
+
     xmlChar *prop = xmlGetProp(node, reinterpret_cast<const xmlChar *>(name.c_str()));
     if (!prop)
         return false;
@@ -191,6 +550,23 @@ int ConfigElement::getEnum(const std::string &name, const char *enumValues[]) co
     int result = -1, i;
     xmlChar *prop;
 
+    if (snapshot) {
+        const ConfigSnapshotAttr *attr = findAttr(name);
+        if (!attr)
+            return 0;
+
+        const char *value = snapshot->strings + attr->value;
+        for (i = 0; enumValues[i]; i++) {
+            if (strcmp(value, enumValues[i]) == 0)
+                result = i;
+        }
+
+        if (result == -1)
+            zu4_error(ZU4_LOG_ERR, "invalid enum value for %s: %s", name.c_str(), value);
+
+        return result;
+    }
+
     prop = xmlGetProp(node, reinterpret_cast<const xmlChar *>(name.c_str()));
     if (!prop)
         return 0;
@@ -211,6 +587,14 @@ int ConfigElement::getEnum(const std::string &name, const char *enumValues[]) co
 std::vector<ConfigElement> ConfigElement::getChildren() const {
     std::vector<ConfigElement> result;
 
+    if (snapshot) {
+        const ConfigSnapshotElement &e = snapshot->elements[index];
+        result.reserve(e.nchildren);
+        for (uint32_t i = e.children; i < e.children + e.nchildren; i++)
+            result.push_back(ConfigElement(snapshot, i));
+        return result;
+    }
+
     for (xmlNodePtr child = node->children; child; child = child->next) {
         if (child->type == XML_ELEMENT_NODE)
             result.push_back(ConfigElement(child));
@@ -218,4 +602,3 @@ std::vector<ConfigElement> ConfigElement::getChildren() const {
 
     return result;
 }
-
@@ -5,15 +5,24 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include <libxml/HTMLparser.h>
 #include <libxml/xmlmemory.h>
 
 struct ConfigElement;
+struct ConfigSnapshot;
+struct ConfigSnapshotAttr;
 
 /**
  * Singleton struct that manages the XML configuration tree.
+ *
+ * The tree is compiled into a binary snapshot in the cache directory,
+ * which later runs map and read in place of the XML.  The XML is still
+ * the source of truth: the snapshot is keyed by the contents of the
+ * config files, and the XML is parsed again (and the snapshot rebuilt)
+ * whenever they change, or when validating.
  */
 struct Config {
 public:
@@ -23,25 +32,31 @@ public:
 
     static std::vector<std::string> getGames();
     static void setGame(const std::string &name);
+    static bool compile();
 
     static char * CONFIG_XML_LOCATION_POINTER;
 
 private:
     Config();
+    static void registerInput();
+    static xmlDocPtr parse();
     static void *fileOpen(const char *filename);
     static void accumError(void *l, const char *fmt, ...);
 
     static Config *instance;
     xmlDocPtr doc;
+    ConfigSnapshot *snapshot;
 };
 
 /**
- * A single configuration element in the config tree.  Right now, a
- * thin wrapper around the XML DOM element.
+ * A single configuration element in the config tree: either an element
+ * of the config snapshot, or a thin wrapper around the XML DOM element
+ * when the XML had to be parsed.
  */
 struct ConfigElement {
 public:
     ConfigElement(xmlNodePtr xmlNode);
+    ConfigElement(const ConfigSnapshot *snapshot, uint32_t index);
     ConfigElement(const ConfigElement &e);
     ~ConfigElement();
 
@@ -60,7 +75,11 @@ public:
     xmlNodePtr getNode() const { return node; }
 
 private:
+    const ConfigSnapshotAttr *findAttr(const std::string &name) const;
+
     xmlNodePtr node;
+    const ConfigSnapshot *snapshot;
+    uint32_t index;
     std::string name;
 };
 
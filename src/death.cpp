@@ -7,6 +7,7 @@
 #include "death.h"
 
 #include "game.h"
+#include "inputlog.h"
 #include "mapmgr.h"
 #include "music.h"
 #include "player.h"
@@ -106,7 +107,7 @@ void deathRevive() {
 
     c->aura->set();
     c->horseSpeed = 0;
-    c->lastCommandTime = time(NULL);
+    c->lastCommandTime = inputLogTime();
     zu4_music_play(c->location->map->music);
 
     c->party->reviveParty();
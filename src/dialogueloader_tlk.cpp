@@ -26,15 +26,19 @@ Dialogue* U4TlkDialogueLoader::load(void *source) {
     };
 
     /* there's no dialogues left in the file */
-    char tlk_buffer[288];
-    if (u4fread(file, tlk_buffer, 1, sizeof(tlk_buffer)) != sizeof(tlk_buffer))
+    const int tlk_size = 288;
+    const char *tlk_buffer = (const char *)u4fspan(file, tlk_size);
+    if (!tlk_buffer)
         return NULL;
 
-    char *ptr = &tlk_buffer[3];
+    const char *ptr = &tlk_buffer[3], *end = tlk_buffer + tlk_size;
     std::vector<std::string> strings;
     for (int i = 0; i < 12; i++) {
-        strings.push_back(ptr);
-        ptr += strlen(ptr) + 1;
+        const char *nul = (const char *)memchr(ptr, '\0', end - ptr);
+        if (!nul)
+            nul = end;
+        strings.push_back(std::string(ptr, nul));
+        ptr = nul < end ? nul + 1 : end;
     }
 
     Dialogue *dlg = new Dialogue();
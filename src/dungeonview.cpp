@@ -32,7 +32,7 @@ void DungeonView::display(Context * c, TileView *view)
         //Note: This shouldn't go above 4, unless we check opaque tiles each step of the way.
         const int farthest_non_wall_tile_visibility = 4;
 
-        std::vector<MapTile> tiles;
+        TileStack tiles;
 
         screenEraseMapArea();
         if (c->party->getTorchDuration() > 0) {
@@ -57,7 +57,7 @@ void DungeonView::display(Context * c, TileView *view)
                	{
                		for (int y_obj = farthest_non_wall_tile_visibility; y_obj > y; y_obj--)
                		{
-                        std::vector<MapTile> distant_tiles = getTiles(y_obj     , 0);
+                        TileStack distant_tiles = getTiles(y_obj     , 0);
                		DungeonGraphicType distant_type = tilesToGraphic(distant_tiles);
 
 					if ((distant_type == DNGGRAPHIC_DNGTILE) || (distant_type == DNGGRAPHIC_BASETILE))
@@ -72,7 +72,7 @@ void DungeonView::display(Context * c, TileView *view)
 
     /* 3rd-person perspective */
     else {
-        std::vector<MapTile> tiles;
+        TileStack tiles;
 
         static MapTile black = c->location->map->tileset->getByName("black")->getId();
         static MapTile avatar = c->location->map->tileset->getByName("avatar")->getId();
@@ -94,8 +94,6 @@ void DungeonView::display(Context * c, TileView *view)
 }
 
 void DungeonView::drawInDungeon(Tile *tile, int x_offset, int distance, Direction orientation, bool tiledWall) {
-    Image *scaled;
-
     const static int nscale_vga[] = { 12, 8, 4, 2, 1};
     const static int nscale_ega[] = { 8, 4, 2, 1, 0};
 
@@ -123,30 +121,21 @@ void DungeonView::drawInDungeon(Tile *tile, int x_offset, int distance, Directio
 
     const int *dscale = tiledWall ? lscale : nscale;
 
-    //Clear scratchpad and set a background color
-    zu4_img_fill(animated, 0, 0, animated->w, animated->h, 14, 15, 16, 255);
-    //Put tile on animated scratchpad
-    if (tile->getAnim()) {
-        MapTile mt = tile->getId();
-        tile->getAnim()->draw(animated, tile, mt, orientation);
-    }
-    else {
-        zu4_img_draw_on(animated, tile->getImage(), 0, 0);
-    }
-
     /* scale is based on distance; 1 means half size, 2 regular, 4 means scale by 2x, etc. */
     if (dscale[distance] == 0)
 		return;
-    else if (dscale[distance] == 1)
-        scaled = zu4_img_scaledown(animated, 2);
-    else
-        scaled = zu4_img_scaleup(animated, dscale[distance] / 2);
+
+    int scaled_w = (dscale[distance] == 1) ? animated->w / 2 : animated->w * (dscale[distance] / 2);
+    int scaled_h = (dscale[distance] == 1) ? animated->h / 2 : animated->h * (dscale[distance] / 2);
 
     if (tiledWall) {
-    	int i_x = ((VIEWPORT_W * tileWidth  / 2) + this->x) - (scaled->w / 2);
-    	int i_y = ((VIEWPORT_H * tileHeight / 2) + this->y) - (scaled->h / 2);
-    	int f_x = i_x + scaled->w;
-    	int f_y = i_y + scaled->h;
+    	//Tiled walls repeat the unscaled tile over the area the scaled tile would cover
+    	drawScratchTile(tile, orientation);
+
+    	int i_x = ((VIEWPORT_W * tileWidth  / 2) + this->x) - (scaled_w / 2);
+    	int i_y = ((VIEWPORT_H * tileHeight / 2) + this->y) - (scaled_h / 2);
+    	int f_x = i_x + scaled_w;
+    	int f_y = i_y + scaled_h;
     	int d_x = animated->w;
     	int d_y = animated->h;
 
@@ -156,15 +145,84 @@ void DungeonView::drawInDungeon(Tile *tile, int x_offset, int distance, Directio
     					x, y, 0, 0, f_x - x, f_y - y);
     }
     else {
+    	Image *scaled = getScaledTile(tile, distance, dscale[distance], orientation);
     	int y_offset = std::max(0,(dscale[distance] - offset_adj) * offset_multiplier);
-    	int x = ((VIEWPORT_W * tileWidth / 2) + this->x) - (scaled->w / 2);
-    	int y = ((VIEWPORT_H * tileHeight / 2) + this->y + y_offset) - (scaled->h / 8);
+    	int x = ((VIEWPORT_W * tileWidth / 2) + this->x) - (scaled_w / 2);
+    	int y = ((VIEWPORT_H * tileHeight / 2) + this->y + y_offset) - (scaled_h / 8);
 
 		zu4_img_draw_subrect_on(this->screen, scaled,
-								x, y, 0, 0, scaled->w, scaled->h);
+								x, y, 0, 0, scaled_w, scaled_h);
     }
+}
 
-    zu4_img_free(scaled);
+/**
+ * Draws a tile onto the scratchpad over the dungeon background color.
+ */
+void DungeonView::drawScratchTile(Tile *tile, Direction orientation) {
+    zu4_img_fill(animated, 0, 0, animated->w, animated->h, 14, 15, 16, 255);
+    if (tile->getAnim()) {
+        MapTile mt = tile->getId();
+        tile->getAnim()->draw(animated, tile, mt, orientation);
+    }
+    else {
+        zu4_img_draw_on(animated, tile->getImage(), 0, 0);
+    }
+}
+
+/**
+ * Returns the tile scaled for the given distance.  Static tiles are
+ * scaled once and kept until the screen is reinitialized; animated tiles
+ * change every draw, so they are rescaled into a reusable image.
+ */
+Image *DungeonView::getScaledTile(Tile *tile, int distance, int scale, Direction orientation) {
+    int w = (scale == 1) ? animated->w / 2 : animated->w * (scale / 2);
+    int h = (scale == 1) ? animated->h / 2 : animated->h * (scale / 2);
+    Image *scaled;
+
+    /* loading the image also finds the tile's animation */
+    tile->getImage();
+
+    if (!tile->getAnim()) {
+        unsigned int key = (tile->getId() << 4) | (distance << 1) | (settings.videoType ? 1 : 0);
+        std::map<unsigned int, Image *>::iterator i = scaledTiles.find(key);
+        if (i != scaledTiles.end())
+            return i->second;
+
+        scaled = zu4_img_create(w, h);
+        scaledTiles[key] = scaled;
+    }
+    else {
+        std::map<int, Image *>::iterator i = scaledScratch.find(scale);
+        if (i != scaledScratch.end() && i->second->w == w && i->second->h == h)
+            scaled = i->second;
+        else {
+            if (i != scaledScratch.end())
+                zu4_img_free(i->second);
+            scaled = zu4_img_create(w, h);
+            scaledScratch[scale] = scaled;
+        }
+    }
+
+    drawScratchTile(tile, orientation);
+    if (scale == 1)
+        zu4_img_scaledown_on(scaled, animated, 2);
+    else
+        zu4_img_scaleup_on(scaled, animated, scale / 2);
+
+    return scaled;
+}
+
+/**
+ * Forgets all pre-scaled tiles, e.g. when the tile images are reloaded.
+ */
+void DungeonView::clearScaledTiles() {
+    for (std::map<unsigned int, Image *>::iterator i = scaledTiles.begin(); i != scaledTiles.end(); i++)
+        zu4_img_free(i->second);
+    scaledTiles.clear();
+
+    for (std::map<int, Image *>::iterator i = scaledScratch.begin(); i != scaledScratch.end(); i++)
+        zu4_img_free(i->second);
+    scaledScratch.clear();
 }
 
 int DungeonView::graphicIndex(int xoffset, int distance, Direction orientation, DungeonGraphicType type) {
@@ -209,7 +267,7 @@ void DungeonView::drawTile(Tile *tile, int x_offset, int distance, Direction ori
 	DungeonViewer.drawInDungeon(tile, x_offset, distance, orientation, tile->isTiledInDungeon());
 }
 
-std::vector<MapTile> DungeonView::getTiles(int fwd, int side) {
+TileStack DungeonView::getTiles(int fwd, int side) {
     Coords coords = c->location->coords;
 
     switch (c->saveGame->orientation) {
@@ -247,7 +305,7 @@ std::vector<MapTile> DungeonView::getTiles(int fwd, int side) {
     return c->location->tilesAt(coords2, focus);
 }
 
-DungeonGraphicType DungeonView::tilesToGraphic(const std::vector<MapTile> &tiles) {
+DungeonGraphicType DungeonView::tilesToGraphic(const TileStack &tiles) {
     MapTile tile = tiles.front();
 
     static const MapTile corridor = c->location->map->tileset->getByName("brick_floor")->getId();
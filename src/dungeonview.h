@@ -5,6 +5,8 @@
 #ifndef DUNGEONVIEW_H
 #define DUNGEONVIEW_H
 
+#include <map>
+
 #include "context.h"
 #include "dungeon.h"
 
@@ -19,8 +21,8 @@ typedef enum {
     DNGGRAPHIC_BASETILE
 } DungeonGraphicType;
 
-std::vector<MapTile> dungeonViewGetTiles(int fwd, int side);
-DungeonGraphicType dungeonViewTilesToGraphic(const std::vector<MapTile> &tiles);
+TileStack dungeonViewGetTiles(int fwd, int side);
+DungeonGraphicType dungeonViewTilesToGraphic(const TileStack &tiles);
 
 #define DungeonViewer (*DungeonView::getInstance())
 
@@ -34,6 +36,12 @@ class DungeonView : public TileView {
 private:
     DungeonView(int x, int y, int columns, int rows);
     bool screen3dDungeonViewEnabled;
+
+    Image *getScaledTile(Tile *tile, int distance, int scale, Direction orientation);
+    void drawScratchTile(Tile *tile, Direction orientation);
+
+    std::map<unsigned int, Image *> scaledTiles;    /**< pre-scaled static tiles, by tile id, distance and video type */
+    std::map<int, Image *> scaledScratch;           /**< reusable scaled images for animated tiles, by scale */
 public:
     static DungeonView * instance;
     static DungeonView * getInstance();
@@ -44,11 +52,12 @@ public:
     void drawWall(int xoffset, int distance, Direction orientation, DungeonGraphicType type);
 
     void display(Context * c, TileView *view);
-    DungeonGraphicType tilesToGraphic(const std::vector<MapTile> &tiles);
+    DungeonGraphicType tilesToGraphic(const TileStack &tiles);
 
     bool toggle3DDungeonView(){return screen3dDungeonViewEnabled=!screen3dDungeonViewEnabled;}
+    void clearScaledTiles();
 
-    std::vector<MapTile> getTiles(int fwd, int side);
+    TileStack getTiles(int fwd, int side);
 };
 
 #endif /* DUNGEONVIEW_H */
@@ -8,6 +8,8 @@
 
 #include "context.h"
 #include "error.h"
+#include "harness.h"
+#include "inputlog.h"
 #include "u4_sdl.h"
 #include "video.h"
 
@@ -140,7 +142,8 @@ TimedEventMgr::TimedEventMgr(int i) : baseInterval(i) {
             zu4_error(ZU4_LOG_ERR, "unable to init SDL: %s", SDL_GetError());
     }
 
-    id = SDL_AddTimer(i, &TimedEventMgr::callback, this);
+    /* the harness and replays supply their own ticks */
+    id = (harnessActive() || inputLogReplaying()) ? 0 : SDL_AddTimer(i, &TimedEventMgr::callback, this);
     instances++;
 }
 
@@ -193,7 +196,7 @@ void TimedEventMgr::stop() {
 }
 
 void TimedEventMgr::start() {
-    if (!id)
+    if (!id && !harnessActive() && !inputLogReplaying())
         id = SDL_AddTimer(baseInterval, &TimedEventMgr::callback, this);
 }
 
@@ -203,11 +206,11 @@ void TimedEventMgr::start() {
 EventHandler::EventHandler() : timer(eventTimerGranularity), updateScreen(NULL) {
 }
 
-static void handleKeyDownEvent(const SDL_Event &event, Controller *controller, updateScreenCallback updateScreen) {
-    int processed;
-    int key;
-
-    key = event.key.keysym.sym;
+/**
+ * Translates a key event into the key code the controllers expect.
+ */
+static int translateKey(const SDL_Event &event) {
+    int key = event.key.keysym.sym;
 
     if (event.key.keysym.mod & KMOD_ALT)
         key += U4_ALT;
@@ -229,6 +232,12 @@ static void handleKeyDownEvent(const SDL_Event &event, Controller *controller, u
 		default: break;
 	}
 
+    return key;
+}
+
+static void handleKey(int key, Controller *controller, updateScreenCallback updateScreen) {
+    int processed;
+
     /* handle the keypress */
     processed = controller->notifyKeyPressed(key);
 
@@ -248,18 +257,58 @@ static Uint32 sleepTimerCallback(Uint32 interval, void *) {
     return 0;
 }
 
+/**
+ * Handles one batch of events from the input log being replayed, in
+ * place of SDL's.  Real input is thrown away, except for quitting.
+ */
+static void replayEvents(EventHandler *handler, updateScreenCallback updateScreen, bool *wake) {
+    InputLogEvent e;
+    int key;
+
+    while ((e = inputLogNext(&key)) != INPUT_LOG_FRAME) {
+        if (e == INPUT_LOG_TICK)
+            eventHandler->getTimer()->tick();
+        else if (e == INPUT_LOG_KEY && handler)
+            handleKey(key, handler->getController(), updateScreen);
+        else if (e == INPUT_LOG_WAKE && wake)
+            *wake = true;
+    }
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT)
+            ::exit(0);
+    }
+}
+
 /**
  * Delays program execution for the specified number of milliseconds.
  * This doesn't actually stop events, but it stops the user from interacting
  * While some important event happens (e.g., getting hit by a cannon ball or a spell effect).
  */
 void EventHandler::sleep(unsigned int usec) {
+    // A headless simulation has no one to hold input back from.
+    if (harnessSimulating())
+        return;
+
     // Start a timer for the amount of time we want to sleep from user input.
     static bool stopUserInput = true; // Make this static so that all instance stop. (e.g., sleep calling sleep).
-    SDL_TimerID sleepingTimer = SDL_AddTimer(usec, sleepTimerCallback, 0);
+    // Under the harness, sleep on its simulated clock instead; a replay wakes where the log says.
+    bool simulated = harnessActive() || inputLogReplaying();
+    SDL_TimerID sleepingTimer = simulated ? 0 : SDL_AddTimer(usec, sleepTimerCallback, 0);
+    unsigned int wake = harnessTicks() + usec;
 
     stopUserInput = true;
     while (stopUserInput) {
+        if (inputLogReplaying()) {
+            bool woke = false;
+            replayEvents(NULL, NULL, &woke);
+            if (woke)
+                stopUserInput = false;
+            zu4_ogl_swap();
+            continue;
+        }
+
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
 			switch (event.type) {
@@ -271,9 +320,11 @@ void EventHandler::sleep(unsigned int usec) {
 				break;
 			case SDL_USEREVENT:
 				if (event.user.code == 0) {
+					inputLogTick();
 					eventHandler->getTimer()->tick();
 				} else if (event.user.code == 1) {
 					SDL_RemoveTimer(sleepingTimer);
+					inputLogWake();
 					stopUserInput = false;
 				}
 				break;
@@ -283,6 +334,15 @@ void EventHandler::sleep(unsigned int usec) {
 			}
 		}
 		zu4_ogl_swap();
+
+		if (harnessActive()) {
+			harnessFrame(false);
+			if (harnessTicks() >= wake) {
+				inputLogWake();
+				stopUserInput = false;
+			}
+		}
+		inputLogFrame();
     }
 }
 
@@ -291,17 +351,26 @@ void EventHandler::run() {
         (*updateScreen)();
 
     while (!ended && !controllerDone) {
+        if (inputLogReplaying()) {
+            replayEvents(this, updateScreen, NULL);
+            zu4_ogl_swap();
+            continue;
+        }
+
         SDL_Event event;
 
         while (SDL_PollEvent(&event)) {
 			switch (event.type) {
 			default:
 				break;
-			case SDL_KEYDOWN:
-				handleKeyDownEvent(event, getController(), updateScreen);
-				break;
+			case SDL_KEYDOWN: {
+				int key = translateKey(event);
+				inputLogKey(key);
+				handleKey(key, getController(), updateScreen);
+			} break;
 
 			case SDL_USEREVENT:
+				inputLogTick();
 				eventHandler->getTimer()->tick();
 				break;
 
@@ -311,6 +380,8 @@ void EventHandler::run() {
 			}
 		}
 		zu4_ogl_swap();
+		inputLogFrame();
+		harnessFrame(true);
     }
 }
 
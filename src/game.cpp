@@ -16,9 +16,11 @@
 #include "death.h"
 #include "dungeonview.h"
 #include "error.h"
+#include "harness.h"
 #include "intro.h"
 #include "item.h"
 #include "imagemgr.h"
+#include "inputlog.h"
 #include "mapmgr.h"
 #include "moongate.h"
 #include "music.h"
@@ -200,7 +202,7 @@ void GameController::init() {
     c->aura = new Aura();
     c->horseSpeed = 0;
     c->opacity = 1;
-    c->lastCommandTime = time(NULL);
+    c->lastCommandTime = inputLogTime();
     c->lastShip = NULL;
 
     /* load in the save game */
@@ -584,10 +586,12 @@ int GameController::exitToParentMap() {
  * moves, etc.
  */
 void GameController::finishTurn() {
-    c->lastCommandTime = time(NULL);
+    c->lastCommandTime = inputLogTime();
     Creature *attacker = NULL;
 
     while (1) {
+        /* each pass is a turn, even while the party sleeps */
+        harnessTurn();
 
         /* adjust food and moves */
         c->party->endTurn();
@@ -3107,7 +3111,7 @@ void gameFixupObjects(Map *map) {
 }
 
 time_t gameTimeSinceLastCommand() {
-    return time(NULL) - c->lastCommandTime;
+    return inputLogTime() - c->lastCommandTime;
 }
 
 /**
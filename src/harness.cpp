@@ -0,0 +1,354 @@
+/*
+ * harness.cpp
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <SDL.h>
+
+#include "harness.h"
+
+#include "context.h"
+#include "error.h"
+#include "event.h"
+#include "image.h"
+#include "inputlog.h"
+#include "location.h"
+#include "map.h"
+#include "miniz.h"
+#include "perf.h"
+#include "random.h"
+#include "stb_image.h"
+#include "video.h"
+
+extern int eventTimerGranularity;
+
+static bool active = false;
+static bool simulating = false;
+static std::vector<std::string> script;
+static unsigned int line = 0;
+static unsigned int waitFrames = 0;
+static unsigned int ticks = 0;
+static unsigned int frames = 0;
+static int comparisons = 0, failures = 0;
+static std::string goldenDir = ".", outputDir = ".";
+
+/* turns taken and the time spent on them, by map type, when simulating */
+static const char *mapTypeNames[] = { "world", "city", "shrine", "combat", "dungeon" };
+static unsigned int turns[Map::DUNGEON + 1];
+static uint64_t turnTime[Map::DUNGEON + 1];
+static uint64_t lastTurn = 0;
+static const Map *lastMap = NULL;
+
+/**
+ * Copies script lines to out, writing out each loop N ... end block N
+ * times.  Returns the index of the line after the block's end.
+ */
+static size_t harnessExpand(const std::vector<std::string> &lines, size_t i, std::vector<std::string> *out, bool nested) {
+    while (i < lines.size()) {
+        std::istringstream cmd(lines[i++]);
+        std::string op, arg;
+        cmd >> op >> arg;
+
+        if (op == "end") {
+            if (!nested)
+                zu4_error(ZU4_LOG_ERR, "harness: end without a loop\n");
+            return i;
+        }
+        else if (op == "loop") {
+            unsigned long n = strtoul(arg.c_str(), NULL, 0);
+            std::vector<std::string> skipped;
+            size_t next = harnessExpand(lines, i, n ? out : &skipped, true);
+
+            for (unsigned long k = 1; k < n; k++)
+                harnessExpand(lines, i, out, true);
+            i = next;
+        }
+        else
+            out->push_back(lines[i - 1]);
+    }
+
+    if (nested)
+        zu4_error(ZU4_LOG_ERR, "harness: loop without an end\n");
+    return i;
+}
+
+/**
+ * Loads a harness script and switches to the headless video backend.
+ * When simulating, audio goes to a dummy device as well, and main()
+ * mutes the mixer once it is up.  Must be called before the screen and
+ * audio are initialized.
+ */
+void harnessInit(const std::string &path, bool simulate) {
+    std::ifstream in(path.c_str());
+    if (!in)
+        zu4_error(ZU4_LOG_ERR, "Unable to open harness script %s\n", path.c_str());
+
+    std::vector<std::string> lines;
+    std::string s;
+    while (std::getline(in, s)) {
+        size_t comment = s.find('#');
+        if (comment != std::string::npos)
+            s.erase(comment);
+        if (s.find_first_not_of(" \t\r") != std::string::npos)
+            lines.push_back(s);
+    }
+    harnessExpand(lines, 0, &script, false);
+
+    active = true;
+    simulating = simulate;
+    zu4_perf_enabled = !simulate;
+    zu4_video_set_backend(VIDEO_BACKEND_HEADLESS);
+
+    if (simulate)
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+
+    // the same script should always see the same game; main() seeds
+    // again afterwards if --seed was given
+    zu4_srandom_seed(0);
+
+    // the harness supplies the timer ticks
+    eventHandler->getTimer()->stop();
+}
+
+/**
+ * Returns whether a harness script is driving the game.
+ */
+bool harnessActive() {
+    return active;
+}
+
+/**
+ * Returns whether the harness is running a headless simulation.
+ */
+bool harnessSimulating() {
+    return simulating;
+}
+
+/**
+ * Returns the simulated time in milliseconds, which advances by one
+ * timer tick every frame.
+ */
+unsigned int harnessTicks() {
+    return ticks;
+}
+
+/**
+ * Returns a copy of the screen, as shown, as opaque RGBA bytes.
+ */
+static std::vector<uint32_t> harnessScreen() {
+    std::vector<uint32_t> pixels(SCREEN_WIDTH * SCREEN_HEIGHT);
+    Image copy = { SCREEN_WIDTH, SCREEN_HEIGHT, &pixels[0] };
+
+    zu4_video_read(&copy, 0, 0, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    return pixels;
+}
+
+/**
+ * Writes the current frame to a PNG file.
+ */
+static bool harnessDump(const std::string &path) {
+    std::vector<uint32_t> pixels = harnessScreen();
+    size_t len;
+    void *png = tdefl_write_image_to_png_file_in_memory(&pixels[0], SCREEN_WIDTH, SCREEN_HEIGHT, 4, &len);
+
+    FILE *out = png ? fopen(path.c_str(), "wb") : NULL;
+    bool written = out && fwrite(png, 1, len, out) == len;
+    if (out)
+        fclose(out);
+    mz_free(png);
+
+    if (!written)
+        zu4_error(ZU4_LOG_WRN, "Unable to write frame %s\n", path.c_str());
+    return written;
+}
+
+/**
+ * Compares the current frame to a golden image, writing the frame out
+ * next to the other dumps if they differ.
+ */
+static void harnessCompare(const std::string &name) {
+    std::string golden = goldenDir + "/" + name + ".png";
+    std::vector<uint32_t> pixels = harnessScreen();
+    int w, h, differ = 0;
+
+    uint8_t *expected = stbi_load(golden.c_str(), &w, &h, NULL, STBI_rgb_alpha);
+    if (!expected) {
+        printf("harness: %s: no golden image %s\n", name.c_str(), golden.c_str());
+        differ = -1;
+    }
+    else if (w != SCREEN_WIDTH || h != SCREEN_HEIGHT) {
+        printf("harness: %s: golden image is %dx%d\n", name.c_str(), w, h);
+        differ = -1;
+    }
+    else {
+        const uint8_t *actual = (const uint8_t*)&pixels[0];
+        for (int i = 0; i < w * h; i++) {
+            if (memcmp(actual + i * 4, expected + i * 4, 3) != 0)
+                differ++;
+        }
+        if (differ)
+            printf("harness: %s: %d pixels differ\n", name.c_str(), differ);
+    }
+    stbi_image_free(expected);
+
+    comparisons++;
+    if (differ) {
+        failures++;
+        harnessDump(outputDir + "/" + name + ".png");
+    }
+}
+
+/**
+ * Prints the results of the run and exits.
+ */
+static void harnessFinish() {
+    printf("harness: %u frames, %d of %d comparisons failed\n", frames, failures, comparisons);
+
+    if (simulating) {
+        for (int i = 0; i <= Map::DUNGEON; i++) {
+            double secs = turnTime[i] / 1e9;
+            if (turns[i])
+                printf("harness: %-8s %8u turns in %7.3f s, %9.0f turns/s\n",
+                       mapTypeNames[i], turns[i], secs, secs > 0 ? turns[i] / secs : 0.0);
+        }
+    }
+    else
+        zu4_perf_report(stdout);
+    ::exit(failures ? 1 : 0);
+}
+
+/**
+ * Translates a key name from a script into a key event, returning false
+ * if the name is unknown.
+ */
+static bool harnessKey(const std::string &name, SDL_Event *event) {
+    static const struct {
+        const char *name;
+        int sym;
+    } keys[] = {
+        { "up", SDLK_UP }, { "down", SDLK_DOWN },
+        { "left", SDLK_LEFT }, { "right", SDLK_RIGHT },
+        { "enter", SDLK_RETURN }, { "escape", SDLK_ESCAPE },
+        { "space", SDLK_SPACE }, { "backspace", SDLK_BACKSPACE }
+    };
+
+    memset(event, 0, sizeof(*event));
+    event->type = SDL_KEYDOWN;
+
+    for (unsigned int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (name == keys[i].name) {
+            event->key.keysym.sym = keys[i].sym;
+            return true;
+        }
+    }
+
+    if (name.size() != 1)
+        return false;
+
+    // capitals arrive as shifted letters, as they do from the keyboard
+    if (name[0] >= 'A' && name[0] <= 'Z') {
+        event->key.keysym.sym = name[0] - 'A' + 'a';
+        event->key.keysym.mod = KMOD_SHIFT;
+    }
+    else
+        event->key.keysym.sym = (unsigned char)name[0];
+    return true;
+}
+
+/**
+ * Ends a frame: records its timing, advances the clock by a tick, and
+ * carries on with the script.  Keys are held back while the game is not
+ * accepting input, since they would otherwise be discarded.
+ */
+void harnessFrame(bool acceptInput) {
+    if (!active)
+        return;
+
+    if (!simulating)
+        zu4_perf_frame();
+    frames++;
+    ticks += eventTimerGranularity;
+
+    SDL_Event tick;
+    memset(&tick, 0, sizeof(tick));
+    tick.type = SDL_USEREVENT;
+    tick.user.code = 0;
+    tick.user.data1 = eventHandler->getTimer();
+    SDL_PushEvent(&tick);
+
+    if (waitFrames) {
+        waitFrames--;
+        return;
+    }
+
+    while (line < script.size()) {
+        std::istringstream cmd(script[line]);
+        std::string op, arg;
+        cmd >> op >> arg;
+
+        if (op == "key") {
+            SDL_Event event;
+            if (!harnessKey(arg, &event))
+                zu4_error(ZU4_LOG_ERR, "harness: unknown key '%s'\n", arg.c_str());
+            if (!acceptInput)
+                return;
+            line++;
+            SDL_PushEvent(&event);
+            return;
+        }
+
+        line++;
+        if (op == "wait") {
+            waitFrames = strtoul(arg.c_str(), NULL, 0);
+            if (waitFrames) {
+                waitFrames--;
+                return;
+            }
+        }
+        else if (op == "dump")
+            harnessDump(outputDir + "/" + arg + ".png");
+        else if (op == "compare")
+            harnessCompare(arg);
+        else if (op == "golden")
+            goldenDir = arg;
+        else if (op == "output")
+            outputDir = arg;
+        else if (op == "seed")
+            inputLogSeed(strtoul(arg.c_str(), NULL, 0));
+        else if (op == "timing")
+            zu4_perf_report(stdout);
+        else if (op == "quit")
+            break;
+        else
+            zu4_error(ZU4_LOG_ERR, "harness: unknown command '%s'\n", op.c_str());
+    }
+
+    harnessFinish();
+}
+
+/**
+ * Counts a finished turn when simulating, charging the time since the
+ * last one to the type of map it was taken on.  The first turn on a map
+ * only starts the clock, so that loading the map and setting up combat
+ * are not charged to it.
+ */
+void harnessTurn() {
+    if (!simulating)
+        return;
+
+    uint64_t now = zu4_perf_now();
+    const Map *map = c->location->map;
+
+    if (lastTurn && map == lastMap) {
+        turns[map->type]++;
+        turnTime[map->type] += now - lastTurn;
+    }
+    lastMap = map;
+    lastTurn = now;
+}
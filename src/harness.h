@@ -0,0 +1,53 @@
+/*
+ * harness.h
+ */
+
+/**
+ * @file
+ * @brief Declares the scripted regression harness
+ *
+ * The harness runs the game on the headless video backend, feeding it
+ * keystrokes from a script through the normal event queue.  Time is
+ * simulated: every frame advances the clock by one timer tick, so a
+ * script replays identically on any machine.  The random number
+ * generator starts from seed 0, unless --seed gives another.  Frames can
+ * be written out as PNG and compared against golden images, and the time
+ * spent rendering each frame is reported at the end of the run.
+ *
+ * With --headless-sim the same script drives a throughput benchmark
+ * instead: the map is not drawn, audio goes to a dummy device, sleeps
+ * return at once and nothing waits on real time, so turns run as fast
+ * as the rules and the creature AI allow.  The number of turns taken and
+ * the time spent on them is reported for each type of map.
+ *
+ * Script commands, one per line, with # starting a comment:
+ * <ul>
+ *     <li>golden DIR, output DIR: where golden images are read from and
+ *         dumped frames are written to (both default to .)</li>
+ *     <li>seed N: reseed the random number generator</li>
+ *     <li>wait N: let N frames pass</li>
+ *     <li>key K: press a key, either a single character or one of up,
+ *         down, left, right, enter, escape, space or backspace; keys
+ *         wait for the game to accept input</li>
+ *     <li>dump NAME: write the current frame to NAME.png</li>
+ *     <li>compare NAME: compare the current frame to the golden NAME.png</li>
+ *     <li>timing: print the frame timings so far</li>
+ *     <li>loop N ... end: repeat the lines in between N times</li>
+ *     <li>quit: end the run; so does the end of the script</li>
+ * </ul>
+ * The game exits with a nonzero status if any comparison failed.
+ */
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <string>
+
+void harnessInit(const std::string &script, bool simulate = false);
+bool harnessActive();
+bool harnessSimulating();
+unsigned int harnessTicks();
+void harnessFrame(bool acceptInput);
+void harnessTurn();
+
+#endif
@@ -26,12 +26,28 @@
 #include <stddef.h>
 #include <string.h>
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "image.h"
+#include "perf.h"
 #include "settings.h"
 #include "error.h"
 
 static Image *screen = NULL;
 
+// Regions of the screen changed since the last upload, and a per-block record
+// of the last write so views can tell when something drew over their cells
+static DamageRect damage[DAMAGE_RECTS_MAX];
+static int numdamage = 0;
+static uint32_t damageserial = 0;
+static uint32_t damageblocks[DAMAGE_BLOCKS_W * DAMAGE_BLOCKS_H];
+
 // Return the address of the main "screen" image
 Image* zu4_img_get_screen() { return screen; }
 
@@ -56,6 +72,8 @@ Image* zu4_img_create_screen() {
 	screen->pixels = (uint32_t*)malloc(sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
 	screen->w = SCREEN_WIDTH;
 	screen->h = SCREEN_HEIGHT;
+	zu4_img_fill(screen, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0, 0, 255);
+	zu4_img_damage_all();
 	return screen;
 }
 
@@ -72,16 +90,8 @@ Image* zu4_img_scaleup(Image *s, int scale) {
 	
 	if (scale != 1) {
 		d = zu4_img_create(s->w * scale, s->h * scale);
-		
-		for (int y = 0; y < s->h; y++) {
-			for (int x = 0; x < s->w; x++) {
-				for (int i = 0; i < scale; i++) {
-					for (int j = 0; j < scale; j++) {
-						uint32_t v = zu4_img_get_pixel(s, x, y);
-						zu4_img_set_pixel(d, x * scale + j, y * scale + i, v);
-					}
-				}
-			}
+		if (d) {
+			zu4_img_scaleup_on(d, s, scale);
 		}
 	}
 	
@@ -101,18 +111,48 @@ Image* zu4_img_scaledown(Image *s, int scale) {
 		return NULL;
 	}
 	
-	if (!d) {
-		d = zu4_img_dup(s);
+	zu4_img_scaledown_on(d, s, scale);
+	
+	return d;
+}
+
+void zu4_img_scaleup_on(Image *d, Image *s, int scale) {
+	// Scale an image up into an existing image at least scale times its size
+	if (d->w < s->w * scale || d->h < s->h * scale) {
+		return;
 	}
 	
-	for (int y = 0; y < s->h; y += scale) {
-		for (int x = 0; x < s->w; x += scale) {
-			uint32_t v = zu4_img_get_pixel(s, x, y);
-			zu4_img_set_pixel(d, x / scale, y / scale, v);
+	for (int y = 0; y < s->h; y++) {
+		uint32_t *srow = (uint32_t*)s->pixels + (y * s->w);
+		uint32_t *drow = (uint32_t*)d->pixels + (y * scale * d->w);
+		
+		for (int x = 0; x < s->w; x++) {
+			for (int j = 0; j < scale; j++) {
+				drow[(x * scale) + j] = srow[x];
+			}
+		}
+		
+		// The remaining rows of this band are the same as the first
+		for (int i = 1; i < scale; i++) {
+			memcpy(drow + (i * d->w), drow, sizeof(uint32_t) * s->w * scale);
 		}
 	}
+}
+
+void zu4_img_scaledown_on(Image *d, Image *s, int scale) {
+	// Scale an image down into an existing image at least 1/scale of its size
+	if (d->w < s->w / scale || d->h < s->h / scale) {
+		return;
+	}
 	
-	return d;
+	for (int y = 0; y < s->h / scale; y++) {
+		uint32_t *srow = (uint32_t*)s->pixels + (y * scale * s->w);
+		uint32_t *drow = (uint32_t*)d->pixels + (y * d->w);
+		
+		for (int x = 0; x < s->w / scale; x++) {
+			drow[x] = srow[x * scale];
+		}
+	}
 }
 
 void zu4_img_free(Image *image) {
@@ -141,6 +181,174 @@ void zu4_img_set_pixel(Image *d, int x, int y, uint32_t value) {
 	*((uint32_t*)(d->pixels) + (y * d->w) + x) = value;
 }
 
+void zu4_img_palette_lut(PaletteLut *lut, const uint32_t *palette, int ncolors) {
+	// Build the lookup tables for a palette of up to 256 packed pixels
+	for (int i = 0; i < 256; i++) {
+		lut->colors[i] = i < ncolors ? palette[i] : 0;
+	}
+	for (int i = 0; i < 256; i++) {
+		lut->pairs[i][0] = lut->colors[i >> 4];
+		lut->pairs[i][1] = lut->colors[i & 0xf];
+	}
+}
+
+void zu4_img_index_8bpp(uint32_t *dst, const uint8_t *src, long n, const PaletteLut *lut) {
+	// Convert n bytes of 8 bit palette indices into n pixels
+	long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		dst[i] = lut->colors[src[i]];
+		dst[i + 1] = lut->colors[src[i + 1]];
+		dst[i + 2] = lut->colors[src[i + 2]];
+		dst[i + 3] = lut->colors[src[i + 3]];
+	}
+	for (; i < n; i++) {
+		dst[i] = lut->colors[src[i]];
+	}
+}
+
+void zu4_img_index_4bpp(uint32_t *dst, const uint8_t *src, long n, const PaletteLut *lut) {
+	// Convert n bytes of 4 bit palette indices, high nibble first, into
+	// 2n pixels
+	long i = 0;
+
+#if defined(__SSSE3__)
+	// Look up each channel of sixteen colors with a byte shuffle, then
+	// interleave the channels back into pixels
+	uint8_t ch[4][16];
+	for (int c = 0; c < 16; c++) {
+		for (int k = 0; k < 4; k++) {
+			ch[k][c] = lut->colors[c] >> (k * 8);
+		}
+	}
+	const __m128i t0 = _mm_loadu_si128((const __m128i*)ch[0]);
+	const __m128i t1 = _mm_loadu_si128((const __m128i*)ch[1]);
+	const __m128i t2 = _mm_loadu_si128((const __m128i*)ch[2]);
+	const __m128i t3 = _mm_loadu_si128((const __m128i*)ch[3]);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		__m128i lo = _mm_and_si128(v, nibble);
+		__m128i idx[2] = { _mm_unpacklo_epi8(hi, lo), _mm_unpackhi_epi8(hi, lo) };
+		uint32_t *out = dst + i * 2;
+
+		for (int h = 0; h < 2; h++, out += 16) {
+			__m128i b0 = _mm_shuffle_epi8(t0, idx[h]);
+			__m128i b1 = _mm_shuffle_epi8(t1, idx[h]);
+			__m128i b2 = _mm_shuffle_epi8(t2, idx[h]);
+			__m128i b3 = _mm_shuffle_epi8(t3, idx[h]);
+			__m128i l01 = _mm_unpacklo_epi8(b0, b1), h01 = _mm_unpackhi_epi8(b0, b1);
+			__m128i l23 = _mm_unpacklo_epi8(b2, b3), h23 = _mm_unpackhi_epi8(b2, b3);
+			_mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(l01, l23));
+			_mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(l01, l23));
+			_mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi16(h01, h23));
+			_mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi16(h01, h23));
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		memcpy(dst + i * 2, lut->pairs[src[i]], sizeof(lut->pairs[0]));
+	}
+}
+
+static void zu4_img_blit_row(uint32_t *dst, const uint32_t *src, int n) {
+	// Copy a row of pixels, leaving the destination alone where the source is transparent
+	int j = 0;
+	
+#if defined(__SSE2__)
+	const __m128i amask = _mm_set1_epi32(0xff000000);
+	const __m128i zero = _mm_setzero_si128();
+	
+	for (; j + 4 <= n; j += 4) {
+		__m128i sv = _mm_loadu_si128((const __m128i*)(src + j));
+		__m128i clear = _mm_cmpeq_epi32(_mm_and_si128(sv, amask), zero);
+		int m = _mm_movemask_epi8(clear);
+		
+		if (m == 0) { // all opaque
+			_mm_storeu_si128((__m128i*)(dst + j), sv);
+		}
+		else if (m != 0xffff) { // mixed, keep the destination under transparent pixels
+			__m128i dv = _mm_loadu_si128((const __m128i*)(dst + j));
+			_mm_storeu_si128((__m128i*)(dst + j),
+				_mm_or_si128(_mm_and_si128(clear, dv), _mm_andnot_si128(clear, sv)));
+		}
+	}
+#elif defined(__ARM_NEON)
+	const uint32x4_t amask = vdupq_n_u32(0xff000000);
+	
+	for (; j + 4 <= n; j += 4) {
+		uint32x4_t sv = vld1q_u32(src + j);
+		uint32x4_t keep = vtstq_u32(sv, amask);
+		vst1q_u32(dst + j, vbslq_u32(keep, sv, vld1q_u32(dst + j)));
+	}
+#endif
+	
+	for (; j < n; j++) {
+		if (src[j] >> 24) dst[j] = src[j];
+	}
+}
+
+static void zu4_img_blit(Image *d, Image *s, int x, int y, int rx, int ry, int rw, int rh, int inv) {
+	// Draw a portion of an image onto another, clipped to both images
+	uint64_t t = zu4_perf_begin();
+	int j0 = 0, j1 = rw, i0 = 0, i1 = rh;
+	
+	// Columns outside either image are never drawn
+	if (-rx > j0) j0 = -rx;
+	if (-x > j0) j0 = -x;
+	if (s->w - rx < j1) j1 = s->w - rx;
+	if (d->w - x < j1) j1 = d->w - x;
+	
+	// Rows outside the source, then rows outside the destination
+	if (-ry > i0) i0 = -ry;
+	if (s->h - ry < i1) i1 = s->h - ry;
+	if (inv) { // destination row is y + rh - 1 - i
+		if (rh - d->h + y > i0) i0 = rh - d->h + y;
+		if (y + rh < i1) i1 = y + rh;
+	}
+	else { // destination row is y + i
+		if (-y > i0) i0 = -y;
+		if (d->h - y < i1) i1 = d->h - y;
+	}
+	
+	if (j0 >= j1 || i0 >= i1) {
+		zu4_perf_end(PERF_BLIT, t);
+		return;
+	}
+	
+	int n = j1 - j0;
+	uint32_t *dpix = (uint32_t*)d->pixels;
+	uint32_t *spix = (uint32_t*)s->pixels;
+	
+	// Copy bottom-up when moving a region down within the same image
+	int step = 1;
+	if (d == s && !inv && y > ry) {
+		int t = i0;
+		i0 = i1 - 1;
+		i1 = t - 1;
+		step = -1;
+	}
+	
+	for (int i = i0; i != i1; i += step) {
+		uint32_t *dst = dpix + ((inv ? y + rh - 1 - i : y + i) * d->w) + x + j0;
+		const uint32_t *src = spix + ((ry + i) * s->w) + rx + j0;
+		
+		if (d == s && dst > src && dst < src + n) {
+			// Overlaps to the right within a row, so copy right to left
+			for (int j = n - 1; j >= 0; j--) {
+				if (src[j] >> 24) dst[j] = src[j];
+			}
+		}
+		else {
+			zu4_img_blit_row(dst, src, n);
+		}
+	}
+	
+	zu4_perf_end(PERF_BLIT, t);
+}
+
 void zu4_img_fill(Image *d, int x, int y, int width, int height, int r, int g, int b, int a) {
 	// Create a rectangle and fill it
 	uint32_t pixel = (a & 0xff) << 24 | (b & 0xff) << 16 | (g & 0xff) << 8 | (r & 0xff);
@@ -149,6 +357,10 @@ void zu4_img_fill(Image *d, int x, int y, int width, int height, int r, int g, i
 			*((uint32_t*)d->pixels + ((y * d->w) + x) + (i * d->w) + j) = pixel;
 		}
 	}
+	
+	if (d == screen) {
+		zu4_img_damage(x, y, width, height);
+	}
 }
 
 void zu4_img_draw_on(Image *d, Image *s, int x, int y) {
@@ -157,10 +369,10 @@ void zu4_img_draw_on(Image *d, Image *s, int x, int y) {
 		d = zu4_img_get_screen();
 	}
 	
-	for (int i = 0; i < s->h; i++) {
-		for (int j = 0; j < s->w; j++) {
-			zu4_img_set_pixel(d, x + j, y + i, zu4_img_get_pixel(s, j, i));
-		}
+	zu4_img_blit(d, s, x, y, 0, 0, s->w, s->h, 0);
+	
+	if (d == screen) {
+		zu4_img_damage(x, y, s->w, s->h);
 	}
 }
 
@@ -175,10 +387,10 @@ void zu4_img_draw_subrect_on(Image *d, Image *s, int x, int y, int rx, int ry, i
 		d = zu4_img_get_screen();
 	}
 	
-	for (int i = 0; i < rh; i++) {
-		for (int j = 0; j < rw; j++) {
-			zu4_img_set_pixel(d, x + j, y + i, zu4_img_get_pixel(s, rx + j, ry + i));
-		}
+	zu4_img_blit(d, s, x, y, rx, ry, rw, rh, 0);
+	
+	if (d == screen) {
+		zu4_img_damage(x, y, rw, rh);
 	}
 }
 
@@ -193,10 +405,10 @@ void zu4_img_draw_subrect_inv(Image *d, Image *s, int x, int y, int rx, int ry,
 		d = zu4_img_get_screen();
 	}
 	
-	for (int i = 0; i < rh; i++) {
-		for (int j = 0; j < rw; j++) {
-			zu4_img_set_pixel(d, x + j, y + rh - 1 - i, zu4_img_get_pixel(s, rx + j, ry + i));
-		}
+	zu4_img_blit(d, s, x, y, rx, ry, rw, rh, 1);
+	
+	if (d == screen) {
+		zu4_img_damage(x, y, rw, rh);
 	}
 }
 
@@ -215,4 +427,99 @@ void zu4_img_draw_highlighted(Image *d) {
 			zu4_img_set_pixel(d, j, i, pixel);
 		}
 	}
+	
+	if (d == screen) {
+		zu4_img_damage(0, 0, d->w, d->h);
+	}
+}
+
+void zu4_img_damage(int x, int y, int w, int h) {
+	// Record a changed region of the screen
+	if (x < 0) { w += x; x = 0; }
+	if (y < 0) { h += y; y = 0; }
+	if (x + w > SCREEN_WIDTH) { w = SCREEN_WIDTH - x; }
+	if (y + h > SCREEN_HEIGHT) { h = SCREEN_HEIGHT - y; }
+	if (w <= 0 || h <= 0) return;
+	
+	// Stamp every block the region touches with a new serial
+	damageserial++;
+	for (int by = y / DAMAGE_BLOCK; by <= (y + h - 1) / DAMAGE_BLOCK; by++) {
+		for (int bx = x / DAMAGE_BLOCK; bx <= (x + w - 1) / DAMAGE_BLOCK; bx++) {
+			damageblocks[(by * DAMAGE_BLOCKS_W) + bx] = damageserial;
+		}
+	}
+	
+	// Grow an overlapping or adjacent rectangle if there is one
+	for (int i = 0; i < numdamage; i++) {
+		DamageRect *r = &damage[i];
+		if (x <= r->x + r->w && r->x <= x + w && y <= r->y + r->h && r->y <= y + h) {
+			int x2 = (x + w > r->x + r->w) ? x + w : r->x + r->w;
+			int y2 = (y + h > r->y + r->h) ? y + h : r->y + r->h;
+			r->x = (x < r->x) ? x : r->x;
+			r->y = (y < r->y) ? y : r->y;
+			r->w = x2 - r->x;
+			r->h = y2 - r->y;
+			return;
+		}
+	}
+	
+	if (numdamage < DAMAGE_RECTS_MAX) {
+		damage[numdamage].x = x;
+		damage[numdamage].y = y;
+		damage[numdamage].w = w;
+		damage[numdamage].h = h;
+		numdamage++;
+		return;
+	}
+	
+	// Out of rectangles, so collapse everything into one bounding rectangle
+	int x1 = x, y1 = y, x2 = x + w, y2 = y + h;
+	for (int i = 0; i < numdamage; i++) {
+		if (damage[i].x < x1) x1 = damage[i].x;
+		if (damage[i].y < y1) y1 = damage[i].y;
+		if (damage[i].x + damage[i].w > x2) x2 = damage[i].x + damage[i].w;
+		if (damage[i].y + damage[i].h > y2) y2 = damage[i].y + damage[i].h;
+	}
+	damage[0].x = x1;
+	damage[0].y = y1;
+	damage[0].w = x2 - x1;
+	damage[0].h = y2 - y1;
+	numdamage = 1;
+}
+
+void zu4_img_damage_all() {
+	// Mark the entire screen as changed
+	zu4_img_damage(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+int zu4_img_damage_get(DamageRect **rects) {
+	// Get the regions of the screen changed since the damage was last cleared
+	*rects = damage;
+	return numdamage;
+}
+
+void zu4_img_damage_clear() {
+	// Forget about changed regions once they have been presented
+	numdamage = 0;
+}
+
+uint32_t zu4_img_damage_serial(int x, int y, int w, int h) {
+	// Get the serial of the most recent write touching a region of the screen
+	uint32_t serial = 0;
+	
+	if (x < 0) { w += x; x = 0; }
+	if (y < 0) { h += y; y = 0; }
+	if (x + w > SCREEN_WIDTH) { w = SCREEN_WIDTH - x; }
+	if (y + h > SCREEN_HEIGHT) { h = SCREEN_HEIGHT - y; }
+	if (w <= 0 || h <= 0) return 0;
+	
+	for (int by = y / DAMAGE_BLOCK; by <= (y + h - 1) / DAMAGE_BLOCK; by++) {
+		for (int bx = x / DAMAGE_BLOCK; bx <= (x + w - 1) / DAMAGE_BLOCK; bx++) {
+			if (damageblocks[(by * DAMAGE_BLOCKS_W) + bx] > serial) {
+				serial = damageblocks[(by * DAMAGE_BLOCKS_W) + bx];
+			}
+		}
+	}
+	
+	return serial;
 }
@@ -10,6 +10,12 @@ extern "C" {
 #define SCREEN_WIDTH 320
 #define SCREEN_HEIGHT 200
 
+/* damage is tracked per 8x8 block of the screen */
+#define DAMAGE_BLOCK 8
+#define DAMAGE_BLOCKS_W (SCREEN_WIDTH / DAMAGE_BLOCK)
+#define DAMAGE_BLOCKS_H (SCREEN_HEIGHT / DAMAGE_BLOCK)
+#define DAMAGE_RECTS_MAX 16
+
 typedef struct RGBA {
     uint8_t r, g, b, a;
 } RGBA;
@@ -20,11 +26,21 @@ typedef struct SubImage {
     int x, y, width, height;
 } SubImage;
 
+typedef struct DamageRect {
+    int x, y, w, h;
+} DamageRect;
+
 typedef struct Image {
     int w, h;
     void *pixels;
 } Image;
 
+/* packed pixels for each palette index, and for each byte of two 4 bit indices */
+typedef struct PaletteLut {
+    uint32_t colors[256];
+    uint32_t pairs[256][2];
+} PaletteLut;
+
 Image* zu4_img_get_screen();
 
 Image* zu4_img_create(int w, int h);
@@ -33,6 +49,8 @@ Image* zu4_img_dup(Image *image);
 
 Image* zu4_img_scaleup(Image *s, int scale);
 Image* zu4_img_scaledown(Image *s, int scale);
+void zu4_img_scaleup_on(Image *d, Image *s, int scale);
+void zu4_img_scaledown_on(Image *d, Image *s, int scale);
 
 void zu4_img_free(Image *image);
 
@@ -47,6 +65,16 @@ void zu4_img_draw_subrect(Image *s, int x, int y, int rx, int ry, int rw, int rh
 void zu4_img_draw_subrect_inv(Image *d, Image *s, int x, int y, int rx, int ry, int rw, int rh);
 void zu4_img_draw_highlighted(Image *d);
 
+void zu4_img_palette_lut(PaletteLut *lut, const uint32_t *palette, int ncolors);
+void zu4_img_index_8bpp(uint32_t *dst, const uint8_t *src, long n, const PaletteLut *lut);
+void zu4_img_index_4bpp(uint32_t *dst, const uint8_t *src, long n, const PaletteLut *lut);
+
+void zu4_img_damage(int x, int y, int w, int h);
+void zu4_img_damage_all();
+int zu4_img_damage_get(DamageRect **rects);
+void zu4_img_damage_clear();
+uint32_t zu4_img_damage_serial(int x, int y, int w, int h);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,8 +21,10 @@
  *
  */
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -31,9 +33,11 @@
 #include "image.h"
 #include "imageloader.h"
 #include "rle.h"
-#include "lzw/u4decode.h"
+#include "lzw/lzw.h"
 
 static RGBA *vgaPalette = NULL;
+static PaletteLut egaLut, vgaLut;
+static bool egaLutBuilt = false;
 
 // Load the 256 color VGA palette from a file.
 static RGBA* loadVgaPalette() {
@@ -50,82 +54,49 @@ static RGBA* loadVgaPalette() {
 		}
 		u4fclose(pal);
 
+		uint32_t packed[256];
+		for (int i = 0; i < 256; i++) {
+			packed[i] = 0xff000000 | vgaPalette[i].b << 16 | vgaPalette[i].g << 8 | vgaPalette[i].r;
+		}
+		zu4_img_palette_lut(&vgaLut, packed, 256);
 	}
 	return vgaPalette;
 }
 
-static void zu4_u4raw_ega_conv(int w, int h, uint8_t *in, uint32_t *out, bool paletteswap) {
+static void loadEgaPalette() {
 	// http://upload.wikimedia.org/wikipedia/commons/d/df/EGA_Table.PNG
-	uint32_t palette_rgba[16] = {
-		0x000000ff, 0x0000aaff, 0x00aa00ff, 0x00aaaaff,
-		0xaa0000ff, 0xaa00aaff, 0xaa5500ff, 0xaaaaaaff,
-		0x555555ff, 0x5555ffff, 0x55ff55ff, 0x55ffffff,
-		0xff5555ff, 0xff55ffff, 0xffff55ff, 0xffffffff,
-	};
-
-	uint32_t palette_abgr[16] = {
+	const uint32_t palette_abgr[16] = {
 		0xff000000, 0xffaa0000, 0xff00aa00, 0xffaaaa00,
 		0xff0000aa, 0xffaa00aa, 0xff0055aa, 0xffaaaaaa,
 		0xff555555, 0xffff5555, 0xff55ff55, 0xffffff55,
 		0xff5555ff, 0xffff55ff, 0xff55ffff, 0xffffffff,
 	};
 
-	uint32_t *palette = paletteswap ? palette_abgr : palette_rgba;
-
-	for (int i = 0; i < (w * h) / 2; i++) {
-		out[i * 2] = palette[(in[i] >> 4) & 0xf];
-		out[(i * 2) + 1] = palette[in[i] & 0xf];
+	if (!egaLutBuilt) {
+		zu4_img_palette_lut(&egaLut, palette_abgr, 16);
+		egaLutBuilt = true;
 	}
 }
 
-static void zu4_u4raw_vga_conv(int w, int h, uint8_t *in, uint32_t *out, bool paletteswap) {
-	RGBA *pp = loadVgaPalette();
-	if (paletteswap) { // ABGR
-		for (int i = 0; i < (w * h); i++) {
-			out[i] = 0xff000000 | pp[in[i] & 0xff].b << 16 |pp[in[i] & 0xff].g << 8 | pp[in[i] & 0xff].r;
-		}
-	}
-	else { // RGBA
-		for (int i = 0; i < (w * h); i++) {
-			out[i] =  pp[in[i] & 0xff].r << 24 |pp[in[i] & 0xff].g << 16 | pp[in[i] & 0xff].b << 8 | 0xff;
-		}
+const PaletteLut *zu4_img_palette(int bpp) {
+	// Return the lookup tables images of the given depth are converted with
+	if (bpp == 8) {
+		loadVgaPalette();
+		return &vgaLut;
 	}
+	loadEgaPalette();
+	return &egaLut;
 }
 
-Image* zu4_img_load(U4FILE *file, int width, int height, int bpp, int type) {
-	if (width == -1 || height == -1 || bpp == -1) {
-		  zu4_error(ZU4_LOG_ERR, "dimensions not set for image");
-	}
-
-	zu4_assert(bpp == 4 || bpp == 8, "invalid bpp: %d", bpp);
-
-	uint8_t *raw = NULL;
-	uint8_t *compressed = NULL;
-	uint32_t *converted = (uint32_t*)malloc(width * height * sizeof(uint32_t));
-
-	long rawLen = 0;
-	long compressedLen;
-
-	if (type == ZU4_IMG_RAW) {
-		rawLen = u4flength(file);
-		raw = (uint8_t*)malloc(rawLen);
-		u4fread(file, raw, 1, rawLen);
-	}
-	else if (type == ZU4_IMG_RLE) {
-		compressedLen = u4flength(file);
-		compressed = (uint8_t*)malloc(compressedLen);
-		u4fread(file, compressed, 1, compressedLen);
-		rawLen = rleDecompressMemory(compressed, compressedLen, (void **) &raw);
-		free(compressed);
-	}
-	else if (type == ZU4_IMG_LZW) {
-		compressedLen = u4flength(file);
-		compressed = (uint8_t*)malloc(compressedLen);
-		u4fread(file, compressed, 1, compressedLen);
-		rawLen = decompress_u4_memory(compressed, compressedLen, (void **) &raw);
-		free(compressed);
-	}
+void zu4_img_palette_load() {
+	// Build the palette tables up front, so images can be decoded off the
+	// main thread
+	loadEgaPalette();
+	loadVgaPalette();
+}
 
+static Image* zu4_img_convert(uint8_t *raw, long rawLen, int width, int height, int bpp) {
+	// Convert decompressed pixel data into an image, freeing the data
 	if (rawLen != (width * height * bpp / 8)) {
 		if (raw) { free(raw); }
 		return NULL;
@@ -133,28 +104,64 @@ Image* zu4_img_load(U4FILE *file, int width, int height, int bpp, int type) {
 
 	Image *image = zu4_img_create(width, height);
 	if (!image) {
-		if (raw) { free(raw); }
-		if (converted) { free(converted); }
+		free(raw);
 		return NULL;
 	}
 
 	if (bpp == 8) { // VGA
-		zu4_u4raw_vga_conv(width, height, raw, converted, true);
-		memcpy((uint32_t*)image->pixels, converted, sizeof(uint32_t) * width * height);
+		loadVgaPalette();
+		zu4_img_index_8bpp((uint32_t*)image->pixels, raw, rawLen, &vgaLut);
 	}
 	else if (bpp == 4) { // EGA
-		zu4_u4raw_ega_conv(width, height, raw, converted, true);
-		memcpy((uint32_t*)image->pixels, converted, sizeof(uint32_t) * width * height);
+		loadEgaPalette();
+		zu4_img_index_4bpp((uint32_t*)image->pixels, raw, rawLen, &egaLut);
 	}
 
 	free(raw);
-	free(converted);
 
 	return image;
 }
 
-Image* zu4_png_load(const char *filename, int *x, int *y) {
-	uint8_t *pixels = stbi_load(filename, x, y, NULL, STBI_rgb_alpha);
+static void zu4_img_check(int width, int height, int bpp) {
+	// Make sure the image has a size that can be decoded
+	if (width == -1 || height == -1 || bpp == -1) {
+		  zu4_error(ZU4_LOG_ERR, "dimensions not set for image");
+	}
+
+	zu4_assert(bpp == 4 || bpp == 8, "invalid bpp: %d", bpp);
+}
+
+Image* zu4_img_decode(const uint8_t *data, long len, int width, int height, int bpp, int type) {
+	// Decode an image from the raw contents of its file
+	zu4_img_check(width, height, bpp);
+
+	uint8_t *raw = NULL;
+	long rawLen = 0;
+
+	if (type == ZU4_IMG_RAW) {
+		rawLen = len;
+		raw = (uint8_t*)malloc(rawLen);
+		memcpy(raw, data, rawLen);
+	}
+	else if (type == ZU4_IMG_RLE) {
+		rawLen = rleDecompressMemory((void*)data, len, (void **) &raw);
+	}
+	else if (type == ZU4_IMG_LZW) {
+		// The image's size is known, so the stream's output never has to
+		// grow and the data is decoded in one pass
+		LzwStream *s = lzwStreamCreate(width * height * bpp / 8);
+		if (!s) { return NULL; }
+		lzwStreamWrite(s, data, len);
+		rawLen = lzwStreamFinish(s, &raw);
+	}
+
+	return zu4_img_convert(raw, rawLen, width, height, bpp);
+}
+
+Image* zu4_png_decode(const uint8_t *data, long len, int *x, int *y) {
+	// Decode a PNG image from the contents of its file
+	uint8_t *pixels = stbi_load_from_memory(data, len, x, y, NULL, STBI_rgb_alpha);
+	if (!pixels) { return NULL; }
 	Image *image = zu4_img_create(*x, *y);
 	memcpy((uint32_t*)image->pixels, (uint32_t*)pixels, sizeof(uint32_t) * *x * *y);
 	stbi_image_free(pixels);
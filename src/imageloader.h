@@ -20,9 +20,12 @@ enum ImageType {
  * charset.ega).  This loader handles the original 4-bit images, as
  * well as the 8-bit VGA upgrade images. This handles RLE and LZW as well.
  */
-Image* zu4_img_load(U4FILE *file, int width, int height, int bpp, int type);
+void zu4_img_palette_load();
+const PaletteLut *zu4_img_palette(int bpp);
 
-Image* zu4_png_load(const char *filename, int *x, int *y);
+Image* zu4_img_decode(const uint8_t *data, long len, int width, int height, int bpp, int type);
+
+Image* zu4_png_decode(const uint8_t *data, long len, int *x, int *y);
 
 #ifdef __cplusplus
 }
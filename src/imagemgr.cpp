@@ -4,6 +4,9 @@
 
 #include <vector>
 
+#include <SDL.h>
+
+#include "assetcache.h"
 #include "config.h"
 #include "error.h"
 #include "image.h"
@@ -26,6 +29,37 @@ public:
     std::map<std::string, ImageInfo *> info;
 };
 
+/**
+ * An image queued to be decoded in the background.  The worker that
+ * decodes it sets ready last, publishing everything else, so the main
+ * thread can take a finished image without locking.
+ */
+struct ImagePreload {
+    ImageInfo *info;
+    int type;
+    int width, height, depth;
+    ImageFixup fixup;
+    uint8_t *data;              /**< the contents of the image file */
+    long len;
+    uint64_t key;               /**< where the decoded image goes in the disk cache */
+    Image *image;               /**< the decoded image, or NULL if it failed */
+    SDL_atomic_t ready;
+};
+
+/**
+ * The images being decoded in the background.  The queue is filled before
+ * the workers start and never changes after; workers take the next job by
+ * bumping a shared counter.
+ */
+struct ImagePreloader {
+    std::vector<ImagePreload *> queue;
+    std::map<const ImageInfo *, ImagePreload *> jobs;
+    SDL_atomic_t next;
+    std::vector<SDL_Thread *> threads;
+    SDL_mutex *lock;            /**< only used to sleep on done */
+    SDL_cond *done;
+};
+
 ImageMgr *ImageMgr::instance = NULL;
 
 ImageMgr *ImageMgr::getInstance() {
@@ -43,13 +77,30 @@ void ImageMgr::destroy() {
     }
 }
 
-ImageMgr::ImageMgr() {
+ImageMgr::ImageMgr() : preloader(NULL) {
     zu4_error(ZU4_LOG_DBG, "Creating ImageMgr");
     //settings.addObserver(this);
 }
 
 ImageMgr::~ImageMgr() {
     //settings.deleteObserver(this);
+    if (preloader) {
+        // let the workers finish what they're decoding, but start nothing new
+        SDL_AtomicSet(&preloader->next, preloader->queue.size());
+        for (unsigned int i = 0; i < preloader->threads.size(); i++)
+            SDL_WaitThread(preloader->threads[i], NULL);
+
+        for (std::map<const ImageInfo *, ImagePreload *>::iterator i = preloader->jobs.begin(); i != preloader->jobs.end(); i++) {
+            if (i->second->image)
+                zu4_img_free(i->second->image);
+            free(i->second->data);
+            delete i->second;
+        }
+        SDL_DestroyCond(preloader->done);
+        SDL_DestroyMutex(preloader->lock);
+        delete preloader;
+    }
+
     for (std::map<std::string, ImageSet *>::iterator i = imageSets.begin(); i != imageSets.end(); i++)
         delete i->second;
 }
@@ -378,8 +429,7 @@ bool ImageMgr::imageExists(ImageInfo * info)
 	U4FILE * file = getImageFile(info);
 	if (file)
 	{
-		if (info->xu4Graphic) zu4_file_stdio_close(file);
-		else u4fclose(file);
+		u4fclose(file);
 		return true;
 	}
 	return false;
@@ -421,6 +471,209 @@ U4FILE * ImageMgr::getImageFile(ImageInfo *info)
     return file;
 }
 
+/**
+ * Returns the loader type for an image, or -1 if there is none.
+ */
+int ImageMgr::getImageType(ImageInfo *info) {
+    if (info->filetype.empty())
+        info->filetype = guessFileType(info->filename);
+
+    const std::string &filetype = info->filetype;
+    if (filetype == "image/png") { return ZU4_IMG_PNG; }
+    else if (filetype == "image/x-u4raw") { return ZU4_IMG_RAW; }
+    else if (filetype == "image/x-u4rle") { return ZU4_IMG_RLE; }
+    else if (filetype == "image/x-u4lzw") { return ZU4_IMG_LZW; }
+
+    zu4_error(ZU4_LOG_WRN, "can't find loader to load image \"%s\" with type \"%s\"", info->filename.c_str(), filetype.c_str());
+    return -1;
+}
+
+/**
+ * Reads the whole of an image's file into memory, returning NULL if it
+ * can't be opened.
+ */
+uint8_t *ImageMgr::readImageFile(ImageInfo *info, long *len) {
+    U4FILE *file = getImageFile(info);
+    if (!file) {
+        zu4_error(ZU4_LOG_WRN, "Failed to open file %s for reading.", info->filename.c_str());
+        return NULL;
+    }
+
+    *len = u4flength(file);
+    uint8_t *data = (uint8_t *)malloc(*len > 0 ? *len : 1);
+    *len = u4fread(file, data, 1, *len);
+
+    u4fclose(file);
+    return data;
+}
+
+/**
+ * Decodes an image from the contents of its file.  This touches nothing
+ * but its arguments, so it is safe to call from the preload workers.
+ */
+Image *ImageMgr::decode(int type, const uint8_t *data, long len, int *width, int *height, int depth) {
+    switch (type) {
+    case ZU4_IMG_RAW: case ZU4_IMG_RLE: case ZU4_IMG_LZW:
+        return zu4_img_decode(data, len, *width, *height, depth, type);
+    case ZU4_IMG_PNG:
+        return zu4_png_decode(data, len, width, height);
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * Returns the disk cache key for an image: a hash of its file and of
+ * everything else its decoded pixels depend on.  Intro and abyss fixups
+ * need other images, so they are applied after the cache.
+ */
+uint64_t ImageMgr::cacheKey(ImageInfo *info, int type, const uint8_t *data, long len) {
+    int32_t params[5] = { type, info->depth, info->width, info->height, info->fixup == FIXUP_DUNGNS };
+
+    uint64_t key = zu4_cache_hash(0, data, len);
+    key = zu4_cache_hash(key, info->filename.c_str(), info->filename.size());
+    key = zu4_cache_hash(key, params, sizeof(params));
+    if (type != ZU4_IMG_PNG) {
+        const PaletteLut *lut = zu4_img_palette(info->depth);
+        key = zu4_cache_hash(key, lut->colors, sizeof(lut->colors));
+    }
+    return key;
+}
+
+/**
+ * Starts decoding the images of the current image set in the background,
+ * leaving out those only used by the intro unless it is going to be
+ * shown.  Images that need the intro or other images to fix them up are
+ * decoded early too, and fixed up when they are first asked for.
+ */
+void ImageMgr::preload(bool intro) {
+    if (preloader)
+        return;
+
+    preloader = new ImagePreloader;
+    SDL_AtomicSet(&preloader->next, 0);
+    preloader->lock = SDL_CreateMutex();
+    preloader->done = SDL_CreateCond();
+
+    // the workers can't load the palettes themselves
+    zu4_img_palette_load();
+
+    for (ImageSet *set = baseSet; set != NULL; set = getSet(set->extends)) {
+        for (std::map<std::string, ImageInfo *>::iterator i = set->info.begin(); i != set->info.end(); i++) {
+            ImageInfo *info = getInfo(i->first);
+            if (!info || info->image || info->filename.empty() || (info->introOnly && !intro))
+                continue;
+            if (preloader->jobs.find(info) != preloader->jobs.end())
+                continue;
+
+            int type = getImageType(info);
+            long len;
+            uint8_t *data = type >= 0 ? readImageFile(info, &len) : NULL;
+            if (!data)
+                continue;
+
+            ImagePreload *job = new ImagePreload;
+            job->info = info;
+            job->type = type;
+            job->width = info->width;
+            job->height = info->height;
+            job->depth = info->depth;
+            job->fixup = info->fixup;
+            job->data = data;
+            job->len = len;
+            job->key = cacheKey(info, type, data, len);
+            job->image = zu4_cache_load(job->key);
+            SDL_AtomicSet(&job->ready, job->image != NULL);
+
+            // images already in the cache need no decoding
+            if (job->image) {
+                job->width = job->image->w;
+                job->height = job->image->h;
+            }
+            else
+                preloader->queue.push_back(job);
+            preloader->jobs[info] = job;
+        }
+    }
+
+    int workers = SDL_GetCPUCount() - 1;
+    if (workers < 1)
+        workers = 1;
+    if (workers > 4)
+        workers = 4;
+
+    for (int i = 0; i < workers; i++) {
+        SDL_Thread *thread = SDL_CreateThread(&ImageMgr::preloadWorker, "preload", preloader);
+        if (thread)
+            preloader->threads.push_back(thread);
+    }
+
+    // with no workers at all, everything is decoded on demand
+    if (preloader->threads.empty())
+        SDL_AtomicSet(&preloader->next, preloader->queue.size());
+}
+
+/**
+ * Decodes queued images until there are none left.
+ */
+int ImageMgr::preloadWorker(void *data) {
+    ImagePreloader *preloader = (ImagePreloader *)data;
+
+    for (;;) {
+        int n = SDL_AtomicAdd(&preloader->next, 1);
+        if (n >= (int)preloader->queue.size())
+            return 0;
+
+        ImagePreload *job = preloader->queue[n];
+        job->image = decode(job->type, job->data, job->len, &job->width, &job->height, job->depth);
+        if (job->image && job->fixup == FIXUP_DUNGNS)
+            fixupDungNS(job->image);
+        zu4_cache_store(job->key, job->image);
+
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&job->ready, 1);
+
+        SDL_LockMutex(preloader->lock);
+        SDL_CondBroadcast(preloader->done);
+        SDL_UnlockMutex(preloader->lock);
+    }
+}
+
+/**
+ * Takes an image from the preloader, waiting for it if it is still being
+ * decoded.  Returns false if the image was never queued, or was queued
+ * but no worker got to it, in which case it's loaded as usual.
+ */
+bool ImageMgr::takePreloaded(ImageInfo *info, Image **image) {
+    if (!preloader)
+        return false;
+
+    std::map<const ImageInfo *, ImagePreload *>::iterator i = preloader->jobs.find(info);
+    if (i == preloader->jobs.end())
+        return false;
+
+    ImagePreload *job = i->second;
+    if (!SDL_AtomicGet(&job->ready)) {
+        if (preloader->threads.empty())
+            return false;
+
+        SDL_LockMutex(preloader->lock);
+        while (!SDL_AtomicGet(&job->ready))
+            SDL_CondWait(preloader->done, preloader->lock);
+        SDL_UnlockMutex(preloader->lock);
+    }
+    SDL_MemoryBarrierAcquire();
+
+    *image = job->image;
+    info->width = job->width;
+    info->height = job->height;
+
+    preloader->jobs.erase(i);
+    free(job->data);
+    delete job;
+    return true;
+}
+
 /**
  * Load in a background image from a ".ega" file.
  */
@@ -433,49 +686,30 @@ ImageInfo *ImageMgr::get(const std::string &name, bool returnUnscaled) {
     if (info->image != NULL)
         return info;
 
-    U4FILE *file = getImageFile(info);
     Image *unscaled = NULL;
-    if (file) {
-        //zu4_error(ZU4_LOG_DBG, "Loading image from file: %s", info->filename.c_str());
-
-        if (info->filetype.empty()) {
-            info->filetype = guessFileType(info->filename);
-		}
+    bool preloaded = takePreloaded(info, &unscaled);
 
-        std::string filetype = info->filetype;
-        int imgtype = 0;
-
-        if (filetype == "image/png") { imgtype = ZU4_IMG_PNG; }
-        else if (filetype == "image/x-u4raw") { imgtype = ZU4_IMG_RAW; }
-        else if (filetype == "image/x-u4rle") { imgtype = ZU4_IMG_RLE; }
-        else if (filetype == "image/x-u4lzw") { imgtype = ZU4_IMG_LZW; }
+    if (!preloaded) {
+        //zu4_error(ZU4_LOG_DBG, "Loading image from file: %s", info->filename.c_str());
+        int type = getImageType(info);
+        long len;
+        uint8_t *data = readImageFile(info, &len);
+        if (!data)
+            return NULL;
+
+        uint64_t key = cacheKey(info, type, data, len);
+        unscaled = zu4_cache_load(key);
+        if (unscaled) {
+            info->width = unscaled->w;
+            info->height = unscaled->h;
+        }
         else {
-			zu4_error(ZU4_LOG_WRN, "can't find loader to load image \"%s\" with type \"%s\"", info->filename.c_str(), filetype.c_str());
-		}
-
-		switch(imgtype) {
-			case ZU4_IMG_RAW: case ZU4_IMG_RLE: case ZU4_IMG_LZW:
-				unscaled = zu4_img_load(file, info->width, info->height, info->depth, imgtype);
-				if (info->width == -1) {
-					info->width = unscaled->w;
-					info->height = unscaled->h;
-				}
-				break;
-
-			case ZU4_IMG_PNG:
-				char imgpath[64];
-				u4find_graphics(imgpath, sizeof(imgpath), info->filename.c_str());
-				unscaled = zu4_png_load(imgpath, &info->width, &info->height);
-				break;
-			default: break;
-		}
-        if (info->xu4Graphic) zu4_file_stdio_close(file);
-		else u4fclose(file);
-    }
-    else
-    {
-        zu4_error(ZU4_LOG_WRN, "Failed to open file %s for reading.", info->filename.c_str());
-        return NULL;
+            unscaled = decode(type, data, len, &info->width, &info->height, info->depth);
+            if (unscaled && info->fixup == FIXUP_DUNGNS)
+                fixupDungNS(unscaled);
+            zu4_cache_store(key, unscaled);
+        }
+        free(data);
     }
 
     if (unscaled == NULL)
@@ -494,7 +728,7 @@ ImageInfo *ImageMgr::get(const std::string &name, bool returnUnscaled) {
         fixupAbyssVision(unscaled);
         break;
     case FIXUP_DUNGNS:
-        fixupDungNS(unscaled);
+        /* already done when the image was decoded */
         break;
     }
 
@@ -528,6 +762,19 @@ SubImage *ImageMgr::getSubImage(const std::string &name) {
  * Free up any background images used only in the animations.
  */
 void ImageMgr::freeIntroBackgrounds() {
+    if (preloader) {
+        std::vector<ImageInfo *> unused;
+        for (std::map<const ImageInfo *, ImagePreload *>::iterator i = preloader->jobs.begin(); i != preloader->jobs.end(); i++) {
+            if (i->second->info->introOnly)
+                unused.push_back(i->second->info);
+        }
+        for (unsigned int i = 0; i < unused.size(); i++) {
+            Image *image = NULL;
+            if (takePreloaded(unused[i], &image) && image)
+                zu4_img_free(image);
+        }
+    }
+
     for (std::map<std::string, ImageSet *>::iterator i = imageSets.begin(); i != imageSets.end(); i++) {
         ImageSet *set = i->second;
         for (std::map<std::string, ImageInfo *>::iterator j = set->info.begin(); j != set->info.end(); j++) {
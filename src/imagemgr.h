@@ -14,6 +14,7 @@
 #include "u4file.h"
 
 struct ConfigElement;
+struct ImagePreloader;
 struct ImageSet;
 struct Settings;
 
@@ -100,6 +101,7 @@ public:
     static ImageMgr *getInstance();
     static void destroy();
 
+    void preload(bool intro);
     ImageInfo *get(const std::string &name, bool returnUnscaled=false);
     SubImage *getSubImage(const std::string &name);
     void freeIntroBackgrounds();
@@ -121,10 +123,16 @@ private:
     ImageInfo *getInfoFromSet(const std::string &name, ImageSet *set);
 
     std::string guessFileType(const std::string &filename);
+    int getImageType(ImageInfo *info);
+    uint8_t *readImageFile(ImageInfo *info, long *len);
+    static Image *decode(int type, const uint8_t *data, long len, int *width, int *height, int depth);
+    uint64_t cacheKey(ImageInfo *info, int type, const uint8_t *data, long len);
+    bool takePreloaded(ImageInfo *info, Image **image);
+    static int preloadWorker(void *data);
 
     void fixupIntro(Image *im);
     void fixupAbyssVision(Image *im);
-    void fixupDungNS(Image *im);
+    static void fixupDungNS(Image *im);
 
     void update(SettingsData *newSettings);
 
@@ -132,6 +140,7 @@ private:
     std::map<std::string, ImageSet *> imageSets;
     std::vector<std::string> imageSetNames;
     ImageSet *baseSet;
+    ImagePreloader *preloader;
 };
 
 #define imageMgr (ImageMgr::getInstance())
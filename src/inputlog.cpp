@@ -0,0 +1,339 @@
+/*
+ * inputlog.cpp
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <SDL.h>
+
+#include "inputlog.h"
+
+#include "assetcache.h"
+#include "context.h"
+#include "error.h"
+#include "event.h"
+#include "harness.h"
+#include "location.h"
+#include "map.h"
+#include "object.h"
+#include "random.h"
+
+extern int eventTimerGranularity;
+
+enum InputLogMode {
+    INPUT_LOG_OFF,
+    INPUT_LOG_RECORDING,
+    INPUT_LOG_REPLAYING
+};
+
+struct InputLogEntry {
+    InputLogEvent event;
+    int key;                /* or the seed, for INPUT_LOG_SEED */
+    uint64_t digest;
+};
+
+static InputLogMode mode = INPUT_LOG_OFF;
+static unsigned int ticks = 0;      /* simulated time in milliseconds */
+static unsigned int tickCount = 0, keyCount = 0;
+
+/* recording */
+static FILE *out = NULL;
+static std::vector<InputLogEntry> batch;
+static unsigned int pendingTicks = 0;
+
+/* replaying */
+static std::vector<std::string> lines;
+static unsigned int line = 0;
+static std::vector<InputLogEntry> entries;
+static unsigned int entry = 0, repeat = 0;
+static unsigned int mismatches = 0;
+static Uint32 replayStart;
+
+/**
+ * Returns a digest of the game state that the input acts on: the saved
+ * game, where the party is, and the objects on the current map.
+ */
+static uint64_t inputLogDigest() {
+    uint64_t hash = 0;
+
+    if (!c)
+        return hash;
+    if (c->saveGame)
+        hash = zu4_cache_hash(hash, c->saveGame, sizeof(*c->saveGame));
+    if (c->location) {
+        hash = zu4_cache_hash(hash, &c->location->coords, sizeof(Coords));
+        hash = zu4_cache_hash(hash, &c->location->map->id, sizeof(MapId));
+
+        ObjectDeque &objects = c->location->map->objects;
+        for (ObjectDeque::iterator i = objects.begin(); i != objects.end(); i++) {
+            TileId id = (*i)->getTile().id;
+            hash = zu4_cache_hash(hash, &(*i)->getCoords(), sizeof(Coords));
+            hash = zu4_cache_hash(hash, &id, sizeof(id));
+        }
+    }
+    return hash;
+}
+
+/**
+ * Writes out the run of single tick batches seen so far.
+ */
+static void inputLogFlushTicks() {
+    if (pendingTicks)
+        fprintf(out, "t %u\n", pendingTicks);
+    pendingTicks = 0;
+}
+
+static void inputLogClose() {
+    inputLogFlushTicks();
+    fclose(out);
+}
+
+/**
+ * Starts recording input to a log.  The generator must already have
+ * been seeded.
+ */
+void inputLogRecord(const std::string &path) {
+    out = fopen(path.c_str(), "w");
+    if (!out)
+        zu4_error(ZU4_LOG_ERR, "Unable to write input log %s\n", path.c_str());
+
+    fprintf(out, "zu4-input 1\nseed %u\n", zu4_random_seed());
+    mode = INPUT_LOG_RECORDING;
+
+    // the game usually ends with exit(), so write the last ticks out then
+    atexit(&inputLogClose);
+}
+
+static void inputLogRead();
+
+/**
+ * Loads an input log to replay, reseeds the generator from it and stops
+ * the real timer.
+ */
+void inputLogReplay(const std::string &path) {
+    std::ifstream in(path.c_str());
+    std::string s;
+    unsigned int version = 0, seed = 0;
+
+    if (!in)
+        zu4_error(ZU4_LOG_ERR, "Unable to open input log %s\n", path.c_str());
+
+    while (std::getline(in, s))
+        lines.push_back(s);
+
+    if (lines.size() < 2
+        || sscanf(lines[0].c_str(), "zu4-input %u", &version) != 1 || version != 1
+        || sscanf(lines[1].c_str(), "seed %u", &seed) != 1)
+        zu4_error(ZU4_LOG_ERR, "%s is not an input log\n", path.c_str());
+    line = 2;
+
+    mode = INPUT_LOG_REPLAYING;
+    zu4_srandom_seed(seed);
+    eventHandler->getTimer()->stop();
+    replayStart = SDL_GetTicks();
+    inputLogRead();
+}
+
+/**
+ * Returns whether input is being recorded or replayed.
+ */
+bool inputLogActive() {
+    return mode != INPUT_LOG_OFF;
+}
+
+/**
+ * Returns whether a log is being replayed in place of real input.
+ */
+bool inputLogReplaying() {
+    return mode == INPUT_LOG_REPLAYING;
+}
+
+/**
+ * Returns the simulated time in milliseconds, which advances with each
+ * timer tick handled.
+ */
+unsigned int inputLogTicks() {
+    return ticks;
+}
+
+/**
+ * Returns the time in seconds: simulated while a log is recorded or
+ * replayed or a harness script runs, the wall clock otherwise.
+ */
+time_t inputLogTime() {
+    if (mode != INPUT_LOG_OFF)
+        return ticks / 1000;
+    if (harnessActive())
+        return harnessTicks() / 1000;
+    return time(NULL);
+}
+
+static void inputLogAdd(InputLogEvent event, int key) {
+    InputLogEntry e = { event, key, 0 };
+
+    if (event == INPUT_LOG_KEY)
+        e.digest = inputLogDigest();
+    batch.push_back(e);
+}
+
+/**
+ * Notes a timer tick about to be handled.
+ */
+void inputLogTick() {
+    ticks += eventTimerGranularity;
+    tickCount++;
+    if (mode == INPUT_LOG_RECORDING)
+        inputLogAdd(INPUT_LOG_TICK, 0);
+}
+
+/**
+ * Notes a key about to be handled.
+ */
+void inputLogKey(int key) {
+    keyCount++;
+    if (mode == INPUT_LOG_RECORDING)
+        inputLogAdd(INPUT_LOG_KEY, key);
+}
+
+/**
+ * Notes the end of a sleep.
+ */
+void inputLogWake() {
+    if (mode == INPUT_LOG_RECORDING)
+        inputLogAdd(INPUT_LOG_WAKE, 0);
+}
+
+/**
+ * Reseeds the generator part way through a run, noting it in the log.
+ */
+void inputLogSeed(unsigned int seed) {
+    zu4_srandom_seed(seed);
+    if (mode == INPUT_LOG_RECORDING)
+        inputLogAdd(INPUT_LOG_SEED, seed);
+}
+
+/**
+ * Ends the batch of events an event loop has handled, writing it out.
+ */
+void inputLogFrame() {
+    if (mode != INPUT_LOG_RECORDING || batch.empty())
+        return;
+
+    if (batch.size() == 1 && batch[0].event == INPUT_LOG_TICK)
+        pendingTicks++;
+    else {
+        inputLogFlushTicks();
+        fputc('b', out);
+        for (unsigned int i = 0; i < batch.size(); i++) {
+            if (batch[i].event == INPUT_LOG_TICK)
+                fputs(" t", out);
+            else if (batch[i].event == INPUT_LOG_WAKE)
+                fputs(" w", out);
+            else if (batch[i].event == INPUT_LOG_SEED)
+                fprintf(out, " s%u", (unsigned int)batch[i].key);
+            else
+                fprintf(out, " k%d:%016llx", batch[i].key, (unsigned long long)batch[i].digest);
+        }
+        fputc('\n', out);
+    }
+    batch.clear();
+}
+
+/**
+ * Prints the results of the replay and exits.
+ */
+static void inputLogFinish() {
+    double secs = (SDL_GetTicks() - replayStart) / 1000.0;
+
+    printf("replay: %u ticks and %u keys in %.2f s (%.0f ticks/s)\n",
+           tickCount, keyCount, secs, secs > 0 ? tickCount / secs : 0.0);
+    if (mismatches)
+        printf("replay: MISMATCH, the state differed before %u of %u keys\n", mismatches, keyCount);
+    else
+        printf("replay: identical\n");
+    ::exit(mismatches ? 1 : 0);
+}
+
+/**
+ * Reads the next batch from the log into entries.
+ */
+static void inputLogRead() {
+    entries.clear();
+    entry = 0;
+
+    while (entries.empty()) {
+        if (line >= lines.size())
+            inputLogFinish();
+
+        std::istringstream in(lines[line++]);
+        std::string op, tok;
+        in >> op;
+
+        if (op == "t") {
+            InputLogEntry e = { INPUT_LOG_TICK, 0, 0 };
+            repeat = 0;
+            in >> repeat;
+            if (repeat)
+                entries.push_back(e);
+        }
+        else if (op == "b") {
+            repeat = 1;
+            while (in >> tok) {
+                InputLogEntry e = { INPUT_LOG_TICK, 0, 0 };
+                unsigned long long digest = 0;
+                unsigned int seed;
+
+                if (tok == "w")
+                    e.event = INPUT_LOG_WAKE;
+                else if (tok[0] == 's' && sscanf(tok.c_str(), "s%u", &seed) == 1) {
+                    e.event = INPUT_LOG_SEED;
+                    e.key = (int)seed;
+                }
+                else if (tok[0] == 'k' && sscanf(tok.c_str(), "k%d:%llx", &e.key, &digest) == 2) {
+                    e.event = INPUT_LOG_KEY;
+                    e.digest = digest;
+                }
+                else if (tok != "t")
+                    zu4_error(ZU4_LOG_ERR, "Bad event '%s' in input log line %u\n", tok.c_str(), line);
+                entries.push_back(e);
+            }
+        }
+        else if (!op.empty())
+            zu4_error(ZU4_LOG_ERR, "Bad input log line %u\n", line);
+    }
+}
+
+/**
+ * Returns the next event from the log being replayed, or
+ * INPUT_LOG_FRAME at the end of each batch.  The replay ends when the
+ * log does.
+ */
+InputLogEvent inputLogNext(int *key) {
+    while (entry < entries.size() && entries[entry].event == INPUT_LOG_SEED)
+        zu4_srandom_seed((unsigned int)entries[entry++].key);
+
+    if (entry == entries.size()) {
+        if (repeat > 1) {
+            repeat--;
+            entry = 0;
+        }
+        else
+            inputLogRead();
+        return INPUT_LOG_FRAME;
+    }
+
+    const InputLogEntry &e = entries[entry++];
+    if (e.event == INPUT_LOG_TICK)
+        inputLogTick();
+    else if (e.event == INPUT_LOG_KEY) {
+        *key = e.key;
+        if (inputLogDigest() != e.digest && mismatches++ == 0)
+            printf("replay: state differs before key %u, at %u ms\n", keyCount + 1, ticks);
+        inputLogKey(e.key);
+    }
+    return e.event;
+}
@@ -0,0 +1,62 @@
+/*
+ * inputlog.h
+ */
+
+/**
+ * @file
+ * @brief Declares the input recorder
+ *
+ * With --record, every keystroke and timer tick the event loops handle
+ * is written to a log, together with the random seed the run started
+ * from.  With --replay, the log is fed back to the event loops in place
+ * of SDL's, with the real timer stopped, so the game goes through
+ * exactly the same states again as fast as it can, and the run is timed.
+ *
+ * Events are logged in the batches the event loops handled them in,
+ * since a batch is finished even after the controller it started with
+ * is done.  Each key carries a digest of the game state as it was just
+ * before the key was handled, which the replay checks.  Time is counted
+ * in ticks whenever a log is being recorded or replayed, so that nothing
+ * depends on the wall clock.
+ *
+ * The log is text, one line per batch:
+ * <ul>
+ *     <li>zu4-input 1, seed N: the header</li>
+ *     <li>t N: N batches of a single timer tick</li>
+ *     <li>b EVENT...: a batch of several events, each either t for a
+ *         tick, w for the end of a sleep, sSEED for a reseed, or
+ *         kKEY:DIGEST for a key</li>
+ * </ul>
+ * A replay must be run with the same settings and game data as the
+ * recording.
+ */
+
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <ctime>
+#include <string>
+
+enum InputLogEvent {
+    INPUT_LOG_TICK,
+    INPUT_LOG_KEY,
+    INPUT_LOG_WAKE,
+    INPUT_LOG_SEED,
+    INPUT_LOG_FRAME
+};
+
+void inputLogRecord(const std::string &path);
+void inputLogReplay(const std::string &path);
+bool inputLogActive();
+bool inputLogReplaying();
+unsigned int inputLogTicks();
+time_t inputLogTime();
+
+void inputLogTick();
+void inputLogKey(int key);
+void inputLogWake();
+void inputLogSeed(unsigned int seed);
+void inputLogFrame();
+InputLogEvent inputLogNext(int *key);
+
+#endif
@@ -10,6 +10,8 @@
 #include "intro.h"
 
 #include "error.h"
+#include "harness.h"
+#include "inputlog.h"
 #include "imagemgr.h"
 #include "music.h"
 #include "player.h"
@@ -18,6 +20,7 @@
 #include "sound.h"
 #include "tilemap.h"
 #include "u4.h"
+#include "video.h"
 
 static bool notblanked = true;
 
@@ -186,6 +189,7 @@ IntroController::IntroController() :
     videoMenu.add(MI_VIDEO_04,    		new IntMenuItem		("Scale                x%d", 2,  4,/*'s'*/  0, reinterpret_cast<int *>(&settingsChanged.scale), 1, 5, 1));
     videoMenu.add(MI_VIDEO_05,  (		new BoolMenuItem	("Mode                 %s",  2,  5,/*'m'*/  0, &settingsChanged.fullscreen))->setValueStrings("Fullscreen", "Window"));
     videoMenu.add(MI_VIDEO_06,    		new IntMenuItem		("Gamma                %s",  2,  6,/*'a'*/  1, &settingsChanged.gamma, 50, 150, 10, MENU_OUTPUT_GAMMA));
+    videoMenu.add(MI_VIDEO_08,  (		new BoolMenuItem	("Renderer             %s",  2,  7,/*'r'*/  0, &settingsChanged.gpuTiles))->setValueStrings("GPU Tiles", "Software"));
     videoMenu.add(USE_SETTINGS,                   "\010 Use These Settings",  2, 11,/*'u'*/  2);
     videoMenu.add(CANCEL,                         "\010 Cancel",              2, 12,/*'c'*/  2);
     videoMenu.addShortcutKey(CANCEL, ' ');
@@ -517,7 +521,7 @@ void IntroController::drawMapAnimated() {
     for (i = 0; i < IntroBinData::INTRO_BASETILE_TABLE_SIZE; i++)
         if (objectStateTable[i].tile != 0)
         {
-        	std::vector<MapTile> tiles;
+        	TileStack tiles;
         	tiles.push_back(objectStateTable[i].tile);
         	tiles.push_back(binData->introMap[objectStateTable[i].x + (objectStateTable[i].y * INTRO_MAP_WIDTH)]);
             mapArea.drawTile(tiles, false, objectStateTable[i].x, objectStateTable[i].y);
@@ -1677,6 +1681,10 @@ void IntroController::getTitleSourceData()
 
 int getTicks()
 {
+	if (inputLogActive())
+		return inputLogTicks();
+	if (harnessActive())
+		return harnessTicks();
 	return SDL_GetTicks();
 }
 
@@ -1911,14 +1919,12 @@ bool IntroController::updateTitle()
             int newtime = getTicks();
             if (newtime > title->timeDuration + 250/4)
             {
-                // grab the map from the screen
-                Image *screen = zu4_img_get_screen();
-
                 // draw the updated map display
                 intro->drawMapStatic();
 
-                zu4_img_draw_subrect_on(
-                    title->srcImage, screen,
+                // grab the map from the screen
+                zu4_video_read(
+                    title->srcImage,
                     8,
                     8,
                     8,
@@ -35,10 +35,10 @@ Location::Location(Coords coords, Map *map, int viewmode, LocationContext ctx,
 /**
  * Return the entire stack of objects at the given location.
  */
-std::vector<MapTile> Location::tilesAt(Coords coords, bool &focus) {
-    std::vector<MapTile> tiles;
-    std::list<Annotation *> a = map->annotations->ptrsToAllAt(coords);
-    std::list<Annotation *>::iterator i;
+TileStack Location::tilesAt(Coords coords, bool &focus) {
+    TileStack tiles;
+    Annotation::List &a = map->annotations->at(coords);
+    Annotation::List::iterator i;
     Object *obj = map->objectAt(coords);
     Creature *m = dynamic_cast<Creature *>(obj);
     focus = false;
@@ -63,15 +63,15 @@ std::vector<MapTile> Location::tilesAt(Coords coords, bool &focus) {
 
     /* Add visual-only annotations to the list */
     for (i = a.begin(); i != a.end(); i++) {
-        if ((*i)->isVisualOnly())
+        if (i->isVisualOnly())
         {
-            tiles.push_back((*i)->getTile());
+            tiles.push_back(i->getTile());
 
             /* If this is the first cover-up annotation,
 			 * everything underneath it will be invisible,
 			 * so stop here
 			 */
-			if ((*i)->isCoverUp())
+			if (i->isCoverUp())
 				return tiles;
         }
     }
@@ -102,14 +102,14 @@ std::vector<MapTile> Location::tilesAt(Coords coords, bool &focus) {
 
     /* then permanent annotations */
     for (i = a.begin(); i != a.end(); i++) {
-        if (!(*i)->isVisualOnly()) {
-            tiles.push_back((*i)->getTile());
+        if (!i->isVisualOnly()) {
+            tiles.push_back(i->getTile());
 
             /* If this is the first cover-up annotation,
              * everything underneath it will be invisible,
              * so stop here
              */
-            if ((*i)->isCoverUp())
+            if (i->isCoverUp())
             	return tiles;
         }
     }
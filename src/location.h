@@ -30,7 +30,7 @@ struct Location : public Observable<Location *, MoveEvent &> {
 public:
     Location(Coords coords, Map *map, int viewmode, LocationContext ctx, TurnCompleter *turnCompleter, Location *prev);
 
-    std::vector<MapTile> tilesAt(Coords coords, bool &focus);
+    TileStack tilesAt(Coords coords, bool &focus);
     TileId getReplacementTile(Coords atCoords, Tile const * forTile);
     int getCurrentPosition(Coords *coords);
     MoveResult move(Direction dir, bool userEvent);
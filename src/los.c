@@ -0,0 +1,248 @@
+/*
+ * Line of sight for the map viewport, computed on packed opacity bitmaps
+ * rather than tile by tile.  Both styles give exactly the same result as
+ * the original tile-by-tile implementations.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "los.h"
+
+#define LOS_ROW_MASK ((1 << VIEWPORT_W) - 1)
+#define LOS_CX (VIEWPORT_W / 2)
+#define LOS_CY (VIEWPORT_H / 2)
+#define LOS_LEFT ((1 << LOS_CX) - 1)
+#define LOS_RIGHT (LOS_ROW_MASK & ~((2 << LOS_CX) - 1))
+
+/*
+ * The shadows each opaque viewport tile casts in the enhanced style,
+ * indexed by the tile's position.  Each row packs the bitmaps for the
+ * three shadow edges (H, C, V) 16 bits apart, and only the rows between
+ * first and last have any shadow in them.
+ */
+typedef struct Shadow {
+	uint64_t rows[VIEWPORT_H];
+	int first, last;
+} Shadow;
+
+static Shadow shadows[VIEWPORT_W][VIEWPORT_H];
+static bool shadowsBuilt = false;
+
+/* the last result, which is reused for as long as nothing changes */
+static uint16_t memoOpaque[VIEWPORT_H];
+static uint16_t memoVisible[VIEWPORT_H];
+static int memoStyle = -1;
+
+static void zu4_los_shadow(int xTile, int yTile, int x, int y, int shadowType) {
+	// Mark one tile as obscured by the given shadow edges
+	if (x < 0 || x >= VIEWPORT_W || y < 0 || y >= VIEWPORT_H)
+		return;
+
+	Shadow *shadow = &shadows[xTile][yTile];
+	for (int edge = 0; edge < 3; edge++) {
+		if (shadowType & (1 << edge))
+			shadow->rows[y] |= (uint64_t)1 << (edge * 16 + x);
+	}
+	if (shadow->first > y)
+		shadow->first = y;
+	if (shadow->last < y)
+		shadow->last = y;
+}
+
+static void zu4_los_build_shadows() {
+	// Record the shadow rasters cast by each tile, based somewhat off Andy
+	// McFadden's 1994 article, "Improvements to a Fast Algorithm for
+	// Calculating Shading and Visibility in a Two-Dimensional Field"
+	//   http://www.fadden.com/techmisc/fast-los.html
+	//
+	// The shadows cast by a tile don't depend on any other tile, so the
+	// rasters are walked once for every tile and the result kept.
+
+	/*
+	 * the shadow rasters for each viewport octant
+	 *
+	 * shadowRaster[0][0]    // number of raster segments in this shadow
+	 * shadowRaster[0][1]    // #1 shadow bitmask value (low three bits) + "newline" flag (high bit)
+	 * shadowRaster[0][2]    // #1 length
+	 * shadowRaster[0][3]    // #2 shadow bitmask value
+	 * shadowRaster[0][4]    // #2 length
+	 * ...etc...
+	 */
+	const int shadowRaster[14][13] = {
+		{ 6, __VCH, 4, _N_CH, 1, __VCH, 3, _N___, 1, ___CH, 1, __VCH, 1 },    // raster_1_0
+		{ 6, __VC_, 1, _NVCH, 2, __VC_, 1, _NVCH, 3, _NVCH, 2, _NVCH, 1 },    // raster_1_1
+		//
+		{ 4, __VCH, 3, _N__H, 1, ___CH, 1, __VCH, 1,     0, 0,     0, 0 },    // raster_2_0
+		{ 6, __VC_, 2, _N_CH, 1, __VCH, 2, _N_CH, 1, __VCH, 1, _N__H, 1 },    // raster_2_1
+		{ 6, __V__, 1, _NVCH, 1, __VC_, 1, _NVCH, 1, __VC_, 1, _NVCH, 1 },    // raster_2_2
+		//
+		{ 2, __VCH, 2, _N__H, 2,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_3_0
+		{ 3, __VC_, 2, _N_CH, 1, __VCH, 1,     0, 0,     0, 0,     0, 0 },    // raster_3_1
+		{ 3, __VC_, 1, _NVCH, 2, _N_CH, 1,     0, 0,     0, 0,     0, 0 },    // raster_3_2
+		{ 3, _NVCH, 1, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0 },    // raster_3_3
+		//
+		{ 2, __VCH, 1, _N__H, 1,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_4_0
+		{ 2, __VC_, 1, _N__H, 1,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_4_1
+		{ 2, __VC_, 1, _N_CH, 1,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_4_2
+		{ 2, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_4_3
+		{ 2, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0,     0, 0 }     // raster_4_4
+	};
+
+	/* the first raster for each column; rows follow in order */
+	const int rasterStart[5] = { 0, 0, 2, 5, 9 };
+
+	for (int x = 0; x < VIEWPORT_W; x++) {
+		for (int y = 0; y < VIEWPORT_H; y++) {
+			shadows[x][y].first = VIEWPORT_H;
+			shadows[x][y].last = -1;
+		}
+	}
+
+	for (int octant = 0; octant < 8; octant++) {
+		int xSign = 0, ySign = 0, reflect = false;
+
+		switch (octant) {
+			case 0:  xSign=  1;  ySign=  1;  reflect=false;  break;        // lower-right
+			case 1:  xSign=  1;  ySign=  1;  reflect=true;   break;
+			case 2:  xSign=  1;  ySign= -1;  reflect=true;   break;        // lower-left
+			case 3:  xSign= -1;  ySign=  1;  reflect=false;  break;
+			case 4:  xSign= -1;  ySign= -1;  reflect=false;  break;        // upper-left
+			case 5:  xSign= -1;  ySign= -1;  reflect=true;   break;
+			case 6:  xSign= -1;  ySign=  1;  reflect=true;   break;        // upper-right
+			case 7:  xSign=  1;  ySign= -1;  reflect=false;  break;
+		}
+
+		// make sure the segment doesn't reach out of bounds
+		int maxWidth = reflect ? LOS_CY : LOS_CX;
+		int maxHeight = reflect ? LOS_CX : LOS_CY;
+
+		for (int currentCol = 1; currentCol <= 4; currentCol++) {
+			for (int currentRow = 0; currentRow <= currentCol; currentRow++) {
+				int xTile, yTile;
+
+				// swap X and Y to reflect the octant rasters
+				if (reflect) {
+					xTile = LOS_CX + (currentRow * ySign);
+					yTile = LOS_CY + (currentCol * xSign);
+				}
+				else {
+					xTile = LOS_CX + (currentCol * xSign);
+					yTile = LOS_CY + (currentRow * ySign);
+				}
+
+				const int *raster = shadowRaster[rasterStart[currentCol] + currentRow];
+				int xTileOffset = 0;
+				int yTileOffset = 0;
+
+				for (int currentSegment = 0; currentSegment < raster[0]; currentSegment++) {
+					int shadowType = raster[currentSegment * 2 + 1];
+					int shadowLength = raster[currentSegment * 2 + 2];
+
+					// update the raster length to make sure it fits in the viewport
+					shadowLength = (shadowLength + 1 + yTileOffset > maxWidth ? maxWidth : shadowLength);
+
+					// check to see if we should move up a row
+					if (shadowType & _N___) {
+						shadowType ^= _N___;
+						if (currentRow + yTileOffset > maxHeight)
+							break;
+						xTileOffset = yTileOffset;
+						yTileOffset++;
+					}
+
+					for (int currentShadow = 1; currentShadow <= shadowLength; currentShadow++) {
+						if (reflect) {
+							zu4_los_shadow(xTile, yTile, xTile + (yTileOffset * ySign),
+								yTile + ((currentShadow + xTileOffset) * xSign), shadowType);
+						}
+						else {
+							zu4_los_shadow(xTile, yTile, xTile + ((currentShadow + xTileOffset) * xSign),
+								yTile + (yTileOffset * ySign), shadowType);
+						}
+					}
+					xTileOffset += shadowLength;
+				}
+			}
+		}
+	}
+
+	shadowsBuilt = true;
+}
+
+static void zu4_los_enhanced(const uint16_t *opaque, uint16_t *visible) {
+	// Hide every tile whose horizontal, center and vertical faces are all
+	// in the shadow of some opaque tile
+	uint64_t edges[VIEWPORT_H];
+
+	if (!shadowsBuilt)
+		zu4_los_build_shadows();
+
+	memset(edges, 0, sizeof(edges));
+
+	for (int y = 0; y < VIEWPORT_H; y++) {
+		for (int x = 0; x < VIEWPORT_W; x++) {
+			if (!(opaque[y] & (1 << x)))
+				continue;
+			const Shadow *shadow = &shadows[x][y];
+			for (int i = shadow->first; i <= shadow->last; i++)
+				edges[i] |= shadow->rows[i];
+		}
+	}
+
+	for (int y = 0; y < VIEWPORT_H; y++)
+		visible[y] = ~(edges[y] & (edges[y] >> 16) & (edges[y] >> 32)) & LOS_ROW_MASK;
+}
+
+static uint16_t zu4_los_spread(uint16_t row, uint16_t clear) {
+	// Let light travel sideways away from the center column through
+	// transparent tiles
+	for (;;) {
+		uint16_t lit = row & clear;
+		uint16_t next = row | ((lit >> 1) & LOS_LEFT) | ((lit << 1) & LOS_RIGHT);
+		if (next == row)
+			return row;
+		row = next;
+	}
+}
+
+static void zu4_los_dos(const uint16_t *opaque, uint16_t *visible) {
+	// The original DOS algorithm, a row at a time: a tile is visible if a
+	// transparent, visible neighbour lies between it and the avatar
+	visible[LOS_CY] = zu4_los_spread(1 << LOS_CX, ~opaque[LOS_CY]);
+
+	for (int y = LOS_CY - 1; y >= 0; y--) {
+		uint16_t lit = visible[y + 1] & ~opaque[y + 1];
+		uint16_t row = (lit & (1 << LOS_CX)) |
+			((lit | (lit >> 1)) & LOS_LEFT) |
+			((lit | (lit << 1)) & LOS_RIGHT);
+		visible[y] = zu4_los_spread(row, ~opaque[y]);
+	}
+
+	for (int y = LOS_CY + 1; y < VIEWPORT_H; y++) {
+		uint16_t lit = visible[y - 1] & ~opaque[y - 1];
+		uint16_t row = (lit & (1 << LOS_CX)) |
+			((lit | (lit >> 1)) & LOS_LEFT) |
+			((lit | (lit << 1)) & LOS_RIGHT);
+		visible[y] = zu4_los_spread(row, ~opaque[y]);
+	}
+}
+
+void zu4_los_find(const uint16_t opaque[VIEWPORT_H], int style, uint16_t visible[VIEWPORT_H]) {
+	// Find which tiles in the viewport are visible from the center; the
+	// result depends on nothing but the opacity bitmap, so timer-driven
+	// redraws reuse the last one until something opaque moves
+	if (style == memoStyle && !memcmp(opaque, memoOpaque, sizeof(memoOpaque))) {
+		memcpy(visible, memoVisible, sizeof(memoVisible));
+		return;
+	}
+
+	if (style == LOS_ENHANCED)
+		zu4_los_enhanced(opaque, visible);
+	else
+		zu4_los_dos(opaque, visible);
+
+	memcpy(memoOpaque, opaque, sizeof(memoOpaque));
+	memcpy(memoVisible, visible, sizeof(memoVisible));
+	memoStyle = style;
+}
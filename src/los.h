@@ -0,0 +1,44 @@
+#ifndef LOS_H
+#define LOS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "u4.h"
+
+/*
+ * bitmasks for LOS shadows
+ */
+#define ____H 0x01    // obscured along the horizontal face
+#define ___C_ 0x02    // obscured at the center
+#define __V__ 0x04    // obscured along the vertical face
+#define _N___ 0x80    // start of new raster
+
+#define ___CH 0x03
+#define __VCH 0x07
+#define __VC_ 0x06
+
+#define _N__H 0x81
+#define _N_CH 0x83
+#define _NVCH 0x87
+#define _NVC_ 0x86
+#define _NV__ 0x84
+
+/* line of sight styles, as stored in settings.lineOfSight */
+#define LOS_DOS 0
+#define LOS_ENHANCED 1
+
+/*
+ * Viewport bitmaps hold one row per element, with bit x set for
+ * column x.  The avatar is always at the center of the viewport.
+ */
+void zu4_los_find(const uint16_t opaque[VIEWPORT_H], int style, uint16_t visible[VIEWPORT_H]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,45 +26,17 @@ int probe1(unsigned char root, int codeword)
     return(newHashCode);
 }
 
-/* The secondary probe uses some assembler instructions that aren't easily translated to C. */
+/*
+ * The secondary probe squares a 16 bit register with mul, leaving the product in DX:AX, and rotates
+ * DX:AX left twice through the carry flag before taking bits 8-19.  The bits rotated in from the
+ * carry never reach bit 8, so this is just bits 6-17 of the product.
+ */
 int probe2(unsigned char root, int codeword)
 {
-    /* registers[0] == AX, registers[1] == DX */
-    long registers[2], temp;
-    long carry, oldCarry;
-    int i,j;
-
-    /* the pre-mul part */
-    registers[1] = 0;
-    registers[0] = ((root << 1) + codeword) | 0x800;
-
-    /* the mul part (simulated mul instruction) */
-    /* DX:AX = AX * AX                          */
-    temp = (registers[0] & 0xff) * (registers[0] & 0xff);
-    temp += 2 * (registers[0] & 0xff) * (registers[0] >> 8) * 0x100;
-    registers[1] = (temp >> 16) + (registers[0] >> 8) * (registers[0] >> 8);
-    registers[0] = temp & 0xffff;
-
-    /* if DX != 0, the mul instruction sets the carry flag */
-    if (registers[1] == 00) {carry = 0;}
-    else {carry = 1;}
-
-    /* the rcl part */
-    for (i = 0; i < 2; i++)   /* 2 rcl's */
-    {
-        for (j = 0; j < 2; j++)   /* rotate through 2 registers */
-        {
-            oldCarry = carry;
-            carry = (registers[j] >> 15) & 1;
-            registers[j] = (registers[j] << 1) | oldCarry;
-            registers[j] = registers[j] & 0xffff;   /* make sure register stays 16 bit */
-        }        
-    }
-
-    /* final touches */
-    registers[0] = ((registers[0] >> 8) | (registers[1] << 8)) & 0xfff;
+    unsigned long ax = (((root << 1) + codeword) | 0x800) & 0xffff;
+    unsigned long product = ax * ax;
 
-    return((int)registers[0]);
+    return((int)((product >> 6) & 0xfff));
 }
 
 int probe3(int hashCode)
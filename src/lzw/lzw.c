@@ -26,8 +26,12 @@
  * 2) The dictionary is implemented as a hash table.
  * While the dictionary is supposed to implemented as a hash table in the LZW *en*coder (to speed up
  * string searches), there is no reason not to implement it as a simple array in the decoder.
- * But since U4 uses a hash table in the decoder, this C version must do the same (or it won't be
- * able to decode the U4 files).
+ * But since U4 uses a hash table, each new string goes in the slot its hash picks, and the
+ * codewords in the compressed data are those slots.  So the decoder still has to hash to know
+ * where each new string goes, even though it looks strings up directly by codeword.
+ *
+ * The decoder works in a single pass, writing each string straight into an output buffer that
+ * grows as needed, and can be fed the compressed data a piece at a time.
  * An article on LZW data (de)compression can be found here:
  * http://dogma.net/markn/articles/lzw/lzw.htm
  */
@@ -37,27 +41,131 @@
 #include <stdlib.h>
 #include <string.h>
 
-typedef void (*WRITE_DECOMP)(unsigned char root, unsigned char *destination, long* position);
+/* re-initialize the dictionary when there are more than 0xccc entries */
+#define LZW_MAX_DICT_ENTRIES 0xccc
+#define LZW_DICTIONARY_SIZE 0x1000
 
-typedef struct _lzwDictionaryEntry
+/*
+ * The state of a decode in progress.  Dictionary strings are stored as
+ * a prefix codeword plus a final root, along with the string's length so
+ * that it can be written out back to front without a stack.
+ */
+struct _LzwStream
 {
-    unsigned char root;
-    int codeword;
-    unsigned char occupied;
-} lzwDictionaryEntry;
+    unsigned char root[LZW_DICTIONARY_SIZE];
+    unsigned short prefix[LZW_DICTIONARY_SIZE];
+    unsigned short length[LZW_DICTIONARY_SIZE];   /* 0 if the codeword isn't in the dictionary */
+    int codewordsInDictionary;
+
+    int oldCode;                 /* the previous codeword, or -1 if the next must be a root */
+    unsigned char character;     /* the first character of the previous string */
 
-long generalizedDecompress(WRITE_DECOMP outFunc, unsigned char* compressedMem, unsigned char* decompressedMem, long compressedSize);
-int getNextCodeword(long* bitsRead, unsigned char *compressedMem);
-void discardRoot(unsigned char root, unsigned char *destination, long* position);
-void outputRoot(unsigned char root, unsigned char *destination, long* position);
+    unsigned long bits;          /* compressed data not yet made into a codeword */
+    int bitCount;
 
-void getString(int codeword, lzwDictionaryEntry *lzwDictionary, unsigned char* stack, int *elementsInStack);
-int getNewHashCode(unsigned char root, int codeword, lzwDictionaryEntry* dictionary);
-unsigned char hashPosFound(int hashCode, unsigned char root, int codeword, lzwDictionaryEntry* dictionary);
+    unsigned char *out;
+    long outSize, outCapacity;
+    int error;
+};
+
+static void lzwStreamReset(LzwStream *s);
+static int lzwStreamCode(LzwStream *s, int code);
+static int lzwStreamGrow(LzwStream *s, long needed);
+static int lzwNewCodeword(LzwStream *s, unsigned char root, int codeword);
+static int lzwCodewordFree(LzwStream *s, int hashCode, unsigned char root, int codeword);
+
+/*
+ * Starts a new decode.  The expected size is only a hint for the first
+ * output buffer, and may be 0.
+ * Returns NULL if out of memory.
+ */
+LzwStream *lzwStreamCreate(long expectedSize)
+{
+    int i;
+    LzwStream *s = (LzwStream *) malloc(sizeof(LzwStream));
+    if (!s)
+        return(NULL);
+
+    for (i = 0; i < 0x100; i++)
+    {
+        s->root[i] = (unsigned char)i;
+        s->prefix[i] = 0;
+        s->length[i] = 1;
+    }
+    lzwStreamReset(s);
+
+    s->bits = 0;
+    s->bitCount = 0;
+    s->out = NULL;
+    s->outSize = 0;
+    s->outCapacity = 0;
+    s->error = 0;
+
+    if (!lzwStreamGrow(s, expectedSize > 0 ? expectedSize : 0x1000))
+        s->error = 1;
+
+    return(s);
+}
+
+/*
+ * Decodes the next piece of compressed data.
+ * Returns:
+ * No errors: 0
+ * Error: -1, and every later call fails too
+ */
+int lzwStreamWrite(LzwStream *s, const unsigned char *compressedMem, long compressedSize)
+{
+    long i;
+
+    if (s->error)
+        return(-1);
+
+    /* codewords are a fixed 12 bits, so one completes at least every other byte */
+    for (i = 0; i < compressedSize; i++)
+    {
+        s->bits = (s->bits << 8) | compressedMem[i];
+        s->bitCount += 8;
+
+        if (s->bitCount >= 12)
+        {
+            s->bitCount -= 12;
+            if (lzwStreamCode(s, (int)(s->bits >> s->bitCount) & 0xfff) < 0)
+            {
+                s->error = 1;
+                return(-1);
+            }
+        }
+    }
+
+    return(0);
+}
+
+/*
+ * Ends a decode, handing over the decompressed data in a buffer that
+ * the caller must free.  Any leftover bits at the end of the compressed
+ * data are padding.  The stream is freed either way.
+ * Returns:
+ * No errors: (long) decompressed size
+ * Error: (long) -1, and *decompressedMem is left alone
+ */
+long lzwStreamFinish(LzwStream *s, unsigned char **decompressedMem)
+{
+    long size = s->error ? -1 : s->outSize;
+
+    if (size >= 0 && decompressedMem)
+    {
+        *decompressedMem = s->out;
+        s->out = NULL;
+    }
+
+    free(s->out);
+    free(s);
+
+    return(size);
+}
 
 /*
  * This function returns the decompressed size of a block of compressed data.
- * It doesn't decompress the data.
  * Use this function if you want to decompress a block of data, but don't know the decompressed size
  * in advance.
  *
@@ -68,7 +176,12 @@ unsigned char hashPosFound(int hashCode, unsigned char root, int codeword, lzwDi
  */
 long lzwGetDecompressedSize(unsigned char* compressedMem, long compressedSize)
 {
-    return(generalizedDecompress(&discardRoot, compressedMem, NULL, compressedSize));
+    LzwStream *s = lzwStreamCreate(compressedSize * 4);
+    if (!s)
+        return(-1);
+
+    lzwStreamWrite(s, compressedMem, compressedSize);
+    return(lzwStreamFinish(s, NULL));
 }
 
 /*
@@ -84,253 +197,154 @@ long lzwGetDecompressedSize(unsigned char* compressedMem, long compressedSize)
  */
 long lzwDecompress(unsigned char* compressedMem, unsigned char* decompressedMem, long compressedSize)
 {
-    return(generalizedDecompress(&outputRoot, compressedMem, decompressedMem, compressedSize));
+    unsigned char *out;
+    long size;
+    LzwStream *s = lzwStreamCreate(compressedSize * 4);
+    if (!s)
+        return(-1);
+
+    lzwStreamWrite(s, compressedMem, compressedSize);
+    size = lzwStreamFinish(s, &out);
+    if (size >= 0)
+    {
+        memcpy(decompressedMem, out, size);
+        free(out);
+    }
+
+    return(size);
 }
 
 /* --------------------------------------------------------------------------------------
    Functions used only inside lzw.c
    -------------------------------------------------------------------------------------- */
 
-/*
- * This function does the actual decompression work.
- * Parameters:
- * perform_decompression: FALSE ==> return decompressed size, but discard decompressed data
- * compressed_mem: compressed data
- * decompressed_mem: this is where the compressed data will be decompressed to
- * compressed_size: size of the compressed data (in bytes)
- */
-long generalizedDecompress(WRITE_DECOMP outFunc, unsigned char* compressedMem, unsigned char* decompressedMem, long compressedSize)
+/* wipe the dictionary back to just the roots */
+static void lzwStreamReset(LzwStream *s)
 {
-    int i;
+    memset(s->length + 0x100, 0, sizeof(s->length[0]) * (LZW_DICTIONARY_SIZE - 0x100));
+    s->codewordsInDictionary = 0;
+    s->oldCode = -1;
+}
 
-    /* re-initialize the dictionary when there are more than 0xccc entries */
-    const int maxDictEntries = 0xccc;
+/* make room for at least needed more bytes of output */
+static int lzwStreamGrow(LzwStream *s, long needed)
+{
+    long capacity = s->outCapacity ? s->outCapacity : 0x1000;
+    unsigned char *out;
 
-    const int lzwStackSize = 0x8000;
-    const int lzwDictionarySize = 0x1000;
+    if (s->outSize + needed <= s->outCapacity)
+        return(1);
 
-    int old_code;
-    int new_code;
-    unsigned char character;
+    while (capacity < s->outSize + needed)
+        capacity *= 2;
 
-    long bitsRead = 0;
-    long bytesWritten = 0;
+    out = (unsigned char *) realloc(s->out, capacity);
+    if (!out)
+        return(0);
 
-    /* newpos: position in the dictionary where new codeword was added                      */
-    /* must be equal to current codeword (if it isn't, the compressed data must be corrupt) */
-    /* unknownCodeword: is the current codeword in the dictionary?                          */
-    int newpos;
-    unsigned char unknownCodeword;
+    s->out = out;
+    s->outCapacity = capacity;
+    return(1);
+}
 
-    /* initialize the dictionary and the stack */
-    lzwDictionaryEntry *lzwDictionary = (lzwDictionaryEntry *) malloc(sizeof(lzwDictionaryEntry) * lzwDictionarySize);
-    int codewordsInDictionary = 0;
-    unsigned char *lzwStack = (unsigned char *) malloc(sizeof(unsigned char) * lzwStackSize);
-    int elementsInStack = 0;
+/* decode one codeword */
+static int lzwStreamCode(LzwStream *s, int code)
+{
+    unsigned char *p;
+    int codeword, length, unknownCodeword;
 
-    /* clear the dictionary */
-    memset(lzwDictionary, 0, sizeof(lzwDictionaryEntry) * lzwDictionarySize);
-    for (i = 0; i < 0x100; i++)
+    if (s->oldCode < 0)
     {
-        lzwDictionary[i].occupied = 1;
+        /* the first codeword, and the first after the dictionary is wiped, is always a root */
+        if (!lzwStreamGrow(s, 1))
+            return(-1);
+        s->character = (unsigned char)code;
+        s->out[s->outSize++] = s->character;
+        s->oldCode = code;
+        return(0);
     }
 
-    if (bitsRead + 12 <= compressedSize * 8)
-    {
-        /* read OLD_CODE */
-        old_code = getNextCodeword(&bitsRead, compressedMem);
-        /* CHARACTER = OLD_CODE */
-        character = (unsigned char)old_code;
-        /* output OLD_CODE */
-        outFunc(character, decompressedMem, &bytesWritten);
-
-        while (bitsRead + 12 <= compressedSize * 8) /* WHILE there are still input characters DO */
-        {
-            /* read NEW_CODE */
-            new_code = getNextCodeword(&bitsRead, compressedMem);
-
-            if (lzwDictionary[new_code].occupied)   /* is the codeword in the dictionary? */
-            {
-                /* codeword is present in the dictionary                                               */
-                /* it must either be a root or a non-root that has already been added to the dicionary */
-                unknownCodeword = 0;
-
-                /* STRING = get translation of NEW_CODE */
-                getString(new_code,lzwDictionary,lzwStack,&elementsInStack);
-            }
-            else
-            {
-                /* codeword is yet to be defined */
-                unknownCodeword = 1;
-
-                /* STRING = get translation of OLD_CODE */
-                /* STRING = STRING+CHARACTER            */
-                lzwStack[elementsInStack] = character;   /* push character on the stack */
-                elementsInStack++;
-
-                getString(old_code,lzwDictionary,lzwStack,&elementsInStack);
-            }
-
-            /* CHARACTER = first character in STRING */
-            character = lzwStack[elementsInStack-1];   /* element at top of stack */
-
-            /* output STRING */
-            while (elementsInStack > 0)
-            {
-                outFunc(lzwStack[elementsInStack-1], decompressedMem, &bytesWritten);
-                elementsInStack--;
-            }
+    if (s->length[s->oldCode] == 0)
+        return(-1);
 
-            /* add OLD_CODE + CHARACTER to the translation table */
-            newpos = getNewHashCode(character,old_code,lzwDictionary);
-
-            lzwDictionary[newpos].root = character;
-            lzwDictionary[newpos].codeword = old_code;
-            lzwDictionary[newpos].occupied = 1;
-            codewordsInDictionary++;
-
-            /* check for errors */
-            if (unknownCodeword && (newpos != new_code))
-            {
-                /* clean up */
-                free(lzwStack);
-                free(lzwDictionary);
+    /* STRING = get translation of NEW_CODE, or if it is yet to be defined,  */
+    /* the translation of OLD_CODE followed by CHARACTER                      */
+    unknownCodeword = s->length[code] == 0;
+    codeword = unknownCodeword ? s->oldCode : code;
+    length = s->length[codeword] + unknownCodeword;
 
-                return(-1);
-            }
+    if (!lzwStreamGrow(s, length))
+        return(-1);
 
-            if (codewordsInDictionary > maxDictEntries)
-            {
-                /* wipe dictionary */
-                codewordsInDictionary = 0;
-                memset(lzwDictionary, 0, sizeof(lzwDictionaryEntry) * lzwDictionarySize);
-                for (i = 0; i < 0x100; i++)
-                {
-                    lzwDictionary[i].occupied = 1;
-                }
-
-                if (bitsRead + 12 <= compressedSize * 8)
-                {
-                    new_code = getNextCodeword(&bitsRead, compressedMem);
-                    character = (unsigned char)new_code;
-
-                    outFunc(character, decompressedMem, &bytesWritten);
-                }
-                else
-                {
-                    /* clean up */
-                    free(lzwStack);
-                    free(lzwDictionary);
-
-                    return(bytesWritten);
-                }
-            }
+    /* output STRING, from the last character back */
+    p = s->out + s->outSize + s->length[codeword] - 1;
+    if (unknownCodeword)
+        p[1] = s->character;
+    while (codeword > 0xff)
+    {
+        *p-- = s->root[codeword];
+        codeword = s->prefix[codeword];
+    }
+    *p = (unsigned char)codeword;
 
-            /* OLD_CODE = NEW_CODE */
-            old_code = new_code;
-        }
-    }    
-    /* clean up */
-    free(lzwStack);
-    free(lzwDictionary);
+    /* CHARACTER = first character in STRING */
+    s->character = *p;
+    s->outSize += length;
 
-    return(bytesWritten);
-}
+    /* add OLD_CODE + CHARACTER to the translation table */
+    codeword = lzwNewCodeword(s, s->character, s->oldCode);
+    s->root[codeword] = s->character;
+    s->prefix[codeword] = (unsigned short)s->oldCode;
+    s->length[codeword] = s->length[s->oldCode] + 1;
+    s->codewordsInDictionary++;
 
-/* read the next 12-bit codeword from the compressed data */
-int getNextCodeword(long* bitsRead, unsigned char *compressedMem)
-{
-    int codeword = (compressedMem[(*bitsRead)/8] << 8) + compressedMem[(*bitsRead)/8+1];
-    codeword = codeword >> (4-((*bitsRead)%8));
-    codeword = codeword & 0xfff;
-    (*bitsRead) += 12;
+    /* check for errors */
+    if (unknownCodeword && codeword != code)
+        return(-1);
 
-    return(codeword);
-}
+    /* OLD_CODE = NEW_CODE */
+    s->oldCode = code;
 
-/* increment position pointer, but do not write root to memory */
-void discardRoot(unsigned char root, unsigned char *destination, long* position)
-{
-    (*position)++;
-}
+    if (s->codewordsInDictionary > LZW_MAX_DICT_ENTRIES)
+        lzwStreamReset(s);
 
-/* output a root to memory */
-void outputRoot(unsigned char root, unsigned char *destination, long* position)
-{
-    destination[*position] = root;
-    (*position)++;
+    return(0);
 }
 
 /* --------------------------------------------------------------------------------------
    Dictionary-related functions
    -------------------------------------------------------------------------------------- */
 
-/* pushes the string associated with codeword onto the stack */
-void getString(int codeword, lzwDictionaryEntry *dictionary, unsigned char *stack, int *elementsInStack)
-{
-    unsigned char root;
-    int currentCodeword = codeword;
-
-    while (currentCodeword > 0xff)
-    {
-        root = dictionary[currentCodeword].root;
-        currentCodeword = dictionary[currentCodeword].codeword;
-        stack[*elementsInStack] = root;
-        (*elementsInStack)++;
-    }
-
-    /* push the root at the leaf */
-    stack[*elementsInStack] = (unsigned char)currentCodeword;
-    (*elementsInStack)++;
-}
-
-int getNewHashCode (unsigned char root, int codeword, lzwDictionaryEntry *dictionary)
+/* find the codeword the U4 encoder gave the string OLD_CODE + CHARACTER */
+static int lzwNewCodeword(LzwStream *s, unsigned char root, int codeword)
 {
     int hashCode;
 
     /* probe 1 */
     hashCode = probe1(root, codeword);
-    if (hashPosFound(hashCode, root, codeword, dictionary)) {
+    if (lzwCodewordFree(s, hashCode, root, codeword))
         return(hashCode);
-    }
+
     /* probe 2 */
     hashCode = probe2(root, codeword);
-    if (hashPosFound(hashCode, root, codeword, dictionary)) {
+    if (lzwCodewordFree(s, hashCode, root, codeword))
         return(hashCode);
-    }
+
     /* probe 3 */
     do {
         hashCode = probe3(hashCode);
     }
-    while (! hashPosFound(hashCode, root, codeword, dictionary));
+    while (!lzwCodewordFree(s, hashCode, root, codeword));
 
     return(hashCode);
 }
 
-unsigned char hashPosFound(int hashCode, unsigned char root, int codeword, lzwDictionaryEntry* dictionary)
+/* is the hash table position free, or already holding our (root,codeword) pair? */
+static int lzwCodewordFree(LzwStream *s, int hashCode, unsigned char root, int codeword)
 {
-    if (hashCode > 0xff)   /* hash codes must not be roots */
-    {
-        unsigned char c1, c2, c3;
-
-        if (dictionary[hashCode].occupied)
-        {
-            /* hash table position is occupied */
-            c1 = 1;
-            /* is our (root,codeword) pair already in the hash table? */
-            c2 = dictionary[hashCode].root == root;
-            c3 = dictionary[hashCode].codeword == codeword;
-        }
-        else
-        {
-            /* hash table position is free */
-            c1 = 0;
-        }
-
-        return((!c1) || (c1 && c2 && c3));
-    }
-    else
-    {
+    /* hash codes must not be roots */
+    if (hashCode <= 0xff)
         return(0);
-    }
+
+    return(!s->length[hashCode] || (s->root[hashCode] == root && s->prefix[hashCode] == codeword));
 }
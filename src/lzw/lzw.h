@@ -25,6 +25,12 @@
 extern "C" {
 #endif
 
+typedef struct _LzwStream LzwStream;
+
+LzwStream *lzwStreamCreate(long expectedSize);
+int lzwStreamWrite(LzwStream *s, const unsigned char *compressedMem, long compressedSize);
+long lzwStreamFinish(LzwStream *s, unsigned char **decompressedMem);
+
 long lzwGetDecompressedSize(unsigned char* compressedMem, long compressedSize);
 long lzwDecompress(unsigned char* compressedMem, unsigned char* decompressedMem, long compressedSize);
 
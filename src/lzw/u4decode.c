@@ -29,22 +29,18 @@ extern "C" {
 #include "lzw.h"
 
 /*
- * Loads a file, decompresses it (from memory to memory), and writes the decompressed data to another file
+ * Loads a file and decompresses it (from memory to memory)
  * Returns:
  * -1 if there was an error
  * the decompressed file length, on success
  */
 long decompress_u4_file(FILE *in, long filesize, void **out)
 {
-    unsigned char *compressed_mem, *decompressed_mem;
-    long compressed_filesize, decompressed_filesize;
+    unsigned char *compressed_mem;
     long errorCode;
 
-    /* size of the compressed input file */
-    compressed_filesize = filesize;
-
     /* input file should be longer than 0 bytes */
-    if (compressed_filesize == 0)
+    if (filesize == 0)
         return(-1);
 
     /* check if the input file is _not_ a valid LZW-compressed file */
@@ -52,71 +48,51 @@ long decompress_u4_file(FILE *in, long filesize, void **out)
         return(-1);
 
     /* load compressed file into compressed_mem[] */
-    compressed_mem = (unsigned char *) malloc(compressed_filesize);
-    fread(compressed_mem, 1, compressed_filesize, in);
-
-    /*
-     * determine decompressed file size
-     * if lzw_get_decompressed_size() can't determine the decompressed size (i.e. the compressed
-     * data is corrupt), it returns -1
-     */
-    decompressed_filesize = lzwGetDecompressedSize(compressed_mem,compressed_filesize);
-
-    if (decompressed_filesize <= 0) {
+    compressed_mem = (unsigned char *) malloc(filesize);
+    if (fread(compressed_mem, 1, filesize, in) != (size_t)filesize) {
+        free(compressed_mem);
         return(-1);
     }
 
-    /* decompress file from compressed_mem[] into decompressed_mem[] */
-    decompressed_mem = (unsigned char *) malloc(decompressed_filesize);
-
-    /* testing: clear destination mem */
-    memset(decompressed_mem, 0, decompressed_filesize);
-
-    errorCode = lzwDecompress(compressed_mem, decompressed_mem, compressed_filesize);
+    errorCode = decompress_u4_memory(compressed_mem, filesize, out);
 
     free(compressed_mem);
 
-    *out = decompressed_mem;
-
     return(errorCode);
 }
 
+/*
+ * Decompresses a block of memory in a single pass
+ * Returns:
+ * -1 if there was an error (i.e. the compressed data is corrupt)
+ * the decompressed length, on success
+ */
 long decompress_u4_memory(void *in, long inlen, void **out) {
-    unsigned char *compressed_mem, *decompressed_mem;
-    long compressed_filesize, decompressed_filesize;
-    long errorCode;
-
-    /* size of the compressed input */
-    compressed_filesize = inlen;
+    unsigned char *decompressed_mem;
+    long decompressed_size;
+    LzwStream *s;
 
-    /* input file should be longer than 0 bytes */
-    if (compressed_filesize == 0)
+    /* input should be longer than 0 bytes */
+    if (inlen == 0)
         return(-1);
 
-    compressed_mem = (unsigned char *) in;
+    /* a first guess at the decompressed size; the output buffer grows as needed */
+    s = lzwStreamCreate(inlen * 4);
+    if (!s)
+        return(-1);
 
-    /*
-     * determine decompressed data size
-     * if lzw_get_decompressed_size() can't determine the decompressed size (i.e. the compressed
-     * data is corrupt), it returns -1
-     */
-    decompressed_filesize = lzwGetDecompressedSize(compressed_mem,compressed_filesize);
+    lzwStreamWrite(s, (unsigned char *) in, inlen);
+    decompressed_size = lzwStreamFinish(s, &decompressed_mem);
 
-    if (decompressed_filesize <= 0) {
+    if (decompressed_size <= 0) {
+        if (decompressed_size == 0)
+            free(decompressed_mem);
         return(-1);
     }
 
-    /* decompress file from compressed_mem[] into decompressed_mem[] */
-    decompressed_mem = (unsigned char *) malloc(decompressed_filesize);
-
-    /* testing: clear destination mem */
-    memset(decompressed_mem, 0, decompressed_filesize);
-
-    errorCode = lzwDecompress(compressed_mem, decompressed_mem, compressed_filesize);
-
     *out = decompressed_mem;
 
-    return(errorCode);
+    return(decompressed_size);
 }
 
 /*
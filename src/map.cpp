@@ -6,6 +6,7 @@
 
 #include "annotation.h"
 #include "error.h"
+#include "image.h"
 #include "player.h"
 #include "portal.h"
 #include "tilemap.h"
@@ -213,12 +214,18 @@ Map::Map() {
     id = 0;
     tileset = NULL;
     tilemap = NULL;
+    gemImage = NULL;
+    gemImageSet = 0;
+    objectFront = 0;
+    objectBack = 0;
 }
 
 Map::~Map() {
     for (PortalList::iterator i = portals.begin(); i != portals.end(); i++)
         delete *i;
     delete annotations;
+    if (gemImage)
+        zu4_img_free(gemImage);
 }
 
 std::string Map::getName() {
@@ -231,22 +238,23 @@ std::string Map::getName() {
  */
 Object *Map::objectAt(const Coords &coords) {
     /* FIXME: return a list instead of one object */
-    ObjectDeque::const_iterator i;
+    std::unordered_map<uint64_t, ObjectBucket>::const_iterator cell = objectGrid.find(objectKey(coords));
     Object *objAt = NULL;
 
-    for(i = objects.begin(); i != objects.end(); i++) {
-        Object *obj = *i;
+    if (cell == objectGrid.end())
+        return NULL;
 
-        if (zu4_coords_equal(obj->getCoords(), coords)) {
-            /* get the most visible object */
-            if (objAt && (objAt->getType() == Object::UNKNOWN) && (obj->getType() != Object::UNKNOWN))
-                objAt = obj;
-            /* give priority to objects that have the focus */
-            else if (objAt && (!objAt->hasFocus()) && (obj->hasFocus()))
-                objAt = obj;
-            else if (!objAt)
-                objAt = obj;
-        }
+    for (ObjectBucket::const_iterator i = cell->second.begin(); i != cell->second.end(); i++) {
+        Object *obj = i->obj;
+
+        /* get the most visible object */
+        if (objAt && (objAt->getType() == Object::UNKNOWN) && (obj->getType() != Object::UNKNOWN))
+            objAt = obj;
+        /* give priority to objects that have the focus */
+        else if (objAt && (!objAt->hasFocus()) && (obj->hasFocus()))
+            objAt = obj;
+        else if (!objAt)
+            objAt = obj;
     }
     return objAt;
 }
@@ -288,8 +296,8 @@ MapTile *Map::getTileFromData(const Coords &coords) {
 MapTile *Map::tileAt(const Coords &coords, int withObjects) {
     /* FIXME: this should return a list of tiles, with the most visible at the front */
     MapTile *tile;
-    std::list<Annotation *> a = annotations->ptrsToAllAt(coords);
-    std::list<Annotation *>::iterator i;
+    Annotation::List &a = annotations->at(coords);
+    Annotation::List::iterator i;
     Object *obj = objectAt(coords);
 
     tile = getTileFromData(coords);
@@ -297,8 +305,8 @@ MapTile *Map::tileAt(const Coords &coords, int withObjects) {
     /* FIXME: this only returns the first valid annotation it can find */
     if (a.size() > 0) {
         for (i = a.begin(); i != a.end(); i++) {
-            if (!(*i)->isVisualOnly())
-                return &(*i)->getTile();
+            if (!i->isVisualOnly())
+                return &i->getTile();
         }
     }
 
@@ -403,14 +411,20 @@ Creature *Map::addCreature(const Creature *creature, Coords coords) {
 
     /* place the creature on the map */
     objects.push_back(m);
+    indexObject(m, false);
     return m;
 }
 
 /**
- * Adds an object to the given map
+ * Adds an object to the given map, in front of the others unless
+ * 'atFront' is false
  */
-Object *Map::addObject(Object *obj, Coords coords) {
-    objects.push_front(obj);
+Object *Map::addObject(Object *obj, Coords coords, bool atFront) {
+    obj->setMap(this);
+    if (atFront)
+        objects.push_front(obj);
+    else objects.push_back(obj);
+    indexObject(obj, atFront);
     return obj;
 }
 
@@ -424,6 +438,7 @@ Object *Map::addObject(MapTile tile, MapTile prevtile, Coords coords) {
     obj->setMap(this);
 
     objects.push_front(obj);
+    indexObject(obj, true);
 
     return obj;
 }
@@ -440,6 +455,7 @@ void Map::removeObject(const Object *rem, bool deleteObject) {
     ObjectDeque::iterator i;
     for (i = objects.begin(); i != objects.end(); i++) {
         if (*i == rem) {
+            unindexObject(rem);
             /* Party members persist through different maps, so don't delete them! */
             if (!isPartyMember(*i) && deleteObject)
                 delete (*i);
@@ -450,6 +466,7 @@ void Map::removeObject(const Object *rem, bool deleteObject) {
 }
 
 ObjectDeque::iterator Map::removeObject(ObjectDeque::iterator rem, bool deleteObject) {
+    unindexObject(*rem);
     /* Party members persist through different maps, so don't delete them! */
     if (!isPartyMember(*rem) && deleteObject)
         delete (*rem);
@@ -518,11 +535,106 @@ void Map::resetObjectAnimations() {
     }
 }
 
+/**
+ * Moves an object to the index cell matching its current coords.  This is
+ * called by Object::setCoords for every map the object belongs to, so
+ * objects that aren't actually placed on this map are ignored.
+ */
+void Map::objectMoved(Object *obj) {
+    std::unordered_map<const Object *, uint64_t>::iterator cell = objectCells.find(obj);
+    if (cell == objectCells.end())
+        return;
+
+    uint64_t key = objectKey(obj->getCoords());
+    if (key == cell->second)
+        return;
+
+    ObjectBucket &from = objectGrid[cell->second];
+    ObjectBucket &to = objectGrid[key];
+
+    for (ObjectBucket::iterator i = from.begin(); i != from.end();) {
+        if (i->obj == obj) {
+            insertSlot(to, *i);
+            i = from.erase(i);
+        }
+        else i++;
+    }
+    if (from.empty())
+        objectGrid.erase(cell->second);
+    cell->second = key;
+}
+
+uint64_t Map::objectKey(const Coords &coords) {
+    return (static_cast<uint64_t>(static_cast<uint16_t>(coords.x)) << 32) |
+           (static_cast<uint64_t>(static_cast<uint16_t>(coords.y)) << 16) |
+           static_cast<uint64_t>(static_cast<uint16_t>(coords.z));
+}
+
+/**
+ * Adds an object to the index.  Objects pushed onto the front of the deque
+ * count down from zero and those pushed onto the back count up, so the
+ * order of slots always matches the order of the deque.
+ */
+void Map::indexObject(Object *obj, bool atFront) {
+    ObjectSlot slot;
+    slot.order = atFront ? --objectFront : objectBack++;
+    slot.obj = obj;
+
+    uint64_t key = objectKey(obj->getCoords());
+    objectCells[obj] = key;
+    insertSlot(objectGrid[key], slot);
+}
+
+/**
+ * Removes one slot for an object from the index.  The object's cell is
+ * forgotten once no slot for it is left, and the cell's bucket is
+ * dropped once it is empty.
+ */
+void Map::unindexObject(const Object *obj) {
+    std::unordered_map<const Object *, uint64_t>::iterator cell = objectCells.find(obj);
+    if (cell == objectCells.end())
+        return;
+
+    std::unordered_map<uint64_t, ObjectBucket>::iterator grid = objectGrid.find(cell->second);
+    bool removed = false, remaining = false;
+
+    if (grid != objectGrid.end()) {
+        ObjectBucket &bucket = grid->second;
+        for (ObjectBucket::iterator i = bucket.begin(); i != bucket.end();) {
+            if (i->obj == obj && !removed) {
+                i = bucket.erase(i);
+                removed = true;
+            }
+            else {
+                if (i->obj == obj)
+                    remaining = true; // the object was on the map more than once
+                i++;
+            }
+        }
+        if (bucket.empty())
+            objectGrid.erase(grid);
+    }
+
+    if (!remaining)
+        objectCells.erase(cell);
+}
+
+void Map::insertSlot(ObjectBucket &bucket, const ObjectSlot &slot) {
+    ObjectBucket::iterator i = bucket.end();
+    while (i != bucket.begin() && (i - 1)->order > slot.order)
+        i--;
+    bucket.insert(i, slot);
+}
+
 /**
  * Removes all objects from the given map
  */
 void Map::clearObjects() {
     objects.clear();
+    objectGrid.clear();
+    objectCells.clear();
+    objectFront = 0;
+    objectBack = 0;
 }
 
 /**
@@ -8,6 +8,7 @@
 #include <list>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "object.h"
@@ -16,6 +17,7 @@
 #define MAP_IS_OOB(mapptr, c) (((c).x) < 0 || ((c).x) >= (static_cast<int>((mapptr)->width)) || ((c).y) < 0 || ((c).y) >= (static_cast<int>((mapptr)->height)) || ((c).z) < 0 || ((c).z) >= (static_cast<int>((mapptr)->levels)))
 
 struct AnnotationMgr;
+struct Image;
 struct Map;
 struct Object;
 struct Person;
@@ -92,12 +94,13 @@ public:
     bool isEnclosed(const Coords &party);
     struct Creature *addCreature(const struct Creature *m, Coords coords);
     struct Object *addObject(MapTile tile, MapTile prevTile, Coords coords);
-    struct Object *addObject(Object *obj, Coords coords);
+    struct Object *addObject(Object *obj, Coords coords, bool atFront = true);
     void removeObject(const struct Object *rem, bool deleteObject = true);
     ObjectDeque::iterator removeObject(ObjectDeque::iterator rem, bool deleteObject = true);
     void clearObjects();
     struct Creature *moveObjects(Coords avatar);
     void resetObjectAnimations();
+    void objectMoved(Object *obj);
     int getNumberOfCreatures();
     int getValidMoves(Coords from, MapTile transport);
     bool move(Object *obj, Direction d);
@@ -136,6 +139,10 @@ public:
     Tileset        *tileset;
     TileMap        *tilemap;
 
+    // the gem view of the map data, drawn the first time it is peered at
+    Image          *gemImage;
+    unsigned int    gemImageSet;    /**< The gem graphics gemImage was drawn with */
+
     // u4dos compatibility
     SaveGameMonsterRecord monsterTable[MONSTERTABLE_SIZE];
 
@@ -146,6 +153,27 @@ private:
     Map &operator=(const Map &map);
 
     void findWalkability(Coords coords, int *path_data);
+
+    /**
+     * Objects are indexed by the cell they stand on, so that objectAt()
+     * doesn't have to scan every object on the map.  Each slot carries the
+     * object's position in the deque, and buckets are kept in that order so
+     * that ties are broken exactly as a front-to-back scan of the deque would.
+     */
+    struct ObjectSlot {
+        long order;
+        Object *obj;
+    };
+    typedef std::vector<ObjectSlot> ObjectBucket;
+
+    static uint64_t objectKey(const Coords &coords);
+    void indexObject(Object *obj, bool atFront);
+    void unindexObject(const Object *obj);
+    void insertSlot(ObjectBucket &bucket, const ObjectSlot &slot);
+
+    std::unordered_map<uint64_t, ObjectBucket> objectGrid;
+    std::unordered_map<const Object *, uint64_t> objectCells;
+    long objectFront, objectBack;
 };
 
 #endif
@@ -73,6 +73,8 @@ bool MapLoader::loadData(Map *map, U4FILE *f) {
     if (map->chunk_width == 0)
         map->chunk_width = map->width;
 
+    zu4_assert(map->tilemap != NULL, "tilemap hasn't been set");
+
     u4fseek(f, map->offset, SEEK_CUR);
 
     for(ych = 0; ych < (map->height / map->chunk_height); ++ych) {
@@ -87,13 +89,10 @@ bool MapLoader::loadData(Map *map, U4FILE *f) {
             }
             else {
                 for(y = 0; y < map->chunk_height; ++y) {
-                    for(x = 0; x < map->chunk_width; ++x) {
-                        int c = u4fgetc(f);
-                        if (c == EOF) { return false; }
+                    const uint8_t *row = u4fspan(f, map->chunk_width);
+                    if (!row) { return false; }
 
-                        MapTile mt = map->translateFromRawTileIndex(c);
-                        map->data[x + (y * map->width) + (xch * map->chunk_width) + (ych * map->chunk_height * map->width)] = mt;
-                    }
+                    map->tilemap->translateRange(row, &map->data[(y * map->width) + (xch * map->chunk_width) + (ych * map->chunk_height * map->width)], map->chunk_width);
                 }
             }
         }
@@ -135,24 +134,26 @@ bool CityMapLoader::load(Map *map) {
     if (!loadData(city, ult))
         return false;
 
+    /* the people follow the map: tiles, starts, previous tiles, redundant starts, movement and conversations */
+    const uint8_t *p = u4fspan(ult, CITY_MAX_PERSONS * 8);
+    if (!p)
+        return false;
+
     /* Properly construct people for the city */
     for (i = 0; i < CITY_MAX_PERSONS; i++)
-        people[i] = new Person(map->translateFromRawTileIndex(u4fgetc(ult)));
+        people[i] = new Person(map->translateFromRawTileIndex(p[i]));
 
     for (i = 0; i < CITY_MAX_PERSONS; i++)
-        people[i]->getStart().x = u4fgetc(ult);
+        people[i]->getStart().x = p[CITY_MAX_PERSONS + i];
 
     for (i = 0; i < CITY_MAX_PERSONS; i++)
-        people[i]->getStart().y = u4fgetc(ult);
+        people[i]->getStart().y = p[CITY_MAX_PERSONS * 2 + i];
 
     for (i = 0; i < CITY_MAX_PERSONS; i++)
-        people[i]->setPrevTile(map->translateFromRawTileIndex(u4fgetc(ult)));
-
-    for (i = 0; i < CITY_MAX_PERSONS * 2; i++)
-        u4fgetc(ult);           /* read redundant startx/starty */
+        people[i]->setPrevTile(map->translateFromRawTileIndex(p[CITY_MAX_PERSONS * 3 + i]));
 
     for (i = 0; i < CITY_MAX_PERSONS; i++) {
-        unsigned char c = u4fgetc(ult);
+        unsigned char c = p[CITY_MAX_PERSONS * 6 + i];
         if (c == 0)
             people[i]->setMovementBehavior(MOVEMENT_FIXED);
         else if (c == 1)
@@ -166,9 +167,7 @@ bool CityMapLoader::load(Map *map) {
     }
 
     unsigned char conv_idx[CITY_MAX_PERSONS];
-    for (i = 0; i < CITY_MAX_PERSONS; i++) {
-        conv_idx[i] = u4fgetc(ult);
-    }
+    memcpy(conv_idx, p + CITY_MAX_PERSONS * 7, sizeof(conv_idx));
 
     for (i = 0; i < CITY_MAX_PERSONS; i++) {
         people[i]->getStart().z = 0;
@@ -289,67 +288,66 @@ bool DngMapLoader::load(Map *map) {
 
     /* load the dungeon map */
     unsigned int i, j;
-    for (i = 0; i < (DNG_HEIGHT * DNG_WIDTH * dungeon->levels); i++) {
-        unsigned char mapData = u4fgetc(dng);
-        MapTile tile = map->translateFromRawTileIndex(mapData);
+    unsigned int mapSize = DNG_HEIGHT * DNG_WIDTH * dungeon->levels;
+    const uint8_t *mapData = u4fspan(dng, mapSize);
+    if (!mapData)
+        return false;
 
-        /* determine what type of tile it is */
-        dungeon->data.push_back(tile);
-        dungeon->dataSubTokens.push_back(mapData % 16);
-    }
+    size_t first = dungeon->data.size();
+    dungeon->data.resize(first + mapSize);
+    map->tilemap->translateRange(mapData, &dungeon->data[first], mapSize);
+
+    /* determine what type of tile it is */
+    dungeon->dataSubTokens.reserve(dungeon->dataSubTokens.size() + mapSize);
+    for (i = 0; i < mapSize; i++)
+        dungeon->dataSubTokens.push_back(mapData[i] % 16);
 
     /* read in the dungeon rooms */
     /* FIXME: needs a cleanup function to free this memory later */
     dungeon->rooms = new DngRoom[dungeon->n_rooms];
 
+    TileMap *base = TileMap::get("base");
     for (i = 0; i < dungeon->n_rooms; i++) {
-        unsigned char room_tiles[121];
+        DngRoom *room = &dungeon->rooms[i];
+
+        /* each room is its triggers, then its start positions, tiles and padding */
+        const uint8_t *p = u4fspan(dng, DNGROOM_NTRIGGERS * 4 + 48 + 64 + 121 + sizeof(room->buffer));
+        if (!p)
+            return false;
 
         for (j = 0; j < DNGROOM_NTRIGGERS; j++) {
-            int tmp;
-
-            dungeon->rooms[i].triggers[j].tile = TileMap::get("base")->translate(u4fgetc(dng)).id;
-
-            tmp = u4fgetc(dng);
-            if (tmp == EOF)
-                return false;
-            dungeon->rooms[i].triggers[j].x = (tmp >> 4) & 0x0F;
-            dungeon->rooms[i].triggers[j].y = tmp & 0x0F;
-
-            tmp = u4fgetc(dng);
-            if (tmp == EOF)
-                return false;
-            dungeon->rooms[i].triggers[j].change_x1 = (tmp >> 4) & 0x0F;
-            dungeon->rooms[i].triggers[j].change_y1 = tmp & 0x0F;
-
-            tmp = u4fgetc(dng);
-            if (tmp == EOF)
-                return false;
-            dungeon->rooms[i].triggers[j].change_x2 = (tmp >> 4) & 0x0F;
-            dungeon->rooms[i].triggers[j].change_y2 = tmp & 0x0F;
+            room->triggers[j].tile = base->translate(*p++).id;
+            room->triggers[j].x = (*p >> 4) & 0x0F;
+            room->triggers[j].y = *p++ & 0x0F;
+            room->triggers[j].change_x1 = (*p >> 4) & 0x0F;
+            room->triggers[j].change_y1 = *p++ & 0x0F;
+            room->triggers[j].change_x2 = (*p >> 4) & 0x0F;
+            room->triggers[j].change_y2 = *p++ & 0x0F;
+        }
+
+        unsigned char *fields[] = {
+            room->creature_tiles, room->creature_start_x, room->creature_start_y,
+            room->party_north_start_x, room->party_north_start_y,
+            room->party_east_start_x, room->party_east_start_y,
+            room->party_south_start_x, room->party_south_start_y,
+            room->party_west_start_x, room->party_west_start_y
+        };
+        const size_t sizes[] = { 16, 16, 16, 8, 8, 8, 8, 8, 8, 8, 8 };
+        for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+            memcpy(fields[j], p, sizes[j]);
+            p += sizes[j];
         }
 
-        u4fread(dng, dungeon->rooms[i].creature_tiles, sizeof(dungeon->rooms[i].creature_tiles), 1);
-        u4fread(dng, dungeon->rooms[i].creature_start_x, sizeof(dungeon->rooms[i].creature_start_x), 1);
-        u4fread(dng, dungeon->rooms[i].creature_start_y, sizeof(dungeon->rooms[i].creature_start_y), 1);
-        u4fread(dng, dungeon->rooms[i].party_north_start_x, sizeof(dungeon->rooms[i].party_north_start_x), 1);
-        u4fread(dng, dungeon->rooms[i].party_north_start_y, sizeof(dungeon->rooms[i].party_north_start_y), 1);
-        u4fread(dng, dungeon->rooms[i].party_east_start_x, sizeof(dungeon->rooms[i].party_east_start_x), 1);
-        u4fread(dng, dungeon->rooms[i].party_east_start_y, sizeof(dungeon->rooms[i].party_east_start_y), 1);
-        u4fread(dng, dungeon->rooms[i].party_south_start_x, sizeof(dungeon->rooms[i].party_south_start_x), 1);
-        u4fread(dng, dungeon->rooms[i].party_south_start_y, sizeof(dungeon->rooms[i].party_south_start_y), 1);
-        u4fread(dng, dungeon->rooms[i].party_west_start_x, sizeof(dungeon->rooms[i].party_west_start_x), 1);
-        u4fread(dng, dungeon->rooms[i].party_west_start_y, sizeof(dungeon->rooms[i].party_west_start_y), 1);
-        u4fread(dng, room_tiles, sizeof(room_tiles), 1);
-        u4fread(dng, dungeon->rooms[i].buffer, sizeof(dungeon->rooms[i].buffer), 1);
+        const uint8_t *room_tiles = p;
+        memcpy(room->buffer, p + 121, sizeof(room->buffer));
 
         /* translate each creature tile to a tile id */
-        for (j = 0; j < sizeof(dungeon->rooms[i].creature_tiles); j++)
-            dungeon->rooms[i].creature_tiles[j] = TileMap::get("base")->translate(dungeon->rooms[i].creature_tiles[j]).id;
+        for (j = 0; j < sizeof(room->creature_tiles); j++)
+            room->creature_tiles[j] = base->translate(room->creature_tiles[j]).id;
 
         /* translate each map tile to a tile id */
-        for (j = 0; j < sizeof(room_tiles); j++)
-            dungeon->rooms[i].map_data.push_back(TileMap::get("base")->translate(room_tiles[j]));
+        room->map_data.resize(121);
+        base->translateRange(room_tiles, &room->map_data[0], 121);
 
         //
         // dungeon room fixup
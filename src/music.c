@@ -27,23 +27,174 @@
 #include "music.h"
 #include "settings.h"
 #include "sound.h"
+#include "u4file.h"
 #include "xmlparse.h"
 
 static int curtrack = TRACK_NONE;
 static int prevtrack = TRACK_NONE;
 static bool music_enabled = false;
+static double music_gain = 1.0;
+
+// Seconds of each track decoded ahead of the mixer, and how often in
+// milliseconds the decoder thread tops it up
+#define MUSIC_AHEAD 0.25
+#define MUSIC_DECODE_DELAY 10
+
+// Tracks are opened when first played, and only this many kept open
+#define MUSIC_OPEN_MAX 4
 
 static SDL_AudioSpec *spec, *obtained;
-static SDL_mutex *audio_mutex;
 
+static SDL_Thread *decoder;
+static SDL_atomic_t decoding;
+
+// Only the game thread changes track[], holding track_mutex while it does,
+// since the decoder thread reads it; the decoder fills the prefetched slot
+// and the game thread empties it
+static SDL_mutex *track_mutex;
 static cm_Source *track[TRACK_MAX];
+static U4FILE *trackfile[TRACK_MAX];
+static unsigned trackused[TRACK_MAX];
+static unsigned trackclock = 0;
+static char trackpath[TRACK_MAX][128];
+
+// stb_vorbis sets up shared tables as it opens a stream, so the threads
+// take turns opening tracks
+static SDL_mutex *load_mutex;
+
+static SDL_atomic_t prefetch;
+static int prefetchedtrack = TRACK_NONE;
+static cm_Source *prefetched;
+static U4FILE *prefetchedfile;
+
+// The track most likely to be wanted after each one; combat can break out
+// almost anywhere, and leaving Lord British returns to the castle
+static const int likely[TRACK_MAX] = {
+	TRACK_NONE,		// TRACK_NONE
+	TRACK_COMBAT,	// TRACK_OUTSIDE
+	TRACK_COMBAT,	// TRACK_TOWNS
+	TRACK_OUTSIDE,	// TRACK_SHRINES
+	TRACK_NONE,		// TRACK_SHOPPING
+	TRACK_CASTLES,	// TRACK_RULEBRIT
+	TRACK_NONE,		// TRACK_FANFARE
+	TRACK_COMBAT,	// TRACK_DUNGEON
+	TRACK_NONE,		// TRACK_COMBAT
+	TRACK_COMBAT,	// TRACK_CASTLES
+};
+
+static cm_Source *zu4_music_load(int music, U4FILE **file) {
+	// Open a track from its mapped file; nothing is sent to the mixer, so
+	// this is safe on either thread
+	*file = NULL;
+	if (!trackpath[music][0]) { return NULL; }
+	
+	// Without the decoder thread the mixer decodes from the file itself, so
+	// it gets a copy that lives as long as the source
+	if (!decoder) {
+		cm_Source *src = cm_new_source_from_file(trackpath[music]);
+		if (!src) {
+			zu4_error(ZU4_LOG_WRN, "Couldn't load music: %s\n", trackpath[music]);
+		}
+		return src;
+	}
+	
+	U4FILE *f = u4fopen_stdio(trackpath[music]);
+	if (!f) {
+		zu4_error(ZU4_LOG_WRN, "Couldn't open music: %s\n", trackpath[music]);
+		return NULL;
+	}
+	
+	long len = u4flength(f);
+	const uint8_t *data = u4fspan(f, len);
+	SDL_LockMutex(load_mutex);
+	cm_Source *src = data ? cm_new_source_from_mem((void*)data, len) : NULL;
+	SDL_UnlockMutex(load_mutex);
+	if (!src) {
+		zu4_error(ZU4_LOG_WRN, "Couldn't load music: %s\n", trackpath[music]);
+		u4fclose(f);
+		return NULL;
+	}
+	
+	cm_set_ahead(src, MUSIC_AHEAD);
+	*file = f;
+	return src;
+}
 
-static void lock_handler(cm_Event *e) {
-	if (e->type == CM_EVENT_LOCK) {
-		SDL_LockMutex(audio_mutex);
+static void zu4_music_close(int music) {
+	// Release an open track; the decoder won't touch it once it is out of
+	// track[], and the mixer never reads the file itself
+	SDL_LockMutex(track_mutex);
+	cm_Source *src = track[music];
+	U4FILE *f = trackfile[music];
+	track[music] = NULL;
+	trackfile[music] = NULL;
+	SDL_UnlockMutex(track_mutex);
+	
+	if (src) { cm_destroy_source(src); }
+	if (f) { u4fclose(f); }
+}
+
+static void zu4_music_add(int music, cm_Source *src, U4FILE *f) {
+	// Make room by closing the least recently played track, then add this one
+	int open = 0, oldest = TRACK_NONE;
+	for (int i = 1; i < TRACK_MAX; i++) {
+		if (!track[i]) { continue; }
+		open++;
+		if (i != curtrack && (oldest == TRACK_NONE || trackused[i] < trackused[oldest])) {
+			oldest = i;
+		}
 	}
-	if (e->type == CM_EVENT_UNLOCK) {
-		SDL_UnlockMutex(audio_mutex);
+	if (open >= MUSIC_OPEN_MAX && oldest != TRACK_NONE) {
+		zu4_music_close(oldest);
+	}
+	
+	SDL_LockMutex(track_mutex);
+	track[music] = src;
+	trackfile[music] = f;
+	SDL_UnlockMutex(track_mutex);
+	
+	trackused[music] = ++trackclock;
+	cm_set_loop(src, 1);
+	cm_set_gain(src, music_gain);
+}
+
+static void zu4_music_collect() {
+	// Take over a track the decoder thread has opened in the background
+	SDL_LockMutex(track_mutex);
+	int music = prefetchedtrack;
+	cm_Source *src = prefetched;
+	U4FILE *f = prefetchedfile;
+	prefetchedtrack = TRACK_NONE;
+	prefetched = NULL;
+	prefetchedfile = NULL;
+	SDL_UnlockMutex(track_mutex);
+	
+	if (!src) { return; }
+	if (track[music]) { // Opened here in the meantime
+		cm_destroy_source(src);
+		u4fclose(f);
+	}
+	else {
+		zu4_music_add(music, src, f);
+	}
+}
+
+static cm_Source *zu4_music_open(int music) {
+	// Return a track, opening it if it isn't already
+	zu4_music_collect();
+	if (music <= TRACK_NONE || music >= TRACK_MAX) { return NULL; }
+	if (track[music]) { return track[music]; }
+	
+	U4FILE *f;
+	cm_Source *src = zu4_music_load(music, &f);
+	if (src) { zu4_music_add(music, src, f); }
+	return src;
+}
+
+void zu4_music_prefetch(int music) {
+	// Have the decoder thread open a track that is likely to play soon
+	if (music > TRACK_NONE && music < TRACK_MAX && !track[music] && decoder) {
+		SDL_AtomicSet(&prefetch, music);
 	}
 }
 
@@ -52,14 +203,19 @@ void zu4_music_play(int music) {
 		if (curtrack == music) { return; }
 		else {
 			zu4_music_stop();
+			cm_Source *src = zu4_music_open(music);
+			if (!src) { return; }
 			curtrack = music;
-			cm_play(track[curtrack]);
+			trackused[music] = ++trackclock;
+			cm_play(src);
+			zu4_music_prefetch(likely[music]);
 		}
 	}
 }
 
 void zu4_music_stop() {
-	if (curtrack && (cm_get_state(track[curtrack]) != CM_STATE_STOPPED)) {
+	// The mixer may not have started the track yet, so don't go by its state
+	if (curtrack && track[curtrack]) {
 		cm_stop(track[curtrack]);
 	}
 	prevtrack = curtrack;
@@ -75,9 +231,11 @@ void zu4_music_fadein(int msecs, bool loadFromMap) { // Implement later
 }
 
 void zu4_music_vol(double volume) {
-	// Every source has to be done independently
+	// Every open source has to be done independently, and the rest get the
+	// volume when they are opened
+	music_gain = volume;
 	for (int i = 1; i < TRACK_MAX; i++) {
-		cm_set_gain(track[i], volume);
+		if (track[i]) { cm_set_gain(track[i], volume); }
 	}
 }
 
@@ -99,26 +257,70 @@ bool zu4_music_toggle() {
 	return music_enabled;
 }
 
+void zu4_music_mute() {
+	// Silence the mixer, music and sound effects alike, without touching
+	// the volume settings
+	cm_set_master_gain(0);
+}
+
 static void zu4_audio_cb(void *userdata, Uint8 *stream, int len) {
 	cm_process((cm_Int16*)stream, len / 2);
 }
 
+static void zu4_music_decode_prefetch() {
+	// Open the track asked for by zu4_music_prefetch, if there's room for it
+	int music = SDL_AtomicSet(&prefetch, TRACK_NONE);
+	if (music == TRACK_NONE) { return; }
+	
+	SDL_LockMutex(track_mutex);
+	bool wanted = !track[music] && !prefetched;
+	SDL_UnlockMutex(track_mutex);
+	if (!wanted) { return; }
+	
+	U4FILE *f;
+	cm_Source *src = zu4_music_load(music, &f);
+	if (!src) { return; }
+	cm_fill_ahead(src);
+	
+	SDL_LockMutex(track_mutex);
+	prefetchedtrack = music;
+	prefetched = src;
+	prefetchedfile = f;
+	SDL_UnlockMutex(track_mutex);
+}
+
+static int zu4_music_decode(void *data) {
+	// Decode the open tracks ahead of the mixer, so the audio callback only
+	// mixes
+	while (SDL_AtomicGet(&decoding)) {
+		zu4_music_decode_prefetch();
+		
+		SDL_LockMutex(track_mutex);
+		for (int i = 1; i < TRACK_MAX; i++) {
+			if (track[i]) { cm_fill_ahead(track[i]); }
+		}
+		SDL_UnlockMutex(track_mutex);
+		
+		SDL_Delay(MUSIC_DECODE_DELAY);
+	}
+	return 0;
+}
+
 static void zu4_music_free_files() {
-	for (int i = 0; i < TRACK_MAX; i++) {
-		if (track[i]) { free(track[i]); }
+	zu4_music_collect();
+	for (int i = 1; i < TRACK_MAX; i++) {
+		if (track[i]) { zu4_music_close(i); }
 	}
 }
 
-static void zu4_music_load_files() {
+static void zu4_music_find_files() {
+	// Only the names are read here; each track is opened when first played
 	zu4_xmlparse_init("conf/music.xml");
 	
-	char trackfile[64]; // Buffer for track filenames that are found
-	char trackpath[128]; // Buffer for full path to track
+	char trackname[64]; // Buffer for track filenames that are found
 	int index = 1; // Start at 1 because track 0 is silence, and has no file
-	while (zu4_xmlparse_find(trackfile, "track", "file")) {
-		snprintf(trackpath, sizeof(trackpath), "%s%s", "music/", trackfile);
-		track[index] = cm_new_source_from_file(trackpath);
-		cm_set_loop(track[index++], 1);
+	while (index < TRACK_MAX && zu4_xmlparse_find(trackname, "track", "file")) {
+		snprintf(trackpath[index++], sizeof(trackpath[0]), "%s%s", "music/", trackname);
 	}
 	
 	zu4_xmlparse_deinit();
@@ -126,7 +328,6 @@ static void zu4_music_load_files() {
 
 void zu4_music_init() {
 	SDL_InitSubSystem(SDL_INIT_AUDIO);
-	audio_mutex = SDL_CreateMutex();
 	spec = (SDL_AudioSpec*)malloc(sizeof(SDL_AudioSpec));
 	obtained = (SDL_AudioSpec*)malloc(sizeof(SDL_AudioSpec));
 	
@@ -134,7 +335,7 @@ void zu4_music_init() {
 	spec->freq = 44100;
 	spec->format = AUDIO_S16SYS;
 	spec->silence = 0;
-	spec->samples = 512;
+	spec->samples = 256;
 	spec->userdata = 0;
 	spec->callback = zu4_audio_cb;
 	
@@ -144,18 +345,33 @@ void zu4_music_init() {
 	free(spec);
 	
 	cm_init(obtained->freq);
-	cm_set_lock(lock_handler);
 	
-	zu4_music_load_files();
+	zu4_music_find_files();
 	music_enabled = settings.musicVol;
 	
 	zu4_music_vol((double)settings.musicVol / MAX_VOLUME);
 	
+	track_mutex = SDL_CreateMutex();
+	load_mutex = SDL_CreateMutex();
+	SDL_AtomicSet(&prefetch, TRACK_NONE);
+	SDL_AtomicSet(&decoding, 1);
+	decoder = SDL_CreateThread(zu4_music_decode, "music", NULL);
+	if (!decoder) {
+		zu4_error(ZU4_LOG_WRN, "Couldn't start music decoder: %s\n", SDL_GetError());
+	}
+	
 	SDL_PauseAudio(0);
 }
 
 void zu4_music_deinit() {
+	SDL_AtomicSet(&decoding, 0);
+	if (decoder) { SDL_WaitThread(decoder, NULL); }
+	
+	// Once the callback has stopped, the queued destroys are run here
+	SDL_CloseAudio();
 	zu4_music_free_files();
+	cm_flush();
+	SDL_DestroyMutex(track_mutex);
+	SDL_DestroyMutex(load_mutex);
 	free(obtained);
-	SDL_CloseAudio();
 }
@@ -25,6 +25,7 @@ enum MusicTrack {
 };
 
 void zu4_music_play(int);
+void zu4_music_prefetch(int);
 void zu4_music_stop();
 void zu4_music_fadeout(int);
 void zu4_music_fadein(int, bool);
@@ -32,6 +33,7 @@ void zu4_music_vol(double);
 int zu4_music_vol_dec();
 int zu4_music_vol_inc();
 bool zu4_music_toggle();
+void zu4_music_mute();
 void zu4_music_init();
 void zu4_music_deinit();
 
@@ -12,6 +12,16 @@ bool Object::setDirection(Direction d) {
     return tile.setDirection(d);
 }
 
+/**
+ * Moves the object, keeping the object index of each map it is on in step
+ */
+void Object::setCoords(Coords c) {
+    prevCoords = coords;
+    coords = c;
+    for (unsigned int i = 0; i < maps.size(); i++)
+        maps[i]->objectMoved(this);
+}
+
 void Object::setMap(struct Map *m) {
     if (find(maps.begin(), maps.end(), m) == maps.end())
         maps.push_back(m);
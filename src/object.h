@@ -52,7 +52,7 @@ public:
     void setTile(MapTile t)                 { tile = t; }
     void setTile(Tile *t)                   {tile = t->getId();}
     void setPrevTile(MapTile t)             { prevTile = t; }
-    void setCoords(Coords c)                { prevCoords = coords; coords = c; }
+    void setCoords(Coords c);
     void setPrevCoords(Coords c)            { prevCoords = c; }
     void setMovementBehavior(ObjectMovementBehavior b)          { movement_behavior = b; }
     void setType(Type t)                    { objType = t; }
@@ -0,0 +1,69 @@
+/*
+ * perf.c
+ *
+ * Per-frame timing of the renderer, summed over each frame and reported
+ * as averages and worst cases over all the frames seen.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <time.h>
+
+#include "perf.h"
+
+typedef struct PerfStat {
+	uint64_t frame;     // time spent in the current frame
+	uint64_t total;
+	uint64_t max;
+	uint64_t calls;
+} PerfStat;
+
+static const char *perfNames[PERF_COUNTERS] = {
+	"screenUpdate", "line of sight", "blit"
+};
+
+static PerfStat perfStats[PERF_COUNTERS];
+static uint64_t perfFrames = 0;
+
+bool zu4_perf_enabled = false;
+
+uint64_t zu4_perf_now() {
+	// Return a monotonic timestamp in nanoseconds
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void zu4_perf_add(int counter, uint64_t start) {
+	// Charge the time since start to a counter
+	perfStats[counter].frame += zu4_perf_now() - start;
+	perfStats[counter].calls++;
+}
+
+void zu4_perf_frame() {
+	// Close off the current frame
+	for (int i = 0; i < PERF_COUNTERS; i++) {
+		PerfStat *stat = &perfStats[i];
+		stat->total += stat->frame;
+		if (stat->frame > stat->max)
+			stat->max = stat->frame;
+		stat->frame = 0;
+	}
+	perfFrames++;
+}
+
+void zu4_perf_report(FILE *out) {
+	// Print the average and worst time per frame for each counter
+	fprintf(out, "%llu frames\n", (unsigned long long)perfFrames);
+	if (!perfFrames)
+		return;
+	
+	for (int i = 0; i < PERF_COUNTERS; i++) {
+		PerfStat *stat = &perfStats[i];
+		fprintf(out, "%-16s avg %9.1f us  max %9.1f us  %8.1f calls/frame\n",
+			perfNames[i],
+			stat->total / 1000.0 / perfFrames,
+			stat->max / 1000.0,
+			(double)stat->calls / perfFrames);
+	}
+}
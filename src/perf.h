@@ -0,0 +1,44 @@
+#ifndef PERF_H
+#define PERF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* the parts of a frame that are timed */
+enum zu4_perf_counter {
+	PERF_SCREEN_UPDATE,
+	PERF_LOS,
+	PERF_BLIT,
+	PERF_COUNTERS
+};
+
+/*
+ * Timing is off unless something turns it on, and costs a single branch
+ * per timed call while it is off.  Begin returns a timestamp to pass to
+ * end, which adds the elapsed time to the current frame.
+ */
+extern bool zu4_perf_enabled;
+
+uint64_t zu4_perf_now(void);
+void zu4_perf_add(int counter, uint64_t start);
+void zu4_perf_frame(void);
+void zu4_perf_report(FILE *out);
+
+static inline uint64_t zu4_perf_begin(void) {
+	return zu4_perf_enabled ? zu4_perf_now() : 0;
+}
+
+static inline void zu4_perf_end(int counter, uint64_t start) {
+	if (zu4_perf_enabled) zu4_perf_add(counter, start);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
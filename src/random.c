@@ -20,31 +20,73 @@
  * 
  */
 
-#include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 
+#include "random.h"
+
+/*
+ * xoshiro128** (Blackman and Vigna).  All of the generator's state is
+ * here, so a run seeded with the same value draws the same numbers on
+ * every platform, unlike rand().
+ */
+static uint32_t state[4];
+static unsigned int seed;
+
+static uint32_t rotl(uint32_t x, int k) {
+	return (x << k) | (x >> (32 - k));
+}
+
+static uint32_t next(void) {
+	uint32_t result = rotl(state[1] * 5, 7) * 9;
+	uint32_t t = state[1] << 9;
+
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+	state[2] ^= t;
+	state[3] = rotl(state[3], 11);
+
+	return result;
+}
+
 /**
- * Seed the random number generator.
+ * Seed the random number generator from the clock.
  */
 void zu4_srandom() {
-#if (defined(BSD) && (BSD >= 199103))
-	srandom(time(NULL));
-#else
-	srand((unsigned int)time(NULL));
-#endif
+	zu4_srandom_seed((unsigned int)time(NULL));
+}
+
+/**
+ * Seed the random number generator with a fixed value, for runs that
+ * need to be reproducible.
+ */
+void zu4_srandom_seed(unsigned int s) {
+	// Spread the seed over the state with splitmix32, which never leaves it all zero
+	uint32_t x = s;
+	int i;
+
+	seed = s;
+	for (i = 0; i < 4; i++) {
+		uint32_t z = (x += 0x9e3779b9);
+		z = (z ^ (z >> 16)) * 0x85ebca6b;
+		z = (z ^ (z >> 13)) * 0xc2b2ae35;
+		state[i] = z ^ (z >> 16);
+	}
+}
+
+/**
+ * Returns the value the generator was last seeded with.
+ */
+unsigned int zu4_random_seed(void) {
+	return seed;
 }
 
 /**
- * Generate a random number between 0 and (upperRange - 1).  This
- * routine uses the upper bits of the random number provided by rand()
- * to compensate for older generators that have low entropy in the
- * lower bits (e.g. MacOS X).
+ * Generate a random number between 0 and (upperRange - 1), scaling the
+ * full 32 bits rather than taking a remainder.
  */
 int zu4_random(int upperRange) {
-#if (defined(BSD) && (BSD >= 199103))
-	int r = random();
-#else
-	int r = rand();
-#endif
-	return (int) ((((double)upperRange) * r) / (RAND_MAX+1.0));
+	return (int)(((int64_t)upperRange * next()) >> 32);
 }
@@ -6,6 +6,8 @@ extern "C" {
 #endif
 
 void zu4_srandom(void);
+void zu4_srandom_seed(unsigned int seed);
+unsigned int zu4_random_seed(void);
 int zu4_random(int upperval);
 
 #ifdef __cplusplus
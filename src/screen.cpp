@@ -9,12 +9,16 @@
 
 #include "screen.h"
 
+#include "annotation.h"
 #include "config.h"
 #include "dungeonview.h"
 #include "error.h"
+#include "harness.h"
 #include "intro.h"
 #include "imagemgr.h"
+#include "los.h"
 #include "names.h"
+#include "perf.h"
 #include "tileanim.h"
 #include "video.h"
 #include "u4.h"
@@ -52,18 +56,28 @@ TileAnimSet *tileanims = NULL;
 ImageInfo *charsetInfo = NULL;
 ImageInfo *gemTilesInfo = NULL;
 
-void screenFindLineOfSight(std::vector<MapTile> viewportTiles[VIEWPORT_W][VIEWPORT_H]);
-void screenFindLineOfSightDOS(std::vector<MapTile> viewportTiles[VIEWPORT_W][VIEWPORT_H]);
-void screenFindLineOfSightEnhanced(std::vector<MapTile> viewportTiles[VIEWPORT_W][VIEWPORT_H]);
+/* bumped whenever the graphics are reloaded, to redraw the maps' gem views */
+static unsigned int gemSet = 0;
+
+void screenFindLineOfSight(TileStack viewportTiles[VIEWPORT_W][VIEWPORT_H]);
 
 int screenNeedPrompt = 1;
 int screenCurrentCycle = 0;
+unsigned int screenCycleCount = 0; /* cycles since startup; tile animations advance once per cycle */
 int screenCursorX = 0;
 int screenCursorY = 0;
 int screenCursorStatus = 0;
 int screenCursorEnabled = 1;
 int screenLos[VIEWPORT_W][VIEWPORT_H];
 
+/* the tile stacks of the viewport, reused from one redraw to the next */
+static TileStack screenViewportTiles[VIEWPORT_W][VIEWPORT_H];
+static bool screenViewportFocus[VIEWPORT_W][VIEWPORT_H];
+
+/* the character last drawn in each text cell, to skip redrawing unchanged text */
+static int screenChars[SCREEN_WIDTH / CHAR_WIDTH][SCREEN_HEIGHT / CHAR_HEIGHT];
+static uint32_t screenCharSerials[SCREEN_WIDTH / CHAR_WIDTH][SCREEN_HEIGHT / CHAR_HEIGHT];
+
 static const int BufferSize = 1024;
 
 extern bool verbose;
@@ -78,6 +92,8 @@ void screenInit() {
 
     charsetInfo = NULL;
     gemTilesInfo = NULL;
+    gemSet++;
+    memset(screenChars, -1, sizeof(screenChars));
 
     screenLoadGraphicsFromConf();
 
@@ -130,6 +146,13 @@ void screenDelete() {
     for (i = layouts.begin(); i != layouts.end(); i++)
         delete(*i);
     layouts.clear();
+
+    /* tiles drop their animations with their images, before this */
+    std::vector<TileAnimSet *>::const_iterator j;
+    for (j = tileanimSets.begin(); j != tileanimSets.end(); j++)
+        delete(*j);
+    tileanimSets.clear();
+    tileanims = NULL;
     zu4_video_deinit();
 
     ImageMgr::destroy();
@@ -141,6 +164,8 @@ void screenDelete() {
 void screenReInit() {
     intro->deleteIntro();       /* delete intro stuff */
     Tileset::unloadAllImages(); /* unload tilesets, which will be reloaded lazily as needed */
+    if (DungeonView::instance)
+        DungeonView::instance->clearScaledTiles(); /* scaled dungeon tiles were made from the old images */
     ImageMgr::destroy();
     tileanims = NULL;
     screenDelete(); /* delete screen stuff */
@@ -321,7 +346,7 @@ Layout *screenLoadLayoutFromConf(const ConfigElement &conf) {
     return layout;
 }
 
-std::vector<MapTile> screenViewportTile(unsigned int width, unsigned int height, int x, int y, bool &focus) {
+TileStack screenViewportTile(unsigned int width, unsigned int height, int x, int y, bool &focus) {
     Coords center = c->location->coords;
     static MapTile grass = c->location->map->tileset->getByName("grass")->getId();
 
@@ -342,7 +367,7 @@ std::vector<MapTile> screenViewportTile(unsigned int width, unsigned int height,
     /* off the edge of the map: pad with grass tiles */
     if (MAP_IS_OOB(c->location->map, tc)) {
         focus = false;
-        std::vector<MapTile> result;
+        TileStack result;
         result.push_back(grass);
         return result;
     }
@@ -363,7 +388,7 @@ bool screenTileUpdate(TileView *view, const Coords &coords, bool redraw)
 	mc.x = coords.x; mc.y = coords.y; mc.z = coords.z;
 	wrap(&mc, c->location->map);
 	Coords mc2(mc);
-	std::vector<MapTile> tiles = c->location->tilesAt(mc2, focus);
+	TileStack tiles = c->location->tilesAt(mc2, focus);
 
 	// Get the screen coordinates
 	int x = coords.x;
@@ -399,6 +424,11 @@ bool screenTileUpdate(TileView *view, const Coords &coords, bool redraw)
 void screenUpdate(TileView *view, bool showmap, bool blackout) {
     zu4_assert(c != NULL, "context has not yet been initialized");
 
+    /* nothing is shown when simulating, so don't draw the map at all */
+    if (harnessSimulating())
+        return;
+
+    uint64_t t = zu4_perf_begin();
     //screenLock();
 
     if (blackout)
@@ -416,21 +446,20 @@ void screenUpdate(TileView *view, bool showmap, bool blackout) {
 
         int x, y;
 
-        std::vector<MapTile> viewportTiles[VIEWPORT_W][VIEWPORT_H];
-        bool viewportFocus[VIEWPORT_W][VIEWPORT_H];
-
         for (y = 0; y < VIEWPORT_H; y++) {
             for (x = 0; x < VIEWPORT_W; x++) {
-                viewportTiles[x][y] = screenViewportTile(VIEWPORT_W, VIEWPORT_H, x, y, viewportFocus[x][y]);
+                screenViewportTiles[x][y] = screenViewportTile(VIEWPORT_W, VIEWPORT_H, x, y, screenViewportFocus[x][y]);
             }
         }
 
-		screenFindLineOfSight(viewportTiles);
+        uint64_t tlos = zu4_perf_begin();
+        screenFindLineOfSight(screenViewportTiles);
+        zu4_perf_end(PERF_LOS, tlos);
 
         for (y = 0; y < VIEWPORT_H; y++) {
             for (x = 0; x < VIEWPORT_W; x++) {
                 if (screenLos[x][y]) {
-               		view->drawTile(viewportTiles[x][y], viewportFocus[x][y], x, y);
+               		view->drawTile(screenViewportTiles[x][y], screenViewportFocus[x][y], x, y);
                 }
                 else
                     view->drawTile(black, false, x, y);
@@ -444,6 +473,7 @@ void screenUpdate(TileView *view, bool showmap, bool blackout) {
     screenUpdateWind();
 
     //screenUnlock();
+    zu4_perf_end(PERF_SCREEN_UPDATE, t);
 }
 
 /**
@@ -522,9 +552,23 @@ void screenShowChar(int chr, int x, int y) {
             zu4_error(ZU4_LOG_ERR, "ERROR 1001: Unable to load the \"%s\" data file.\t\n\nIs Ultima IV installed?\n\nVisit the XU4 website for additional information.\n\thttp://xu4.sourceforge.net/", BKGD_CHARSET);
     }
 
-    zu4_img_draw_subrect(charsetInfo->image, x * charsetInfo->image->w, y * CHAR_HEIGHT,
+    int px = x * charsetInfo->image->w;
+    int py = y * CHAR_HEIGHT;
+    bool cached = x >= 0 && y >= 0 && x < SCREEN_WIDTH / CHAR_WIDTH && y < SCREEN_HEIGHT / CHAR_HEIGHT;
+
+    /* nothing to do if the character is already there and hasn't been drawn over */
+    if (cached && screenChars[x][y] == chr &&
+        screenCharSerials[x][y] == zu4_img_damage_serial(px, py, charsetInfo->image->w, CHAR_HEIGHT))
+        return;
+
+    zu4_img_draw_subrect(charsetInfo->image, px, py,
                                     0, chr * CHAR_HEIGHT,
                                     charsetInfo->image->w, CHAR_HEIGHT);
+
+    if (cached) {
+        screenChars[x][y] = chr;
+        screenCharSerials[x][y] = zu4_img_damage_serial(px, py, charsetInfo->image->w, CHAR_HEIGHT);
+    }
 }
 
 /**
@@ -553,6 +597,7 @@ void screenScrollMessageArea() {
 void screenCycle() {
     if (++screenCurrentCycle >= SCR_CYCLE_MAX)
         screenCurrentCycle = 0;
+    screenCycleCount++;
 }
 
 void screenUpdateCursor() {
@@ -631,9 +676,10 @@ void screenSetCursorPos(int x, int y) {
 
 /**
  * Finds which tiles in the viewport are visible from the avatars
- * location in the middle. (original DOS algorithm)
+ * location in the middle, using either the original DOS algorithm
+ * or the enhanced shadow rasters.
  */
-void screenFindLineOfSight(std::vector <MapTile> viewportTiles[VIEWPORT_W][VIEWPORT_H]) {
+void screenFindLineOfSight(TileStack viewportTiles[VIEWPORT_W][VIEWPORT_H]) {
     int x, y;
 
     if (!c)
@@ -652,304 +698,23 @@ void screenFindLineOfSight(std::vector <MapTile> viewportTiles[VIEWPORT_W][VIEWP
     }
 
     /*
-     * otherwise calculate it from the map data
+     * otherwise calculate it from the opaque tiles in view
      */
+    uint16_t opaque[VIEWPORT_H], visible[VIEWPORT_H];
+
     for (y = 0; y < VIEWPORT_H; y++) {
+        opaque[y] = 0;
         for (x = 0; x < VIEWPORT_W; x++) {
-            screenLos[x][y] = 0;
-        }
-    }
-
-    if (!settings.lineOfSight)
-        screenFindLineOfSightDOS(viewportTiles);
-    else if (settings.lineOfSight)
-        screenFindLineOfSightEnhanced(viewportTiles);
-    else
-        zu4_error(ZU4_LOG_ERR, "unknown line of sight style %s!\n", settings.lineOfSight ? "Enhanced" : "DOS");
-}
-
-/**
- * Finds which tiles in the viewport are visible from the avatars
- * location in the middle. (original DOS algorithm)
- */
-void screenFindLineOfSightDOS(std::vector <MapTile> viewportTiles[VIEWPORT_W][VIEWPORT_H]) {
-    int x, y;
-
-    screenLos[VIEWPORT_W / 2][VIEWPORT_H / 2] = 1;
-
-    for (x = VIEWPORT_W / 2 - 1; x >= 0; x--)
-        if (screenLos[x + 1][VIEWPORT_H / 2] &&
-            !viewportTiles[x + 1][VIEWPORT_H / 2].front().getTileType()->isOpaque())
-            screenLos[x][VIEWPORT_H / 2] = 1;
-
-    for (x = VIEWPORT_W / 2 + 1; x < VIEWPORT_W; x++)
-        if (screenLos[x - 1][VIEWPORT_H / 2] &&
-            !viewportTiles[x - 1][VIEWPORT_H / 2].front().getTileType()->isOpaque())
-            screenLos[x][VIEWPORT_H / 2] = 1;
-
-    for (y = VIEWPORT_H / 2 - 1; y >= 0; y--)
-        if (screenLos[VIEWPORT_W / 2][y + 1] &&
-            !viewportTiles[VIEWPORT_W / 2][y + 1].front().getTileType()->isOpaque())
-            screenLos[VIEWPORT_W / 2][y] = 1;
-
-    for (y = VIEWPORT_H / 2 + 1; y < VIEWPORT_H; y++)
-        if (screenLos[VIEWPORT_W / 2][y - 1] &&
-            !viewportTiles[VIEWPORT_W / 2][y - 1].front().getTileType()->isOpaque())
-            screenLos[VIEWPORT_W / 2][y] = 1;
-
-    for (y = VIEWPORT_H / 2 - 1; y >= 0; y--) {
-
-        for (x = VIEWPORT_W / 2 - 1; x >= 0; x--) {
-            if (screenLos[x][y + 1] &&
-                !viewportTiles[x][y + 1].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-            else if (screenLos[x + 1][y] &&
-                     !viewportTiles[x + 1][y].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-            else if (screenLos[x + 1][y + 1] &&
-                     !viewportTiles[x + 1][y + 1].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-        }
-
-        for (x = VIEWPORT_W / 2 + 1; x < VIEWPORT_W; x++) {
-            if (screenLos[x][y + 1] &&
-                !viewportTiles[x][y + 1].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-            else if (screenLos[x - 1][y] &&
-                     !viewportTiles[x - 1][y].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-            else if (screenLos[x - 1][y + 1] &&
-                     !viewportTiles[x - 1][y + 1].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
+            if (viewportTiles[x][y].front().getTileType()->isOpaque())
+                opaque[y] |= 1 << x;
         }
     }
 
-    for (y = VIEWPORT_H / 2 + 1; y < VIEWPORT_H; y++) {
-
-        for (x = VIEWPORT_W / 2 - 1; x >= 0; x--) {
-            if (screenLos[x][y - 1] &&
-                !viewportTiles[x][y - 1].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-            else if (screenLos[x + 1][y] &&
-                     !viewportTiles[x + 1][y].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-            else if (screenLos[x + 1][y - 1] &&
-                     !viewportTiles[x + 1][y - 1].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-        }
-
-        for (x = VIEWPORT_W / 2 + 1; x < VIEWPORT_W; x++) {
-            if (screenLos[x][y - 1] &&
-                !viewportTiles[x][y - 1].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-            else if (screenLos[x - 1][y] &&
-                     !viewportTiles[x - 1][y].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-            else if (screenLos[x - 1][y - 1] &&
-                     !viewportTiles[x - 1][y - 1].front().getTileType()->isOpaque())
-                screenLos[x][y] = 1;
-        }
-    }
-}
-
-/**
- * Finds which tiles in the viewport are visible from the avatars
- * location in the middle.
- *
- * A new, more accurate LOS function
- *
- * Based somewhat off Andy McFadden's 1994 article,
- *   "Improvements to a Fast Algorithm for Calculating Shading
- *   and Visibility in a Two-Dimensional Field"
- *   -----
- *   http://www.fadden.com/techmisc/fast-los.html
- *
- * This function uses a lookup table to get the correct shadowmap,
- * therefore, the table will need to be updated if the viewport
- * dimensions increase. Also, the function assumes that the
- * viewport width and height are odd values and that the player
- * is always at the center of the screen.
- */
-void screenFindLineOfSightEnhanced(std::vector <MapTile> viewportTiles[VIEWPORT_W][VIEWPORT_H]) {
-    int x, y;
+    zu4_los_find(opaque, settings.lineOfSight ? LOS_ENHANCED : LOS_DOS, visible);
 
-    /*
-     * the shadow rasters for each viewport octant
-     *
-     * shadowRaster[0][0]    // number of raster segments in this shadow
-     * shadowRaster[0][1]    // #1 shadow bitmask value (low three bits) + "newline" flag (high bit)
-     * shadowRaster[0][2]    // #1 length
-     * shadowRaster[0][3]    // #2 shadow bitmask value
-     * shadowRaster[0][4]    // #2 length
-     * shadowRaster[0][5]    // #3 shadow bitmask value
-     * shadowRaster[0][6]    // #3 length
-     * ...etc...
-     */
-    const int shadowRaster[14][13] = {
-        { 6, __VCH, 4, _N_CH, 1, __VCH, 3, _N___, 1, ___CH, 1, __VCH, 1 },    // raster_1_0
-        { 6, __VC_, 1, _NVCH, 2, __VC_, 1, _NVCH, 3, _NVCH, 2, _NVCH, 1 },    // raster_1_1
-        //
-        { 4, __VCH, 3, _N__H, 1, ___CH, 1, __VCH, 1,     0, 0,     0, 0 },    // raster_2_0
-        { 6, __VC_, 2, _N_CH, 1, __VCH, 2, _N_CH, 1, __VCH, 1, _N__H, 1 },    // raster_2_1
-        { 6, __V__, 1, _NVCH, 1, __VC_, 1, _NVCH, 1, __VC_, 1, _NVCH, 1 },    // raster_2_2
-        //
-        { 2, __VCH, 2, _N__H, 2,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_3_0
-        { 3, __VC_, 2, _N_CH, 1, __VCH, 1,     0, 0,     0, 0,     0, 0 },    // raster_3_1
-        { 3, __VC_, 1, _NVCH, 2, _N_CH, 1,     0, 0,     0, 0,     0, 0 },    // raster_3_2
-        { 3, _NVCH, 1, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0 },    // raster_3_3
-        //
-        { 2, __VCH, 1, _N__H, 1,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_4_0
-        { 2, __VC_, 1, _N__H, 1,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_4_1
-        { 2, __VC_, 1, _N_CH, 1,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_4_2
-        { 2, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0,     0, 0 },    // raster_4_3
-        { 2, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0,     0, 0 }     // raster_4_4
-    };
-
-    /*
-     * As each viewport tile is processed, it will store the bitmask for the shadow it casts.
-     * Later, after processing all octants, the entire viewport will be marked visible except
-     * for those tiles that have the __VCH bitmask.
-     */
-    const int _OCTANTS = 8;
-    const int _NUM_RASTERS_COLS = 4;
-
-    int octant;
-    int xOrigin, yOrigin, xSign, ySign, reflect, xTile, yTile, xTileOffset, yTileOffset;
-
-    for (octant = 0; octant < _OCTANTS; octant++) {
-        switch (octant) {
-            case 0:  xSign=  1;  ySign=  1;  reflect=false;  break;        // lower-right
-            case 1:  xSign=  1;  ySign=  1;  reflect=true;   break;
-            case 2:  xSign=  1;  ySign= -1;  reflect=true;   break;        // lower-left
-            case 3:  xSign= -1;  ySign=  1;  reflect=false;  break;
-            case 4:  xSign= -1;  ySign= -1;  reflect=false;  break;        // upper-left
-            case 5:  xSign= -1;  ySign= -1;  reflect=true;   break;
-            case 6:  xSign= -1;  ySign=  1;  reflect=true;   break;        // upper-right
-            case 7:  xSign=  1;  ySign= -1;  reflect=false;  break;
-        }
-
-        // determine the origin point for the current LOS octant
-        xOrigin = VIEWPORT_W / 2;
-        yOrigin = VIEWPORT_H / 2;
-
-        // make sure the segment doesn't reach out of bounds
-        int maxWidth      = xOrigin;
-        int maxHeight     = yOrigin;
-        int currentRaster = 0;
-
-        // just in case the viewport isn't square, swap the width and height
-        if (reflect) {
-            // swap height and width for later use
-            maxWidth ^= maxHeight;
-            maxHeight ^= maxWidth;
-            maxWidth ^= maxHeight;
-        }
-
-        // check the visibility of each tile
-        for (int currentCol = 1; currentCol <= _NUM_RASTERS_COLS; currentCol++) {
-            for (int currentRow = 0; currentRow <= currentCol; currentRow++) {
-                // swap X and Y to reflect the octant rasters
-                if (reflect) {
-                    xTile = xOrigin+(currentRow*ySign);
-                    yTile = yOrigin+(currentCol*xSign);
-                }
-                else {
-                    xTile = xOrigin+(currentCol*xSign);
-                    yTile = yOrigin+(currentRow*ySign);
-                }
-
-                if (viewportTiles[xTile][yTile].front().getTileType()->isOpaque()) {
-                    // a wall was detected, so go through the raster for this wall
-                    // segment and mark everything behind it with the appropriate
-                    // shadow bitmask.
-                    //
-                    // first, get the correct raster
-                    //
-                    if ((currentCol==1) && (currentRow==0)) { currentRaster=0; }
-                    else if ((currentCol==1) && (currentRow==1)) { currentRaster=1; }
-                    else if ((currentCol==2) && (currentRow==0)) { currentRaster=2; }
-                    else if ((currentCol==2) && (currentRow==1)) { currentRaster=3; }
-                    else if ((currentCol==2) && (currentRow==2)) { currentRaster=4; }
-                    else if ((currentCol==3) && (currentRow==0)) { currentRaster=5; }
-                    else if ((currentCol==3) && (currentRow==1)) { currentRaster=6; }
-                    else if ((currentCol==3) && (currentRow==2)) { currentRaster=7; }
-                    else if ((currentCol==3) && (currentRow==3)) { currentRaster=8; }
-                    else if ((currentCol==4) && (currentRow==0)) { currentRaster=9; }
-                    else if ((currentCol==4) && (currentRow==1)) { currentRaster=10; }
-                    else if ((currentCol==4) && (currentRow==2)) { currentRaster=11; }
-                    else if ((currentCol==4) && (currentRow==3)) { currentRaster=12; }
-                    else { currentRaster=13; }  // currentCol and currentRow must equal 4
-
-                    xTileOffset = 0;
-                    yTileOffset = 0;
-
-                    //========================================
-                    for (int currentSegment = 0; currentSegment < shadowRaster[currentRaster][0]; currentSegment++) {
-                        // each shadow segment is 2 bytes
-                        int shadowType   = shadowRaster[currentRaster][currentSegment*2+1];
-                        int shadowLength = shadowRaster[currentRaster][currentSegment*2+2];
-
-                        // update the raster length to make sure it fits in the viewport
-                        shadowLength = (shadowLength+1+yTileOffset > maxWidth ? maxWidth : shadowLength);
-
-                        // check to see if we should move up a row
-                        if (shadowType & 0x80) {
-                            // remove the flag from the shadowType
-                            shadowType ^= _N___;
-//                            if (currentRow + yTileOffset >= maxHeight) {
-                            if (currentRow + yTileOffset > maxHeight) {
-                                break;
-                            }
-                            xTileOffset = yTileOffset;
-                            yTileOffset++;
-                        }
-
-                        /* it is seemingly unnecessary to swap the edges for
-                         * shadow tiles, because we only care about shadow
-                         * tiles that have all three parts (V, C, and H)
-                         * flagged.  if a tile has fewer than three, it is
-                         * ignored during the draw phase, so vertical and
-                         * horizontal shadow edge accuracy isn't important
-                         */
-                        // if reflecting the octant, swap the edges
-//                        if (reflect) {
-//                            int shadowTemp = 0;
-//                            // swap the vertical and horizontal shadow edges
-//                            if (shadowType & __V__) { shadowTemp |= ____H; }
-//                            if (shadowType & ___C_) { shadowTemp |= ___C_; }
-//                            if (shadowType & ____H) { shadowTemp |= __V__; }
-//                            shadowType = shadowTemp;
-//                        }
-
-                        for (int currentShadow = 1; currentShadow <= shadowLength; currentShadow++) {
-                            // apply the shadow to the shadowMap
-                            if (reflect) {
-                                screenLos[xTile + ((yTileOffset) * ySign)][yTile + ((currentShadow+xTileOffset) * xSign)] |= shadowType;
-                            }
-                            else {
-                                screenLos[xTile + ((currentShadow+xTileOffset) * xSign)][yTile + ((yTileOffset) * ySign)] |= shadowType;
-                            }
-                        }
-                        xTileOffset += shadowLength;
-                    }  // for (int currentSegment = 0; currentSegment < shadowRaster[currentRaster][0]; currentSegment++)
-                    //========================================
-
-                }  // if (viewportTiles[xTile][yTile].front().getTileType()->isOpaque())
-            }  // for (int currentRow = 0; currentRow <= currentCol; currentRow++)
-        }  // for (int currentCol = 1; currentCol <= _NUM_RASTERS_COLS; currentCol++)
-    }  // for (octant = 0; octant < _OCTANTS; octant++)
-
-    // go through all tiles on the viewable area and set the appropriate visibility
     for (y = 0; y < VIEWPORT_H; y++) {
         for (x = 0; x < VIEWPORT_W; x++) {
-            // if the shadow flags equal __VCH, hide it, otherwise it's fully visible
-            //
-            if ((screenLos[x][y] & __VCH) == __VCH) {
-                screenLos[x][y] = 0;
-            }
-            else {
-                screenLos[x][y] = 1;
-            }
+            screenLos[x][y] = (visible[y] >> x) & 1;
         }
     }
 }
@@ -1019,9 +784,9 @@ void screenShake(int iterations) {
 }
 
 /**
- * Draw a tile graphic on the screen.
+ * Draw the gem view glyph for a tile onto an image.
  */
-void screenShowGemTile(Layout *layout, Map *map, MapTile &t, bool focus, int x, int y) {
+static void screenDrawGemTile(Image *dest, Layout *layout, Map *map, MapTile &t, int px, int py) {
     // Make sure we account for tiles that look like other tiles (dungeon tiles, mainly)
     std::string looks_like = t.getTileType()->getLooksLike();
     if (!looks_like.empty())
@@ -1033,8 +798,7 @@ void screenShowGemTile(Layout *layout, Map *map, MapTile &t, bool focus, int x,
         zu4_assert(charsetInfo, "charset not initialized");
         std::map<std::string, int>::iterator charIndex = dungeonTileChars.find(t.getTileType()->getName());
         if (charIndex != dungeonTileChars.end()) {
-            zu4_img_draw_subrect(charsetInfo->image, (layout->viewport.x + (x * layout->tileshape.width)),
-                                            (layout->viewport.y + (y * layout->tileshape.height)),
+            zu4_img_draw_subrect_on(dest, charsetInfo->image, px, py,
                                             0,
                                             charIndex->second * layout->tileshape.height,
                                             layout->tileshape.width,
@@ -1049,16 +813,13 @@ void screenShowGemTile(Layout *layout, Map *map, MapTile &t, bool focus, int x,
         }
 
         if (tile < 128) {
-            zu4_img_draw_subrect(gemTilesInfo->image, (layout->viewport.x + (x * layout->tileshape.width)),
-                                             (layout->viewport.y + (y * layout->tileshape.height)),
+            zu4_img_draw_subrect_on(dest, gemTilesInfo->image, px, py,
                                              0,
                                              tile * layout->tileshape.height,
                                              layout->tileshape.width,
                                              layout->tileshape.height);
         } else {
-            Image *screen = zu4_img_get_screen();
-            zu4_img_fill(screen, (layout->viewport.x + (x * layout->tileshape.width)),
-                             (layout->viewport.y + (y * layout->tileshape.height)),
+            zu4_img_fill(dest, px, py,
                              layout->tileshape.width,
                              layout->tileshape.height,
                              0, 0, 0, 255);
@@ -1066,6 +827,15 @@ void screenShowGemTile(Layout *layout, Map *map, MapTile &t, bool focus, int x,
     }
 }
 
+/**
+ * Draw a tile graphic on the screen.
+ */
+void screenShowGemTile(Layout *layout, Map *map, MapTile &t, bool focus, int x, int y) {
+    screenDrawGemTile(zu4_img_get_screen(), layout, map, t,
+                      layout->viewport.x + (x * layout->tileshape.width),
+                      layout->viewport.y + (y * layout->tileshape.height));
+}
+
 Layout *screenGetGemLayout(const Map *map) {
     if (map->type == Map::DUNGEON) {
         std::vector<Layout *>::const_iterator i;
@@ -1082,9 +852,212 @@ Layout *screenGetGemLayout(const Map *map) {
         return gemlayout;
 }
 
-void screenGemUpdate() {
+/**
+ * Returns the gem view of a map's own data, one glyph per map cell,
+ * building it the first time the map is peered at.  Map data doesn't
+ * change once loaded (doors and the like are annotations), so only the
+ * avatar, objects and annotations need drawing over it afterwards.
+ */
+static Image *screenGemMapImage(Layout *layout, Map *map) {
+    if (map->gemImage && map->gemImageSet == gemSet)
+        return map->gemImage;
+
+    int tw = layout->tileshape.width, th = layout->tileshape.height;
+    if (map->gemImage)
+        zu4_img_free(map->gemImage);
+    Image *image = zu4_img_create(map->width * tw, map->height * th);
+
+    zu4_img_fill(image, 0, 0, image->w, image->h, 0, 0, 0, 255);
+
+    for (unsigned int y = 0; y < map->height; y++) {
+        for (unsigned int x = 0; x < map->width; x++) {
+            Coords coords = { (int)x, (int)y, 0 };
+            MapTile tile = *map->getTileFromData(coords);
+            screenDrawGemTile(image, layout, map, tile, x * tw, y * th);
+        }
+    }
+
+    map->gemImage = image;
+    map->gemImageSet = gemSet;
+    return image;
+}
+
+/**
+ * Finds the map column and row shown in each column and row of the gem
+ * viewport, as screenViewportTile would, or -1 where the view runs off
+ * the edge of the map.
+ */
+static void screenGemAxes(Layout *layout, Map *map, std::vector<int> &cols, std::vector<int> &rows) {
+    int width = layout->viewport.width, height = layout->viewport.height;
+    Coords center = c->location->coords;
+
+    if (map->width <= (unsigned int)width && map->height <= (unsigned int)height) {
+        center.x = map->width / 2;
+        center.y = map->height / 2;
+    }
+
+    cols.resize(width);
+    for (int x = 0; x < width; x++) {
+        Coords tc = center;
+        tc.x += x - (width / 2);
+        wrap(&tc, map);
+        cols[x] = (tc.x < 0 || tc.x >= (int)map->width) ? -1 : tc.x;
+    }
+
+    rows.resize(height);
+    for (int y = 0; y < height; y++) {
+        Coords tc = center;
+        tc.y += y - (height / 2);
+        wrap(&tc, map);
+        rows[y] = (tc.y < 0 || tc.y >= (int)map->height) ? -1 : tc.y;
+    }
+}
+
+/**
+ * Draws the gem view of a map where everything is visible: the map
+ * itself is copied from its gem view in as few blits as the wrapping
+ * allows, then the cells holding anything else are drawn over it.
+ */
+static void screenGemUpdateMap(Layout *layout, Map *map) {
+    static std::vector<int> cols, rows;
+    static std::vector<Coords> overlays;
+    static MapTile grass = map->tileset->getByName("grass")->getId();
+    int tw = layout->tileshape.width, th = layout->tileshape.height;
+    int width = layout->viewport.width, height = layout->viewport.height;
+    Image *image = screenGemMapImage(layout, map);
+    Image *screen = zu4_img_get_screen();
+    int x, y;
+
+    screenGemAxes(layout, map, cols, rows);
+
+    // copy each block of viewport cells that shows consecutive map cells
+    for (int y0 = 0, y1; y0 < height; y0 = y1) {
+        for (y1 = y0 + 1; y1 < height && rows[y0] >= 0 && rows[y1] == rows[y1 - 1] + 1; y1++) {}
+        if (rows[y0] < 0)
+            continue;
+
+        for (int x0 = 0, x1; x0 < width; x0 = x1) {
+            for (x1 = x0 + 1; x1 < width && cols[x0] >= 0 && cols[x1] == cols[x1 - 1] + 1; x1++) {}
+            if (cols[x0] < 0)
+                continue;
+
+            zu4_img_draw_subrect(image, layout->viewport.x + x0 * tw, layout->viewport.y + y0 * th,
+                                 cols[x0] * tw, rows[y0] * th, (x1 - x0) * tw, (y1 - y0) * th);
+        }
+    }
+
+    // off the edge of the map: pad with grass tiles
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            if (rows[y] < 0 || cols[x] < 0) {
+                MapTile tile = grass;
+                screenShowGemTile(layout, map, tile, false, x, y);
+            }
+        }
+    }
+
+    // the avatar, and objects and annotations if peering shows them
+    overlays.clear();
+    overlays.push_back(c->location->coords);
+    if (settings.enhancements && settings.enhancementsOptions.peerShowsObjects) {
+        for (ObjectDeque::const_iterator i = map->objects.begin(); i != map->objects.end(); i++)
+            overlays.push_back((*i)->getCoords());
+        map->annotations->positions(overlays);
+    }
+
+    for (std::vector<Coords>::const_iterator i = overlays.begin(); i != overlays.end(); i++) {
+        for (y = 0; y < height; y++) {
+            if (rows[y] != i->y)
+                continue;
+            for (x = 0; x < width; x++) {
+                if (cols[x] != i->x)
+                    continue;
+
+                bool focus;
+                MapTile tile = screenViewportTile(width, height, x, y, focus).front();
+                zu4_img_fill(screen, layout->viewport.x + x * tw, layout->viewport.y + y * th,
+                             tw, th, 0, 0, 0, 255);
+                screenShowGemTile(layout, map, tile, focus, x, y);
+            }
+        }
+    }
+}
+
+/**
+ * Draws the gem view of a dungeon level, which only shows what can be
+ * reached from the avatar's position without passing through walls.
+ */
+static void screenGemUpdateDungeon(Layout *layout, Map *map) {
+    static std::vector<char> drawnTiles;
+    static std::vector<std::pair<int, int> > coordStack;
+    int width = layout->viewport.width, height = layout->viewport.height;
+    TileId avatarTileId = map->tileset->getByName("avatar")->getId();
     MapTile tile;
     int x, y;
+
+    drawnTiles.assign(width * height, 0);
+    coordStack.clear();
+
+    //Put the avatar's position on the stack
+    int center_x = width / 2 - 1;
+    int center_y = height / 2 - 1;
+    int avt_x = c->location->coords.x - 1;
+    int avt_y = c->location->coords.y - 1;
+
+    coordStack.push_back(std::pair<int,int>(center_x, center_y));
+    bool weAreDrawingTheAvatarTile = true;
+
+    //And draw each tile on the growing stack until it is empty
+    while (!coordStack.empty()) {
+        x = coordStack.back().first;
+        y = coordStack.back().second;
+        coordStack.pop_back();
+
+        if (x < 0 || x >= width || y < 0 || y >= height)
+            continue;   //Skip out of range tiles
+
+        if (drawnTiles[x * height + y])
+            continue;   //Skip already considered tiles
+
+        drawnTiles[x * height + y] = 1;
+
+        // DRAW THE ACTUAL TILE
+        bool focus;
+        tile = screenViewportTile(width, height, x - center_x + avt_x, y - center_y + avt_y, focus).front();
+
+        if (!weAreDrawingTheAvatarTile)
+        {
+            //Hack to avoid showing the avatar tile multiple times in cycling dungeon maps
+            if (tile.getId() == avatarTileId)
+                tile = map->getTileFromData(c->location->coords)->getId();
+        }
+
+        screenShowGemTile(layout, map, tile, focus, x, y);
+
+        if (!tile.getTileType()->isOpaque() || tile.getTileType()->isWalkable() || weAreDrawingTheAvatarTile)
+        {
+            //Continue the search so we can see through all walkable objects, non-opaque objects (like creatures)
+            //or the avatar position in those rare circumstances where he is stuck in a wall
+
+            //by adding all relative adjacency combinations to the stack for drawing
+            coordStack.push_back(std::pair<int,int>(x + 1, y - 1));
+            coordStack.push_back(std::pair<int,int>(x + 1, y    ));
+            coordStack.push_back(std::pair<int,int>(x + 1, y + 1));
+
+            coordStack.push_back(std::pair<int,int>(x    , y - 1));
+            coordStack.push_back(std::pair<int,int>(x    , y + 1));
+
+            coordStack.push_back(std::pair<int,int>(x - 1, y - 1));
+            coordStack.push_back(std::pair<int,int>(x - 1, y    ));
+            coordStack.push_back(std::pair<int,int>(x - 1, y + 1));
+
+            // We only draw the avatar tile once, it is the first tile drawn
+            weAreDrawingTheAvatarTile = false;
+        }
+    }
+}
+
+void screenGemUpdate() {
     Image *screen = zu4_img_get_screen();
 
     zu4_img_fill(screen, BORDER_WIDTH,
@@ -1096,88 +1069,10 @@ void screenGemUpdate() {
     Layout *layout = screenGetGemLayout(c->location->map);
 
     //TODO, move the code responsible for determining 'peer' visibility to a non SDL specific part of the code.
-    if (c->location->map->type == Map::DUNGEON) {
-    	//DO THE SPECIAL DUNGEON MAP TRAVERSAL
-    	std::vector<std::vector<int> > drawnTiles(layout->viewport.width, std::vector<int>(layout->viewport.height, 0));
-    	std::list<std::pair<int,int> > coordStack;
-
-    	//Put the avatar's position on the stack
-    	int center_x = layout->viewport.width / 2 - 1;
-    	int center_y = layout->viewport.height / 2 - 1;
-    	int avt_x = c->location->coords.x - 1;
-    	int avt_y = c->location->coords.y - 1;
-
-    	coordStack.push_back(std::pair<int,int>(center_x, center_y));
-    	bool weAreDrawingTheAvatarTile = true;
-
-    	//And draw each tile on the growing stack until it is empty
-    	while (coordStack.size() > 0) {
-    		std::pair<int,int> currentXY = coordStack.back();
-    		coordStack.pop_back();
-
-    		x = currentXY.first;
-    		y = currentXY.second;
-
-    		if (	x < 0 || x >= layout->viewport.width ||
-                y < 0 || y >= layout->viewport.height)
-    			continue;	//Skip out of range tiles
-
-    		if (drawnTiles[x][y])
-    			continue;	//Skip already considered tiles
-
-    		drawnTiles[x][y] = 1;
-
-    		// DRAW THE ACTUAL TILE
-    		bool focus;
-
-			std::vector<MapTile> tiles = screenViewportTile(layout->viewport.width,
-                                                       layout->viewport.height, x - center_x + avt_x, y - center_y + avt_y, focus);
-			tile = tiles.front();
-
-			TileId avatarTileId = c->location->map->tileset->getByName("avatar")->getId();
-
-			if (!weAreDrawingTheAvatarTile)
-			{
-				//Hack to avoid showing the avatar tile multiple times in cycling dungeon maps
-				if (tile.getId() == avatarTileId)
-					tile = c->location->map->getTileFromData(c->location->coords)->getId();
-			}
-
-			screenShowGemTile(layout, c->location->map, tile, focus, x, y);
-
-			if (!tile.getTileType()->isOpaque() || tile.getTileType()->isWalkable() ||  weAreDrawingTheAvatarTile)
-			{
-				//Continue the search so we can see through all walkable objects, non-opaque objects (like creatures)
-				//or the avatar position in those rare circumstances where he is stuck in a wall
-
-				//by adding all relative adjacency combinations to the stack for drawing
-				coordStack.push_back(std::pair<int,int>(x	+ 1	,	y	- 1	));
-				coordStack.push_back(std::pair<int,int>(x	+ 1	,	y		));
-				coordStack.push_back(std::pair<int,int>(x	+ 1	,	y	+ 1	));
-
-				coordStack.push_back(std::pair<int,int>(x		,	y	- 1	));
-				coordStack.push_back(std::pair<int,int>(x		,	y	+ 1	));
-
-				coordStack.push_back(std::pair<int,int>(x	- 1	,	y	- 1	));
-				coordStack.push_back(std::pair<int,int>(x	- 1	,	y	 	));
-				coordStack.push_back(std::pair<int,int>(x	- 1	,	y	+ 1	));
-
-				// We only draw the avatar tile once, it is the first tile drawn
-				weAreDrawingTheAvatarTile = false;
-			}
-    	}
-
-	} else {
-		//DO THE REGULAR EVERYTHING-IS-VISIBLE MAP TRAVERSAL
-		for (x = 0; x < layout->viewport.width; x++) {
-			for (y = 0; y < layout->viewport.height; y++) {
-				bool focus;
-				tile = screenViewportTile(layout->viewport.width,
-                                          layout->viewport.height, x, y, focus).front();
-				screenShowGemTile(layout, c->location->map, tile, focus, x, y);
-			}
-		}
-	}
+    if (c->location->map->type == Map::DUNGEON)
+        screenGemUpdateDungeon(layout, c->location->map);
+    else
+        screenGemUpdateMap(layout, c->location->map);
 
     screenRedrawMapArea();
 
@@ -41,24 +41,6 @@ struct Coords;
 #define PRINTF_LIKE(x,y)
 #endif
 
-/*
- * bitmasks for LOS shadows
- */
-#define ____H 0x01    // obscured along the horizontal face
-#define ___C_ 0x02    // obscured at the center
-#define __V__ 0x04    // obscured along the vertical face
-#define _N___ 0x80    // start of new raster
-
-#define ___CH 0x03
-#define __VCH 0x07
-#define __VC_ 0x06
-
-#define _N__H 0x81
-#define _N_CH 0x83
-#define _NVCH 0x87
-#define _NVC_ 0x86
-#define _NV__ 0x84
-
 #define SCR_CYCLE_PER_SECOND 4
 
 void screenInit(void);
@@ -91,7 +73,7 @@ void screenUpdate(TileView *view, bool showmap, bool blackout);
 void screenUpdateCursor(void);
 void screenUpdateMoons(void);
 void screenUpdateWind(void);
-std::vector<MapTile> screenViewportTile(unsigned int width, unsigned int height, int x, int y, bool &focus);
+TileStack screenViewportTile(unsigned int width, unsigned int height, int x, int y, bool &focus);
 
 void screenShowCursor(void);
 void screenHideCursor(void);
@@ -100,6 +82,7 @@ void screenDisableCursor(void);
 void screenSetCursorPos(int x, int y);
 
 extern int screenCurrentCycle;
+extern unsigned int screenCycleCount;
 
 #define SCR_CYCLE_MAX 16
 
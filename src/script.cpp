@@ -47,6 +47,186 @@ static std::vector<std::string> split(const std::string &s, const std::string &s
     return result;
 }
 
+/**
+ * Removes all unnecessary spaces from xml: tabs, pairs of spaces and
+ * spaces at the start of a line.
+ */
+static void tidy(std::string *text) {
+    std::string result;
+    result.reserve(text->length());
+
+    for (unsigned i = 0; i < text->length(); i++) {
+        char ch = (*text)[i];
+        if (ch == '\t')
+            continue;
+        /* a run of spaces loses them in pairs */
+        if (ch == ' ' && !result.empty() && result[result.length() - 1] == ' ')
+            result.erase(result.length() - 1);
+        else result += ch;
+    }
+
+    std::string::size_type pos = 0;
+    while ((pos = result.find("\n ", pos)) != std::string::npos)
+        result.erase(pos + 1, 1);
+
+    *text = result;
+}
+
+/**
+ * Returns true if the text has no letters or digits, in which case it
+ * translates to nothing at all.
+ */
+static bool isBlank(const std::string &text) {
+    for (std::string::const_iterator current = text.begin(); current != text.end(); current++) {
+        if (isalnum(*current))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Interned names
+ *
+ * Element, attribute and variable names share one table, so each is
+ * compared as an integer and a variable's name is its slot.  The names
+ * the interpreter itself looks for come first, in this order.
+ */
+enum {
+    ATOM_SCRIPT, ATOM_END, ATOM_ITEM, ATOM_ID, ATOM_NOUN, ATOM_ID_PROP, ATOM_DEFAULT,
+    ATOM_HIDDEN, ATOM_REQ, ATOM_NAME, ATOM_VALUE, ATOM_REDIRECT, ATOM_TARGET, ATOM_MSECS,
+    ATOM_START, ATOM_CHANCE, ATOM_X, ATOM_Y, ATOM_Z, ATOM_ENABLE, ATOM_PRICE, ATOM_QUANTITY,
+    ATOM_CANTPAY, ATOM_TEST, ATOM_TYPE, ATOM_MAXLEN, ATOM_OPTIONS, ATOM_SUBTYPE, ATOM_PLAYER,
+    ATOM_PTS, ATOM_ACTION, ATOM_RESET, ATOM_PLAY, ATOM_STOP, ATOM_SCREEN, ATOM_SCRIPTS
+};
+
+struct AtomTable {
+    std::vector<std::string> names;
+    std::map<std::string, int> index;
+
+    AtomTable() {
+        static const char *known[] = {
+            "script", "end", "item", "id", "noun", "id_prop", "default",
+            "hidden", "req", "name", "value", "redirect", "target", "msecs",
+            "start", "chance", "x", "y", "z", "enable", "price", "quantity",
+            "cantpay", "test", "type", "maxlen", "options", "subtype", "player",
+            "pts", "action", "reset", "play", "stop", "screen", "scripts", NULL
+        };
+        for (int i = 0; known[i]; i++)
+            intern(known[i]);
+    }
+
+    int intern(const std::string &name) {
+        std::map<std::string, int>::iterator i = index.find(name);
+        if (i != index.end())
+            return i->second;
+        names.push_back(name);
+        return index[name] = names.size() - 1;
+    }
+};
+
+static AtomTable &atoms() {
+    static AtomTable table;
+    return table;
+}
+
+static int intern(const std::string &name) {
+    return atoms().intern(name);
+}
+
+static const char *atomName(int atom) {
+    return atom >= 0 ? atoms().names[atom].c_str() : "";
+}
+
+/**
+ * A piece of text, split into the literals between its {...}
+ * expressions.  Text with no expressions is tidied when it is compiled.
+ */
+struct Script::Text {
+    bool blank;                         /**< No letters or digits, so it translates to nothing */
+    std::vector<std::string> literals;  /**< One more than there are expressions */
+    std::vector<Expr *> exprs;
+
+    Text() : blank(false) {}
+    ~Text();
+
+private:
+    Text(const Text &);
+    Text &operator=(const Text &);
+};
+
+/**
+ * An expression inside {...}.  If it has expressions of its own, what
+ * it refers to can only be told once those are translated; otherwise
+ * that is decided when it is compiled.
+ */
+struct Script::Expr {
+    enum Type {
+        EXPR_DYNAMIC,
+        EXPR_VARIABLE,
+        EXPR_ITERATOR,
+        EXPR_SHOW_INVENTORY,
+        EXPR_INVENTORY_CHOICES,
+        EXPR_PROVIDER,
+        EXPR_PROPERTY,
+        EXPR_MATH,
+        EXPR_COMPARE,
+        EXPR_TOUPPER,
+        EXPR_TOLOWER,
+        EXPR_RANDOM,
+        EXPR_ISEMPTY,
+        EXPR_NONE
+    };
+
+    Type type;
+    std::string item;                   /**< The expression as written, once translated */
+    Text *source;                       /**< The expression to translate, if dynamic */
+    int name;                           /**< The variable, property or script named */
+    std::string provider;
+    std::vector<std::string> parts;     /**< What to ask the provider for */
+    std::string content;                /**< The argument to a function */
+
+    Expr() : type(EXPR_NONE), source(NULL), name(-1) {}
+    ~Expr() { delete source; }
+};
+
+Script::Text::~Text() {
+    for (unsigned i = 0; i < exprs.size(); i++)
+        delete exprs[i];
+}
+
+struct Script::Attr {
+    int name;
+    std::string value;                  /**< As written, for ids and flags */
+    Text *text;                         /**< Compiled, for translating */
+};
+
+/**
+ * An element or piece of text in a script file.  An element's body is
+ * the nodes between it and its end, which is where its next sibling (or
+ * its parent's end) is.
+ */
+struct Script::Node {
+    int name;                           /**< The element name, or -1 for text */
+    int action;                         /**< The action the element performs, or -1 */
+    int parent;
+    int end;
+    bool empty;                         /**< The element had no children at all */
+    bool constant;                      /**< None of its attributes need translating */
+    int attrs, nattrs;
+    Text *text;                         /**< The text, if this isn't an element */
+};
+
+/**
+ * A compiled script file.  Node 0 is the document itself.
+ */
+struct Script::Program {
+    std::vector<Node> nodes;
+    std::vector<Attr> attrs;
+};
+
+/* not yet looked for; -1 is looked for but not found */
+#define SCRIPT_UNRESOLVED -2
+
 /*
  * Script::Variable class
  */
@@ -80,12 +260,13 @@ bool    Script::Variable::isSet() const             { return set; }
  * Static member variables
  */
 Script::ActionMap Script::action_map;
+std::map<std::string, Script::Program *> Script::programs;
 
 /**
  * Constructs a script object
  */
-Script::Script() : vendorScriptDoc(NULL), scriptNode(NULL), debug(NULL), state(STATE_UNLOADED),
-    nounName("item"), idPropName("id")
+Script::Script() : program(NULL), scriptNode(-1), debug(NULL), state(STATE_UNLOADED),
+    currentScript(-1), currentItem(-1), noun(ATOM_ITEM), idProp(ATOM_ID)
 {
     action_map["context"]           = ACTION_SET_CONTEXT;
     action_map["unset_context"]     = ACTION_UNSET_CONTEXT;
@@ -123,20 +304,16 @@ Script::~Script() {
     // Smart pointers anyone?
 
     // Clean variables
-    std::map<std::string, Script::Variable *>::iterator variableItem = variables.begin();
-    std::map<std::string, Script::Variable *>::iterator variablesEnd = variables.end();
-    while (variableItem != variablesEnd) {
-        delete variableItem->second;
-        ++variableItem;
-    }
+    for (unsigned i = 0; i < variables.size(); i++)
+        delete variables[i];
 }
 
-void Script::removeCurrentVariable(const std::string &name) {
-    std::map<std::string, Script::Variable *>::iterator dup = variables.find(name);
-    if (dup != variables.end()) {
-        delete dup->second;
-        variables.erase(dup); // not strictly necessary, but correct.
-    }
+void Script::removeCurrentVariable(int name) {
+    if (name >= static_cast<int>(variables.size()))
+        variables.resize(name + 1, NULL);
+
+    delete variables[name];
+    variables[name] = NULL;
 }
 
 /**
@@ -146,40 +323,238 @@ void Script::addProvider(const std::string &name, Provider *p) {
     providers[name] = p;
 }
 
+/**
+ * Compiles a script file.  This is done once for each file, the first
+ * time it is loaded.
+ */
+Script::Program *Script::compile(const std::string &filename) {
+    xmlDocPtr doc = xmlParse(filename.c_str());
+    Program *program = new Program;
+
+    Node document;
+    document.name = -1;
+    document.action = -1;
+    document.parent = -1;
+    document.empty = doc->children == NULL;
+    document.constant = true;
+    document.attrs = document.nattrs = 0;
+    document.text = NULL;
+    program->nodes.push_back(document);
+
+    for (xmlNodePtr node = doc->children; node; node = node->next)
+        compileNode(program, node, 0);
+    program->nodes[0].end = program->nodes.size();
+
+    xmlFreeDoc(doc);
+    return program;
+}
+
+/**
+ * Compiles an element and its body, or a piece of text.  Comments and
+ * the like are left out, as they are never executed.
+ */
+void Script::compileNode(Program *program, xmlNodePtr node, int parent) {
+    if (node->type != XML_ELEMENT_NODE && node->type != XML_TEXT_NODE)
+        return;
+
+    int index = program->nodes.size();
+    Node n;
+    n.name = -1;
+    n.action = -1;
+    n.parent = parent;
+    n.empty = node->children == NULL;
+    n.constant = true;
+    n.attrs = program->attrs.size();
+    n.nattrs = 0;
+    n.text = NULL;
+
+    if (xmlNodeIsText(node)) {
+        xmlChar *nodeContent = xmlNodeGetContent(node);
+        n.text = new Text;
+        compileText(reinterpret_cast<char *>(nodeContent), n.text);
+        xmlFree(nodeContent);
+    }
+    else {
+        n.name = intern(reinterpret_cast<const char *>(node->name));
+
+        ActionMap::iterator action = action_map.find(reinterpret_cast<const char *>(node->name));
+        if (action != action_map.end())
+            n.action = action->second;
+
+        for (xmlAttrPtr prop = node->properties; prop; prop = prop->next) {
+            Attr attr;
+            attr.name = intern(reinterpret_cast<const char *>(prop->name));
+            attr.value = xmlGetPropAsString(node, reinterpret_cast<const char *>(prop->name));
+            attr.text = new Text;
+            compileText(attr.value, attr.text);
+            if (!attr.text->exprs.empty())
+                n.constant = false;
+            program->attrs.push_back(attr);
+        }
+        n.nattrs = program->attrs.size() - n.attrs;
+    }
+    program->nodes.push_back(n);
+
+    if (!n.text) {
+        for (xmlNodePtr child = node->children; child; child = child->next)
+            compileNode(program, child, index);
+    }
+    program->nodes[index].end = program->nodes.size();
+}
+
+/**
+ * Splits text into literals and {...} expressions, compiling each
+ * expression as it goes.
+ */
+void Script::compileText(const std::string &raw, Text *text) {
+    std::string literal;
+    unsigned pos = 0;
+
+    text->blank = isBlank(raw);
+
+    while (pos < raw.length()) {
+        if (raw[pos] != '{') {
+            literal += raw[pos++];
+            continue;
+        }
+
+        /* find the matching }, skipping over embedded items */
+        unsigned close = pos + 1;
+        int num_embedded = 0;
+        for (; close < raw.length(); close++) {
+            if (raw[close] == '{')
+                num_embedded++;
+            else if (raw[close] == '}' && num_embedded-- == 0)
+                break;
+        }
+        if (close >= raw.length())
+            zu4_error(ZU4_LOG_ERR, "Error: no closing } found in script.");
+
+        std::string item = raw.substr(pos + 1, close - pos - 1);
+        Expr *expr = new Expr;
+
+        if (item.find('{') != std::string::npos) {
+            expr->type = Expr::EXPR_DYNAMIC;
+            expr->source = new Text;
+            compileText(item, expr->source);
+        }
+        else {
+            /* the item is translated like any other text first */
+            if (isBlank(item))
+                item.erase();
+            tidy(&item);
+            classify(item, expr);
+        }
+
+        text->literals.push_back(literal);
+        text->exprs.push_back(expr);
+        literal.erase();
+        pos = close + 1;
+    }
+
+    if (text->exprs.empty())
+        tidy(&literal);
+    text->literals.push_back(literal);
+}
+
+/**
+ * Decides what a translated {...} item refers to
+ */
+void Script::classify(const std::string &item, Expr *expr) {
+    std::string::size_type pos;
+
+    expr->item = item;
+
+    // Get defined variables
+    if (item[0] == '$') {
+        expr->type = Expr::EXPR_VARIABLE;
+        expr->name = intern(item.substr(1));
+    }
+    // Get the current iterator for our loop
+    else if (item == "iterator")
+        expr->type = Expr::EXPR_ITERATOR;
+    else if (item.find("show_inventory:") != std::string::npos) {
+        pos = item.find(":");
+        expr->type = Expr::EXPR_SHOW_INVENTORY;
+        expr->name = intern(item.substr(pos + 1));
+    }
+    else if (item == "inventory_choices")
+        expr->type = Expr::EXPR_INVENTORY_CHOICES;
+    else if ((pos = item.find_first_of(":")) != std::string::npos) {
+        expr->type = Expr::EXPR_PROVIDER;
+        expr->provider = item.substr(0, pos);
+        expr->parts = split(item.substr(pos + 1), ":");
+    }
+    else {
+        std::string funcName;
+
+        funcParse(item, &funcName, &expr->content);
+
+        if (funcName.empty()) {
+            expr->type = Expr::EXPR_PROPERTY;
+            expr->name = intern(item);
+        }
+        else if (funcName == "math")
+            expr->type = Expr::EXPR_MATH;
+        else if (funcName == "compare")
+            expr->type = Expr::EXPR_COMPARE;
+        else if (funcName == "toupper")
+            expr->type = Expr::EXPR_TOUPPER;
+        else if (funcName == "tolower")
+            expr->type = Expr::EXPR_TOLOWER;
+        else if (funcName == "random")
+            expr->type = Expr::EXPR_RANDOM;
+        else if (funcName == "isempty")
+            expr->type = Expr::EXPR_ISEMPTY;
+        else expr->type = Expr::EXPR_NONE;
+    }
+}
+
 /**
  * Loads the vendor script
  */
 bool Script::load(const std::string &filename, const std::string &baseId, const std::string &subNodeName, const std::string &subNodeId) {
-    xmlNodePtr root, node, child;
+    int root, node, child;
+    const Attr *attr;
     this->state = STATE_NORMAL;
 
     /* unload previous script */
     unload();
 
     /**
-     * Open and parse the .xml file
+     * Compile the .xml file, if it hasn't been already
      */
-    this->vendorScriptDoc = xmlParse(filename.c_str());
-    root = xmlDocGetRootElement(vendorScriptDoc);
-    if (xmlStrcmp(root->name, (const xmlChar *) "scripts") != 0)
+    std::map<std::string, Program *>::iterator compiled = programs.find(filename);
+    if (compiled == programs.end())
+        compiled = programs.insert(std::make_pair(filename, compile(filename))).first;
+    this->program = compiled->second;
+
+    const std::vector<Node> &nodes = program->nodes;
+    for (root = 1; root < nodes[0].end && nodes[root].text; root = nodes[root].end) {}
+    if (root >= nodes[0].end || nodes[root].name != ATOM_SCRIPTS)
         zu4_error(ZU4_LOG_ERR, "malformed %s", filename.c_str());
 
     /**
      * Get a new global item name or id name
      */
-    if (xmlPropExists(root, "noun"))
-        nounName = xmlGetPropAsString(root, "noun");
-    if (xmlPropExists(root, "id_prop"))
-        idPropName = xmlGetPropAsString(root, "id_prop");
+    if ((attr = findAttr(root, ATOM_NOUN)))
+        noun = intern(attr->value);
+    if ((attr = findAttr(root, ATOM_ID_PROP)))
+        idProp = intern(attr->value);
+
+    this->currentScript = -1;
+    this->currentItem = -1;
+    this->scriptNode = -1;
+    this->translationContext.clear();
 
-    this->currentScript = NULL;
-    this->currentItem = NULL;
+    int subNode = subNodeName.empty() ? -1 : intern(subNodeName);
 
-    for (node = root->xmlChildrenNode; node; node = node->next) {
-        if (xmlNodeIsText(node) || (xmlStrcmp(node->name, (const xmlChar *) "script") != 0))
+    for (node = root + 1; node < nodes[root].end; node = nodes[node].end) {
+        if (nodes[node].name != ATOM_SCRIPT)
             continue;
 
-        if (baseId == xmlGetPropAsString(node, "id")) {
+        attr = findAttr(node, ATOM_ID);
+        if (baseId == (attr ? attr->value : "")) {
             /**
              * We use the base node as our main script node
              */
@@ -190,12 +565,12 @@ bool Script::load(const std::string &filename, const std::string &baseId, const
                 break;
             }
 
-            for (child = node->xmlChildrenNode; child; child = child->next) {
-                if (xmlNodeIsText(child) ||
-                    xmlStrcmp(child->name, (const xmlChar *) subNodeName.c_str()) != 0)
+            for (child = node + 1; child < nodes[node].end; child = nodes[child].end) {
+                if (nodes[child].name != subNode)
                     continue;
 
-                std::string id = xmlGetPropAsString(child, "id");
+                attr = findAttr(child, ATOM_ID);
+                std::string id = attr ? attr->value : "";
 
                 if (id == subNodeId) {
                     this->scriptNode = child;
@@ -204,28 +579,28 @@ bool Script::load(const std::string &filename, const std::string &baseId, const
                     /**
                      * Get a new local item name or id name
                      */
-                    if (xmlPropExists(node, "noun"))
-                        nounName = xmlGetPropAsString(node, "noun");
-                    if (xmlPropExists(node, "id_prop"))
-                        idPropName = xmlGetPropAsString(node, "id_prop");
+                    if ((attr = findAttr(node, ATOM_NOUN)))
+                        noun = intern(attr->value);
+                    if ((attr = findAttr(node, ATOM_ID_PROP)))
+                        idProp = intern(attr->value);
 
                     break;
                 }
             }
 
-            if (scriptNode)
+            if (scriptNode >= 0)
                 break;
         }
     }
 
-    if (scriptNode) {
+    if (scriptNode >= 0) {
         /**
          * Get a new local item name or id name
          */
-        if (xmlPropExists(scriptNode, "noun"))
-            nounName = xmlGetPropAsString(scriptNode, "noun");
-        if (xmlPropExists(scriptNode, "id_prop"))
-            idPropName = xmlGetPropAsString(scriptNode, "id_prop");
+        if ((attr = findAttr(scriptNode, ATOM_NOUN)))
+            noun = intern(attr->value);
+        if ((attr = findAttr(scriptNode, ATOM_ID_PROP)))
+            idProp = intern(attr->value);
 
         if (debug)
             fprintf(debug, "\n<Loaded subscript '%s' where id='%s' for script '%s'>\n", subNodeName.c_str(), subNodeId.c_str(), baseId.c_str());
@@ -236,20 +611,18 @@ bool Script::load(const std::string &filename, const std::string &baseId, const
         else zu4_error(ZU4_LOG_ERR, "Couldn't find subscript '%s' where id='%s' in script '%s' in %s", subNodeName.c_str(), subNodeId.c_str(), baseId.c_str(), filename.c_str());
     }
 
+    /* the targets found depend on the script node and its id name */
+    resolved.assign(nodes.size(), SCRIPT_UNRESOLVED);
+
     this->state = STATE_UNLOADED;
 
     return false;
 }
 
 /**
- * Unloads the script
+ * Unloads the script.  The compiled file is kept for the next load.
  */
 void Script::unload() {
-    if (vendorScriptDoc) {
-        xmlFreeDoc(vendorScriptDoc);
-        vendorScriptDoc = NULL;
-    }
-
     if (debug) {
         fclose(debug);
         debug = NULL;
@@ -260,18 +633,18 @@ void Script::unload() {
  * Runs a script after it's been loaded
  */
  void Script::run(const std::string &script) {
-    xmlNodePtr scriptNode;
+    int scriptNode;
     std::string search_id;
 
-    if (variables.find(idPropName) != variables.end()) {
-        if (variables[idPropName]->isSet())
-            search_id = variables[idPropName]->getString();
+    if (idProp < static_cast<int>(variables.size()) && variables[idProp]) {
+        if (variables[idProp]->isSet())
+            search_id = variables[idProp]->getString();
         else search_id = "null";
     }
 
-    scriptNode = find(this->scriptNode, script, search_id);
+    scriptNode = find(this->scriptNode, intern(script), search_id);
 
-    if (!scriptNode)
+    if (scriptNode < 0)
         zu4_error(ZU4_LOG_ERR, "Script '%s' not found in vendorScript.xml", script.c_str());
 
     execute(scriptNode);
@@ -280,14 +653,15 @@ void Script::unload() {
 /**
  * Executes the subscript 'script' of the main script
  */
-Script::ReturnCode Script::execute(xmlNodePtr script, xmlNodePtr currentItem, std::string *output) {
-    xmlNodePtr current;
+Script::ReturnCode Script::execute(int script, int currentItem, std::string *output) {
+    const std::vector<Node> &nodes = program->nodes;
+    int current;
     Script::ReturnCode retval = RET_OK;
 
-    if (!script->children) {
+    if (nodes[script].empty) {
         /* redirect the script to another node */
-        if (xmlPropExists(script, "redirect"))
-            retval = redirect(NULL, script);
+        if (findAttr(script, ATOM_REDIRECT))
+            retval = redirect(-1, script);
         /* end the conversation */
         else {
             if (debug)
@@ -298,17 +672,16 @@ Script::ReturnCode Script::execute(xmlNodePtr script, xmlNodePtr currentItem, st
     }
 
     /* do we start where we left off, or start from the beginning? */
-    if (currentItem) {
-        current = currentItem->next;
+    if (currentItem >= 0) {
+        current = nodes[currentItem].end;
         if (debug)
-            fprintf(debug, "\nReturning to execution from end of '%s' script\n", currentItem->name);
+            fprintf(debug, "\nReturning to execution from end of '%s' script\n", atomName(nodes[currentItem].name));
     }
-    else current = script->children;
+    else current = script + 1;
 
-    for (; current; current = current->next) {
-        std::string name = (char *)current->name;
+    for (; current < nodes[script].end; current = nodes[current].end) {
+        const Node &node = nodes[current];
         retval = RET_OK;
-        ActionMap::iterator action;
 
         /* nothing left to do */
         if (this->state == STATE_DONE)
@@ -319,8 +692,8 @@ Script::ReturnCode Script::execute(xmlNodePtr script, xmlNodePtr currentItem, st
         /**
          * Handle Text
          */
-        if (xmlNodeIsText(current)) {
-            std::string content = getContent(current);
+        if (node.text) {
+            std::string content = translate(*node.text);
             if (output)
                 *output += content;
             else screenMessage("%s", content.c_str());
@@ -328,53 +701,44 @@ Script::ReturnCode Script::execute(xmlNodePtr script, xmlNodePtr currentItem, st
             if (debug && content.length())
                 fprintf(debug, "\nOutput: \n====================\n%s\n====================", content.c_str());
         }
-        /* skip comments */
-        else if (current->type == XML_COMMENT_NODE) {}
         else {
             /**
-             * Search for the corresponding action and execute it!
+             * Execute the action the element was compiled to
              */
-            action = action_map.find(name);
-            if (action != action_map.end()) {
+            switch(node.action) {
+            case ACTION_SET_CONTEXT:    retval = pushContext(script, current); break;
+            case ACTION_UNSET_CONTEXT:  retval = popContext(script, current); break;
+            case ACTION_END:            retval = end(script, current); break;
+            case ACTION_REDIRECT:       retval = redirect(script, current); break;
+            case ACTION_WAIT_FOR_KEY:   retval = waitForKeypress(script, current); break;
+            case ACTION_WAIT:           retval = wait(script, current); break;
+            case ACTION_STOP:           retval = RET_STOP; break;
+            case ACTION_INCLUDE:        retval = include(script, current); break;
+            case ACTION_FOR_LOOP:       retval = forLoop(script, current); break;
+            case ACTION_RANDOM:         retval = random(script, current); break;
+            case ACTION_MOVE:           retval = move(script, current); break;
+            case ACTION_SLEEP:          retval = sleep(script, current); break;
+            case ACTION_CURSOR:         retval = cursor(script, current); break;
+            case ACTION_PAY:            retval = pay(script, current); break;
+            case ACTION_IF:             retval = _if(script, current); break;
+            case ACTION_INPUT:          retval = input(script, current); break;
+            case ACTION_ADD:            retval = add(script, current); break;
+            case ACTION_LOSE:           retval = lose(script, current); break;
+            case ACTION_HEAL:           retval = heal(script, current); break;
+            case ACTION_CAST_SPELL:     retval = castSpell(script, current); break;
+            case ACTION_DAMAGE:         retval = damage(script, current); break;
+            case ACTION_KARMA:          retval = karma(script, current); break;
+            case ACTION_MUSIC:          retval = music(script, current); break;
+            case ACTION_SET_VARIABLE:   retval = setVar(script, current); break;
+            case ACTION_ZTATS:          retval = ztats(script, current); break;
+            default:
                 /**
-                 * Found it!
+                 * Didn't find the corresponding action...
                  */
-                switch(action->second) {
-                case ACTION_SET_CONTEXT:    retval = pushContext(script, current); break;
-                case ACTION_UNSET_CONTEXT:  retval = popContext(script, current); break;
-                case ACTION_END:            retval = end(script, current); break;
-                case ACTION_REDIRECT:       retval = redirect(script, current); break;
-                case ACTION_WAIT_FOR_KEY:   retval = waitForKeypress(script, current); break;
-                case ACTION_WAIT:           retval = wait(script, current); break;
-                case ACTION_STOP:           retval = RET_STOP; break;
-                case ACTION_INCLUDE:        retval = include(script, current); break;
-                case ACTION_FOR_LOOP:       retval = forLoop(script, current); break;
-                case ACTION_RANDOM:         retval = random(script, current); break;
-                case ACTION_MOVE:           retval = move(script, current); break;
-                case ACTION_SLEEP:          retval = sleep(script, current); break;
-                case ACTION_CURSOR:         retval = cursor(script, current); break;
-                case ACTION_PAY:            retval = pay(script, current); break;
-                case ACTION_IF:             retval = _if(script, current); break;
-                case ACTION_INPUT:          retval = input(script, current); break;
-                case ACTION_ADD:            retval = add(script, current); break;
-                case ACTION_LOSE:           retval = lose(script, current); break;
-                case ACTION_HEAL:           retval = heal(script, current); break;
-                case ACTION_CAST_SPELL:     retval = castSpell(script, current); break;
-                case ACTION_DAMAGE:         retval = damage(script, current); break;
-                case ACTION_KARMA:          retval = karma(script, current); break;
-                case ACTION_MUSIC:          retval = music(script, current); break;
-                case ACTION_SET_VARIABLE:   retval = setVar(script, current); break;
-                case ACTION_ZTATS:          retval = ztats(script, current); break;
-                default:
-
-                    break;
-                }
+                if (debug)
+                    fprintf(debug, "ERROR: '%s' method not found", atomName(node.name));
+                break;
             }
-            /**
-             * Didn't find the corresponding action...
-             */
-            else if (debug)
-                 fprintf(debug, "ERROR: '%s' method not found", name.c_str());
 
             /* The script was redirected or stopped, stop now! */
             if ((retval == RET_REDIRECTED) || (retval== RET_STOP))
@@ -408,13 +772,18 @@ void Script::resetState()               { state = STATE_NORMAL; }
 void Script::setState(Script::State s)  { state = s; }
 void Script::setTarget(const std::string &val)      { target = val; }
 void Script::setChoices(const std::string &val)     { choices = val; }
-void Script::setVar(const std::string &name, const std::string &val)    { removeCurrentVariable(name); variables[name] = new Variable(val); }
-void Script::setVar(const std::string &name, int val)       { removeCurrentVariable(name); variables[name] = new Variable(val); }
+void Script::setVar(const std::string &name, const std::string &val)    { int n = intern(name); removeCurrentVariable(n); variables[n] = new Variable(val); }
+void Script::setVar(const std::string &name, int val)       { int n = intern(name); removeCurrentVariable(n); variables[n] = new Variable(val); }
 void Script::unsetVar(const std::string &name) {
+    int n = intern(name);
+
     // Ensure that the variable at least exists, but has no value
-    if (variables.find(name) != variables.end())
-        variables[name]->unset();
-    else variables[name] = new Variable;
+    if (n < static_cast<int>(variables.size()) && variables[n])
+        variables[n]->unset();
+    else {
+        removeCurrentVariable(n);
+        variables[n] = new Variable;
+    }
 }
 
 Script::State Script::getState()        { return state; }
@@ -424,303 +793,283 @@ std::string Script::getChoices()        { return choices; }
 std::string Script::getInputName()      { return inputName; }
 int Script::getInputMaxLen()            { return inputMaxLen; }
 
+/**
+ * Translates compiled text with dynamic variables
+ */
+std::string Script::translate(const Text &text) {
+    /* scripts that are composed entirely of whitespace are erased */
+    if (text.blank)
+        return "";
+    if (text.exprs.empty())
+        return text.literals[0];
+
+    std::string result = text.literals[0];
+    for (unsigned i = 0; i < text.exprs.size(); i++) {
+        result += evaluate(*text.exprs[i]);
+        result += text.literals[i + 1];
+    }
+
+    tidy(&result);
+    return result;
+}
+
 /**
  * Translates a script string with dynamic variables
  */
 void Script::translate(std::string *text) {
-    unsigned int pos;
-    bool nochars = true;
-    xmlNodePtr node = this->translationContext.back();
-
-    /* determine if the script is completely whitespace */
-    for (std::string::iterator current = text->begin(); current != text->end(); current++) {
-        if (isalnum(*current)) {
-            nochars = false;
-            break;
-        }
+    if (text->find('{') == std::string::npos) {
+        if (isBlank(*text))
+            text->erase();
+        tidy(text);
+        return;
     }
 
-    /* erase scripts that are composed entirely of whitespace */
-    if (nochars)
-        text->erase();
+    Text compiled;
+    compileText(*text, &compiled);
+    *text = translate(compiled);
+}
 
-    while ((pos = text->find_first_of("{")) < text->length()) {
-        std::string pre = text->substr(0, pos);
-        std::string post;
-        std::string item = text->substr(pos+1);
+/**
+ * Gives the value of a {...} expression
+ */
+std::string Script::evaluate(const Expr &expr) {
+    const std::vector<Node> &nodes = program->nodes;
+    int node = this->translationContext.back();
+    std::string prop;
+
+    /* translate any stuff contained in the item */
+    if (expr.type == Expr::EXPR_DYNAMIC) {
+        Expr resolved;
+        classify(translate(*expr.source), &resolved);
+        return evaluate(resolved);
+    }
 
-        /**
-         * Handle embedded items
-         */
-        int num_embedded = 0;
-        int total_pos = 0;
-        std::string current = item;
-        while (true) {
-            unsigned int open = current.find_first_of("{"),
-                         close = current.find_first_of("}");
+    if (debug)
+        fprintf(debug, "\n{%s} == ", expr.item.c_str());
 
-            if (close == current.length())
-                zu4_error(ZU4_LOG_ERR, "Error: no closing } found in script.");
+    switch (expr.type) {
+    case Expr::EXPR_VARIABLE:
+        if (expr.name < static_cast<int>(variables.size()) && variables[expr.name])
+            prop = variables[expr.name]->getString();
+        break;
 
-            if (open < close) {
-                num_embedded++;
-                total_pos += open + 1;
-                current = current.substr(open+1);
-            }
-            if (close < open) {
-                total_pos += close;
-                if (num_embedded == 0) {
-                    pos = total_pos;
-                    break;
-                }
-                num_embedded--;
-                total_pos += 1;
-                current = current.substr(close+1);
-            }
-        }
+    case Expr::EXPR_ITERATOR:
+        prop = zu4_to_string(this->iterator);
+        break;
+
+    case Expr::EXPR_SHOW_INVENTORY: {
+        int itemShowScript = find(node, expr.name);
 
         /**
-         * Separate the item itself from the pre- and post-data
+         * Save iterator
          */
-        post = item.substr(pos+1);
-        item = item.substr(0, pos);
-
-        if (debug)
-            fprintf(debug, "\n{%s} == ", item.c_str());
+        int oldIterator = this->iterator;
 
-        /* translate any stuff contained in the item */
-        translate(&item);
+        /* start iterator at 0 */
+        this->iterator = 0;
 
-        std::string prop;
-
-        // Get defined variables
-        if (item[0] == '$') {
-            std::string varName = item.substr(1);
-            if (variables.find(varName) != variables.end())
-                prop = variables[varName]->getString();
-        }
-        // Get the current iterator for our loop
-        else if (item == "iterator")
-            prop = zu4_to_string(this->iterator);
-        else if ((pos = item.find("show_inventory:")) < item.length()) {
-            pos = item.find(":");
-            std::string itemScript = item.substr(pos+1);
-
-            xmlNodePtr itemShowScript = find(node, itemScript);
-
-            xmlNodePtr item;
-            prop.erase();
-
-            /**
-             * Save iterator
-             */
-            int oldIterator = this->iterator;
+        for (int item = node + 1; node >= 0 && item < nodes[node].end; item = nodes[item].end) {
+            if (nodes[item].name == noun) {
+                bool hidden = getPropAsBool(item, ATOM_HIDDEN);
 
-            /* start iterator at 0 */
-            this->iterator = 0;
-
-            for (item = node->children; item; item = item->next) {
-                if (xmlStrcmp(item->name, (const xmlChar *)nounName.c_str()) == 0) {
-                    bool hidden = (bool)xmlGetPropAsBool(item, "hidden");
-
-                    if (!hidden) {
-                        /* make sure the item's requisites are met */
-                        if (!xmlPropExists(item, "req") || compare(getPropAsStr(item, "req"))) {
-                            /* put a newline after each */
-                            if (this->iterator > 0)
-                                prop += "\n";
-
-                            /* set translation context to item */
-                            translationContext.push_back(item);
-                            execute(itemShowScript, NULL, &prop);
-                            translationContext.pop_back();
-
-                            this->iterator++;
-                        }
+                if (!hidden) {
+                    /* make sure the item's requisites are met */
+                    if (!findAttr(item, ATOM_REQ) || compare(getPropAsStr(item, ATOM_REQ))) {
+                        /* put a newline after each */
+                        if (this->iterator > 0)
+                            prop += "\n";
+
+                        /* set translation context to item */
+                        translationContext.push_back(item);
+                        if (itemShowScript >= 0)
+                            execute(itemShowScript, -1, &prop);
+                        translationContext.pop_back();
+
+                        this->iterator++;
                     }
                 }
             }
-
-            /**
-             * Restore iterator to previous value
-             */
-            this->iterator = oldIterator;
         }
 
         /**
-         * Make a string containing the available ids using the
-         * vendor's inventory (i.e. "bcde")
+         * Restore iterator to previous value
          */
-        else if (item == "inventory_choices") {
-            xmlNodePtr item;
-            std::string ids;
+        this->iterator = oldIterator;
+    } break;
 
-            for (item = node->children; item; item = item->next) {
-                if (xmlStrcmp(item->name, (const xmlChar *)nounName.c_str()) == 0) {
-                    std::string id = getPropAsStr(item, idPropName.c_str());
-                    /* make sure the item's requisites are met */
-                    if (!xmlPropExists(item, "req") || (compare(getPropAsStr(item, "req"))))
-                        ids += id[0];
-                }
+    /**
+     * Make a string containing the available ids using the
+     * vendor's inventory (i.e. "bcde")
+     */
+    case Expr::EXPR_INVENTORY_CHOICES:
+        for (int item = node + 1; node >= 0 && item < nodes[node].end; item = nodes[item].end) {
+            if (nodes[item].name == noun) {
+                std::string id = getPropAsStr(item, idProp);
+                /* make sure the item's requisites are met */
+                if (!findAttr(item, ATOM_REQ) || (compare(getPropAsStr(item, ATOM_REQ))))
+                    prop += id[0];
             }
-
-            prop = ids;
         }
+        break;
 
-        /**
-         * Ask our providers if they have a valid translation for us
-         */
-        else if (item.find_first_of(":") != std::string::npos) {
-            int pos = item.find_first_of(":");
-            std::string provider = item;
-            std::string to_find;
-
-            provider = item.substr(0, pos);
-            to_find = item.substr(pos + 1);
-            if (providers.find(provider) != providers.end()) {
-                std::vector<std::string> parts = split(to_find, ":");
-                Provider* p = providers[provider];
-                prop = p->translate(parts);
-            }
+    /**
+     * Ask our providers if they have a valid translation for us
+     */
+    case Expr::EXPR_PROVIDER:
+        if (providers.find(expr.provider) != providers.end()) {
+            std::vector<std::string> parts = expr.parts;
+            Provider* p = providers[expr.provider];
+            prop = p->translate(parts);
         }
+        break;
 
-        /**
-         * Resolve as a property name or a function
-         */
-        else {
-            std::string funcName, content;
-
-            funcParse(item, &funcName, &content);
+    /* we have the property name, now go get the property value! */
+    case Expr::EXPR_PROPERTY:
+        prop = getPropAsStr(translationContext, expr.name, true);
+        break;
 
-            /*
-             * Check to see if it's a property name
-             */
-            if (funcName.empty()) {
-                /* we have the property name, now go get the property value! */
-                prop = getPropAsStr(translationContext, item, true);
-            }
+    /* perform the <math> function on the content */
+    case Expr::EXPR_MATH:
+        if (expr.content.empty())
+            zu4_error(ZU4_LOG_WRN, "Error: empty math() function");
 
-            /**
-             * We have a function, make it work!
-             */
-            else {
-                /* perform the <math> function on the content */
-                if (funcName == "math") {
-                    if (content.empty())
-                        zu4_error(ZU4_LOG_WRN, "Error: empty math() function");
+        prop = zu4_to_string(mathValue(expr.content));
+        break;
 
-                    prop = zu4_to_string(mathValue(content));
-                }
-
-                /**
-                 * Does a true/false comparison on the content.
-                 * Replaced with "true" if evaluates to true, or "false" if otherwise
-                 */
-                else if (funcName == "compare") {
-                    if (compare(content))
-                        prop = "true";
-                    else prop = "false";
-                }
-
-                /* make the string upper case */
-                else if (funcName == "toupper") {
-                    std::string::iterator current;
-                    for (current = content.begin(); current != content.end(); current++)
-                        *current = toupper(*current);
-
-                    prop = content;
-                }
-                /* make the string lower case */
-                else if (funcName == "tolower") {
-                    std::string::iterator current;
-                    for (current = content.begin(); current != content.end(); current++)
-                        *current = tolower(*current);
-
-                    prop = content;
-                }
-
-                /* generate a random number */
-                else if (funcName == "random")
-                    prop = zu4_to_string(zu4_random((int)strtol(content.c_str(), NULL, 10)));
+    /**
+     * Does a true/false comparison on the content.
+     * Replaced with "true" if evaluates to true, or "false" if otherwise
+     */
+    case Expr::EXPR_COMPARE:
+        if (compare(expr.content))
+            prop = "true";
+        else prop = "false";
+        break;
+
+    /* make the string upper case */
+    case Expr::EXPR_TOUPPER:
+        prop = expr.content;
+        for (std::string::iterator current = prop.begin(); current != prop.end(); current++)
+            *current = toupper(*current);
+        break;
+
+    /* make the string lower case */
+    case Expr::EXPR_TOLOWER:
+        prop = expr.content;
+        for (std::string::iterator current = prop.begin(); current != prop.end(); current++)
+            *current = tolower(*current);
+        break;
+
+    /* generate a random number */
+    case Expr::EXPR_RANDOM:
+        prop = zu4_to_string(zu4_random((int)strtol(expr.content.c_str(), NULL, 10)));
+        break;
+
+    /* replaced with "true" if content is empty, or "false" if not */
+    case Expr::EXPR_ISEMPTY:
+        if (expr.content.empty())
+            prop = "true";
+        else prop = "false";
+        break;
+
+    default:
+        break;
+    }
 
-                /* replaced with "true" if content is empty, or "false" if not */
-                else if (funcName == "isempty") {
-                    if (content.empty())
-                        prop = "true";
-                    else prop = "false";
-                }
-            }
-        }
+    if (prop.empty() && debug)
+        fprintf(debug, "\nWarning: dynamic property '{%s}' not found in vendor script (was this intentional?)", expr.item.c_str());
 
-        if (prop.empty() && debug)
-            fprintf(debug, "\nWarning: dynamic property '{%s}' not found in vendor script (was this intentional?)", item.c_str());
+    if (debug)
+        fprintf(debug, "\"%s\"", prop.c_str());
 
-        if (debug)
-            fprintf(debug, "\"%s\"", prop.c_str());
+    return prop;
+}
 
-        /* put the script back together */
-        *text = pre + prop + post;
+/**
+ * Returns the named attribute of a node, or NULL if it has none
+ */
+const Script::Attr *Script::findAttr(int node, int prop) {
+    if (node < 0)
+        return NULL;
+
+    const Node &n = program->nodes[node];
+    for (int i = n.attrs; i < n.attrs + n.nattrs; i++) {
+        if (program->attrs[i].name == prop)
+            return &program->attrs[i];
     }
-
-    /* remove all unnecessary spaces from xml */
-    while ((pos = text->find("\t")) < text->length())
-        text->replace(pos, 1, "");
-    while ((pos = text->find("  ")) < text->length())
-        text->replace(pos, 2, "");
-    while ((pos = text->find("\n ")) < text->length())
-        text->replace(pos, 2, "\n");
+    return NULL;
 }
 
 /**
  * Finds a subscript of script 'node'
  */
- xmlNodePtr Script::find(xmlNodePtr node, const std::string &script_to_find, const std::string &id, bool _default) {
-    xmlNodePtr current;
-    if (node) {
-        for (current = node->children; current; current = current->next) {
-            if (!xmlNodeIsText(current) && (script_to_find == (char *)current->name)) {
-                if (id.empty() && !xmlPropExists(current, idPropName.c_str()) && !_default)
-                    return current;
-                else if (xmlPropExists(current, idPropName.c_str()) && (id == xmlGetPropAsString(current, idPropName.c_str())))
-                    return current;
-                else if (_default && xmlPropExists(current, "default") && xmlGetPropAsBool(current, "default"))
-                    return current;
+int Script::find(int node, int script_to_find, const std::string &id, bool _default) {
+    const std::vector<Node> &nodes = program->nodes;
+    int current = -1;
+
+    if (node >= 0) {
+        for (int child = node + 1; child < nodes[node].end; child = nodes[child].end) {
+            if (!nodes[child].text && script_to_find == nodes[child].name) {
+                const Attr *idAttr = findAttr(child, idProp);
+                if (id.empty() && !idAttr && !_default)
+                    return child;
+                else if (idAttr && (id == idAttr->value))
+                    return child;
+                else if (_default && getPropAsBool(child, ATOM_DEFAULT))
+                    return child;
             }
         }
 
         /* only search the parent nodes if we haven't hit the base <script> node */
-        if (xmlStrcmp(node->name, (const xmlChar *)"script") != 0)
-            current = find(node->parent, script_to_find, id);
+        if (nodes[node].name != ATOM_SCRIPT)
+            current = find(nodes[node].parent, script_to_find, id);
 
         /* find the default script instead */
-        if (!current && !id.empty() && !_default)
+        if (current < 0 && !id.empty() && !_default)
             current = find(node, script_to_find, "", true);
         return current;
     }
-    return NULL;
+    return -1;
+}
+
+/**
+ * Finds the script a redirect or include goes to.  Where the node's
+ * attributes don't need translating, it always goes to the same place,
+ * so that is only looked for once.
+ */
+int Script::findScript(int current, const std::string &script, const std::string &id) {
+    if (resolved[current] != SCRIPT_UNRESOLVED)
+        return resolved[current];
+
+    int found = find(this->scriptNode, intern(script), id);
+    if (program->nodes[current].constant)
+        resolved[current] = found;
+    return found;
 }
 
 /**
  * Gets a property as string from the script, and
  * translates it using scriptTranslate.
  */
-std::string Script::getPropAsStr(std::list<xmlNodePtr>& nodes, const std::string &prop, bool recursive) {
+std::string Script::getPropAsStr(std::list<int>& nodes, int prop, bool recursive) {
     std::string propvalue;
-    std::list<xmlNodePtr>::reverse_iterator i;
+    const Attr *attr = NULL;
+    std::list<int>::reverse_iterator i;
 
     for (i = nodes.rbegin(); i != nodes.rend(); i++) {
-        xmlNodePtr node = *i;
-        if (xmlPropExists(node, prop.c_str())) {
-            propvalue = xmlGetPropAsString(node, prop.c_str());
+        if ((attr = findAttr(*i, prop)))
             break;
-        }
     }
 
-    if (propvalue.empty() && recursive) {
+    /* the value as compiled, if it's there */
+    if (attr && !attr->value.empty())
+        return translate(*attr->text);
+
+    if (recursive) {
         for (i = nodes.rbegin(); i != nodes.rend(); i++) {
-            xmlNodePtr node = *i;
-            if (node->parent) {
-                propvalue = getPropAsStr(node->parent, prop, recursive);
+            int node = *i;
+            if (node >= 0 && program->nodes[node].parent >= 0) {
+                propvalue = getPropAsStr(program->nodes[node].parent, prop, recursive);
                 break;
             }
         }
@@ -729,8 +1078,8 @@ std::string Script::getPropAsStr(std::list<xmlNodePtr>& nodes, const std::string
     translate(&propvalue);
     return propvalue;
 }
-std::string Script::getPropAsStr(xmlNodePtr node, const std::string &prop, bool recursive) {
-    std::list<xmlNodePtr> list;
+std::string Script::getPropAsStr(int node, int prop, bool recursive) {
+    std::list<int> list;
     list.push_back(node);
     return getPropAsStr(list, prop, recursive);
 }
@@ -738,47 +1087,44 @@ std::string Script::getPropAsStr(xmlNodePtr node, const std::string &prop, bool
 /**
  * Gets a property as int from the script
  */
-int Script::getPropAsInt(std::list<xmlNodePtr>& nodes, const std::string &prop, bool recursive) {
+int Script::getPropAsInt(std::list<int>& nodes, int prop, bool recursive) {
     std::string propvalue = getPropAsStr(nodes, prop, recursive);
     return mathValue(propvalue);
 }
-int Script::getPropAsInt(xmlNodePtr node, const std::string &prop, bool recursive) {
+int Script::getPropAsInt(int node, int prop, bool recursive) {
     std::string propvalue = getPropAsStr(node, prop, recursive);
     return mathValue(propvalue);
 }
 
 /**
- * Gets the content of a script node
+ * Gets a property as it was written, as a boolean
  */
-std::string Script::getContent(xmlNodePtr node) {
-    xmlChar *nodeContent = xmlNodeGetContent(node);
-    std::string content = reinterpret_cast<char *>(nodeContent);
-    xmlFree(nodeContent);
-    translate(&content);
-    return content;
+bool Script::getPropAsBool(int node, int prop) {
+    const Attr *attr = findAttr(node, prop);
+    return attr && attr->value == "true";
 }
 
 /**
  * Sets a new translation context for the script
  */
-Script::ReturnCode Script::pushContext(xmlNodePtr script, xmlNodePtr current) {
-    std::string nodeName = getPropAsStr(current, "name");
+Script::ReturnCode Script::pushContext(int script, int current) {
+    std::string nodeName = getPropAsStr(current, ATOM_NAME);
     std::string search_id;
 
-    if (xmlPropExists(current, idPropName.c_str()))
-        search_id = getPropAsStr(current, idPropName);
-    else if (variables.find(idPropName) != variables.end()) {
-        if (variables[idPropName]->isSet())
-            search_id = variables[idPropName]->getString();
+    if (findAttr(current, idProp))
+        search_id = getPropAsStr(current, idProp);
+    else if (idProp < static_cast<int>(variables.size()) && variables[idProp]) {
+        if (variables[idProp]->isSet())
+            search_id = variables[idProp]->getString();
         else search_id = "null";
     }
 
     // When looking for a new context, start from within our old one
-    translationContext.push_back(find(translationContext.back(), nodeName, search_id));
+    translationContext.push_back(find(translationContext.back(), intern(nodeName), search_id));
     if (debug) {
-        if (!this->translationContext.back())
-            fprintf(debug, "\nWarning!!! Invalid translation context <%s %s=\"%s\" ...>", nodeName.c_str(), idPropName.c_str(), search_id.c_str());
-        else fprintf(debug, "\nChanging translation context to <%s %s=\"%s\" ...>", nodeName.c_str(), idPropName.c_str(), search_id.c_str());
+        if (this->translationContext.back() < 0)
+            fprintf(debug, "\nWarning!!! Invalid translation context <%s %s=\"%s\" ...>", nodeName.c_str(), atomName(idProp), search_id.c_str());
+        else fprintf(debug, "\nChanging translation context to <%s %s=\"%s\" ...>", nodeName.c_str(), atomName(idProp), search_id.c_str());
     }
 
     return RET_OK;
@@ -787,11 +1133,11 @@ Script::ReturnCode Script::pushContext(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Removes a node from the translation context
  */
-Script::ReturnCode Script::popContext(xmlNodePtr script, xmlNodePtr current) {
+Script::ReturnCode Script::popContext(int script, int current) {
     if (translationContext.size() > 1) {
         translationContext.pop_back();
         if (debug)
-            fprintf(debug, "\nReverted translation context to <%s ...>", translationContext.back()->name);
+            fprintf(debug, "\nReverted translation context to <%s ...>", atomName(translationContext.back() >= 0 ? program->nodes[translationContext.back()].name : -1));
     }
     return RET_OK;
 }
@@ -799,12 +1145,12 @@ Script::ReturnCode Script::popContext(xmlNodePtr script, xmlNodePtr current) {
 /**
  * End script execution
  */
-Script::ReturnCode Script::end(xmlNodePtr script, xmlNodePtr current) {
+Script::ReturnCode Script::end(int script, int current) {
     /**
      * See if there's a global 'end' node declared for cleanup
      */
-    xmlNodePtr endScript = find(scriptNode, "end");
-    if (endScript)
+    int endScript = find(scriptNode, ATOM_END);
+    if (endScript >= 0)
         execute(endScript);
 
     if (debug)
@@ -818,7 +1164,7 @@ Script::ReturnCode Script::end(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Wait for keypress from the user
  */
-Script::ReturnCode Script::waitForKeypress(xmlNodePtr script, xmlNodePtr current) {
+Script::ReturnCode Script::waitForKeypress(int script, int current) {
     this->currentScript = script;
     this->currentItem = current;
     this->choices = "abcdefghijklmnopqrstuvwxyz01234567890\015 \033";
@@ -835,24 +1181,24 @@ Script::ReturnCode Script::waitForKeypress(xmlNodePtr script, xmlNodePtr current
 /**
  * Redirects script execution to another script
  */
-Script::ReturnCode Script::redirect(xmlNodePtr script, xmlNodePtr current) {
+Script::ReturnCode Script::redirect(int script, int current) {
     std::string target;
 
-    if (xmlPropExists(current, "redirect"))
-        target = getPropAsStr(current, "redirect");
-    else target = getPropAsStr(current, "target");
+    if (findAttr(current, ATOM_REDIRECT))
+        target = getPropAsStr(current, ATOM_REDIRECT);
+    else target = getPropAsStr(current, ATOM_TARGET);
 
     /* set a new search id */
-    std::string search_id = getPropAsStr(current, idPropName);
+    std::string search_id = getPropAsStr(current, idProp);
 
-    xmlNodePtr newScript = find(this->scriptNode, target, search_id);
-    if (!newScript)
-        zu4_error(ZU4_LOG_ERR, "Error: redirect failed -- could not find target script '%s' with %s=\"%s\"", target.c_str(), idPropName.c_str(), search_id.c_str());
+    int newScript = findScript(current, target, search_id);
+    if (newScript < 0)
+        zu4_error(ZU4_LOG_ERR, "Error: redirect failed -- could not find target script '%s' with %s=\"%s\"", target.c_str(), atomName(idProp), search_id.c_str());
 
     if (debug) {
         fprintf(debug, "\nRedirected to <%s", target.c_str());
         if (search_id.length())
-            fprintf(debug, " %s=\"%s\"", idPropName.c_str(), search_id.c_str());
+            fprintf(debug, " %s=\"%s\"", atomName(idProp), search_id.c_str());
         fprintf(debug, " .../>");
     }
 
@@ -863,18 +1209,18 @@ Script::ReturnCode Script::redirect(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Includes a script to be executed
  */
-Script::ReturnCode Script::include(xmlNodePtr script, xmlNodePtr current) {
-    std::string scriptName = getPropAsStr(current, "script");
-    std::string id = getPropAsStr(current, idPropName);
+Script::ReturnCode Script::include(int script, int current) {
+    std::string scriptName = getPropAsStr(current, ATOM_SCRIPT);
+    std::string id = getPropAsStr(current, idProp);
 
-    xmlNodePtr newScript = find(this->scriptNode, scriptName, id);
-    if (!newScript)
-        zu4_error(ZU4_LOG_ERR, "Error: include failed -- could not find target script '%s' with %s=\"%s\"", scriptName.c_str(), idPropName.c_str(), id.c_str());
+    int newScript = findScript(current, scriptName, id);
+    if (newScript < 0)
+        zu4_error(ZU4_LOG_ERR, "Error: include failed -- could not find target script '%s' with %s=\"%s\"", scriptName.c_str(), atomName(idProp), id.c_str());
 
     if (debug) {
         fprintf(debug, "\nIncluded script <%s", scriptName.c_str());
         if (id.length())
-            fprintf(debug, " %s=\"%s\"", idPropName.c_str(), id.c_str());
+            fprintf(debug, " %s=\"%s\"", atomName(idProp), id.c_str());
         fprintf(debug, " .../>");
     }
 
@@ -885,8 +1231,8 @@ Script::ReturnCode Script::include(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Waits a given number of milliseconds before continuing execution
  */
-Script::ReturnCode Script::wait(xmlNodePtr script, xmlNodePtr current) {
-    int msecs = getPropAsInt(current, "msecs");
+Script::ReturnCode Script::wait(int script, int current) {
+    int msecs = getPropAsInt(current, ATOM_MSECS);
     EventHandler::wait_msecs(msecs);
     return RET_OK;
 }
@@ -894,10 +1240,10 @@ Script::ReturnCode Script::wait(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Executes a 'for' loop script
  */
-Script::ReturnCode Script::forLoop(xmlNodePtr script, xmlNodePtr current) {
+Script::ReturnCode Script::forLoop(int script, int current) {
     Script::ReturnCode retval = RET_OK;
-    int start = getPropAsInt(current, "start"),
-        end = getPropAsInt(current, "end"),
+    int start = getPropAsInt(current, ATOM_START),
+        end = getPropAsInt(current, ATOM_END),
         /* save the iterator in case this loop is nested */
         oldIterator = this->iterator,
         i;
@@ -926,8 +1272,8 @@ Script::ReturnCode Script::forLoop(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Randomely executes script code
  */
-Script::ReturnCode Script::random(xmlNodePtr script, xmlNodePtr current) {
-    int perc = getPropAsInt(current, "chance");
+Script::ReturnCode Script::random(int script, int current) {
+    int perc = getPropAsInt(current, ATOM_CHANCE);
     int num = zu4_random(100);
     Script::ReturnCode retval = RET_OK;
 
@@ -943,13 +1289,13 @@ Script::ReturnCode Script::random(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Moves the player's current position
  */
-Script::ReturnCode Script::move(xmlNodePtr script, xmlNodePtr current) {
-    if (xmlPropExists(current, "x"))
-        c->location->coords.x = getPropAsInt(current, "x");
-    if (xmlPropExists(current, "y"))
-        c->location->coords.y = getPropAsInt(current, "y");
-    if (xmlPropExists(current, "z"))
-        c->location->coords.z = getPropAsInt(current, "z");
+Script::ReturnCode Script::move(int script, int current) {
+    if (findAttr(current, ATOM_X))
+        c->location->coords.x = getPropAsInt(current, ATOM_X);
+    if (findAttr(current, ATOM_Y))
+        c->location->coords.y = getPropAsInt(current, ATOM_Y);
+    if (findAttr(current, ATOM_Z))
+        c->location->coords.z = getPropAsInt(current, ATOM_Z);
 
     if (debug)
         fprintf(debug, "\nMove: x-%d y-%d z-%d", c->location->coords.x, c->location->coords.y, c->location->coords.z);
@@ -961,7 +1307,7 @@ Script::ReturnCode Script::move(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Puts the player to sleep. Useful when coding inn scripts
  */
-Script::ReturnCode Script::sleep(xmlNodePtr script, xmlNodePtr current) {
+Script::ReturnCode Script::sleep(int script, int current) {
     if (debug)
         fprintf(debug, "\nSleep!\n");
 
@@ -974,8 +1320,8 @@ Script::ReturnCode Script::sleep(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Enables/Disables the keyboard cursor
  */
-Script::ReturnCode Script::cursor(xmlNodePtr script, xmlNodePtr current) {
-    bool enable = (bool)xmlGetPropAsBool(current, "enable");
+Script::ReturnCode Script::cursor(int script, int current) {
+    bool enable = getPropAsBool(current, ATOM_ENABLE);
     if (enable)
         screenEnableCursor();
     else screenDisableCursor();
@@ -986,11 +1332,11 @@ Script::ReturnCode Script::cursor(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Pay gold to someone
  */
-Script::ReturnCode Script::pay(xmlNodePtr script, xmlNodePtr current) {
-    int price = getPropAsInt(current, "price");
-    int quant = getPropAsInt(current, "quantity");
+Script::ReturnCode Script::pay(int script, int current) {
+    int price = getPropAsInt(current, ATOM_PRICE);
+    int quant = getPropAsInt(current, ATOM_QUANTITY);
 
-    std::string cantpay = getPropAsStr(current, "cantpay");
+    std::string cantpay = getPropAsStr(current, ATOM_CANTPAY);
 
     if (price < 0)
         zu4_error(ZU4_LOG_ERR, "Error: could not find price for item");
@@ -1019,8 +1365,8 @@ Script::ReturnCode Script::pay(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Perform a limited 'if' statement
  */
-Script::ReturnCode Script::_if(xmlNodePtr script, xmlNodePtr current) {
-    std::string test = getPropAsStr(current, "test");
+Script::ReturnCode Script::_if(int script, int current) {
+    std::string test = getPropAsStr(current, ATOM_TEST);
     Script::ReturnCode retval = RET_OK;
 
     if (debug)
@@ -1028,7 +1374,7 @@ Script::ReturnCode Script::_if(xmlNodePtr script, xmlNodePtr current) {
 
     if (compare(test)) {
         if (debug)
-            fprintf(debug, "True - Executing '%s'", current->name);
+            fprintf(debug, "True - Executing '%s'", atomName(program->nodes[current].name));
 
         retval = execute(current);
     }
@@ -1041,30 +1387,30 @@ Script::ReturnCode Script::_if(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Get input from the player
  */
-Script::ReturnCode Script::input(xmlNodePtr script, xmlNodePtr current) {
-    std::string type = getPropAsStr(current, "type");
+Script::ReturnCode Script::input(int script, int current) {
+    std::string type = getPropAsStr(current, ATOM_TYPE);
 
     this->currentScript = script;
     this->currentItem = current;
 
-    if (xmlPropExists(current, "target"))
-        this->target = getPropAsStr(current, "target");
+    if (findAttr(current, ATOM_TARGET))
+        this->target = getPropAsStr(current, ATOM_TARGET);
     else this->target.erase();
 
     this->state = STATE_INPUT;
     this->inputName = "input";
 
     // Does the variable have a maximum length?
-    if (xmlPropExists(current, "maxlen"))
-        this->inputMaxLen = getPropAsInt(current, "maxlen");
+    if (findAttr(current, ATOM_MAXLEN))
+        this->inputMaxLen = getPropAsInt(current, ATOM_MAXLEN);
     else this->inputMaxLen = Conversation::BUFFERLEN;
 
     // Should we name the variable something other than "input"
-    if (xmlPropExists(current, "name"))
-        this->inputName = getPropAsStr(current, "name");
+    if (findAttr(current, ATOM_NAME))
+        this->inputName = getPropAsStr(current, ATOM_NAME);
     else {
         if (type == "choice")
-            this->inputName = idPropName;
+            this->inputName = atomName(idProp);
     }
 
     if (type == "number")
@@ -1073,7 +1419,7 @@ Script::ReturnCode Script::input(xmlNodePtr script, xmlNodePtr current) {
         this->inputType = INPUT_KEYPRESS;
     else if (type == "choice") {
         this->inputType = INPUT_CHOICE;
-        this->choices = getPropAsStr(current, "options");
+        this->choices = getPropAsStr(current, ATOM_OPTIONS);
         this->choices += " \015\033";
     }
     else if (type == "text")
@@ -1093,14 +1439,14 @@ Script::ReturnCode Script::input(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Add item to inventory
  */
-Script::ReturnCode Script::add(xmlNodePtr script, xmlNodePtr current) {
-    std::string type = getPropAsStr(current, "type");
-    std::string subtype = getPropAsStr(current, "subtype");
-    int quant = getPropAsInt(this->translationContext.back(), "quantity");
+Script::ReturnCode Script::add(int script, int current) {
+    std::string type = getPropAsStr(current, ATOM_TYPE);
+    std::string subtype = getPropAsStr(current, ATOM_SUBTYPE);
+    int quant = getPropAsInt(this->translationContext.back(), ATOM_QUANTITY);
     if (quant == 0)
-        quant = getPropAsInt(current, "quantity");
+        quant = getPropAsInt(current, ATOM_QUANTITY);
     else
-        quant *= getPropAsInt(current, "quantity");
+        quant *= getPropAsInt(current, ATOM_QUANTITY);
 
     if (debug) {
         fprintf(debug, "\nAdd: %s ", type.c_str());
@@ -1168,10 +1514,10 @@ Script::ReturnCode Script::add(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Lose item
  */
-Script::ReturnCode Script::lose(xmlNodePtr script, xmlNodePtr current) {
-    std::string type = getPropAsStr(current, "type");
-    std::string subtype = getPropAsStr(current, "subtype");
-    int quant = getPropAsInt(current, "quantity");
+Script::ReturnCode Script::lose(int script, int current) {
+    std::string type = getPropAsStr(current, ATOM_TYPE);
+    std::string subtype = getPropAsStr(current, ATOM_SUBTYPE);
+    int quant = getPropAsInt(current, ATOM_QUANTITY);
 
     if (type == "weapon")
         AdjustValueMin(c->saveGame->weapons[subtype[0] - 'a'], -quant, 0);
@@ -1191,9 +1537,9 @@ Script::ReturnCode Script::lose(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Heals a party member
  */
-Script::ReturnCode Script::heal(xmlNodePtr script, xmlNodePtr current) {
-    std::string type = getPropAsStr(current, "type");
-    PartyMember *p = c->party->member(getPropAsInt(current, "player")-1);
+Script::ReturnCode Script::heal(int script, int current) {
+    std::string type = getPropAsStr(current, ATOM_TYPE);
+    PartyMember *p = c->party->member(getPropAsInt(current, ATOM_PLAYER)-1);
 
     if (type == "cure")
         p->heal(HT_CURE);
@@ -1210,7 +1556,7 @@ Script::ReturnCode Script::heal(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Performs all of the visual/audio effects of casting a spell
  */
-Script::ReturnCode Script::castSpell(xmlNodePtr script, xmlNodePtr current) {
+Script::ReturnCode Script::castSpell(int script, int current) {
     extern SpellEffectCallback spellEffectCallback;
     (*spellEffectCallback)('r', -1, SOUND_MAGIC);
     if (debug)
@@ -1222,9 +1568,9 @@ Script::ReturnCode Script::castSpell(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Apply damage to a player
  */
-Script::ReturnCode Script::damage(xmlNodePtr script, xmlNodePtr current) {
-    int player = getPropAsInt(current, "player") - 1;
-    int pts = getPropAsInt(current, "pts");
+Script::ReturnCode Script::damage(int script, int current) {
+    int player = getPropAsInt(current, ATOM_PLAYER) - 1;
+    int pts = getPropAsInt(current, ATOM_PTS);
     PartyMember *p;
 
     p = c->party->member(player);
@@ -1239,8 +1585,8 @@ Script::ReturnCode Script::damage(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Apply karma changes based on the action taken
  */
-Script::ReturnCode Script::karma(xmlNodePtr script, xmlNodePtr current) {
-    std::string action = getPropAsStr(current, "action");
+Script::ReturnCode Script::karma(int script, int current) {
+    std::string action = getPropAsStr(current, ATOM_ACTION);
 
     if (debug)
         fprintf(debug, "\nKarma: adjusting - '%s'", action.c_str());
@@ -1284,15 +1630,15 @@ Script::ReturnCode Script::karma(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Set the currently playing music
  */
-Script::ReturnCode Script::music(xmlNodePtr script, xmlNodePtr current) {
-    if (xmlGetPropAsBool(current, "reset"))
+Script::ReturnCode Script::music(int script, int current) {
+    if (getPropAsBool(current, ATOM_RESET))
         zu4_music_play(c->location->map->music);
     else {
-        std::string type = getPropAsStr(current, "type");
+        std::string type = getPropAsStr(current, ATOM_TYPE);
 
-        if (xmlGetPropAsBool(current, "play"))
+        if (getPropAsBool(current, ATOM_PLAY))
             zu4_music_play(c->location->map->music);
-        if (xmlGetPropAsBool(current, "stop"))
+        if (getPropAsBool(current, ATOM_STOP))
             zu4_music_stop();
         else if (type == "shopping")
             zu4_music_play(TRACK_SHOPPING);
@@ -1306,9 +1652,9 @@ Script::ReturnCode Script::music(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Sets a variable
  */
-Script::ReturnCode Script::setVar(xmlNodePtr script, xmlNodePtr current) {
-    std::string name = getPropAsStr(current, "name");
-    std::string value = getPropAsStr(current, "value");
+Script::ReturnCode Script::setVar(int script, int current) {
+    std::string name = getPropAsStr(current, ATOM_NAME);
+    std::string value = getPropAsStr(current, ATOM_VALUE);
 
     if (name.empty()) {
         if (debug)
@@ -1316,11 +1662,12 @@ Script::ReturnCode Script::setVar(xmlNodePtr script, xmlNodePtr current) {
         return RET_STOP;
     }
 
-    removeCurrentVariable(name);
-    variables[name] = new Variable(value);
+    int slot = intern(name);
+    removeCurrentVariable(slot);
+    variables[slot] = new Variable(value);
 
     if (debug)
-        fprintf(debug, "\nSet Variable: %s=%s", name.c_str(), variables[name]->getString().c_str());
+        fprintf(debug, "\nSet Variable: %s=%s", name.c_str(), variables[slot]->getString().c_str());
 
     return RET_OK;
 }
@@ -1328,7 +1675,7 @@ Script::ReturnCode Script::setVar(xmlNodePtr script, xmlNodePtr current) {
 /**
  * Display a different ztats screen
  */
-Script::ReturnCode Script::ztats(xmlNodePtr script, xmlNodePtr current) {
+Script::ReturnCode Script::ztats(int script, int current) {
     typedef std::map<std::string, StatsView, std::less<std::string> > StatsViewMap;
     static StatsViewMap view_map;
 
@@ -1350,8 +1697,8 @@ Script::ReturnCode Script::ztats(xmlNodePtr script, xmlNodePtr current) {
         view_map["mixtures"]    = STATS_MIXTURES;
     }
 
-    if (xmlPropExists(current, "screen")) {
-        std::string screen = getPropAsStr(current, "screen");
+    if (findAttr(current, ATOM_SCREEN)) {
+        std::string screen = getPropAsStr(current, ATOM_SCREEN);
         StatsViewMap::iterator view;
 
         if (debug)
@@ -1371,29 +1718,6 @@ Script::ReturnCode Script::ztats(xmlNodePtr script, xmlNodePtr current) {
     return RET_OK;
 }
 
-/**
- * Parses a math string's children into results so
- * there is only 1 equation remaining.
- *
- * ie. <math>5*<math>6/3</math></math>
- */
-void Script::mathParseChildren(xmlNodePtr math, std::string *result) {
-    xmlNodePtr current;
-    result->erase();
-
-    for (current = math->children; current; current = current->next) {
-        if (xmlNodeIsText(current)) {
-            *result = getContent(current);
-        }
-        else if (xmlStrcmp(current->name, (const xmlChar *)"math") == 0) {
-            std::string children_results;
-
-            mathParseChildren(current, &children_results);
-            *result = zu4_to_string(mathValue(children_results));
-        }
-    }
-}
-
 /**
  * Parses a string into left integer value, right integer value,
  * and operator. Returns false if the string is not a valid
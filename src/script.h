@@ -19,6 +19,12 @@
  * it should be possible to write scripts for other parts of the
  * game.
  *
+ * Each script file is compiled once into a flat program of nodes,
+ * with the XML element names resolved to actions, names interned as
+ * small integers (which also serve as the variable slots), and text
+ * pre-split around its {...} expressions.  An element's body is the
+ * run of nodes following it, up to the index it records as its end.
+ *
  * @todo
  * <ul>
  *      <li>Strip vendor-specific code from the language</li>
@@ -137,7 +143,7 @@ public:
     bool load(const std::string &filename, const std::string &baseId, const std::string &subNodeName = "", const std::string &subNodeId = "");
     void unload();
     void run(const std::string &script);
-    ReturnCode execute(xmlNodePtr script, xmlNodePtr currentItem = NULL, std::string *output = NULL);
+    ReturnCode execute(int script, int currentItem = -1, std::string *output = NULL);
     void _continue();
 
     void resetState();
@@ -157,47 +163,59 @@ public:
     int getInputMaxLen();
 
 private:
+    struct Expr;
+    struct Text;
+    struct Attr;
+    struct Node;
+    struct Program;
+
+    Program    *compile(const std::string &filename);
+    void        compileNode(Program *program, xmlNodePtr node, int parent);
+    void        compileText(const std::string &raw, Text *text);
+    void        classify(const std::string &item, Expr *expr);
+    std::string evaluate(const Expr &expr);
+    std::string translate(const Text &text);
     void        translate(std::string *script);
-    xmlNodePtr  find(xmlNodePtr node, const std::string &script, const std::string &choice = "", bool _default = false);
-    std::string getPropAsStr(std::list<xmlNodePtr>& nodes, const std::string &prop, bool recursive);
-    std::string getPropAsStr(xmlNodePtr node, const std::string &prop, bool recursive = false);
-    int         getPropAsInt(std::list<xmlNodePtr>& nodes, const std::string &prop, bool recursive);
-    int         getPropAsInt(xmlNodePtr node, const std::string &prop, bool recursive = false);
-    std::string getContent(xmlNodePtr node);
+    const Attr *findAttr(int node, int prop);
+    int         find(int node, int script, const std::string &choice = "", bool _default = false);
+    int         findScript(int current, const std::string &script, const std::string &id);
+    std::string getPropAsStr(std::list<int>& nodes, int prop, bool recursive);
+    std::string getPropAsStr(int node, int prop, bool recursive = false);
+    int         getPropAsInt(std::list<int>& nodes, int prop, bool recursive);
+    int         getPropAsInt(int node, int prop, bool recursive = false);
+    bool        getPropAsBool(int node, int prop);
 
     /*
      * Action Functions
      */
-    ReturnCode pushContext(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode popContext(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode end(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode waitForKeypress(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode redirect(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode include(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode wait(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode forLoop(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode random(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode move(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode sleep(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode cursor(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode pay(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode _if(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode input(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode add(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode lose(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode heal(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode castSpell(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode damage(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode karma(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode music(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode setVar(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode setId(xmlNodePtr script, xmlNodePtr current);
-    ReturnCode ztats(xmlNodePtr script, xmlNodePtr current);
+    ReturnCode pushContext(int script, int current);
+    ReturnCode popContext(int script, int current);
+    ReturnCode end(int script, int current);
+    ReturnCode waitForKeypress(int script, int current);
+    ReturnCode redirect(int script, int current);
+    ReturnCode include(int script, int current);
+    ReturnCode wait(int script, int current);
+    ReturnCode forLoop(int script, int current);
+    ReturnCode random(int script, int current);
+    ReturnCode move(int script, int current);
+    ReturnCode sleep(int script, int current);
+    ReturnCode cursor(int script, int current);
+    ReturnCode pay(int script, int current);
+    ReturnCode _if(int script, int current);
+    ReturnCode input(int script, int current);
+    ReturnCode add(int script, int current);
+    ReturnCode lose(int script, int current);
+    ReturnCode heal(int script, int current);
+    ReturnCode castSpell(int script, int current);
+    ReturnCode damage(int script, int current);
+    ReturnCode karma(int script, int current);
+    ReturnCode music(int script, int current);
+    ReturnCode setVar(int script, int current);
+    ReturnCode ztats(int script, int current);
 
     /*
      * Math and comparison functions
      */
-    void mathParseChildren(xmlNodePtr math, std::string *result);
     int mathValue(const std::string &str);
     int math(int lval, int rval, std::string &op);
     bool mathParse(const std::string &str, int *lval, int *rval, std::string *op);
@@ -211,30 +229,32 @@ private:
 private:
     typedef std::map<std::string, Action> ActionMap;
     static ActionMap action_map;
+    static std::map<std::string, Program *> programs;
 
 private:
-    void removeCurrentVariable(const std::string &name);
-    xmlDocPtr vendorScriptDoc;
-    xmlNodePtr scriptNode;
+    void removeCurrentVariable(int name);
+    Program *program;               /**< The compiled script file */
+    int scriptNode;
     FILE *debug;
 
     State state;                    /**< The state the script is in */
-    xmlNodePtr currentScript;       /**< The currently running script */
-    xmlNodePtr currentItem;         /**< The current position in the script */
-    std::list<xmlNodePtr> translationContext;  /**< A list of nodes that make up our translation context */
+    int currentScript;              /**< The currently running script */
+    int currentItem;                /**< The current position in the script */
+    std::list<int> translationContext;  /**< A list of nodes that make up our translation context */
     std::string target;             /**< The name of a target script */
     InputType inputType;            /**< The type of input required */
     std::string inputName;          /**< The variable in which to place the input (by default, "input") */
     int inputMaxLen;                /**< The maximum length allowed for input */
 
-    std::string nounName;           /**< The name that identifies a node name of noun nodes */
-    std::string idPropName;         /**< The name of the property that uniquely identifies a noun node
+    int noun;                       /**< The name that identifies a node name of noun nodes */
+    int idProp;                     /**< The name of the property that uniquely identifies a noun node
                                          and is used to find a new translation context */
 
     std::string choices;
     int iterator;
 
-    std::map<std::string, Variable*> variables;
+    std::vector<Variable *> variables;  /**< Variables by name, NULL where there is none */
+    std::vector<int> resolved;      /**< Redirect and include targets found so far, by node */
     std::map<std::string, Provider*> providers;
 };
 
@@ -92,6 +92,7 @@ bool zu4_settings_read() {
     settings.shakeInterval         = DEFAULT_SHAKE_INTERVAL;
     settings.titleSpeedRandom      = DEFAULT_TITLE_SPEED_RANDOM;
     settings.titleSpeedOther       = DEFAULT_TITLE_SPEED_OTHER;
+    settings.gpuTiles              = DEFAULT_GPU_TILES;
 
     /* all specific minor enhancements default to "on", any major enhancements default to "off" */
     settings.enhancementsOptions.activePlayer     = true;
@@ -126,6 +127,8 @@ bool zu4_settings_read() {
             settings.gemLayout = (int) strtoul(buffer + strlen("gemLayout="), NULL, 0);
         else if (strstr(buffer, "lineOfSight=") == buffer)
             settings.lineOfSight = (int) strtoul(buffer + strlen("lineOfSight="), NULL, 0);
+        else if (strstr(buffer, "gpuTiles=") == buffer)
+            settings.gpuTiles = (int) strtoul(buffer + strlen("gpuTiles="), NULL, 0);
         else if (strstr(buffer, "screenShakes=") == buffer)
             settings.screenShakes = (int) strtoul(buffer + strlen("screenShakes="), NULL, 0);        
         else if (strstr(buffer, "gamma=") == buffer)
@@ -224,6 +227,7 @@ bool zu4_settings_write() {
             "video=%d\n"
             "gemLayout=%d\n"
             "lineOfSight=%d\n"
+            "gpuTiles=%d\n"
             "screenShakes=%d\n"
             "gamma=%d\n"
             "musicVol=%d\n"
@@ -263,6 +267,7 @@ bool zu4_settings_write() {
             settings.videoType,
             settings.gemLayout,
             settings.lineOfSight,
+            settings.gpuTiles,
             settings.screenShakes,
             settings.gamma,
             settings.musicVol,
@@ -46,6 +46,7 @@ extern "C" {
 #define DEFAULT_BATTLE_DIFFICULTY       0 // 0 = Normal, 1 = Hard, 2 = Expert
 #define DEFAULT_TITLE_SPEED_RANDOM      150
 #define DEFAULT_TITLE_SPEED_OTHER       30
+#define DEFAULT_GPU_TILES               0
 
 typedef struct SettingsEnhancementOptions {
     bool activePlayer;
@@ -91,6 +92,7 @@ typedef struct SettingsData {
     int                 gemLayout;
     int                 lineOfSight;
     int                 battleDiff;
+    bool                gpuTiles;
 } SettingsData;
 
 extern SettingsData settings;
@@ -69,7 +69,7 @@ int zu4_snd_vol_dec() {
 
 static void zu4_snd_free_files() {
 	for (int i = 0; i < SOUND_MAX; i++) {
-		if (effect[i]) { free(effect[i]); }
+		if (effect[i]) { cm_destroy_source(effect[i]); }
 	}
 }
 
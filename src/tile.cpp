@@ -162,8 +162,13 @@ void Tile::loadImage() {
 
 void Tile::deleteImage()
 {
+    /* animation frames cached for the tile were made from its image */
+    if (anim) {
+        anim->forget(this);
+        anim = NULL;
+    }
     if(image) {
-        delete image;
+        zu4_img_free(image);
         image = NULL;
     }
     scale = 1;
@@ -200,7 +205,7 @@ bool Tile::isDungeonFloor() const {
 
 bool Tile::isOpaque() const {
     extern Context *c;
-    return c->opacity ? opaque : false;
+    return c->opacity ? attr().opaque : false;
 }
 
 /**
@@ -208,7 +213,7 @@ bool Tile::isOpaque() const {
  * Deprecated? Never used in XML. Other mechanisms exist, though this could help?
  */
 bool Tile::isForeground() const {
-    return (rule->mask & MASK_FOREGROUND);
+    return (attr().mask & MASK_FOREGROUND);
 }
 
 Direction Tile::directionForFrame(int frame) const {
@@ -56,41 +56,44 @@ public:
     TileAnim *getAnim() const           {return anim;}
     Image *getImage();
     const std::string &getLooksLike() const {return looks_like;}
+    Tileset *getTileset() const         {return tileset;}
+    const TileRule *getRule() const     {return rule;}
+    bool getOpaque() const              {return opaque;}
 
     bool isTiledInDungeon() const       {return tiledInDungeon;}
     bool isLandForeground() const       {return foreground;}
     bool isWaterForeground() const      {return waterForeground;}
 
-    int canWalkOn(Direction d) const   {return DIR_IN_MASK(d, rule->walkonDirs);}
-	int canWalkOff(Direction d) const  { return DIR_IN_MASK(d, rule->walkoffDirs); }
+    int canWalkOn(Direction d) const   {return DIR_IN_MASK(d, attr().walkonDirs);}
+	int canWalkOff(Direction d) const  { return DIR_IN_MASK(d, attr().walkoffDirs); }
 
     /**
      * All tiles that you can walk, swim, or sail on, can be attacked over. All others must declare
      * themselves
      */
-	int  canAttackOver() const      {return isWalkable() || isSwimable() || isSailable() || (rule->mask & MASK_ATTACKOVER); }
-	int  canLandBalloon() const     {return rule->mask & MASK_CANLANDBALLOON; }
-	int  isLivingObject() const     {return rule->mask & MASK_LIVING_THING; }
-	int  isReplacement() const      {return rule->mask & MASK_REPLACEMENT; }
-	int  isWaterReplacement() const {return rule->mask & MASK_WATER_REPLACEMENT; }
-
-	int  isWalkable() const         {return rule->walkonDirs > 0; }
-    bool isCreatureWalkable() const {return canWalkOn(DIR_ADVANCE) && !(rule->movementMask & MASK_CREATURE_UNWALKABLE);}
+	int  canAttackOver() const      {return isWalkable() || isSwimable() || isSailable() || (attr().mask & MASK_ATTACKOVER); }
+	int  canLandBalloon() const     {return attr().mask & MASK_CANLANDBALLOON; }
+	int  isLivingObject() const     {return attr().mask & MASK_LIVING_THING; }
+	int  isReplacement() const      {return attr().mask & MASK_REPLACEMENT; }
+	int  isWaterReplacement() const {return attr().mask & MASK_WATER_REPLACEMENT; }
+
+	int  isWalkable() const         {return attr().walkonDirs > 0; }
+    bool isCreatureWalkable() const {return canWalkOn(DIR_ADVANCE) && !(attr().movementMask & MASK_CREATURE_UNWALKABLE);}
     bool isDungeonWalkable() const;
     bool isDungeonFloor() const;
-    int  isSwimable() const         {return rule->movementMask & MASK_SWIMABLE;}
-    int  isSailable() const         {return rule->movementMask & MASK_SAILABLE;}
+    int  isSwimable() const         {return attr().movementMask & MASK_SWIMABLE;}
+    int  isSailable() const         {return attr().movementMask & MASK_SAILABLE;}
     bool isWater() const            {return (isSwimable() || isSailable());}
-    int  isFlyable() const          {return !(rule->movementMask & MASK_UNFLYABLE);}
-    int  isDoor() const             {return rule->mask & MASK_DOOR;}
-    int  isLockedDoor() const       {return rule->mask & MASK_LOCKEDDOOR;}
-    int  isChest() const            {return rule->mask & MASK_CHEST;}
-    int  isShip() const             {return rule->mask & MASK_SHIP;}
+    int  isFlyable() const          {return !(attr().movementMask & MASK_UNFLYABLE);}
+    int  isDoor() const             {return attr().mask & MASK_DOOR;}
+    int  isLockedDoor() const       {return attr().mask & MASK_LOCKEDDOOR;}
+    int  isChest() const            {return attr().mask & MASK_CHEST;}
+    int  isShip() const             {return attr().mask & MASK_SHIP;}
     bool isPirateShip() const       {return name == "pirate_ship";}
-    int  isHorse() const            {return rule->mask & MASK_HORSE;}
-    int  isBalloon() const          {return rule->mask & MASK_BALLOON;}
-    int  canDispel() const          {return rule->mask & MASK_DISPEL;}
-    int  canTalkOver() const        {return rule->mask & MASK_TALKOVER;}
+    int  isHorse() const            {return attr().mask & MASK_HORSE;}
+    int  isBalloon() const          {return attr().mask & MASK_BALLOON;}
+    int  canDispel() const          {return attr().mask & MASK_DISPEL;}
+    int  canTalkOver() const        {return attr().mask & MASK_TALKOVER;}
     TileSpeed getSpeed() const      {return rule->speed;}
     TileEffect getEffect() const    {return rule->effect;}
 
@@ -106,6 +109,7 @@ public:
 
 private:
     void loadImage();
+    const TileAttributes &attr() const  {return Tileset::attributesOf(id);}
 
 private:
     TileId id;          /**< an id that is unique across all tilesets */
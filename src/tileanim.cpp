@@ -2,15 +2,38 @@
  * $Id: tileanim.cpp 3019 2012-03-18 11:31:13Z daniel_santos $
  */
 
+#include <stdint.h>
 #include <vector>
 
 #include "config.h"
 #include "image.h"
-#include "random.h"
 #include "screen.h"
 #include "tileanim.h"
 #include "tile.h"
 
+/* the number of differently seeded frames kept for random animations */
+#define TILEANIM_VARIANTS 4
+
+/*
+ * Random numbers for rendering animation frames.  Each cached frame is
+ * rendered from its own seed, and the game's random sequence is left
+ * alone by the animations.
+ */
+static uint32_t animSeed = 1;
+
+static void animSrandom(uint32_t seed) {
+    animSeed = seed ? seed : 1;
+}
+
+static int animRandom(int upperRange) {
+    animSeed ^= animSeed << 13;
+    animSeed ^= animSeed >> 17;
+    animSeed ^= animSeed << 5;
+    if (upperRange <= 0)
+        return 0;
+    return (int)(((uint64_t)animSeed * upperRange) >> 32);
+}
+
 TileAnimTransform *TileAnimTransform::create(const ConfigElement &conf) {
     TileAnimTransform *transform = NULL;
     static const char *transformTypeEnumStrings[] = { "invert", "pixel", "scroll", "frame", "pixel_color", NULL };
@@ -114,7 +137,7 @@ TileAnimPixelTransform::TileAnimPixelTransform(int x, int y) {
 
 bool TileAnimPixelTransform::drawsTile() const { return false; }
 void TileAnimPixelTransform::draw(Image *dest, Tile *tile, MapTile &mapTile) {
-    RGBA *color = colors[zu4_random(colors.size())];
+    RGBA *color = colors[animRandom(colors.size())];
     int scale = tile->getScale();
     zu4_img_fill(dest, x * scale, y * scale, scale, scale, color->r, color->g, color->b, color->a);
 }
@@ -144,8 +167,11 @@ void TileAnimScrollTransform::draw(Image *dest, Tile *tile, MapTile &mapTile) {
  */
 bool TileAnimFrameTransform::drawsTile() const { return true; }
 void TileAnimFrameTransform::draw(Image *dest, Tile *tile, MapTile &mapTile) {
-    if (++currentFrame >= tile->getFrames())
-    	currentFrame = 0;
+    if (lastCycle != screenCycleCount) {
+        lastCycle = screenCycleCount;
+        if (++currentFrame >= tile->getFrames())
+            currentFrame = 0;
+    }
     zu4_img_draw_subrect_on(dest, tile->getImage(), 0, 0, 0, currentFrame * tile->getHeight(), tile->getWidth(), tile->getHeight());
 
 }
@@ -179,9 +205,9 @@ void TileAnimPixelColorTransform::draw(Image *dest, Tile *tile, MapTile &mapTile
                 pixelAt.g >= start->g && pixelAt.g <= end->g &&
                 pixelAt.b >= start->b && pixelAt.b <= end->b) {
                 zu4_img_set_pixel(dest, i, j,
-					(start->r + zu4_random(diff.r)) |
-					(start->g + zu4_random(diff.g)) << 8 |
-					(start->b + zu4_random(diff.b)) << 16 |
+					(start->r + animRandom(diff.r)) |
+					(start->g + animRandom(diff.g)) << 8 |
+					(start->b + animRandom(diff.b)) << 16 |
 					pixelAt.a << 24);
             }
         }
@@ -227,6 +253,11 @@ TileAnimContext* TileAnimContext::create(const ConfigElement &conf) {
     return context;
 }
 
+TileAnimContext::~TileAnimContext() {
+    for (TileAnimTransformList::iterator i = animTransforms.begin(); i != animTransforms.end(); i++)
+        delete *i;
+}
+
 /**
  * Adds a tile transform to the context
  */
@@ -265,6 +296,11 @@ TileAnimSet::TileAnimSet(const ConfigElement &conf) {
     }
 }
 
+TileAnimSet::~TileAnimSet() {
+    for (TileAnimMap::iterator i = tileanims.begin(); i != tileanims.end(); i++)
+        delete i->second;
+}
+
 /**
  * Returns the tile animation with the given name from the current set
  */
@@ -275,7 +311,7 @@ TileAnim *TileAnimSet::getByName(const std::string &name) {
     return i->second;
 }
 
-TileAnim::TileAnim(const ConfigElement &conf) : random(0) {
+TileAnim::TileAnim(const ConfigElement &conf) : random(0), varies(false) {
     name = conf.getString("name");
     if (conf.exists("random"))
         random = conf.getInt("random");
@@ -293,15 +329,112 @@ TileAnim::TileAnim(const ConfigElement &conf) : random(0) {
             contexts.push_back(context);
         }
     }
+
+    /* random animations need more than one frame per cycle */
+    std::vector<TileAnimTransform *> all = transforms;
+    for (std::vector<TileAnimContext *>::iterator c = contexts.begin(); c != contexts.end(); c++) {
+        if (*c)
+            all.insert(all.end(), (*c)->getTransforms().begin(), (*c)->getTransforms().end());
+    }
+    varies = random != 0;
+    for (std::vector<TileAnimTransform *>::iterator t = all.begin(); t != all.end(); t++) {
+        if ((*t)->random || dynamic_cast<TileAnimPixelTransform *>(*t) || dynamic_cast<TileAnimPixelColorTransform *>(*t))
+            varies = true;
+    }
+}
+
+TileAnim::~TileAnim() {
+    for (unsigned int i = 0; i < cache.size(); i++) {
+        if (cache[i].image)
+            zu4_img_free(cache[i].image);
+    }
+    for (std::vector<TileAnimTransform *>::iterator t = transforms.begin(); t != transforms.end(); t++)
+        delete *t;
+    for (std::vector<TileAnimContext *>::iterator c = contexts.begin(); c != contexts.end(); c++)
+        delete *c;
 }
 
-void TileAnim::draw(Image *dest, Tile *tile, MapTile &mapTile, Direction dir) {
+/**
+ * Frees the frames cached for a tile, which must be done before the
+ * tile or its image goes away.
+ */
+void TileAnim::forget(const Tile *tile) {
+    for (unsigned int i = 0; i < cache.size();) {
+        if (cache[i].tile == tile) {
+            if (cache[i].image)
+                zu4_img_free(cache[i].image);
+            cache[i] = cache.back();
+            cache.pop_back();
+        }
+        else i++;
+    }
+}
+
+/**
+ * Draws the tile's animation for the current screen cycle.  The frame is
+ * rendered the first time it is needed in a cycle and drawn from the
+ * cache after that; instance picks among the random variants, and is
+ * usually the tile's position in its view.
+ */
+void TileAnim::draw(Image *dest, Tile *tile, MapTile &mapTile, Direction dir, unsigned int instance) {
+    /* nothing to do, draw the tile and return! */
+    if ((!transforms.size() && !contexts.size()) || mapTile.freezeAnimation) {
+        zu4_img_draw_subrect_on(dest, tile->getImage(), 0, 0, 0, mapTile.frame * tile->getHeight(), tile->getWidth(), tile->getHeight());
+        return;
+    }
+
+    unsigned int variant = varies ? ((instance * 2654435761u) >> 16) % TILEANIM_VARIANTS : 0;
+
+    CachedFrame *cached = NULL;
+    for (unsigned int i = 0; i < cache.size(); i++) {
+        CachedFrame &f = cache[i];
+        if (f.tile == tile && f.frame == mapTile.frame && f.dir == dir && f.variant == variant) {
+            cached = &f;
+            break;
+        }
+    }
+
+    bool stale = true;
+    if (!cached) {
+        CachedFrame f = { tile, mapTile.frame, dir, variant, 0, NULL };
+        cache.push_back(f);
+        cached = &cache.back();
+    }
+    else
+        stale = cached->cycle != screenCycleCount;
+
+    /* the tile's size changes when the screen is rescaled */
+    if (cached->image && (cached->image->w != tile->getWidth() || cached->image->h != tile->getHeight())) {
+        zu4_img_free(cached->image);
+        cached->image = NULL;
+    }
+    if (!cached->image) {
+        cached->image = zu4_img_create(tile->getWidth(), tile->getHeight());
+        stale = true;
+    }
+
+    if (stale) {
+        zu4_img_fill(cached->image, 0, 0, cached->image->w, cached->image->h, 0, 0, 0, 0);
+        animSrandom((screenCycleCount * 2654435761u) ^ (variant * 40503u) ^ (tile->getId() << 8) ^ mapTile.frame);
+        render(cached->image, tile, mapTile, dir);
+        cached->cycle = screenCycleCount;
+    }
+
+    zu4_img_draw_on(dest, cached->image, 0, 0);
+}
+
+/**
+ * Applies the animation's transforms to a tile.  Only opaque pixels are
+ * ever drawn, so a frame rendered onto a clear image and then drawn onto
+ * dest looks the same as one rendered straight onto it.
+ */
+void TileAnim::render(Image *dest, Tile *tile, MapTile &mapTile, Direction dir) {
     std::vector<TileAnimTransform *>::const_iterator t;
     std::vector<TileAnimContext *>::const_iterator c;
     bool drawn = false;
 
     /* nothing to do, draw the tile and return! */
-    if ((random && zu4_random(100) > random) || (!transforms.size() && !contexts.size()) || mapTile.freezeAnimation) {
+    if (random && animRandom(100) > random) {
         zu4_img_draw_subrect_on(dest, tile->getImage(), 0, 0, 0, mapTile.frame * tile->getHeight(), tile->getWidth(), tile->getHeight());
         return;
     }
@@ -312,7 +445,7 @@ void TileAnim::draw(Image *dest, Tile *tile, MapTile &mapTile, Direction dir) {
     for (t = transforms.begin(); t != transforms.end(); t++) {
         TileAnimTransform *transform = *t;
 
-        if (!transform->random || zu4_random(100) < transform->random) {
+        if (!transform->random || animRandom(100) < transform->random) {
             if (!transform->drawsTile() && !drawn)
                 zu4_img_draw_subrect_on(dest, tile->getImage(), 0, 0, 0, mapTile.frame * tile->getHeight(), tile->getWidth(), tile->getHeight());
             transform->draw(dest, tile, mapTile);
@@ -329,7 +462,7 @@ void TileAnim::draw(Image *dest, Tile *tile, MapTile &mapTile, Direction dir) {
             for (t = ctx_transforms.begin(); t != ctx_transforms.end(); t++) {
                 TileAnimTransform *transform = *t;
 
-                if (!transform->random || zu4_random(100) < transform->random) {
+                if (!transform->random || animRandom(100) < transform->random) {
                     if (!transform->drawsTile() && !drawn)
                         zu4_img_draw_subrect_on(dest, tile->getImage(), 0, 0, 0, mapTile.frame * tile->getHeight(), tile->getWidth(), tile->getHeight());
                     transform->draw(dest, tile, mapTile);
@@ -81,11 +81,12 @@ private:
  */
 struct TileAnimFrameTransform : public TileAnimTransform {
 public:
-	TileAnimFrameTransform() : currentFrame(0){}
+	TileAnimFrameTransform() : currentFrame(0), lastCycle(0) {}
     virtual void draw(Image *dest, Tile *tile, MapTile &mapTile);
     virtual bool drawsTile() const;
 protected:
     int currentFrame;
+    unsigned int lastCycle;
 };
 
 /**
@@ -119,7 +120,7 @@ public:
     void add(TileAnimTransform*);
     virtual bool isInContext(Tile *t, MapTile &mapTile, Direction d) = 0;
 	TileAnimTransformList& getTransforms() {return animTransforms;}	/**< Returns a list of transformations under the context. */
-    virtual ~TileAnimContext() {}
+    virtual ~TileAnimContext();
 private:
 
     TileAnimTransformList animTransforms;
@@ -153,19 +154,43 @@ private:
  * Instructions for animating a tile.  Each tile animation is made up
  * of a list of transformations which are applied to the tile after it
  * is drawn.
+ *
+ * Each screen cycle, a tile is animated once into a cached frame that
+ * every instance of it is then drawn from.  Animations with random parts
+ * keep a few differently seeded frames, and an instance picks one by
+ * its position so they don't all change in step.
  */
 struct TileAnim {
 public:
     TileAnim(const ConfigElement &conf);
+    ~TileAnim();
 
     std::string name;
     std::vector<TileAnimTransform *> transforms;
     std::vector<TileAnimContext *> contexts;
 
-    /* returns the frame to set the mapTile to (only relevent if persistent) */
-    void draw(Image *dest, Tile *tile, MapTile &mapTile, Direction dir);
+    void draw(Image *dest, Tile *tile, MapTile &mapTile, Direction dir, unsigned int instance = 0);
+    void forget(const Tile *tile);
 
     int random;   /* true if the tile animation occurs randomely */
+
+private:
+    /**
+     * A frame of the animation, as rendered for one cycle
+     */
+    struct CachedFrame {
+        const Tile *tile;
+        int frame;
+        Direction dir;
+        unsigned int variant;
+        unsigned int cycle;
+        Image *image;
+    };
+
+    void render(Image *dest, Tile *tile, MapTile &mapTile, Direction dir);
+
+    bool varies;  /* true if any part of the animation is random */
+    std::vector<CachedFrame> cache;
 };
 
 /**
@@ -177,6 +202,7 @@ struct TileAnimSet {
 
 public:
     TileAnimSet(const ConfigElement &conf);
+    ~TileAnimSet();
 
     TileAnim *getByName(const std::string &name);
 
@@ -106,6 +106,12 @@ void TileMap::load(const ConfigElement &tilemapConf) {
         index += frames;
     }
 
+    for (unsigned int i = 0; i < 256; i++) {
+        std::map<unsigned int, MapTile>::iterator tile = tm->tilemap.find(i);
+        if (tile != tm->tilemap.end())
+            tm->byteTiles[i] = tile->second;
+    }
+
     /* add the tilemap to our list */
     tileMaps[name] = tm;
 }
@@ -123,9 +129,19 @@ TileMap *TileMap::get(std::string name) {
  * Translates a raw index to a MapTile.
  */
 MapTile TileMap::translate(unsigned int index) {
+    if (index < 256)
+        return byteTiles[index];
     return tilemap[index];
 }
 
+/**
+ * Translates a run of raw bytes to MapTiles.
+ */
+void TileMap::translateRange(const uint8_t *indices, MapTile *tiles, unsigned int n) const {
+    for (unsigned int i = 0; i < n; i++)
+        tiles[i] = byteTiles[indices[i]];
+}
+
 unsigned int TileMap::untranslate(MapTile &tile) {
     unsigned int index = 0;
 
@@ -7,6 +7,7 @@
 
 #include <map>
 #include <string>
+#include <stdint.h>
 #include "types.h"
 
 struct ConfigElement;
@@ -19,6 +20,7 @@ public:
     typedef std::map<std::string, TileMap *> TileIndexMapMap;
 
     MapTile translate(unsigned int index);
+    void translateRange(const uint8_t *indices, MapTile *tiles, unsigned int n) const;
     unsigned int untranslate(MapTile &tile);
 
     static void loadAll();
@@ -30,6 +32,9 @@ private:
     static TileIndexMapMap tileMaps;
 
     std::map<unsigned int, MapTile> tilemap;
+
+    /* the tiles for each raw byte, so rows translate without map lookups */
+    MapTile byteTiles[256];
 };
 
 #endif
@@ -144,6 +144,8 @@ bool TileRule::initFromConf(const ConfigElement &conf) {
 
 /* static member variables */
 Tileset::TilesetMap Tileset::tilesets;
+std::vector<Tile *> Tileset::tileTable;
+std::vector<TileAttributes> Tileset::attributeTable;
 
 /**
  * Loads all tilesets using the filename
@@ -197,6 +199,8 @@ void Tileset::unloadAll() {
         delete i->second;
     }
     tilesets.clear();
+    tileTable.clear();
+    attributeTable.clear();
 
     Tile::resetNextId();
 }
@@ -237,15 +241,26 @@ Tile* Tileset::findTileByName(const std::string &name) {
     return NULL;
 }
 
-Tile* Tileset::findTileById(TileId id) {
-    TilesetMap::iterator i;
-    for (i = tilesets.begin(); i != tilesets.end(); i++) {
-        Tile *t = i->second->get(id);
-        if (t)
-            return t;
+/**
+ * Adds a newly loaded tile to the id lookup tables
+ */
+void Tileset::addToTables(Tile *tile) {
+    TileId id = tile->getId();
+    const TileRule *rule = tile->getRule();
+
+    if (id >= tileTable.size()) {
+        tileTable.resize(id + 1, NULL);
+        attributeTable.resize(id + 1);
     }
 
-    return NULL;
+    tileTable[id] = tile;
+
+    TileAttributes &attr = attributeTable[id];
+    attr.mask = rule->mask;
+    attr.movementMask = rule->movementMask;
+    attr.walkonDirs = rule->walkonDirs;
+    attr.walkoffDirs = rule->walkoffDirs;
+    attr.opaque = tile->getOpaque();
 }
 
 /**
@@ -275,6 +290,7 @@ void Tileset::load(const ConfigElement &tilesetConf) {
         /* add the tile to our tileset */
         tiles[tile->getId()] = tile;
         nameMap[tile->getName()] = tile;
+        addToTables(tile);
 
         index += tile->getFrames();
     }
@@ -299,8 +315,10 @@ void Tileset::unload() {
     Tileset::TileIdMap::iterator i;
 
     /* free all the memory for the tiles */
-    for (i = tiles.begin(); i != tiles.end(); i++)
+    for (i = tiles.begin(); i != tiles.end(); i++) {
+        i->second->deleteImage();
         delete i->second;
+    }
 
     tiles.clear();
     totalFrames = 0;
@@ -311,10 +329,12 @@ void Tileset::unload() {
  * Returns the tile with the given id in the tileset
  */
 Tile* Tileset::get(TileId id) {
-    if (tiles.find(id) != tiles.end())
-        return tiles[id];
-    else if (extends)
-        return extends->get(id);
+    Tile *tile = findTileById(id);
+
+    for (Tileset *set = this; tile && set; set = set->extends) {
+        if (tile->getTileset() == set)
+            return tile;
+    }
     return NULL;
 }
 
@@ -7,6 +7,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include "types.h"
 
 struct ConfigElement;
@@ -34,6 +35,18 @@ public:
     int walkoffDirs;
 };
 
+/**
+ * The rule flags of a single tile, copied out of its TileRule so the
+ * common predicates are one indexed load by tile id.
+ */
+struct TileAttributes {
+    unsigned short mask;
+    unsigned char movementMask;
+    unsigned char walkonDirs;
+    unsigned char walkoffDirs;
+    bool opaque;
+};
+
 /**
  * Tileset struct
  */
@@ -49,7 +62,18 @@ public:
     static Tileset* get(const std::string &name);
 
     static Tile* findTileByName(const std::string &name);
-    static Tile* findTileById(TileId id);
+
+    /**
+     * Returns the tile with the given id from any tileset, if there is one.
+     * Tile ids are unique across all tilesets, so this is a table lookup.
+     */
+    static Tile* findTileById(TileId id) {
+        return id < tileTable.size() ? tileTable[id] : NULL;
+    }
+
+    static const TileAttributes &attributesOf(TileId id) {
+        return attributeTable[id];
+    }
 
 public:
     void load(const ConfigElement &tilesetConf);
@@ -62,7 +86,11 @@ public:
     unsigned int numFrames() const;
 
 private:
+    static void addToTables(Tile *tile);
+
     static TilesetMap tilesets;
+    static std::vector<Tile *> tileTable;               /**< every loaded tile, indexed by id */
+    static std::vector<TileAttributes> attributeTable;  /**< every loaded tile's rule flags, indexed by id */
 
     std::string name;
     TileIdMap tiles;
@@ -13,6 +13,7 @@
 #include "tile.h"
 #include "tileanim.h"
 #include "u4.h"
+#include "video.h"
 
 TileView::TileView(int x, int y, int columns, int rows) : View(x, y, columns * TILE_WIDTH, rows * TILE_HEIGHT) {
     this->columns = columns;
@@ -21,6 +22,7 @@ TileView::TileView(int x, int y, int columns, int rows) : View(x, y, columns * T
     this->tileHeight = TILE_HEIGHT;
     this->tileset = Tileset::get("base");
     animated = zu4_img_create(tileWidth, tileHeight);
+    cells.resize(columns * rows);
 }
 
 TileView::TileView(int x, int y, int columns, int rows, const std::string &tileset) : View(x, y, columns * TILE_WIDTH, rows * TILE_HEIGHT) {
@@ -30,6 +32,7 @@ TileView::TileView(int x, int y, int columns, int rows, const std::string &tiles
     this->tileHeight = TILE_HEIGHT;
     this->tileset = Tileset::get(tileset);
     animated = zu4_img_create(tileWidth, tileHeight);
+    cells.resize(columns * rows);
 }
 
 TileView::~TileView() {
@@ -47,6 +50,103 @@ void TileView::reinit() {
     	animated = NULL;
     }
     animated = zu4_img_create(tileWidth, tileHeight);
+    invalidateCells();
+}
+
+/**
+ * Hands a cell over to the GPU tile renderer, if it is on and all the
+ * tiles are plain images that fit in the atlas.  The cell is cleared to
+ * transparent on screen so the tiles show through from underneath.
+ * Otherwise, the GPU forgets the cell and false is returned so it can be
+ * drawn in software.
+ */
+bool TileView::drawCellOnGpu(const MapTile *tiles, int n, bool focus, int x, int y) {
+    int slots[VIDEO_TILE_LAYERS];
+    int sx = x * tileWidth + this->x;
+    int sy = y * tileHeight + this->y;
+
+    if (!zu4_video_tiles())
+        return false;
+
+    bool usable = n > 0 && n <= VIDEO_TILE_LAYERS;
+    for (int i = 0; usable && i < n; i++) {
+        Tile *tile = tileset->get(tiles[i].id);
+        Image *image = tile ? tile->getImage() : NULL;
+        if (!image || tile->getAnim()) {
+            usable = false;
+            break;
+        }
+
+        uint32_t key = (tiles[i].id << 8) | tiles[i].frame;
+        slots[i] = zu4_video_atlas_find(key);
+        if (slots[i] < 0)
+            slots[i] = zu4_video_atlas_add(key, image, 0, tileHeight * tiles[i].frame);
+        usable = slots[i] >= 0;
+    }
+
+    if (!usable) {
+        zu4_video_tile_cell(sx, sy, NULL, 0);
+        return false;
+    }
+
+    zu4_img_fill(zu4_img_get_screen(), sx, sy, tileWidth, tileHeight, 0, 0, 0, 0);
+    zu4_video_tile_cell(sx, sy, slots, n);
+
+    if (focus)
+        drawFocus(x, y);
+
+    return true;
+}
+
+/**
+ * Returns true if the cell already shows exactly these tiles and nothing
+ * else has drawn over it since.
+ */
+bool TileView::cellUnchanged(const MapTile *tiles, int n, bool focus, int x, int y) {
+    CellState &cell = cells[y * columns + x];
+
+    if (!cell.valid || cell.focus != focus || cell.tiles.size() != (unsigned int)n)
+        return false;
+
+    if (cell.animated && cell.cycle != screenCycleCount)
+        return false;
+
+    for (int i = 0; i < n; i++) {
+        if (cell.tiles[i].id != tiles[i].id || cell.tiles[i].frame != tiles[i].frame)
+            return false;
+    }
+
+    return cell.serial == zu4_img_damage_serial(x * tileWidth + this->x, y * tileHeight + this->y, tileWidth, tileHeight);
+}
+
+/**
+ * Remembers what was drawn into a cell.  Animated tiles only change once
+ * per screen cycle, so cells containing them are kept until the next one.
+ */
+void TileView::cellDrawn(const MapTile *tiles, int n, bool focus, int x, int y) {
+    CellState &cell = cells[y * columns + x];
+
+    cell.valid = true;
+    cell.animated = false;
+    cell.cycle = screenCycleCount;
+    for (int i = 0; i < n; i++) {
+        Tile *tile = tileset->get(tiles[i].id);
+        if (!tile)
+            cell.valid = false;
+        else if (tile->getAnim())
+            cell.animated = true;
+    }
+
+    cell.focus = focus;
+    cell.tiles.clear();
+    for (int i = 0; i < n; i++)
+        cell.tiles.push_back(tiles[i]);
+    cell.serial = zu4_img_damage_serial(x * tileWidth + this->x, y * tileHeight + this->y, tileWidth, tileHeight);
+}
+
+void TileView::invalidateCells() {
+    for (std::vector<CellState>::iterator i = cells.begin(); i != cells.end(); i++)
+        i->valid = false;
 }
 
 void TileView::loadTile(MapTile &mapTile)
@@ -67,6 +167,15 @@ void TileView::drawTile(MapTile &mapTile, bool focus, int x, int y) {
     zu4_assert(x < columns, "x value of %d out of range", x);
     zu4_assert(y < rows, "y value of %d out of range", y);
 
+    bool showFocus = focus && ((screenCurrentCycle * 4 / SCR_CYCLE_PER_SECOND) % 2);
+    if (cellUnchanged(&mapTile, 1, showFocus, x, y))
+        return;
+
+    if (drawCellOnGpu(&mapTile, 1, focus, x, y)) {
+        cellDrawn(&mapTile, 1, showFocus, x, y);
+        return;
+    }
+
     //Blank scratch pad
 	zu4_img_fill(animated, 0,0,tileWidth,tileHeight,0,0,0,255);
 	//Draw blackness on the tile.
@@ -80,7 +189,7 @@ void TileView::drawTile(MapTile &mapTile, bool focus, int x, int y) {
     // draw the tile to the screen
     if (tile->getAnim()) {
         // First, create our animated version of the tile
-        tile->getAnim()->draw(animated, tile, mapTile, DIR_NONE);
+        tile->getAnim()->draw(animated, tile, mapTile, DIR_NONE, y * columns + x);
 
         // Then draw it to the screen
         zu4_img_draw_subrect(animated, x * tileWidth + this->x,
@@ -102,12 +211,23 @@ void TileView::drawTile(MapTile &mapTile, bool focus, int x, int y) {
     // draw the focus around the tile if it has the focus
     if (focus)
         drawFocus(x, y);
+
+    cellDrawn(&mapTile, 1, showFocus, x, y);
 }
 
-void TileView::drawTile(std::vector<MapTile> &tiles, bool focus, int x, int y) {
+void TileView::drawTile(TileStack &tiles, bool focus, int x, int y) {
 	zu4_assert(x < columns, "x value of %d out of range", x);
 	zu4_assert(y < rows, "y value of %d out of range", y);
 
+	bool showFocus = focus && ((screenCurrentCycle * 4 / SCR_CYCLE_PER_SECOND) % 2);
+	if (!tiles.empty() && cellUnchanged(&tiles[0], tiles.size(), showFocus, x, y))
+		return;
+
+	if (!tiles.empty() && drawCellOnGpu(&tiles[0], tiles.size(), focus, x, y)) {
+		cellDrawn(&tiles[0], tiles.size(), showFocus, x, y);
+		return;
+	}
+
 	zu4_img_fill(animated, 0,0,tileWidth,tileHeight,0,0,0,255);
 	zu4_img_draw_subrect(animated, x * tileWidth + this->x,
 						  y * tileHeight + this->y,
@@ -118,11 +238,9 @@ void TileView::drawTile(std::vector<MapTile> &tiles, bool focus, int x, int y) {
 
 	//int layer = 0;
 
-	for (std::vector<MapTile>::reverse_iterator t = tiles.rbegin();
-			t != tiles.rend();
-			++t)
+	for (int t = tiles.size() - 1; t >= 0; t--)
 	{
-		MapTile& frontTile = *t;
+		MapTile& frontTile = tiles[t];
 		Tile *frontTileType = tileset->get(frontTile.id);
 
 		if (!frontTileType)
@@ -136,7 +254,7 @@ void TileView::drawTile(std::vector<MapTile> &tiles, bool focus, int x, int y) {
 		// draw the tile to the screen
 		if (frontTileType->getAnim()) {
 			// First, create our animated version of the tile
-			frontTileType->getAnim()->draw(animated, frontTileType, frontTile, DIR_NONE);
+			frontTileType->getAnim()->draw(animated, frontTileType, frontTile, DIR_NONE, y * columns + x);
 		}
 		else {
             if (!image)
@@ -159,6 +277,9 @@ void TileView::drawTile(std::vector<MapTile> &tiles, bool focus, int x, int y) {
 	// draw the focus around the tile if it has the focus
 	if (focus)
         drawFocus(x, y);
+
+	if (!tiles.empty())
+		cellDrawn(&tiles[0], tiles.size(), showFocus, x, y);
 }
 
 /**
@@ -204,4 +325,5 @@ void TileView::drawFocus(int x, int y) {
 
 void TileView::setTileset(Tileset *tileset) {
     this->tileset = tileset;
+    invalidateCells();
 }
@@ -5,8 +5,10 @@
 #ifndef TILEVIEW_H
 #define TILEVIEW_H
 
+#include <stdint.h>
 #include <vector>
 
+#include "types.h"
 #include "view.h"
 
 struct Tile;
@@ -29,16 +31,35 @@ public:
 
     void reinit();
     void drawTile(MapTile &mapTile, bool focus, int x, int y);
-    void drawTile(std::vector<MapTile> &tiles, bool focus, int x, int y);
+    void drawTile(TileStack &tiles, bool focus, int x, int y);
     void drawFocus(int x, int y);
     void loadTile(MapTile &mapTile);
     void setTileset(Tileset *tileset);
 
 protected:
+    /**
+     * What was last drawn into a cell, so unchanged cells can be skipped
+     */
+    struct CellState {
+        CellState() : valid(false), focus(false), animated(false), serial(0), cycle(0) {}
+        bool valid;
+        bool focus;
+        bool animated;              /**< holds an animated tile, which changes every screen cycle */
+        uint32_t serial;            /**< damage serial of the cell right after it was drawn */
+        unsigned int cycle;         /**< screen cycle the cell was drawn in */
+        TileStack tiles;
+    };
+
+    bool drawCellOnGpu(const MapTile *tiles, int n, bool focus, int x, int y);
+    bool cellUnchanged(const MapTile *tiles, int n, bool focus, int x, int y);
+    void cellDrawn(const MapTile *tiles, int n, bool focus, int x, int y);
+    void invalidateCells();
+
     int columns, rows;
     int tileWidth, tileHeight;
     Tileset *tileset;
     Image *animated;            /**< a scratchpad image for drawing animations */
+    std::vector<CellState> cells;
 };
 
 #endif /* TILEVIEW_H */
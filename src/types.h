@@ -71,6 +71,41 @@ public:
     bool freezeAnimation;
 };
 
+#define TILESTACK_MAX 8
+
+/**
+ * A TileStack is the list of MapTiles shown on a single map cell, topmost
+ * first.  Its tiles are stored inline, so building one never touches the
+ * heap.  Should a cell ever hold more layers than fit, the bottommost tile
+ * takes the last slot so that the ground still shows.
+ */
+struct TileStack {
+public:
+    TileStack() : count(0) {}
+
+    void push_back(const MapTile &t) {
+        if (count < TILESTACK_MAX)
+            tiles[count++] = t;
+        else tiles[TILESTACK_MAX - 1] = t;
+    }
+    void clear()                                    {count = 0;}
+
+    bool empty() const                              {return count == 0;}
+    unsigned int size() const                       {return count;}
+    MapTile &front()                                {return tiles[0];}
+    const MapTile &front() const                    {return tiles[0];}
+    MapTile &operator[](unsigned int i)             {return tiles[i];}
+    const MapTile &operator[](unsigned int i) const {return tiles[i];}
+    MapTile *begin()                                {return tiles;}
+    MapTile *end()                                  {return tiles + count;}
+    const MapTile *begin() const                    {return tiles;}
+    const MapTile *end() const                      {return tiles + count;}
+
+private:
+    MapTile tiles[TILESTACK_MAX];
+    unsigned int count;
+};
+
 /**
  * An Uncopyable has no default copy constructor of operator=.  A subclass may derive from
  * Uncopyable at any level of visibility, even private, and subclasses will not have a default copy
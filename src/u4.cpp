@@ -13,8 +13,13 @@
 
 #include "u4.h"
 
+#include "assetcache.h"
+#include "config.h"
 #include "error.h"
 #include "game.h"
+#include "harness.h"
+#include "imagemgr.h"
+#include "inputlog.h"
 #include "intro.h"
 #include "music.h"
 #include "person.h"
@@ -24,6 +29,7 @@
 #include "settings.h"
 #include "sound.h"
 #include "u4file.h"
+#include "video.h"
 
 bool verbose = false;
 bool quit = false;
@@ -31,12 +37,19 @@ bool useProfile = false;
 std::string profileName = "";
 
 int main(int argc, char *argv[]) {
+	zu4_file_init();
+
 	if (!u4fopen("AVATAR.EXE")) {
 		zu4_error(ZU4_LOG_ERR, 	"xu4 requires the PC version of Ultima IV to be present.\n");
 	}
 
 	unsigned int i;
     int skipIntro = 0;
+    std::string harnessScript;
+    bool simulate = false;
+    std::string recordLog, replayLog;
+    bool seeded = false;
+    unsigned int seed = 0;
 
     /*
      * if the -p or -profile arguments are passed to the application,
@@ -67,6 +80,7 @@ int main(int argc, char *argv[]) {
 
     /* initialize the settings */
     zu4_settings_init(useProfile, profileName.c_str());
+    zu4_cache_init(zu4_settings_ptr()->path);
 
     /* update the settings based upon command-line arguments */
     for (i = 1; i < (unsigned int)argc; i++) {
@@ -119,6 +133,60 @@ int main(int argc, char *argv[]) {
             settings.musicVol = 0;
             settings.soundVol = 0;
         }
+        else if (strcmp(argv[i], "--headless") == 0)
+        {
+            zu4_video_set_backend(VIDEO_BACKEND_HEADLESS);
+        }
+        else if (strcmp(argv[i], "--harness") == 0)
+        {
+            if ((unsigned int)argc > i + 1)
+            {
+                harnessScript = argv[i+1];
+                i++;
+            }
+            else
+                zu4_error(ZU4_LOG_ERR, "%s is invalid alone: Requires a script as input. See --help for more detail.\n", argv[i]);
+        }
+        else if (strcmp(argv[i], "--headless-sim") == 0)
+        {
+            if ((unsigned int)argc > i + 1)
+            {
+                harnessScript = argv[i+1];
+                simulate = true;
+                i++;
+            }
+            else
+                zu4_error(ZU4_LOG_ERR, "%s is invalid alone: Requires a script as input. See --help for more detail.\n", argv[i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0)
+        {
+            if ((unsigned int)argc > i + 1)
+            {
+                seed = strtoul(argv[i+1], NULL, 0);
+                seeded = true;
+                i++;
+            }
+            else
+                zu4_error(ZU4_LOG_ERR, "%s is invalid alone: Requires a number for input. See --help for more detail.\n", argv[i]);
+        }
+        else if (strcmp(argv[i], "--record") == 0
+              || strcmp(argv[i], "--replay") == 0)
+        {
+            if ((unsigned int)argc > i + 1)
+            {
+                if (strcmp(argv[i], "--record") == 0)
+                    recordLog = argv[i+1];
+                else
+                    replayLog = argv[i+1];
+                i++;
+            }
+            else
+                zu4_error(ZU4_LOG_ERR, "%s is invalid alone: Requires a file as input. See --help for more detail.\n", argv[i]);
+        }
+        else if (strcmp(argv[i], "--compile-config") == 0)
+        {
+            return Config::compile() ? 0 : 1;
+        }
         else if (strcmp(argv[i], "-h") == 0
               || strcmp(argv[i], "-help") == 0
               || strcmp(argv[i], "--help") == 0)
@@ -130,12 +198,19 @@ int main(int argc, char *argv[]) {
             printf("-q, --quiet		Sets all audio volume to zero.\n");
             printf("-f, --fullscreen	Runs xu4 in fullscreen mode.\n");
             printf("-i, --skip-intro	Skips the intro and loads the last savegame.\n");
+            printf("--headless		Renders offscreen only, without a window.\n");
 
             printf("\n-s <int>,\n");
             printf("--scale <int>		Used to specify scaling options.\n");
             printf("-p <string>,\n");
             printf("--profile <string>	Used to pass extra arguments to the program.\n");
             printf("--filter <string>	Used to specify filtering options.\n");
+            printf("--harness <file>	Runs a scripted regression test without a window.\n");
+            printf("--headless-sim <file>	Runs a script as fast as possible and reports turns per second.\n");
+            printf("--seed <int>		Seeds the random number generator.\n");
+            printf("--record <file>		Records keystrokes and timer ticks to a file.\n");
+            printf("--replay <file>		Replays a recording as fast as possible and checks it.\n");
+            printf("--compile-config		Rebuilds the compiled config snapshot and exits.\n");
 
             printf("\n-h, --help		Prints this message.\n");
 
@@ -146,9 +221,30 @@ int main(int argc, char *argv[]) {
 
     }
 
-    zu4_srandom();
+    /* the harness seeds with 0 and takes over the clock */
+    if (!harnessScript.empty())
+        harnessInit(harnessScript, simulate);
+
+    /* an explicit seed wins over the harness's */
+    if (seeded)
+        zu4_srandom_seed(seed);
+    else if (harnessScript.empty())
+        zu4_srandom();
+
+    /* a replay reseeds from its log and takes over the clock and input */
+    if (!replayLog.empty()) {
+        if (!harnessScript.empty() || !recordLog.empty())
+            zu4_error(ZU4_LOG_ERR, "--replay can't be combined with --harness or --record\n");
+        inputLogReplay(replayLog);
+    }
+    else if (!recordLog.empty())
+        inputLogRecord(recordLog);
 
     screenInit();
+
+    /* decode the images in the background while everything else loads */
+    imageMgr->preload(!skipIntro);
+
     ProgressBar pb((320/2) - (200/2), (200/2), 200, 10, 0, (skipIntro ? 4 : 7));
     pb.setBorderColor(240, 240, 240);
     pb.setColor(0, 0, 128);
@@ -159,6 +255,8 @@ int main(int argc, char *argv[]) {
 
     zu4_music_init();
     zu4_snd_init();
+    if (harnessSimulating())
+        zu4_music_mute();
     ++pb;
 
     Tileset::loadAll();
@@ -203,5 +301,7 @@ int main(int argc, char *argv[]) {
 
     game->deinit();
 
+    zu4_file_deinit();
+
     return 0;
 }
@@ -20,22 +20,25 @@
  *
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "error.h"
 #include "u4file.h"
 
-void (*zu4_file_close)(U4FILE*);
-int (*zu4_file_seek)(U4FILE*, long offset, int whence);
-long (*zu4_file_tell)(U4FILE*);
-size_t (*zu4_file_read)(U4FILE*, void *ptr, size_t size, size_t nmemb);
-long (*zu4_file_length)(U4FILE*);
-int (*zu4_file_getc)(U4FILE*);
-int (*zu4_file_putc)(U4FILE*, int);
-
 const char *rootpath = "./";
 const char *dospath = "ultima4";
 const char *zippath = "./";
@@ -44,6 +47,169 @@ const char *graphicspath = "graphics";
 
 static U4ZipPackage u4base;
 static U4ZipPackage u4upgrade;
+static bool packagesProbed = false;
+
+// Extracted members no longer in use are kept up to this many bytes
+#define ZIP_CACHE_BUDGET (8 * 1024 * 1024)
+static long zipCacheSize = 0;
+static U4ZipMember *idleOldest = NULL, *idleNewest = NULL;
+
+static unsigned int zu4_zip_hash(const char *name) {
+	// FNV-1a, over the lowercased name
+	unsigned int h = 2166136261u;
+	for (; *name; name++) {
+		h ^= (unsigned char)tolower((unsigned char)*name);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static U4ZipMember *zu4_zip_find(U4ZipPackage *package, const char *name) {
+	// Look up a member by name, ignoring case as miniz does
+	if (!package->loaded) { return NULL; }
+
+	unsigned int mask = package->indexsize - 1;
+	for (unsigned int i = zu4_zip_hash(name) & mask; package->index[i] >= 0; i = (i + 1) & mask) {
+		U4ZipMember *member = &package->members[package->index[i]];
+		if (!strcasecmp(member->name, name)) { return member; }
+	}
+	return NULL;
+}
+
+static void zu4_zip_idle_remove(U4ZipMember *member) {
+	// Take a member off the list of idle extracted members
+	if (member->older) { member->older->newer = member->newer; }
+	else { idleOldest = member->newer; }
+	if (member->newer) { member->newer->older = member->older; }
+	else { idleNewest = member->older; }
+	member->older = member->newer = NULL;
+}
+
+static void zu4_zip_idle_add(U4ZipMember *member) {
+	// Put a member that was just closed at the new end of the idle list
+	member->older = idleNewest;
+	member->newer = NULL;
+	if (idleNewest) { idleNewest->newer = member; }
+	else { idleOldest = member; }
+	idleNewest = member;
+}
+
+static void zu4_zip_evict(void) {
+	// Free idle extracted members, least recently used first, until the
+	// cache fits the budget; members still open can't be freed
+	while (zipCacheSize > ZIP_CACHE_BUDGET && idleOldest) {
+		U4ZipMember *member = idleOldest;
+		zu4_zip_idle_remove(member);
+		zipCacheSize -= member->len;
+		free((void*)member->data);
+		member->data = NULL;
+		member->extracted = 0;
+	}
+}
+
+static void zu4_zip_close(U4ZipPackage *package) {
+	// Release everything held for a package
+	for (int i = 0; i < package->nmembers; i++) {
+		if (package->members[i].extracted) {
+			free((void*)package->members[i].data);
+		}
+		free(package->members[i].name);
+	}
+	free(package->members);
+	free(package->index);
+	mz_zip_reader_end(&package->archive);
+
+#ifndef _WIN32
+	if (package->map) { munmap(package->map, package->mapsize); }
+#endif
+
+	memset(package, 0, sizeof(*package));
+}
+
+static void zu4_zip_open(U4ZipPackage *package, const char *zipname, const char *probe) {
+	// Open a zip package for the life of the game and index its members;
+	// the archive is mapped into memory where possible, so that stored
+	// members can be used in place
+	char path[64];
+	u4find_path(path, sizeof(path), zipname, zippath);
+	if (path[0] == '\0') { return; }
+
+	memset(package, 0, sizeof(*package));
+
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			package->map = (uint8_t*)map;
+			package->mapsize = st.st_size;
+		}
+	}
+	if (fd >= 0) { close(fd); }
+#endif
+
+	// Check zip file validity
+	if (!(package->map ?
+		mz_zip_reader_init_mem(&package->archive, package->map, package->mapsize, 0) :
+		mz_zip_reader_init_file(&package->archive, path, 0))) {
+		zu4_error(ZU4_LOG_ERR, "Archive corrupt, exiting...\n");
+	}
+
+	package->nmembers = mz_zip_reader_get_num_files(&package->archive);
+	package->members = (U4ZipMember*)calloc(package->nmembers, sizeof(U4ZipMember));
+
+	package->indexsize = 16;
+	while (package->indexsize < (unsigned int)package->nmembers * 2) {
+		package->indexsize *= 2;
+	}
+	package->index = (int*)malloc(sizeof(int) * package->indexsize);
+	memset(package->index, -1, sizeof(int) * package->indexsize);
+
+	unsigned int mask = package->indexsize - 1;
+	for (int i = 0; i < package->nmembers; i++) {
+		char name[256];
+		mz_zip_reader_get_filename(&package->archive, i, name, sizeof(name));
+
+		U4ZipMember *member = &package->members[i];
+		member->name = strdup(name);
+		member->index = i;
+
+		// Earlier entries win, as they would in a linear search
+		unsigned int h = zu4_zip_hash(name) & mask;
+		while (package->index[h] >= 0 && strcasecmp(package->members[package->index[h]].name, name)) {
+			h = (h + 1) & mask;
+		}
+		if (package->index[h] < 0) { package->index[h] = i; }
+	}
+
+	package->loaded = 1;
+	snprintf(package->name, sizeof(package->name), "%s", path);
+	snprintf(package->path, sizeof(package->path), "%s", "");
+
+	// Locate file to detect directory structure inside archive
+	if (!zu4_zip_find(package, probe)) {
+		zu4_zip_close(package);
+	}
+}
+
+void zu4_file_init(void) {
+	// Open the default zip packages, if they are present
+	if (packagesProbed) { return; }
+	packagesProbed = true;
+
+	zu4_zip_open(&u4base, "ultima4.zip", "charset.ega");
+	zu4_zip_open(&u4upgrade, "u4upgrad.zip", "u4vga.pal");
+}
+
+void zu4_file_deinit(void) {
+	// Close the zip packages
+	if (u4base.loaded) { zu4_zip_close(&u4base); }
+	if (u4upgrade.loaded) { zu4_zip_close(&u4upgrade); }
+	zipCacheSize = 0;
+	idleOldest = idleNewest = NULL;
+	packagesProbed = false;
+}
 
 bool u4isUpgradeAvailable() {
 	bool avail = false;
@@ -82,9 +248,7 @@ bool u4isUpgradeInstalled() {
  *
  * First, it looks in the zipfiles.  Next, it tries FILENAME, Filename
  * and filename in up to four paths, meaning up to twelve or more
- * opens per file.  Seems to be ok for performance, but could be
- * getting excessive.  The presence of the zipfiles should probably be
- * cached.
+ * opens per file.  The zipfiles are only looked for once.
  */
 
 U4FILE *u4fopen(const char *fname) {
@@ -92,76 +256,15 @@ U4FILE *u4fopen(const char *fname) {
 
 	zu4_error(ZU4_LOG_DBG, "looking for %s\n", fname);
 
-	if (!u4base.loaded) {
-		// Check for the default zip packages
-		char path[64];
-		u4find_path(path, sizeof(path), "ultima4.zip", zippath);
-
-		if (path[0] != '\0') {
-			// Open the zip
-			mz_zip_archive zip_archive;
-			memset(&zip_archive, 0, sizeof(zip_archive));
-
-			// Check zip file validity
-			if (!mz_zip_reader_init_file(&zip_archive, path, 0)) {
-				zu4_error(ZU4_LOG_ERR, "Archive corrupt, exiting...\n");
-			}
-
-			// Locate file to detect directory structure inside archive
-			// Revisit this, because miniz may not care about directory case sensitivity FIXME
-			if (mz_zip_reader_locate_file(&zip_archive, "charset.ega", NULL, 0) >= 0) {
-				snprintf(u4base.name, sizeof(u4base.name), "%s", path);
-				snprintf(u4base.path, sizeof(u4base.path), "%s", "");
-				u4base.loaded = 1;
-			}
-
-			mz_zip_reader_end(&zip_archive);
-		}
-	}
-
-	if (!u4upgrade.loaded) {
-		char path[64];
-		u4find_path(path, sizeof(path), "u4upgrad.zip", zippath);
-
-		if (path[0] != '\0') {
-			mz_zip_archive zip_archive;
-			memset(&zip_archive, 0, sizeof(zip_archive));
-
-			if (!mz_zip_reader_init_file(&zip_archive, path, 0)) {
-				zu4_error(ZU4_LOG_ERR, "Archive corrupt, exiting...\n");
-			}
-
-			if (mz_zip_reader_locate_file(&zip_archive, "u4vga.pal", NULL, 0) >= 0) {
-				snprintf(u4upgrade.name, sizeof(u4upgrade.name), "%s", path);
-				snprintf(u4upgrade.path, sizeof(u4upgrade.path), "%s", "");
-				u4upgrade.loaded = 1;
-			}
-
-			mz_zip_reader_end(&zip_archive);
-		}
-	}
+	zu4_file_init();
 
 	u4f = u4fopen_zip(fname, &u4base);
 	if (u4f) {
-		zu4_file_close = &zu4_file_zip_close;
-		zu4_file_seek = &zu4_file_zip_seek;
-		zu4_file_tell = &zu4_file_zip_tell;
-		zu4_file_read = &zu4_file_zip_read;
-		zu4_file_length = &zu4_file_zip_length;
-		zu4_file_getc = &zu4_file_zip_getc;
-		zu4_file_putc = &zu4_file_zip_putc;
 		return u4f; /* file was found, return it! */
 	}
 	
 	u4f = u4fopen_zip(fname, &u4upgrade);
 	if (u4f) {
-		zu4_file_close = &zu4_file_zip_close;
-		zu4_file_seek = &zu4_file_zip_seek;
-		zu4_file_tell = &zu4_file_zip_tell;
-		zu4_file_read = &zu4_file_zip_read;
-		zu4_file_length = &zu4_file_zip_length;
-		zu4_file_getc = &zu4_file_zip_getc;
-		zu4_file_putc = &zu4_file_zip_putc;
 		return u4f; /* file was found, return it! */
 	}
 
@@ -194,19 +297,13 @@ U4FILE *u4fopen(const char *fname) {
 		}
 	}
 
-	zu4_file_close = &zu4_file_stdio_close;
-	zu4_file_seek = &zu4_file_stdio_seek;
-	zu4_file_tell = &zu4_file_stdio_tell;
-	zu4_file_read = &zu4_file_stdio_read;
-	zu4_file_length = &zu4_file_stdio_length;
-	zu4_file_getc = &zu4_file_stdio_getc;
-	zu4_file_putc = &zu4_file_stdio_putc;
 	return u4f;
 }
 
 /**
  * Opens a file with the standard C stdio facilities and wrap it in a
- * U4FILE.
+ * U4FILE.  Where possible the file is mapped into memory, and read
+ * from there like a file in a zip package.
  */
 U4FILE *u4fopen_stdio(const char *fname) {
 	U4FILE *u4f;
@@ -217,66 +314,113 @@ U4FILE *u4fopen_stdio(const char *fname) {
 
 	u4f = (U4FILE*)malloc(sizeof(U4FILE));
 	u4f->file = f;
+	u4f->member = NULL;
+	u4f->fptr = NULL;
+	u4f->len = 0;
+	u4f->cur = 0;
+	u4f->span = NULL;
+
+#ifndef _WIN32
+	struct stat st;
+	if (fstat(fileno(f), &st) == 0 && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		if (map != MAP_FAILED) {
+			fclose(f);
+			u4f->file = NULL;
+			u4f->fptr = (const uint8_t*)map;
+			u4f->len = st.st_size;
+		}
+	}
+#endif
 
 	return u4f;
 }
 
 /**
- * Opens a file from a zipfile and wraps it in a U4FILE.
+ * Opens a file from a zipfile and wraps it in a U4FILE.  Stored files
+ * are read straight from the mapped archive; compressed ones are
+ * extracted once and kept while anything uses them.
  */
 U4FILE *u4fopen_zip(const char *fname, U4ZipPackage *package) {
-	U4FILE *u4f;
+	char pathname[320];
+	snprintf(pathname, sizeof(pathname), "%s%s", package->path, fname);
 
-	mz_zip_archive za;
-	memset(&za, 0, sizeof(za));
+	U4ZipMember *member = zu4_zip_find(package, pathname);
+	if (!member) { return NULL; }
 
-	// Check zip file validity
-	if (!mz_zip_reader_init_file(&za, package->name, 0)) {
-		return NULL;
-	}
+	if (!member->data) {
+		mz_zip_archive_file_stat stat;
+		if (!mz_zip_reader_file_stat(&package->archive, member->index, &stat)) {
+			return NULL;
+		}
 
-	char pathname[320];
-	snprintf(pathname, sizeof(pathname), "%s%s", package->path, fname);
+		// A stored file's data follows its local header
+		if (package->map && stat.m_method == 0 && !stat.m_is_encrypted) {
+			const uint8_t *hdr = package->map + stat.m_local_header_ofs;
+			if (stat.m_local_header_ofs + 30 <= package->mapsize) {
+				size_t ofs = stat.m_local_header_ofs + 30 +
+					(hdr[26] | hdr[27] << 8) + (hdr[28] | hdr[29] << 8);
+				if (ofs + stat.m_uncomp_size <= package->mapsize) {
+					member->data = package->map + ofs;
+					member->len = stat.m_uncomp_size;
+				}
+			}
+		}
 
-	int index = mz_zip_reader_locate_file(&za, pathname, NULL, 0);
-	if (index == -1) {
-		mz_zip_reader_end(&za);
-		return NULL;
+		if (!member->data) {
+			size_t len;
+			void *ptr = mz_zip_reader_extract_to_heap(&package->archive, member->index, &len, 0);
+			if (!ptr) { return NULL; }
+			member->data = (const uint8_t*)ptr;
+			member->len = len;
+			member->extracted = 1;
+			zipCacheSize += len;
+			zu4_zip_evict();
+		}
 	}
 
-	mz_zip_archive_file_stat stat;
-	mz_zip_reader_file_stat(&za, index, &stat);
-	void *ptr = mz_zip_reader_extract_to_heap(&za, index, NULL, 0);
+	if (member->refs++ == 0 && member->extracted) {
+		zu4_zip_idle_remove(member);
+	}
 
-	u4f = (U4FILE*)malloc(sizeof(U4FILE));
-	u4f->zip_archive = za;
-	u4f->za_index = index;
-	u4f->za_stat = stat;
-	u4f->fptr = (uint8_t*)ptr;
+	U4FILE *u4f = (U4FILE*)malloc(sizeof(U4FILE));
+	u4f->file = NULL;
+	u4f->member = member;
+	u4f->fptr = member->data;
+	u4f->len = member->len;
 	u4f->cur = 0;
+	u4f->span = NULL;
 
 	return u4f;
 }
 
+/*
+ * Files in zip packages and mapped files are read straight from memory;
+ * only files that couldn't be mapped go through stdio.
+ */
+
 void u4fclose(U4FILE *f) {
-	zu4_file_close(f);
+	if (f->member) { zu4_file_zip_close(f); }
+	else if (f->fptr) { zu4_file_mmap_close(f); }
+	else { zu4_file_stdio_close(f); }
+	free(f->span);
 	free(f);
 }
 
 int u4fseek(U4FILE *f, long offset, int whence) {
-	return zu4_file_seek(f, offset, whence);
+	return f->fptr ? zu4_file_mem_seek(f, offset, whence) : zu4_file_stdio_seek(f, offset, whence);
 }
 
 long u4ftell(U4FILE *f) {
-	return zu4_file_tell(f);
+	return f->fptr ? zu4_file_mem_tell(f) : zu4_file_stdio_tell(f);
 }
 
 size_t u4fread(U4FILE *f, void *ptr, size_t size, size_t nmemb) {
-	return zu4_file_read(f, ptr, size, nmemb);
+	return f->fptr ? zu4_file_mem_read(f, ptr, size, nmemb) : zu4_file_stdio_read(f, ptr, size, nmemb);
 }
 
 int u4fgetc(U4FILE *f) {
-	return zu4_file_getc(f);
+	return f->fptr ? zu4_file_mem_getc(f) : zu4_file_stdio_getc(f);
 }
 
 int u4fgetshort(U4FILE *f) {
@@ -284,11 +428,31 @@ int u4fgetshort(U4FILE *f) {
 }
 
 int u4fputc(int c, U4FILE *f) {
-	return zu4_file_putc(f, c);
+	return f->fptr ? zu4_file_mem_putc(f, c) : zu4_file_stdio_putc(f, c);
 }
 
 long u4flength(U4FILE *f) {
-	return zu4_file_length(f);
+	return f->fptr ? zu4_file_mem_length(f) : zu4_file_stdio_length(f);
+}
+
+/**
+ * Returns the next len bytes of a file and moves past them, or NULL if
+ * the file ends first.  The bytes are valid until the next call or the
+ * file is closed, and are only copied for files that aren't in memory.
+ */
+const uint8_t *u4fspan(U4FILE *f, long len) {
+	if (f->fptr) {
+		if (len < 0 || len > f->len - f->cur) { return NULL; }
+		const uint8_t *span = f->fptr + f->cur;
+		f->cur += len;
+		return span;
+	}
+
+	uint8_t *span = (uint8_t*)realloc(f->span, len > 0 ? len : 1);
+	if (!span) { return NULL; }
+	f->span = span;
+	if (fread(span, 1, len, f->file) != (size_t)len) { return NULL; }
+	return span;
 }
 
 /**
@@ -307,7 +471,7 @@ void zu4_read_strtable(U4FILE *f, long offset, char **array, int nstrings) {
 		int j = 0;
 		char c;
 
-		while ((c = zu4_file_getc(f)) != '\0') {
+		while ((c = u4fgetc(f)) != '\0') {
 			buffer[j++] = c;
 		}
 
@@ -355,27 +519,12 @@ int zu4_file_stdio_seek(U4FILE *u4f, long offset, int whence) {
 	return fseek(u4f->file, offset, whence);
 }
 
-int zu4_file_zip_seek(U4FILE *u4f, long offset, int whence) {
-	long pos;
-
-	zu4_assert(whence != SEEK_END, "seeking with whence == SEEK_END not allowed with zipfiles");
-	pos = u4f->cur;
+int zu4_file_mem_seek(U4FILE *u4f, long offset, int whence) {
+	if (whence == SEEK_CUR) { offset += u4f->cur; }
+	else if (whence == SEEK_END) { offset += u4f->len; }
 
-	if (whence == SEEK_CUR) {
-		offset = pos + offset;
-	}
-
-	if (offset == pos) {
-		return 0;
-	}
-
-	if (offset < pos) {
-		pos = 0;
-		u4f->cur = 0;
-	}
-
-	zu4_assert(offset - pos > 0, "error in U4FILE_zip::seek");
-	u4f->cur += offset - pos;
+	if (offset < 0) { return -1; }
+	u4f->cur = offset;
 	return 0;
 }
 
@@ -383,16 +532,26 @@ void zu4_file_stdio_close(U4FILE *u4f) {
 	fclose(u4f->file);
 }
 
+void zu4_file_mmap_close(U4FILE *u4f) {
+#ifndef _WIN32
+	munmap((void*)u4f->fptr, u4f->len);
+#endif
+}
+
 void zu4_file_zip_close(U4FILE *u4f) {
-	mz_zip_reader_end(&(u4f->zip_archive));
-	free(u4f->fptr);
+	// Extracted files stay cached until they no longer fit the budget
+	U4ZipMember *member = u4f->member;
+	if (--member->refs == 0 && member->extracted) {
+		zu4_zip_idle_add(member);
+		zu4_zip_evict();
+	}
 }
 
 long zu4_file_stdio_tell(U4FILE *u4f) {
 	return ftell(u4f->file);
 }
 
-long zu4_file_zip_tell(U4FILE *u4f) {
+long zu4_file_mem_tell(U4FILE *u4f) {
 	return u4f->cur;
 }
 
@@ -400,13 +559,14 @@ size_t zu4_file_stdio_read(U4FILE *u4f, void *ptr, size_t size, size_t nmemb) {
 	return fread(ptr, size, nmemb, u4f->file);
 }
 
-size_t zu4_file_zip_read(U4FILE *u4f, void *ptr, size_t size, size_t nmemb) {
-	size_t retval = nmemb * size;
-	if (retval) {
-		memcpy(ptr, u4f->fptr + u4f->cur, retval);
-		u4f->cur += retval;
-	}
-	return retval;
+size_t zu4_file_mem_read(U4FILE *u4f, void *ptr, size_t size, size_t nmemb) {
+	long avail = u4f->len - u4f->cur;
+	if (size == 0 || avail <= 0) { return 0; }
+	if (nmemb > (size_t)avail / size) { nmemb = avail / size; }
+
+	memcpy(ptr, u4f->fptr + u4f->cur, nmemb * size);
+	u4f->cur += nmemb * size;
+	return nmemb;
 }
 
 long zu4_file_stdio_length(U4FILE *u4f) {
@@ -420,29 +580,29 @@ long zu4_file_stdio_length(U4FILE *u4f) {
 	return len;
 }
 
-long zu4_file_zip_length(U4FILE *u4f) {
-	return u4f->za_stat.m_uncomp_size;
+long zu4_file_mem_length(U4FILE *u4f) {
+	return u4f->len;
 }
 
 int zu4_file_stdio_getc(U4FILE *u4f) {
 	return fgetc(u4f->file);
 }
 
-int zu4_file_zip_getc(U4FILE *u4f) {
-	uint8_t *retptr = u4f->fptr;
-	return (int)retptr[u4f->cur++];
+int zu4_file_mem_getc(U4FILE *u4f) {
+	if (u4f->cur >= u4f->len) { return EOF; }
+	return (int)u4f->fptr[u4f->cur++];
 }
 
 int zu4_file_stdio_putc(U4FILE *u4f, int c) {
 	return fputc(c, u4f->file);
 }
 
-int zu4_file_zip_putc(U4FILE *u4f, int c) {
-	zu4_assert(0, "zipfiles must be read-only!");
+int zu4_file_mem_putc(U4FILE *u4f, int c) {
+	zu4_assert(0, "zipfiles and mapped files must be read-only!");
 	return c;
 }
 
 int zu4_file_getshort(U4FILE *u4f) {
-	int byteLow = zu4_file_getc(u4f);
-	return byteLow | (zu4_file_getc(u4f) << 8);
+	int byteLow = u4fgetc(u4f);
+	return byteLow | (u4fgetc(u4f) << 8);
 }
@@ -8,12 +8,36 @@ extern "C" {
 #include "miniz.h"
 
 /**
- * Represents zip files that game resources can be loaded from.
+ * A file inside a zip package.  Its contents are mapped or extracted the
+ * first time it is opened, and shared by every open U4FILE.  Extracted
+ * members that are no longer open are kept on a list, least recently
+ * used first, until they are evicted.
+ */
+typedef struct U4ZipMember {
+	char *name;
+	int index;
+	const uint8_t *data;
+	long len;
+	int extracted;
+	int refs;
+	struct U4ZipMember *older, *newer;
+} U4ZipMember;
+
+/**
+ * Represents zip files that game resources can be loaded from.  Each is
+ * opened once, and its members indexed by lowercase name.
  */
 typedef struct U4ZipPackage {
 	int loaded;
 	char name[256];
 	char path[256];
+	mz_zip_archive archive;
+	uint8_t *map;
+	size_t mapsize;
+	U4ZipMember *members;
+	int nmembers;
+	int *index;
+	unsigned int indexsize;
 } U4ZipPackage;
 
 /**
@@ -21,13 +45,16 @@ typedef struct U4ZipPackage {
  */
 typedef struct U4FILE {
 	FILE *file;
-	mz_zip_archive zip_archive;
-	mz_zip_archive_file_stat za_stat;
-	int za_index;
-	uint8_t *fptr;
+	U4ZipMember *member;
+	const uint8_t *fptr;
+	long len;
 	long cur;
+	uint8_t *span;
 } U4FILE;
 
+void zu4_file_init(void);
+void zu4_file_deinit(void);
+
 U4FILE *u4fopen_zip(const char *fname, U4ZipPackage *package);
 
 /////////////////////////////////
@@ -41,6 +68,7 @@ void u4fclose(U4FILE *f);
 int u4fseek(U4FILE *f, long offset, int whence);
 long u4ftell(U4FILE *f);
 size_t u4fread(U4FILE *f, void *ptr, size_t size, size_t nmemb);
+const uint8_t *u4fspan(U4FILE *f, long len);
 int u4fgetc(U4FILE *f);
 int u4fgetshort(U4FILE *f);
 int u4fputc(int c, U4FILE *f);
@@ -52,25 +80,26 @@ void u4find_graphics(char *path, size_t psize, const char *fname);
 void zu4_read_strtable(U4FILE *f, long offset, char **array, int nstrings);
 
 void zu4_file_stdio_close(U4FILE *u4f);
+void zu4_file_mmap_close(U4FILE *u4f);
 void zu4_file_zip_close(U4FILE *u4f);
 
 int zu4_file_stdio_seek(U4FILE *u4f, long offset, int whence);
-int zu4_file_zip_seek(U4FILE *u4f, long offset, int whence);
+int zu4_file_mem_seek(U4FILE *u4f, long offset, int whence);
 
 long zu4_file_stdio_tell(U4FILE *u4f);
-long zu4_file_zip_tell(U4FILE *u4f);
+long zu4_file_mem_tell(U4FILE *u4f);
 
 size_t zu4_file_stdio_read(U4FILE*, void*, size_t, size_t);
-size_t zu4_file_zip_read(U4FILE*, void*, size_t, size_t);
+size_t zu4_file_mem_read(U4FILE*, void*, size_t, size_t);
 
 long zu4_file_stdio_length(U4FILE *u4f);
-long zu4_file_zip_length(U4FILE *u4f);
+long zu4_file_mem_length(U4FILE *u4f);
 
 int zu4_file_stdio_getc(U4FILE *u4f);
-int zu4_file_zip_getc(U4FILE *u4f);
+int zu4_file_mem_getc(U4FILE *u4f);
 
 int zu4_file_stdio_putc(U4FILE *u4f, int c);
-int zu4_file_zip_putc(U4FILE *u4f, int c);
+int zu4_file_mem_putc(U4FILE *u4f, int c);
 
 int zu4_file_getshort(U4FILE *u4f);
 
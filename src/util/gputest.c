@@ -0,0 +1,189 @@
+/*
+ * gputest.c
+ *
+ * Draws random stacks of tiles through the GPU tile renderer, under a
+ * screen image with text and transparent cells like the map view's, and
+ * checks the frame the GPU draws pixel for pixel against zu4_video_read,
+ * which is what the title screen, highlighting and the harness read the
+ * screen back through.  Run it with SDL's offscreen driver and Mesa's
+ * software rasterizer to check the renderer without a display:
+ *   SDL_VIDEODRIVER=offscreen LIBGL_ALWAYS_SOFTWARE=1 ./gputest
+ *
+ * Build from the src directory with:
+ *   cc -std=c99 -O2 -I. $(sdl2-config --cflags) util/gputest.c image.c perf.c \
+ *     settings.c error.c u4_sdl.c $(sdl2-config --libs) -lGL -lGLU -o gputest
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// The renderer's frame is drawn without being presented, so that it can
+// be read back, which takes the static parts of video.c
+#include "../video.c"
+
+#define TILES 24
+#define FRAMES 2
+#define MAP_X 8
+#define MAP_Y 8
+#define MAP_CELLS 11
+
+int eventTimerGranularity;
+
+static unsigned int seed = 1;
+
+static unsigned int rnd(unsigned int n) {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+static uint32_t rndPixel(uint32_t alpha) {
+	return (alpha << 24) | (rnd(256) << 16) | (rnd(256) << 8) | rnd(256);
+}
+
+// Tiles are opaque, have transparent parts like the over-layer tiles, or
+// are translucent
+static Image *makeTile(int kind) {
+	Image *im = zu4_img_create(TILE_WIDTH, TILE_HEIGHT * FRAMES);
+	uint32_t *p = (uint32_t*)im->pixels;
+
+	for (int i = 0; i < im->w * im->h; i++) {
+		if (kind == 0)
+			p[i] = rndPixel(0xff);
+		else if (kind == 1)
+			p[i] = rnd(2) ? rndPixel(0xff) : 0;
+		else
+			p[i] = rndPixel(0x80);
+	}
+	return im;
+}
+
+static int check(Image *expect, const uint32_t *frame, const char *what) {
+	// Compare a frame read from the GPU, bottom row first, to the readback
+	int bad = 0, worst = 0;
+
+	for (int y = 0; y < SCREEN_HEIGHT; y++) {
+		for (int x = 0; x < SCREEN_WIDTH; x++) {
+			uint32_t e = ((uint32_t*)expect->pixels)[y * SCREEN_WIDTH + x];
+			uint32_t g = frame[(SCREEN_HEIGHT - 1 - y) * SCREEN_WIDTH + x];
+			int diff = 0;
+
+			for (int shift = 0; shift < 24; shift += 8) {
+				int d = abs((int)((e >> shift) & 0xff) - (int)((g >> shift) & 0xff));
+				if (d > diff)
+					diff = d;
+			}
+
+			// translucent tiles may round differently by one
+			if (diff > 1) {
+				if (!bad)
+					printf("gputest: %s: first difference at %d,%d: %08x read back, %08x drawn\n",
+						what, x, y, e, g);
+				bad++;
+			}
+			if (diff > worst)
+				worst = diff;
+		}
+	}
+
+	printf("gputest: %s: %d pixels differ, largest difference %d\n", what, bad, worst);
+	return bad;
+}
+
+int main(int argc, char *argv[]) {
+	Image *tiles[TILES];
+	Image *screen, *readback;
+	uint32_t *frame;
+	int failures = 0;
+
+	settings.scale = 1;
+	settings.gpuTiles = true;
+
+	screen = zu4_img_create_screen();
+	zu4_video_init();
+	printf("gputest: %s\n", (const char*)glGetString(GL_RENDERER));
+
+	if (!zu4_video_tiles()) {
+		printf("gputest: the GPU tile renderer did not start\n");
+		return 1;
+	}
+
+	for (int i = 0; i < TILES; i++)
+		tiles[i] = makeTile(i % 3);
+
+	readback = zu4_img_create(SCREEN_WIDTH, SCREEN_HEIGHT);
+	frame = (uint32_t*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+
+	for (int round = 0; round < 8; round++) {
+		char what[32];
+
+		// Opaque borders and text everywhere, as the game draws them
+		for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+			((uint32_t*)screen->pixels)[i] = rndPixel(0xff);
+
+		// The map view's cells are transparent, with a stack of one to
+		// three tiles under each, bottom tile opaque
+		for (int cy = 0; cy < MAP_CELLS; cy++) {
+			for (int cx = 0; cx < MAP_CELLS; cx++) {
+				int x = MAP_X + cx * TILE_WIDTH, y = MAP_Y + cy * TILE_HEIGHT;
+				int slots[3], n = 1 + rnd(3);
+
+				for (int i = 0; i < n; i++) {
+					int tile = i == n - 1 ? 3 * rnd(TILES / 3) : rnd(TILES);
+					int f = rnd(FRAMES);
+					uint32_t key = (tile << 8) | f;
+
+					slots[i] = zu4_video_atlas_find(key);
+					if (slots[i] < 0)
+						slots[i] = zu4_video_atlas_add(key, tiles[tile], 0, TILE_HEIGHT * f);
+				}
+
+				// some cells are left to software, as animated tiles are
+				if (rnd(8) == 0) {
+					zu4_video_tile_cell(x, y, NULL, 0);
+					continue;
+				}
+				zu4_img_fill(screen, x, y, TILE_WIDTH, TILE_HEIGHT, 0, 0, 0, 0);
+				zu4_video_tile_cell(x, y, slots, n);
+			}
+		}
+
+		// Focus boxes and other things drawn over the map in software
+		for (int i = 0; i < 40; i++) {
+			int x = MAP_X + rnd(MAP_CELLS * TILE_WIDTH - 4);
+			int y = MAP_Y + rnd(MAP_CELLS * TILE_HEIGHT - 4);
+			uint32_t p = rndPixel(rnd(2) ? 0xff : 0x80);
+			zu4_img_fill(screen, x, y, 4, 4, p & 0xff, (p >> 8) & 0xff, (p >> 16) & 0xff, p >> 24);
+		}
+
+		zu4_img_damage_all();
+		zu4_ogl_draw();
+		glFinish();
+		glReadPixels(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, frame);
+
+		zu4_video_read(readback, 0, 0, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+		snprintf(what, sizeof(what), "round %d", round);
+		failures += check(readback, frame, what) != 0;
+	}
+
+	// A single opaque tile reads back as the tile itself
+	int slot = zu4_video_atlas_find(0);
+	if (slot < 0)
+		slot = zu4_video_atlas_add(0, tiles[0], 0, 0);
+	zu4_img_fill(screen, MAP_X, MAP_Y, TILE_WIDTH, TILE_HEIGHT, 0, 0, 0, 0);
+	zu4_video_tile_cell(MAP_X, MAP_Y, &slot, 1);
+	zu4_video_read(readback, 0, 0, MAP_X, MAP_Y, TILE_WIDTH, TILE_HEIGHT);
+	for (int y = 0; y < TILE_HEIGHT; y++) {
+		for (int x = 0; x < TILE_WIDTH; x++) {
+			if (((uint32_t*)readback->pixels)[y * SCREEN_WIDTH + x] != ((uint32_t*)tiles[0]->pixels)[y * TILE_WIDTH + x]) {
+				printf("gputest: an opaque tile does not read back as itself at %d,%d\n", x, y);
+				failures++;
+				y = TILE_HEIGHT;
+				break;
+			}
+		}
+	}
+
+	zu4_video_deinit();
+	printf("gputest: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * imgbench.c
+ *
+ * A microbenchmark comparing the row-wise image blitter against the
+ * original per-pixel path, on tile-sized and full-screen blits.
+ *
+ * Build from the src directory with:
+ *   cc -std=c99 -O2 -I. util/imgbench.c image.c perf.c -o imgbench
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image.h"
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The original per-pixel blit, kept here as the reference
+static void blit_per_pixel(Image *d, Image *s, int x, int y, int rx, int ry, int rw, int rh) {
+	for (int i = 0; i < rh; i++) {
+		for (int j = 0; j < rw; j++) {
+			zu4_img_set_pixel(d, x + j, y + i, zu4_img_get_pixel(s, rx + j, ry + i));
+		}
+	}
+}
+
+static void fill_random(Image *im, int transparent) {
+	uint32_t *p = (uint32_t*)im->pixels;
+	for (int i = 0; i < im->w * im->h; i++) {
+		p[i] = (uint32_t)rand() | 0xff000000;
+		if (transparent && (rand() % 4) == 0) p[i] &= 0x00ffffff;
+	}
+}
+
+static void bench(const char *name, int w, int h, int transparent, int iterations) {
+	Image *src = zu4_img_create(w, h);
+	Image *ref = zu4_img_create(SCREEN_WIDTH, SCREEN_HEIGHT);
+	Image *dst = zu4_img_create(SCREEN_WIDTH, SCREEN_HEIGHT);
+	double t, tref, tnew;
+
+	fill_random(src, transparent);
+	fill_random(ref, 0);
+	memcpy(dst->pixels, ref->pixels, sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+
+	// Partly off the right edge, so clipping is exercised too
+	int x = SCREEN_WIDTH - w + 4 > 0 ? SCREEN_WIDTH - w + 4 : 0;
+	int y = 8;
+
+	t = now();
+	for (int i = 0; i < iterations; i++)
+		blit_per_pixel(ref, src, x, y, 0, 0, w, h);
+	tref = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; i++)
+		zu4_img_draw_subrect_on(dst, src, x, y, 0, 0, w, h);
+	tnew = now() - t;
+
+	int same = !memcmp(ref->pixels, dst->pixels, sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+
+	printf("%-28s per-pixel %8.3f us  row-wise %8.3f us  x%5.1f  %s\n", name,
+		tref * 1e6 / iterations, tnew * 1e6 / iterations, tref / tnew,
+		same ? "identical" : "MISMATCH");
+
+	zu4_img_free(src);
+	zu4_img_free(ref);
+	zu4_img_free(dst);
+}
+
+int main(int argc, char *argv[]) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+
+	srand(1);
+	bench("tile 16x16 opaque", 16, 16, 0, iterations * 100);
+	bench("tile 16x16 color-keyed", 16, 16, 1, iterations * 100);
+	bench("screen 320x200 opaque", 320, 200, 0, iterations);
+	bench("screen 320x200 color-keyed", 320, 200, 1, iterations);
+
+	return 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * lostest.c
+ *
+ * Compares the bitmap line of sight engine cell for cell against the
+ * original tile-by-tile DOS and enhanced algorithms, on random and
+ * hand-made viewports, and reports how long each takes.
+ *
+ * Build from the src directory with:
+ *   cc -std=c99 -O2 -I. util/lostest.c los.c -o lostest
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "los.h"
+
+static int opaqueAt[VIEWPORT_W][VIEWPORT_H];
+static int screenLos[VIEWPORT_W][VIEWPORT_H];
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The original DOS algorithm, kept here as the reference
+static void reference_dos() {
+	int x, y;
+
+	memset(screenLos, 0, sizeof(screenLos));
+	screenLos[VIEWPORT_W / 2][VIEWPORT_H / 2] = 1;
+
+	for (x = VIEWPORT_W / 2 - 1; x >= 0; x--)
+		if (screenLos[x + 1][VIEWPORT_H / 2] && !opaqueAt[x + 1][VIEWPORT_H / 2])
+			screenLos[x][VIEWPORT_H / 2] = 1;
+
+	for (x = VIEWPORT_W / 2 + 1; x < VIEWPORT_W; x++)
+		if (screenLos[x - 1][VIEWPORT_H / 2] && !opaqueAt[x - 1][VIEWPORT_H / 2])
+			screenLos[x][VIEWPORT_H / 2] = 1;
+
+	for (y = VIEWPORT_H / 2 - 1; y >= 0; y--)
+		if (screenLos[VIEWPORT_W / 2][y + 1] && !opaqueAt[VIEWPORT_W / 2][y + 1])
+			screenLos[VIEWPORT_W / 2][y] = 1;
+
+	for (y = VIEWPORT_H / 2 + 1; y < VIEWPORT_H; y++)
+		if (screenLos[VIEWPORT_W / 2][y - 1] && !opaqueAt[VIEWPORT_W / 2][y - 1])
+			screenLos[VIEWPORT_W / 2][y] = 1;
+
+	for (y = VIEWPORT_H / 2 - 1; y >= 0; y--) {
+		for (x = VIEWPORT_W / 2 - 1; x >= 0; x--) {
+			if (screenLos[x][y + 1] && !opaqueAt[x][y + 1])
+				screenLos[x][y] = 1;
+			else if (screenLos[x + 1][y] && !opaqueAt[x + 1][y])
+				screenLos[x][y] = 1;
+			else if (screenLos[x + 1][y + 1] && !opaqueAt[x + 1][y + 1])
+				screenLos[x][y] = 1;
+		}
+
+		for (x = VIEWPORT_W / 2 + 1; x < VIEWPORT_W; x++) {
+			if (screenLos[x][y + 1] && !opaqueAt[x][y + 1])
+				screenLos[x][y] = 1;
+			else if (screenLos[x - 1][y] && !opaqueAt[x - 1][y])
+				screenLos[x][y] = 1;
+			else if (screenLos[x - 1][y + 1] && !opaqueAt[x - 1][y + 1])
+				screenLos[x][y] = 1;
+		}
+	}
+
+	for (y = VIEWPORT_H / 2 + 1; y < VIEWPORT_H; y++) {
+		for (x = VIEWPORT_W / 2 - 1; x >= 0; x--) {
+			if (screenLos[x][y - 1] && !opaqueAt[x][y - 1])
+				screenLos[x][y] = 1;
+			else if (screenLos[x + 1][y] && !opaqueAt[x + 1][y])
+				screenLos[x][y] = 1;
+			else if (screenLos[x + 1][y - 1] && !opaqueAt[x + 1][y - 1])
+				screenLos[x][y] = 1;
+		}
+
+		for (x = VIEWPORT_W / 2 + 1; x < VIEWPORT_W; x++) {
+			if (screenLos[x][y - 1] && !opaqueAt[x][y - 1])
+				screenLos[x][y] = 1;
+			else if (screenLos[x - 1][y] && !opaqueAt[x - 1][y])
+				screenLos[x][y] = 1;
+			else if (screenLos[x - 1][y - 1] && !opaqueAt[x - 1][y - 1])
+				screenLos[x][y] = 1;
+		}
+	}
+}
+
+// The original enhanced algorithm, kept here as the reference
+static void reference_enhanced() {
+	const int shadowRaster[14][13] = {
+		{ 6, __VCH, 4, _N_CH, 1, __VCH, 3, _N___, 1, ___CH, 1, __VCH, 1 },
+		{ 6, __VC_, 1, _NVCH, 2, __VC_, 1, _NVCH, 3, _NVCH, 2, _NVCH, 1 },
+		{ 4, __VCH, 3, _N__H, 1, ___CH, 1, __VCH, 1,     0, 0,     0, 0 },
+		{ 6, __VC_, 2, _N_CH, 1, __VCH, 2, _N_CH, 1, __VCH, 1, _N__H, 1 },
+		{ 6, __V__, 1, _NVCH, 1, __VC_, 1, _NVCH, 1, __VC_, 1, _NVCH, 1 },
+		{ 2, __VCH, 2, _N__H, 2,     0, 0,     0, 0,     0, 0,     0, 0 },
+		{ 3, __VC_, 2, _N_CH, 1, __VCH, 1,     0, 0,     0, 0,     0, 0 },
+		{ 3, __VC_, 1, _NVCH, 2, _N_CH, 1,     0, 0,     0, 0,     0, 0 },
+		{ 3, _NVCH, 1, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0 },
+		{ 2, __VCH, 1, _N__H, 1,     0, 0,     0, 0,     0, 0,     0, 0 },
+		{ 2, __VC_, 1, _N__H, 1,     0, 0,     0, 0,     0, 0,     0, 0 },
+		{ 2, __VC_, 1, _N_CH, 1,     0, 0,     0, 0,     0, 0,     0, 0 },
+		{ 2, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0,     0, 0 },
+		{ 2, __V__, 1, _NVCH, 1,     0, 0,     0, 0,     0, 0,     0, 0 }
+	};
+	int x, y, octant;
+	int xOrigin, yOrigin, xSign = 0, ySign = 0, reflect = 0, xTile, yTile, xTileOffset, yTileOffset;
+
+	memset(screenLos, 0, sizeof(screenLos));
+
+	for (octant = 0; octant < 8; octant++) {
+		switch (octant) {
+			case 0:  xSign=  1;  ySign=  1;  reflect=0;  break;
+			case 1:  xSign=  1;  ySign=  1;  reflect=1;  break;
+			case 2:  xSign=  1;  ySign= -1;  reflect=1;  break;
+			case 3:  xSign= -1;  ySign=  1;  reflect=0;  break;
+			case 4:  xSign= -1;  ySign= -1;  reflect=0;  break;
+			case 5:  xSign= -1;  ySign= -1;  reflect=1;  break;
+			case 6:  xSign= -1;  ySign=  1;  reflect=1;  break;
+			case 7:  xSign=  1;  ySign= -1;  reflect=0;  break;
+		}
+
+		xOrigin = VIEWPORT_W / 2;
+		yOrigin = VIEWPORT_H / 2;
+
+		int maxWidth = xOrigin;
+		int maxHeight = yOrigin;
+		int currentRaster = 0;
+
+		if (reflect) {
+			maxWidth ^= maxHeight;
+			maxHeight ^= maxWidth;
+			maxWidth ^= maxHeight;
+		}
+
+		for (int currentCol = 1; currentCol <= 4; currentCol++) {
+			for (int currentRow = 0; currentRow <= currentCol; currentRow++) {
+				if (reflect) {
+					xTile = xOrigin+(currentRow*ySign);
+					yTile = yOrigin+(currentCol*xSign);
+				}
+				else {
+					xTile = xOrigin+(currentCol*xSign);
+					yTile = yOrigin+(currentRow*ySign);
+				}
+
+				if (opaqueAt[xTile][yTile]) {
+					if ((currentCol==1) && (currentRow==0)) { currentRaster=0; }
+					else if ((currentCol==1) && (currentRow==1)) { currentRaster=1; }
+					else if ((currentCol==2) && (currentRow==0)) { currentRaster=2; }
+					else if ((currentCol==2) && (currentRow==1)) { currentRaster=3; }
+					else if ((currentCol==2) && (currentRow==2)) { currentRaster=4; }
+					else if ((currentCol==3) && (currentRow==0)) { currentRaster=5; }
+					else if ((currentCol==3) && (currentRow==1)) { currentRaster=6; }
+					else if ((currentCol==3) && (currentRow==2)) { currentRaster=7; }
+					else if ((currentCol==3) && (currentRow==3)) { currentRaster=8; }
+					else if ((currentCol==4) && (currentRow==0)) { currentRaster=9; }
+					else if ((currentCol==4) && (currentRow==1)) { currentRaster=10; }
+					else if ((currentCol==4) && (currentRow==2)) { currentRaster=11; }
+					else if ((currentCol==4) && (currentRow==3)) { currentRaster=12; }
+					else { currentRaster=13; }
+
+					xTileOffset = 0;
+					yTileOffset = 0;
+
+					for (int currentSegment = 0; currentSegment < shadowRaster[currentRaster][0]; currentSegment++) {
+						int shadowType   = shadowRaster[currentRaster][currentSegment*2+1];
+						int shadowLength = shadowRaster[currentRaster][currentSegment*2+2];
+
+						shadowLength = (shadowLength+1+yTileOffset > maxWidth ? maxWidth : shadowLength);
+
+						if (shadowType & 0x80) {
+							shadowType ^= _N___;
+							if (currentRow + yTileOffset > maxHeight) {
+								break;
+							}
+							xTileOffset = yTileOffset;
+							yTileOffset++;
+						}
+
+						for (int currentShadow = 1; currentShadow <= shadowLength; currentShadow++) {
+							if (reflect) {
+								screenLos[xTile + ((yTileOffset) * ySign)][yTile + ((currentShadow+xTileOffset) * xSign)] |= shadowType;
+							}
+							else {
+								screenLos[xTile + ((currentShadow+xTileOffset) * xSign)][yTile + ((yTileOffset) * ySign)] |= shadowType;
+							}
+						}
+						xTileOffset += shadowLength;
+					}
+				}
+			}
+		}
+	}
+
+	for (y = 0; y < VIEWPORT_H; y++) {
+		for (x = 0; x < VIEWPORT_W; x++) {
+			if ((screenLos[x][y] & __VCH) == __VCH)
+				screenLos[x][y] = 0;
+			else
+				screenLos[x][y] = 1;
+		}
+	}
+}
+
+static void pack(uint16_t *opaque) {
+	for (int y = 0; y < VIEWPORT_H; y++) {
+		opaque[y] = 0;
+		for (int x = 0; x < VIEWPORT_W; x++) {
+			if (opaqueAt[x][y])
+				opaque[y] |= 1 << x;
+		}
+	}
+}
+
+static int compare(int style) {
+	uint16_t opaque[VIEWPORT_H], visible[VIEWPORT_H];
+
+	pack(opaque);
+	zu4_los_find(opaque, style, visible);
+
+	if (style == LOS_ENHANCED)
+		reference_enhanced();
+	else
+		reference_dos();
+
+	for (int y = 0; y < VIEWPORT_H; y++) {
+		for (int x = 0; x < VIEWPORT_W; x++) {
+			if (screenLos[x][y] != ((visible[y] >> x) & 1))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static void randomize(int density) {
+	for (int y = 0; y < VIEWPORT_H; y++) {
+		for (int x = 0; x < VIEWPORT_W; x++)
+			opaqueAt[x][y] = (rand() % 100) < density;
+	}
+}
+
+static void check(const char *name, int style, int trials) {
+	int failures = 0;
+
+	// every single wall on its own, then a range of wall densities
+	for (int i = 0; i < VIEWPORT_W * VIEWPORT_H; i++) {
+		memset(opaqueAt, 0, sizeof(opaqueAt));
+		opaqueAt[i % VIEWPORT_W][i / VIEWPORT_W] = 1;
+		failures += !compare(style);
+	}
+	for (int i = 0; i < trials; i++) {
+		randomize(i % 100);
+		failures += !compare(style);
+	}
+
+	printf("%-10s %d viewports, %d mismatches\n", name, VIEWPORT_W * VIEWPORT_H + trials, failures);
+}
+
+static void bench(const char *name, int style, int iterations) {
+	uint16_t opaque[VIEWPORT_H], visible[VIEWPORT_H];
+	double t, tref, tnew;
+
+	randomize(30);
+	pack(opaque);
+
+	t = now();
+	for (int i = 0; i < iterations; i++) {
+		if (style == LOS_ENHANCED)
+			reference_enhanced();
+		else
+			reference_dos();
+	}
+	tref = now() - t;
+
+	// flip a bit each time so the memoized result isn't simply reused
+	t = now();
+	for (int i = 0; i < iterations; i++) {
+		opaque[0] ^= 1;
+		zu4_los_find(opaque, style, visible);
+	}
+	tnew = now() - t;
+
+	printf("%-10s reference %8.3f us  bitmap %8.3f us  x%5.1f\n", name,
+		tref * 1e6 / iterations, tnew * 1e6 / iterations, tref / tnew);
+}
+
+int main(int argc, char *argv[]) {
+	int trials = argc > 1 ? atoi(argv[1]) : 100000;
+
+	srand(1);
+	check("DOS", LOS_DOS, trials);
+	check("Enhanced", LOS_ENHANCED, trials);
+
+	bench("DOS", LOS_DOS, trials);
+	bench("Enhanced", LOS_ENHANCED, trials);
+
+	return 0;
+}
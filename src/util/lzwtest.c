@@ -0,0 +1,238 @@
+/*
+ * lzwtest.c
+ *
+ * Checks that the single-pass LZW decoder gives byte-identical output to
+ * the original two-pass decoder on each compressed file named on the
+ * command line (the .EGA and .LZW files from the game), both all at once
+ * and fed in small pieces, and reports how long each takes.
+ *
+ * Build from the src directory with:
+ *   cc -std=c99 -O2 -I. -Ilzw util/lzwtest.c lzw/lzw.c lzw/hash.c lzw/u4decode.c -o lzwtest
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lzw/hash.h"
+#include "lzw/lzw.h"
+#include "lzw/u4decode.h"
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The original secondary probe, simulating the DOS mul and rcl instructions
+static int reference_probe2(unsigned char root, int codeword) {
+	long registers[2], temp;
+	long carry, oldCarry;
+
+	registers[0] = ((root << 1) + codeword) | 0x800;
+	temp = (registers[0] & 0xff) * (registers[0] & 0xff);
+	temp += 2 * (registers[0] & 0xff) * (registers[0] >> 8) * 0x100;
+	registers[1] = (temp >> 16) + (registers[0] >> 8) * (registers[0] >> 8);
+	registers[0] = temp & 0xffff;
+
+	carry = registers[1] != 0;
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			oldCarry = carry;
+			carry = (registers[j] >> 15) & 1;
+			registers[j] = ((registers[j] << 1) | oldCarry) & 0xffff;
+		}
+	}
+
+	return (int)(((registers[0] >> 8) | (registers[1] << 8)) & 0xfff);
+}
+
+typedef struct {
+	unsigned char root;
+	int codeword;
+	unsigned char occupied;
+} Entry;
+
+static int reference_found(Entry *dict, int hashCode, unsigned char root, int codeword) {
+	if (hashCode <= 0xff)
+		return 0;
+	return !dict[hashCode].occupied ||
+		(dict[hashCode].root == root && dict[hashCode].codeword == codeword);
+}
+
+static int reference_hash(Entry *dict, unsigned char root, int codeword) {
+	int hashCode = probe1(root, codeword);
+	if (reference_found(dict, hashCode, root, codeword))
+		return hashCode;
+	hashCode = reference_probe2(root, codeword);
+	if (reference_found(dict, hashCode, root, codeword))
+		return hashCode;
+	do {
+		hashCode = probe3(hashCode);
+	} while (!reference_found(dict, hashCode, root, codeword));
+	return hashCode;
+}
+
+static int reference_code(const unsigned char *in, long *bitsRead) {
+	int codeword = (in[*bitsRead / 8] << 8) + in[*bitsRead / 8 + 1];
+	codeword = (codeword >> (4 - *bitsRead % 8)) & 0xfff;
+	*bitsRead += 12;
+	return codeword;
+}
+
+static void reference_clear(Entry *dict) {
+	memset(dict, 0, sizeof(Entry) * 0x1000);
+	for (int i = 0; i < 0x100; i++)
+		dict[i].occupied = 1;
+}
+
+// The original decoder, kept here as the reference; out may be NULL to
+// only count the decompressed size
+static long reference_pass(const unsigned char *in, long len, unsigned char *out) {
+	static Entry dict[0x1000];
+	unsigned char stack[0x8000];
+	int sp = 0, count = 0, oldCode, newCode, newpos, unknown;
+	unsigned char character;
+	long bitsRead = 0, written = 0;
+
+	reference_clear(dict);
+	if (bitsRead + 12 > len * 8)
+		return 0;
+
+	oldCode = reference_code(in, &bitsRead);
+	character = (unsigned char)oldCode;
+	if (out) out[written] = character;
+	written++;
+
+	while (bitsRead + 12 <= len * 8) {
+		newCode = reference_code(in, &bitsRead);
+		unknown = !dict[newCode].occupied;
+		int c = newCode;
+		if (unknown) {
+			stack[sp++] = character;
+			c = oldCode;
+		}
+		while (c > 0xff) {
+			stack[sp++] = dict[c].root;
+			c = dict[c].codeword;
+		}
+		stack[sp++] = (unsigned char)c;
+
+		character = stack[sp - 1];
+		while (sp > 0) {
+			if (out) out[written] = stack[sp - 1];
+			written++;
+			sp--;
+		}
+
+		newpos = reference_hash(dict, character, oldCode);
+		dict[newpos].root = character;
+		dict[newpos].codeword = oldCode;
+		dict[newpos].occupied = 1;
+		count++;
+
+		if (unknown && newpos != newCode)
+			return -1;
+
+		if (count > 0xccc) {
+			count = 0;
+			reference_clear(dict);
+			if (bitsRead + 12 > len * 8)
+				return written;
+			newCode = reference_code(in, &bitsRead);
+			character = (unsigned char)newCode;
+			if (out) out[written] = character;
+			written++;
+		}
+		oldCode = newCode;
+	}
+
+	return written;
+}
+
+static long reference_decode(const unsigned char *in, long len, unsigned char **out) {
+	long size = reference_pass(in, len, NULL);
+	if (size <= 0)
+		return -1;
+	*out = (unsigned char*)malloc(size);
+	return reference_pass(in, len, *out);
+}
+
+static long stream_decode(const unsigned char *in, long len, long piece, unsigned char **out) {
+	LzwStream *s = lzwStreamCreate(0);
+	for (long i = 0; i < len; i += piece)
+		lzwStreamWrite(s, in + i, len - i < piece ? len - i : piece);
+	return lzwStreamFinish(s, out);
+}
+
+static int test(const char *path, int iterations) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("%-16s unable to open\n", path);
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	unsigned char *in = (unsigned char*)malloc(len + 1);
+	len = fread(in, 1, len, f);
+	in[len] = 0;
+	fclose(f);
+
+	unsigned char *ref = NULL, *out = NULL;
+	long refLen = reference_decode(in, len, &ref);
+	long outLen = decompress_u4_memory(in, len, (void**)&out);
+	int same = refLen == outLen && (refLen <= 0 || !memcmp(ref, out, refLen));
+	free(out);
+
+	// feed the stream in awkward pieces, to cross codewords between writes
+	static const long pieces[] = { 1, 2, 3, 7, 4096 };
+	for (unsigned int i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+		outLen = stream_decode(in, len, pieces[i], &out);
+		if (refLen > 0)
+			same = same && refLen == outLen && !memcmp(ref, out, refLen);
+		if (outLen >= 0)
+			free(out);
+	}
+	free(ref);
+
+	double t = now();
+	for (int i = 0; i < iterations; i++) {
+		ref = NULL;
+		reference_decode(in, len, &ref);
+		free(ref);
+	}
+	double tref = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; i++) {
+		out = NULL;
+		decompress_u4_memory(in, len, (void**)&out);
+		free(out);
+	}
+	double tnew = now() - t;
+
+	printf("%-16s %7ld -> %7ld  two-pass %8.1f us  single-pass %8.1f us  x%4.1f  %s\n", path,
+		len, refLen, tref * 1e6 / iterations, tnew * 1e6 / iterations, tref / tnew,
+		same ? "identical" : "MISMATCH");
+
+	free(in);
+	return same;
+}
+
+int main(int argc, char *argv[]) {
+	int failures = 0;
+
+	if (argc < 2) {
+		printf("usage: %s file.ega|file.lzw ...\n", argv[0]);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++)
+		failures += !test(argv[i], 50);
+
+	return failures ? 1 : 0;
+}
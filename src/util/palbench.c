@@ -0,0 +1,157 @@
+/*
+ * palbench.c
+ *
+ * Compares the table-driven palette conversion pixel for pixel against
+ * the original per-pixel conversion, on random images and on the image
+ * files named on the command line, and reports how long each takes.
+ * Files after -4 are EGA images and files after -8 (the default) are
+ * VGA upgrade images; each is decompressed as LZW or RLE if it can be.
+ *
+ * Build from the src directory with:
+ *   cc -std=c99 -O2 -I. util/palbench.c image.c perf.c rle.c lzw/lzw.c lzw/hash.c lzw/u4decode.c -o palbench
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image.h"
+#include "rle.h"
+#include "lzw/u4decode.h"
+
+static RGBA vga[256];
+static PaletteLut egaLut, vgaLut;
+
+static const uint32_t ega[16] = {
+	0xff000000, 0xffaa0000, 0xff00aa00, 0xffaaaa00,
+	0xff0000aa, 0xffaa00aa, 0xff0055aa, 0xffaaaaaa,
+	0xff555555, 0xffff5555, 0xff55ff55, 0xffffff55,
+	0xff5555ff, 0xffff55ff, 0xff55ffff, 0xffffffff,
+};
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The original conversions, kept here as the reference
+static void reference_ega(int w, int h, uint8_t *in, uint32_t *out) {
+	for (int i = 0; i < (w * h) / 2; i++) {
+		out[i * 2] = ega[(in[i] >> 4) & 0xf];
+		out[(i * 2) + 1] = ega[in[i] & 0xf];
+	}
+}
+
+static void reference_vga(int w, int h, uint8_t *in, uint32_t *out) {
+	RGBA *pp = vga;
+	for (int i = 0; i < (w * h); i++) {
+		out[i] = 0xff000000 | pp[in[i] & 0xff].b << 16 |pp[in[i] & 0xff].g << 8 | pp[in[i] & 0xff].r;
+	}
+}
+
+static int bench(const char *name, uint8_t *raw, long len, int bpp, int iterations) {
+	int pixels = len * 8 / bpp;
+	uint32_t *ref = (uint32_t*)calloc(pixels, sizeof(uint32_t));
+	uint32_t *out = (uint32_t*)calloc(pixels, sizeof(uint32_t));
+	double t, tref, tnew;
+
+	t = now();
+	for (int i = 0; i < iterations; i++) {
+		if (bpp == 4)
+			reference_ega(pixels, 1, raw, ref);
+		else
+			reference_vga(pixels, 1, raw, ref);
+	}
+	tref = now() - t;
+
+	t = now();
+	for (int i = 0; i < iterations; i++) {
+		if (bpp == 4)
+			zu4_img_index_4bpp(out, raw, len, &egaLut);
+		else
+			zu4_img_index_8bpp(out, raw, len, &vgaLut);
+	}
+	tnew = now() - t;
+
+	int same = !memcmp(ref, out, sizeof(uint32_t) * pixels);
+
+	printf("%-20s %d bpp %7d px  per-pixel %8.1f us  table %8.1f us  x%5.1f  %s\n", name, bpp,
+		pixels, tref * 1e6 / iterations, tnew * 1e6 / iterations, tref / tnew,
+		same ? "identical" : "MISMATCH");
+
+	free(ref);
+	free(out);
+	return same;
+}
+
+static int bench_file(const char *path, int bpp, int iterations) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("%-20s unable to open\n", path);
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = (uint8_t*)malloc(len);
+	len = fread(data, 1, len, f);
+	fclose(f);
+
+	// Images are LZW or RLE compressed, or raw
+	void *raw = NULL;
+	long rawLen = decompress_u4_memory(data, len, &raw);
+	if (rawLen <= 0) {
+		raw = NULL;
+		rawLen = rleDecompressMemory(data, len, &raw);
+	}
+	if (rawLen <= 0) {
+		free(raw);
+		raw = data;
+		rawLen = len;
+		data = NULL;
+	}
+
+	int same = bench(path, (uint8_t*)raw, rawLen, bpp, iterations);
+	free(raw);
+	free(data);
+	return same;
+}
+
+int main(int argc, char *argv[]) {
+	int failures = 0, bpp = 8;
+	uint8_t *noise = (uint8_t*)malloc(SCREEN_WIDTH * SCREEN_HEIGHT);
+	uint32_t packed[256];
+
+	srand(1);
+	for (int i = 0; i < 256; i++) {
+		vga[i].r = rand() & 0xff;
+		vga[i].g = rand() & 0xff;
+		vga[i].b = rand() & 0xff;
+		packed[i] = 0xff000000 | vga[i].b << 16 | vga[i].g << 8 | vga[i].r;
+	}
+	zu4_img_palette_lut(&vgaLut, packed, 256);
+	zu4_img_palette_lut(&egaLut, ega, 16);
+
+	for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+		noise[i] = rand() & 0xff;
+
+	failures += !bench("random 320x200", noise, SCREEN_WIDTH * SCREEN_HEIGHT / 2, 4, 2000);
+	failures += !bench("random 320x200", noise, SCREEN_WIDTH * SCREEN_HEIGHT, 8, 2000);
+	failures += !bench("random odd length", noise, 1001, 4, 2000);
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-4"))
+			bpp = 4;
+		else if (!strcmp(argv[i], "-8"))
+			bpp = 8;
+		else
+			failures += !bench_file(argv[i], bpp, 200);
+	}
+
+	free(noise);
+	return failures ? 1 : 0;
+}
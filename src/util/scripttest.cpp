@@ -0,0 +1,406 @@
+/*
+ * scripttest.cpp
+ *
+ * Talks to every vendor in vendorScript.xml -- each kind of shop in
+ * each towne -- feeding the script the same pseudo-random keys every
+ * time, and prints a transcript of everything the script says and does.
+ * Build it once against the script interpreter in the tree and once
+ * against another one (such as the DOM interpreter the compiled one
+ * replaced), and diff the transcripts; they should be identical.
+ *
+ * The interpreter is included into this file with stand-ins for the
+ * rest of the game, so gold, healing, sleeping at the inn and so on
+ * are logged rather than done.
+ *
+ * Build from the src directory with:
+ *   c++ -O2 -I. -I../deps/miniz $(xml2-config --cflags) util/scripttest.cpp xml.cpp \
+ *     $(xml2-config --libs) -o scripttest
+ * and, to build it against the interpreter from an older revision:
+ *   mkdir -p /tmp/dom && git show <rev>:src/script.h > /tmp/dom/script.h \
+ *     && git show <rev>:src/script.cpp > /tmp/dom/script.cpp
+ *   c++ -O2 -I/tmp/dom -I. -I../deps/miniz $(xml2-config --cflags) \
+ *     -DSCRIPT_SOURCE='"/tmp/dom/script.cpp"' util/scripttest.cpp xml.cpp \
+ *     $(xml2-config --libs) -o scripttest-dom
+ * then run each from the src directory as
+ *   ./scripttest [walks per vendor] > transcript.txt
+ */
+
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <libxml/parser.h>
+
+/* keep the interpreter from dragging in the combat and party code */
+#define CAMP_H
+
+#include "context.h"
+#include "error.h"
+#include "event.h"
+#include "random.h"
+#include "savegame.h"
+#include "screen.h"
+#include "script.h"
+#include "settings.h"
+#include "stats.h"
+#include "tileset.h"
+#include "u4file.h"
+
+enum KarmaAction {
+    KA_FOUND_ITEM, KA_STOLE_CHEST, KA_GAVE_TO_BEGGAR, KA_GAVE_ALL_TO_BEGGAR,
+    KA_BRAGGED, KA_HUMBLE, KA_HAWKWIND, KA_MEDITATION, KA_BAD_MANTRA,
+    KA_ATTACKED_GOOD, KA_FLED_EVIL, KA_FLED_GOOD, KA_HEALTHY_FLED_EVIL,
+    KA_KILLED_EVIL, KA_SPARED_GOOD, KA_DONATED_BLOOD, KA_DIDNT_DONATE_BLOOD,
+    KA_CHEAT_REAGENTS, KA_DIDNT_CHEAT_REAGENTS, KA_USED_SKULL,
+    KA_DESTROYED_SKULL
+};
+
+enum HealType {
+    HT_NONE, HT_CURE, HT_FULLHEAL, HT_RESURRECT, HT_HEAL, HT_CAMPHEAL,
+    HT_INNHEAL
+};
+
+struct PartyEvent {
+    enum Type { INVENTORY_ADDED };
+};
+
+struct PartyMember {
+    int index;
+    void heal(HealType type);
+    bool applyDamage(int damage, bool byplayer = false);
+};
+
+struct Party : public Script::Provider {
+    PartyMember members[4];
+
+    Party() { for (int i = 0; i < 4; i++) members[i].index = i; }
+    std::string translate(std::vector<std::string> &parts);
+    void adjustGold(int gold);
+    void adjustFood(int food);
+    void adjustKarma(KarmaAction action);
+    void setTransport(MapTile tile);
+    void notifyOfChange(PartyMember *pm, PartyEvent::Type eventType);
+    PartyMember *member(int index);
+};
+
+struct CombatController {
+    virtual ~CombatController() {}
+    virtual void begin() = 0;
+};
+
+struct InnController : public CombatController {
+    void begin();
+};
+
+void gameUpdateScreen(void);
+
+#ifndef SCRIPT_SOURCE
+#define SCRIPT_SOURCE "script.cpp"
+#endif
+#include SCRIPT_SOURCE
+
+/* Thrown to cut a conversation short where the game would leave it */
+struct WalkEnded {};
+
+static const char *vendorTypes[] = {
+    "Weapons", "Armor", "Food", "Tavern", "Reagents", "Healer", "Inn", "Guild", "Stable"
+};
+
+static unsigned int inputSeed, scriptSeed;
+static std::vector<std::string> topics;
+
+const unsigned int Conversation::BUFFERLEN = 16;
+SettingsData settings;
+bool verbose = false;
+Context *c;
+SpellEffectCallback spellEffectCallback;
+
+static Party party;
+static SaveGame saveGame;
+static StatsArea *stats;
+static Map *map;
+static Location *location;
+
+static int next(unsigned int *seed, int upperval) {
+    *seed = *seed * 1103515245 + 12345;
+    return upperval > 0 ? (int)((*seed >> 16) % upperval) : 0;
+}
+
+/*
+ * Stand-ins for the game
+ */
+
+extern "C" {
+
+void zu4_error(int level, const char *fmt, ...) {
+    va_list args;
+    printf("<%s: ", level == ZU4_LOG_ERR ? "error" : "warning");
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf(">\n");
+    if (level == ZU4_LOG_ERR)
+        exit(1);
+}
+
+void zu4_assert(bool exp, const char *fmt, ...) {
+    if (!exp) {
+        printf("<assertion failed: %s>\n", fmt);
+        exit(1);
+    }
+}
+
+void u4find_conf(char *path, size_t size, const char *name) {
+    snprintf(path, size, "../conf/%s", name);
+}
+
+void zu4_srandom(void) {}
+void zu4_srandom_seed(unsigned int seed) { scriptSeed = seed; }
+int zu4_random(int upperval) { return next(&scriptSeed, upperval); }
+
+void zu4_music_play(int track) { printf("<music %d>", track); }
+void zu4_music_stop() { printf("<music stop>"); }
+void zu4_music_fadeout(int msecs) { printf("<music fadeout %d>", msecs); }
+
+}
+
+void screenMessage(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void screenEnableCursor(void) { printf("<cursor on>"); }
+void screenDisableCursor(void) { printf("<cursor off>"); }
+void gameUpdateScreen(void) { printf("<move %d,%d,%d>", location->coords.x, location->coords.y, location->coords.z); }
+void EventHandler::wait_msecs(unsigned int msecs) { printf("<wait %u>", msecs); }
+void StatsArea::setView(StatsView view) { printf("<ztats %d>", view); }
+void StatsArea::resetReagentsMenu() { printf("<reagents menu>"); }
+
+Tile *Tileset::findTileByName(const std::string &name) {
+    printf("<transport %s>\n", name.c_str());
+    throw WalkEnded();
+}
+
+Map::Map() {}
+Map::~Map() {}
+std::string Map::getName() { return fname; }
+
+Location::Location(Coords coords, Map *map, int viewmode, LocationContext ctx, TurnCompleter *turnCompleter, Location *prev) :
+    coords(coords), map(map), viewMode(viewmode), context(ctx), turnCompleter(turnCompleter), prev(prev) {}
+
+static void spellEffect(int spell, int player, int sound) {
+    printf("<spell %c>", spell);
+}
+
+void InnController::begin() {
+    printf("<sleep>\n");
+    delete this;
+    throw WalkEnded();
+}
+
+void PartyMember::heal(HealType type) { printf("<heal %d: %d>", index + 1, type); }
+bool PartyMember::applyDamage(int damage, bool byplayer) { printf("<damage %d: %d>", index + 1, damage); return true; }
+
+std::string Party::translate(std::vector<std::string> &parts) {
+    if (parts.size() == 1) {
+        if (parts[0] == "gold")
+            return zu4_to_string(saveGame.gold);
+        else if (parts[0] == "food")
+            return zu4_to_string(saveGame.food);
+        else if (parts[0] == "members")
+            return "4";
+        else if (parts[0] == "transport")
+            return "foot";
+    }
+    else if (parts.size() >= 2 && parts[0].compare(0, 6, "member") == 0) {
+        int p = atoi(parts[0].c_str() + 6);
+        if (parts[1] == "needs")
+            return (p + parts.back().size()) % 2 ? "true" : "false";
+        else if (parts[1] == "name")
+            return "Member" + zu4_to_string(p);
+        return zu4_to_string(p * 100);
+    }
+    else if (parts.size() == 2) {
+        if (parts[0] == "weapon" || parts[0] == "armor")
+            return zu4_to_string(parts[1].size() % 3);
+    }
+    return "";
+}
+
+void Party::adjustGold(int gold) { saveGame.gold += gold; printf("<gold %+d>", gold); }
+void Party::adjustFood(int food) { saveGame.food += food; printf("<food %+d>", food); }
+void Party::adjustKarma(KarmaAction action) { printf("<karma %d>", action); }
+void Party::setTransport(MapTile tile) {}
+void Party::notifyOfChange(PartyMember *pm, PartyEvent::Type eventType) { printf("<inventory>"); }
+PartyMember *Party::member(int index) {
+    if (index < 0 || index >= 4) {
+        printf("<no member %d>\n", index + 1);
+        throw WalkEnded();
+    }
+    return &members[index];
+}
+
+/*
+ * The driver
+ */
+
+/* Collects the towne of each vendor, and every word the scripts answer to */
+static void scanVendors(xmlNodePtr node, std::vector<std::pair<std::string, std::string> > *vendors, const std::string &type) {
+    for (; node; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE)
+            continue;
+
+        std::string id;
+        xmlChar *prop = xmlGetProp(node, (const xmlChar *)"id");
+        if (prop) {
+            id = (const char *)prop;
+            xmlFree(prop);
+        }
+
+        if (xmlStrcmp(node->name, (const xmlChar *)"script") == 0 && !id.empty())
+            scanVendors(node->children, vendors, id);
+        else {
+            if (xmlStrcmp(node->name, (const xmlChar *)"vendor") == 0)
+                vendors->push_back(std::make_pair(type, id));
+
+            prop = xmlGetProp(node, (const xmlChar *)"choice");
+            if (prop) {
+                /* the DOM interpreter expands braces in what the player types */
+                if (xmlStrlen(prop) > 1 && !xmlStrchr(prop, '{'))
+                    topics.push_back((const char *)prop);
+                xmlFree(prop);
+            }
+            scanVendors(node->children, vendors, type);
+        }
+    }
+}
+
+static void walk(const std::string &type, const std::string &towne, int n) {
+    Script *script = new Script();
+    int inputs;
+
+    memset(&saveGame, 0, sizeof(saveGame));
+    saveGame.gold = next(&inputSeed, 2) ? 9999 : next(&inputSeed, 400);
+    saveGame.food = 10000;
+    location->coords.x = 1;
+    location->coords.y = 2;
+    location->coords.z = 0;
+    map->fname = towne;
+    c->line = 0;
+
+    printf("\n=== %s, %s, walk %d\n", type.c_str(), towne.c_str(), n);
+
+    try {
+        script->addProvider("party", &party);
+        script->load("vendorScript.xml", type, "vendor", towne);
+        script->run("intro");
+
+        for (inputs = 0; script->getState() != Script::STATE_DONE; inputs++) {
+            if (script->getState() != Script::STATE_INPUT || inputs == 60) {
+                printf("\n<stuck>\n");
+                break;
+            }
+
+            const std::string &name = script->getInputName();
+            switch (script->getInputType()) {
+            case Script::INPUT_CHOICE: {
+                std::string choices = script->getChoices();
+                char val = " \033"[next(&inputSeed, 2)];
+                if (next(&inputSeed, 4))
+                    val = choices[next(&inputSeed, choices.size())];
+                printf("[%s '%c']", name.c_str(), val == '\033' ? '^' : val);
+                if (isspace(val) || val == '\033')
+                    script->unsetVar(name);
+                else
+                    script->setVar(name, std::string(1, val));
+            } break;
+
+            case Script::INPUT_KEYPRESS:
+                printf("[key]");
+                break;
+
+            case Script::INPUT_NUMBER: {
+                int val = next(&inputSeed, 4) ? next(&inputSeed, 12) : next(&inputSeed, 200);
+                printf("[%s %d]", name.c_str(), val);
+                script->setVar(name, val);
+            } break;
+
+            case Script::INPUT_STRING: {
+                std::string str;
+                if (next(&inputSeed, 8))
+                    str = topics[next(&inputSeed, topics.size())];
+                printf("[%s \"%s\"]", name.c_str(), str.c_str());
+                if (str.size())
+                    script->setVar(name, str);
+                else script->unsetVar(name);
+            } break;
+
+            case Script::INPUT_PLAYER: {
+                int player = next(&inputSeed, 6) - 1;
+                printf("[%s %d]", name.c_str(), player + 1);
+                if (player != -1)
+                    script->setVar(name, zu4_to_string(player + 1));
+                else script->unsetVar(name);
+            } break;
+
+            default: break;
+            }
+
+            c->line++;
+            script->_continue();
+        }
+    } catch (WalkEnded &) {
+    }
+
+    printf("\n--- gold %d food %d\n", saveGame.gold, saveGame.food);
+    delete script;
+}
+
+int main(int argc, char *argv[]) {
+    int walks = argc > 1 ? atoi(argv[1]) : 20;
+    std::vector<std::pair<std::string, std::string> > vendors;
+    static Context ctx;
+    unsigned int i;
+    int n;
+
+    xmlDocPtr doc = xmlParseFile("../conf/vendorScript.xml");
+    if (!doc) {
+        fprintf(stderr, "can't read ../conf/vendorScript.xml\n");
+        return 1;
+    }
+    scanVendors(xmlDocGetRootElement(doc)->children, &vendors, "");
+    xmlFreeDoc(doc);
+
+    Coords start = { 1, 2, 0 };
+    map = new Map();
+    location = new Location(start, map, 0, CTX_CITY, NULL, NULL);
+    c = &ctx;
+    c->party = &party;
+    c->saveGame = &saveGame;
+    c->location = location;
+    c->stats = stats;
+    spellEffectCallback = &spellEffect;
+
+    for (i = 0; i < sizeof(vendorTypes) / sizeof(vendorTypes[0]); i++) {
+        bool found = false;
+        for (unsigned int v = 0; v < vendors.size(); v++) {
+            if (vendors[v].first != vendorTypes[i])
+                continue;
+            found = true;
+            for (n = 0; n < walks; n++) {
+                inputSeed = scriptSeed = (i * 131 + v) * 7919 + n;
+                walk(vendors[v].first, vendors[v].second, n);
+            }
+        }
+        if (!found)
+            printf("\n=== %s: no vendors\n", vendorTypes[i]);
+    }
+
+    return 0;
+}
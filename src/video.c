@@ -19,18 +19,244 @@
  * 
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <SDL.h>
 #include <GL/glu.h>
 
 #include "error.h"
 #include "image.h"
 #include "settings.h"
+#include "u4.h"
 #include "u4_sdl.h"
+#include "video.h"
+
+/*
+ * With the GPU tile renderer, map tiles are drawn as textured quads from
+ * an atlas, underneath the screen image.  The screen image is left
+ * transparent wherever a tile cell should show through, so anything drawn
+ * over the map area in software still ends up on top.  The atlas is
+ * mirrored in memory so that zu4_video_read can put the same picture
+ * together for code that reads the screen back.
+ */
+#define ATLAS_SIZE 1024
+#define ATLAS_COLS (ATLAS_SIZE / TILE_WIDTH)
+#define ATLAS_SLOTS (ATLAS_COLS * (ATLAS_SIZE / TILE_HEIGHT))
+#define ATLAS_HASH_SIZE (ATLAS_SLOTS * 2)
+
+/* tile cells are positioned on the character grid */
+#define TILE_CELLS_W (SCREEN_WIDTH / CHAR_WIDTH)
+#define TILE_CELLS_H (SCREEN_HEIGHT / CHAR_HEIGHT)
+
+typedef struct TileCell {
+	int n;
+	int slots[VIDEO_TILE_LAYERS];   // topmost first
+} TileCell;
+
+static int backend = VIDEO_BACKEND_SDL;
 
 static SDL_Window *window;
 static SDL_GLContext glcontext;
 
 static GLuint texID = 0;
+static GLuint atlasID = 0;
+
+static uint32_t atlasKeys[ATLAS_HASH_SIZE];    // key + 1, or 0 if unused
+static int atlasSlots[ATLAS_HASH_SIZE];
+static int atlasUsed = 0;
+static uint32_t *atlasPixels = NULL;
+
+static TileCell tileCells[TILE_CELLS_H][TILE_CELLS_W];
+
+static void zu4_ogl_atlas_init() {
+	// Allocate an empty tile atlas
+	memset(atlasKeys, 0, sizeof(atlasKeys));
+	memset(tileCells, 0, sizeof(tileCells));
+	atlasUsed = 0;
+	atlasPixels = (uint32_t*)calloc(ATLAS_SIZE * ATLAS_SIZE, sizeof(uint32_t));
+	
+	glGenTextures(1, &atlasID);
+	glBindTexture(GL_TEXTURE_2D, atlasID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D,
+				0,
+				GL_RGBA,
+				ATLAS_SIZE, ATLAS_SIZE,
+				0,
+				GL_RGBA,
+				GL_UNSIGNED_BYTE,
+				NULL);
+	glBindTexture(GL_TEXTURE_2D, texID);
+}
+
+static void zu4_ogl_atlas_draw() {
+	// Draw every tile cell as a stack of quads, bottom layer first
+	const float ts = (float)TILE_WIDTH / ATLAS_SIZE;
+	
+	glBindTexture(GL_TEXTURE_2D, atlasID);
+	glBegin(GL_QUADS);
+	for (int cy = 0; cy < TILE_CELLS_H; cy++) {
+		for (int cx = 0; cx < TILE_CELLS_W; cx++) {
+			TileCell *cell = &tileCells[cy][cx];
+			float x0 = cx * CHAR_WIDTH * settings.scale;
+			float y0 = cy * CHAR_HEIGHT * settings.scale;
+			float x1 = x0 + TILE_WIDTH * settings.scale;
+			float y1 = y0 + TILE_HEIGHT * settings.scale;
+			
+			for (int i = cell->n - 1; i >= 0; i--) {
+				float u = (cell->slots[i] % ATLAS_COLS) * ts;
+				float v = (cell->slots[i] / ATLAS_COLS) * ts;
+				
+				glTexCoord2f(u + ts, v + ts);
+				glVertex2f(x1, y1);
+				
+				glTexCoord2f(u + ts, v);
+				glVertex2f(x1, y0);
+				
+				glTexCoord2f(u, v);
+				glVertex2f(x0, y0);
+				
+				glTexCoord2f(u, v + ts);
+				glVertex2f(x0, y1);
+			}
+		}
+	}
+	glEnd();
+	glBindTexture(GL_TEXTURE_2D, texID);
+}
+
+bool zu4_video_tiles() {
+	// Return whether map tiles are drawn on the GPU
+	return settings.gpuTiles && atlasID;
+}
+
+int zu4_video_atlas_find(uint32_t key) {
+	// Return the atlas slot holding the given tile frame, or -1
+	unsigned h = (key * 2654435761u) % ATLAS_HASH_SIZE;
+	
+	while (atlasKeys[h]) {
+		if (atlasKeys[h] == key + 1)
+			return atlasSlots[h];
+		h = (h + 1) % ATLAS_HASH_SIZE;
+	}
+	return -1;
+}
+
+int zu4_video_atlas_add(uint32_t key, Image *im, int sx, int sy) {
+	// Copy a tile-sized block of an image into the atlas, returning its
+	// slot, or -1 if the atlas is full
+	if (atlasUsed == ATLAS_SLOTS || sx + TILE_WIDTH > im->w || sy + TILE_HEIGHT > im->h)
+		return -1;
+	
+	int slot = atlasUsed++;
+	unsigned h = (key * 2654435761u) % ATLAS_HASH_SIZE;
+	while (atlasKeys[h])
+		h = (h + 1) % ATLAS_HASH_SIZE;
+	atlasKeys[h] = key + 1;
+	atlasSlots[h] = slot;
+	
+	uint32_t *dst = atlasPixels + (slot / ATLAS_COLS) * TILE_HEIGHT * ATLAS_SIZE + (slot % ATLAS_COLS) * TILE_WIDTH;
+	for (int y = 0; y < TILE_HEIGHT; y++)
+		memcpy(dst + y * ATLAS_SIZE, (uint32_t*)im->pixels + (sy + y) * im->w + sx, TILE_WIDTH * sizeof(uint32_t));
+	
+	glBindTexture(GL_TEXTURE_2D, atlasID);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, im->w);
+	glTexSubImage2D(GL_TEXTURE_2D,
+				0,
+				(slot % ATLAS_COLS) * TILE_WIDTH, (slot / ATLAS_COLS) * TILE_HEIGHT,
+				TILE_WIDTH, TILE_HEIGHT,
+				GL_RGBA,
+				GL_UNSIGNED_BYTE,
+				(uint32_t*)im->pixels + (sy * im->w) + sx);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, SCREEN_WIDTH);
+	glBindTexture(GL_TEXTURE_2D, texID);
+	
+	return slot;
+}
+
+void zu4_video_tile_cell(int x, int y, const int *slots, int n) {
+	// Set the tiles stacked in the cell at the given screen position
+	TileCell *cell = &tileCells[y / CHAR_HEIGHT][x / CHAR_WIDTH];
+	
+	if (n > VIDEO_TILE_LAYERS)
+		n = VIDEO_TILE_LAYERS;
+	
+	for (int i = 0; i < n; i++)
+		cell->slots[i] = slots[i];
+	cell->n = n;
+}
+
+static uint32_t zu4_video_blend(uint32_t d, uint32_t s) {
+	// Blend one pixel over another the way the GPU does, by source alpha
+	uint32_t a = s >> 24;
+	uint32_t out = 0;
+	
+	if (a == 0xff)
+		return s;
+	if (a == 0)
+		return d;
+	
+	for (int shift = 0; shift < 32; shift += 8) {
+		uint32_t sc = (s >> shift) & 0xff, dc = (d >> shift) & 0xff;
+		out |= ((sc * a + dc * (255 - a) + 127) / 255) << shift;
+	}
+	return out;
+}
+
+static uint32_t zu4_video_tile_pixel(int x, int y) {
+	// Return the pixel the tile cells put on the screen at x, y, drawing
+	// the cells that cover it in the same order as zu4_ogl_atlas_draw
+	uint32_t p = 0;
+	
+	for (int cy = y / CHAR_HEIGHT - 1; cy <= y / CHAR_HEIGHT; cy++) {
+		for (int cx = x / CHAR_WIDTH - 1; cx <= x / CHAR_WIDTH; cx++) {
+			if (cy < 0 || cx < 0 || cy >= TILE_CELLS_H || cx >= TILE_CELLS_W)
+				continue;
+			
+			TileCell *cell = &tileCells[cy][cx];
+			int tx = x - cx * CHAR_WIDTH, ty = y - cy * CHAR_HEIGHT;
+			if (tx >= TILE_WIDTH || ty >= TILE_HEIGHT)
+				continue;
+			
+			for (int i = cell->n - 1; i >= 0; i--) {
+				int slot = cell->slots[i];
+				p = zu4_video_blend(p, atlasPixels[
+					((slot / ATLAS_COLS) * TILE_HEIGHT + ty) * ATLAS_SIZE +
+					(slot % ATLAS_COLS) * TILE_WIDTH + tx]);
+			}
+		}
+	}
+	return p;
+}
+
+void zu4_video_read(Image *d, int x, int y, int rx, int ry, int rw, int rh) {
+	// Copy a region of the screen to an image as it is shown, with the tile
+	// cells drawn on the GPU filled in underneath, so the copy is opaque
+	Image *screen = zu4_img_get_screen();
+	bool tiles = zu4_video_tiles();
+	
+	for (int j = 0; j < rh; j++) {
+		int sy = ry + j, dy = y + j;
+		if (sy < 0 || sy >= screen->h || dy < 0 || dy >= d->h)
+			continue;
+		
+		const uint32_t *src = (const uint32_t*)screen->pixels + sy * screen->w;
+		uint32_t *dst = (uint32_t*)d->pixels + dy * d->w;
+		
+		for (int i = 0; i < rw; i++) {
+			int sx = rx + i, dx = x + i;
+			if (sx < 0 || sx >= screen->w || dx < 0 || dx >= d->w)
+				continue;
+			
+			uint32_t p = src[sx];
+			if (tiles && (p >> 24) != 0xff)
+				p = zu4_video_blend(zu4_video_tile_pixel(sx, sy), p);
+			dst[dx] = p | 0xff000000;
+		}
+	}
+}
 
 static void zu4_ogl_init() {
 	glEnable(GL_TEXTURE_2D);
@@ -39,6 +265,22 @@ static void zu4_ogl_init() {
 	glBindTexture(GL_TEXTURE_2D, texID);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	
+	// Allocate the texture once, changed regions are uploaded on swap
+	glTexImage2D(GL_TEXTURE_2D,
+				0,
+				GL_RGBA,
+				SCREEN_WIDTH, SCREEN_HEIGHT,
+				0,
+				GL_RGBA,
+				GL_UNSIGNED_BYTE,
+				NULL);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, SCREEN_WIDTH);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	zu4_img_damage_all();
+	
+	if (settings.gpuTiles)
+		zu4_ogl_atlas_init();
 
 	glViewport(0, 0, SCREEN_WIDTH * settings.scale, SCREEN_HEIGHT * settings.scale);
 	glDisable(GL_DEPTH_TEST);
@@ -53,16 +295,31 @@ static void zu4_ogl_init() {
 	glLoadIdentity();
 }
 
-void zu4_ogl_swap() {
+static void zu4_ogl_draw() {
+	// Upload the changed regions of the screen and draw the frame
 	Image *screen = zu4_img_get_screen();
-	glTexImage2D(GL_TEXTURE_2D,
-				0,
-				GL_RGB,
-				SCREEN_WIDTH, SCREEN_HEIGHT,
-				0,
-				GL_RGBA,
-				GL_UNSIGNED_BYTE,
-		screen->pixels);
+	DamageRect *rects;
+	int numrects = zu4_img_damage_get(&rects);
+	
+	// Only upload the regions of the screen which have changed
+	for (int i = 0; i < numrects; i++) {
+		glTexSubImage2D(GL_TEXTURE_2D,
+					0,
+					rects[i].x, rects[i].y,
+					rects[i].w, rects[i].h,
+					GL_RGBA,
+					GL_UNSIGNED_BYTE,
+			(uint32_t*)screen->pixels + (rects[i].y * SCREEN_WIDTH) + rects[i].x);
+	}
+	zu4_img_damage_clear();
+	
+	// Tiles go underneath, showing through the transparent parts of the screen
+	if (zu4_video_tiles()) {
+		glClear(GL_COLOR_BUFFER_BIT);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		zu4_ogl_atlas_draw();
+	}
 	
 	glBegin(GL_QUADS);
 		glTexCoord2f(1.0f, 1.0f);
@@ -77,10 +334,47 @@ void zu4_ogl_swap() {
 		glTexCoord2f(0.0f, 1.0f);
 		glVertex2f(0, SCREEN_HEIGHT * settings.scale);
 	glEnd();
+	
+	if (zu4_video_tiles())
+		glDisable(GL_BLEND);
+}
+
+void zu4_ogl_swap() {
+	// The headless backend has nothing to present, the screen image is the
+	// only output
+	if (backend == VIDEO_BACKEND_HEADLESS) {
+		zu4_img_damage_clear();
+		return;
+	}
+	
+	zu4_ogl_draw();
 	SDL_GL_SwapWindow(window);
 }
 
+void zu4_video_set_backend(int b) {
+	// Choose how frames are presented; must be called before SDL starts
+	backend = b;
+	
+	// Anything else that brings up SDL video gets the offscreen driver
+	if (backend == VIDEO_BACKEND_HEADLESS)
+		SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+}
+
+bool zu4_video_headless() {
+	// Return whether frames are rendered offscreen only
+	return backend == VIDEO_BACKEND_HEADLESS;
+}
+
 void zu4_video_init() {
+	// Without a window, only the event queue is needed to drive the game
+	if (backend == VIDEO_BACKEND_HEADLESS) {
+		if (u4_SDL_InitSubSystem(SDL_INIT_EVENTS) < 0)
+			zu4_error(ZU4_LOG_ERR, "Unable to init SDL: %s", SDL_GetError());
+		atexit(SDL_Quit);
+		zu4_img_damage_all();
+		return;
+	}
+	
     if (u4_SDL_InitSubSystem(SDL_INIT_VIDEO) < 0) {
         zu4_error(ZU4_LOG_ERR, "Unable to init SDL: %s", SDL_GetError());
 	}
@@ -101,7 +395,15 @@ void zu4_video_init() {
 }
 
 void zu4_video_deinit() {
+	if (backend == VIDEO_BACKEND_HEADLESS) {
+		u4_SDL_QuitSubSystem(SDL_INIT_EVENTS);
+		return;
+	}
+	
     SDL_DestroyWindow(window);
     u4_SDL_QuitSubSystem(SDL_INIT_VIDEO);
     if (texID) { glDeleteTextures(1, &texID); }
+    if (atlasID) { glDeleteTextures(1, &atlasID); atlasID = 0; }
+    free(atlasPixels);
+    atlasPixels = NULL;
 }
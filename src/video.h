@@ -5,10 +5,31 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image.h"
+
+/* video backends, selected before zu4_video_init */
+#define VIDEO_BACKEND_SDL 0
+#define VIDEO_BACKEND_HEADLESS 1
+
+/* the most tiles the GPU renderer will stack in one cell */
+#define VIDEO_TILE_LAYERS 8
+
+void zu4_video_set_backend(int backend);
+bool zu4_video_headless();
+
 void zu4_video_init();
 void zu4_video_deinit();
 void zu4_ogl_swap();
 
+bool zu4_video_tiles();
+int zu4_video_atlas_find(uint32_t key);
+int zu4_video_atlas_add(uint32_t key, Image *im, int sx, int sy);
+void zu4_video_tile_cell(int x, int y, const int *slots, int n);
+void zu4_video_read(Image *d, int x, int y, int rx, int ry, int rw, int rh);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,6 +3,7 @@
 #include "view.h"
 
 #include "imagemgr.h"
+#include "video.h"
 
 Image *View::screen = NULL;
 
@@ -64,13 +65,11 @@ void View::unhighlight() {
 }
 
 void View::drawHighlighted() {
-    Image *screen = zu4_img_get_screen();
-
     Image *tmp = zu4_img_create(highlightW, highlightH);
     if (!tmp)
         return;
 
-    zu4_img_draw_subrect_on(tmp, screen, 0, 0, this->x + highlightX, this->y + highlightY, highlightW, highlightH);
+    zu4_video_read(tmp, 0, 0, this->x + highlightX, this->y + highlightY, highlightW, highlightH);
     zu4_img_draw_highlighted(tmp);
     zu4_img_draw(tmp, (this->x + highlightX), (this->y + highlightY));
     delete tmp;